@@ -0,0 +1,893 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <chrono>
+#include <climits>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <csignal>
+
+#include "./src/params.h"
+#include "./src/pointGrid.h"
+#include "./src/fields.h"
+#include "./src/meshExporter.h"
+#include "./src/volumeFile.h"
+#include "./src/decimator.h"
+#include "./src/meshOptimizer.h"
+#include "./src/vertexPacking.h"
+#include "./src/sessionLog.h"
+#include "./src/autoTuner.h"
+#include "./src/regression.h"
+#include "./src/meshServer.h"
+#include "./src/meshClient.h"
+
+using namespace std::chrono;
+
+void printUsage() {
+  printf(
+    "Usage: marching_cubes_cli [options] -o <mesh.ply|mesh.obj|mesh.gltf>\n"
+    "\n"
+    "Field:\n"
+    "  --field <name>      sphere, perlin, prism or configs (default sphere)\n"
+    "  --scene <file>      Signed distance scene, see scenes/ for the syntax\n"
+    "  --radius <r>        Sphere radius\n"
+    "  --offset <x y z>    Perlin noise offset\n"
+    "  --config <n>        Cube configuration index (0-14)\n"
+    "  --time <t>          Time in seconds for animated fields\n"
+    "\n"
+    "Grid:\n"
+    "  --size <x y z>      Number of units along each axis\n"
+    "  --density <d>       Points per unit\n"
+    "  --iso <v>           Iso value\n"
+    "  --layers <v,v,...>  Mesh a surface per iso value in one pass, each written to\n"
+    "                      the output path with _0, _1, ... before the extension\n"
+    "  --interpolate       Interpolate intersections along cube edges\n"
+    "  --mesher <name>     mc (marching cubes), nets (surface nets), dc (dual contouring)\n"
+    "                      or adaptive (octree marching cubes)\n"
+    "  --adaptive-error <e> Deviation from trilinear that splits an adaptive cube\n"
+    "  --decimate <n>      Collapse edges by quadric error down to n triangles\n"
+    "  --max-error <e>     Stop decimating before the surface moves further than e\n"
+    "  --optimize          Reorder triangles and vertices for the GPU vertex cache\n"
+    "  --min-island <n>    Remove inside regions of fewer than n grid points before meshing\n"
+    "  --min-island-tris <n>\n"
+    "                      Remove inside regions whose surface would have fewer than n\n"
+    "                      triangles, estimated from the grid edges it crosses\n"
+    "  --quantize          Write 16 bit positions and byte normals (glTF only)\n"
+    "  --shards <n>        Mesh n runs of x-slabs in worker processes sharing the field\n"
+    "  --workers <n>       Worker processes running at once (default one per core)\n"
+    "  --threads <n>       Threads generating the field\n"
+    "  --pipeline          Fill the field brick by brick on --threads threads while the\n"
+    "                      bricks already filled are meshed (marching cubes only), and\n"
+    "                      print how busy each stage kept the threads\n"
+    "\n"
+    "Volume input (replaces the field and grid size):\n"
+    "  --volume <file>     NRRD volume (.nrrd or detached .nhdr, raw encoding)\n"
+    "  --raw <file>        Raw volume, described by the options below\n"
+    "  --dims <x y z>      Raw volume dimensions\n"
+    "  --type <t>          Raw voxel type: uint8, uint16 or float (default uint8)\n"
+    "  --layout <x|z>      Raw axis varying fastest (default x)\n"
+    "  --header-bytes <n>  Bytes to skip before the raw samples\n"
+    "  --chunk <n>         Slabs meshed per resident chunk (default 64)\n"
+    "\n"
+    "Field files:\n"
+    "  --save-field <file> Save the generated field in the chunked field format\n"
+    "  --lossless          Store float bricks instead of 16 bit quantised ones\n"
+    "  --load-field <file> Load a saved field and its Params instead of generating\n"
+    "  --region <x0 y0 z0 x1 y1 z1>\n"
+    "                      Only load the grid points in [x0, x1) x [y0, y1) x [z0, z1)\n"
+    "\n"
+    "Benchmark:\n"
+    "  --bench <runs>      Time generating and meshing every built-in field, no output,\n"
+    "                      with vertex cache misses before and after --optimize\n"
+    "  --tune <runs>       Time thread counts, chunk sizes and sharding on this machine\n"
+    "                      for the grid given and two denser ones, and save the fastest\n"
+    "  --profile <file>    Tuning profile to save to and apply (default\n"
+    "                      ~/.config/marching-cubes/tuning.txt); calibrated settings\n"
+    "                      are applied unless --threads or --workers are given\n"
+    "  --replay <log>      Mesh every event of a session recorded by the viewer with\n"
+    "                      --record, and print latency percentiles\n"
+    "\n"
+    "Regression:\n"
+    "  --golden <file>     Mesh the cube configs, every single cube configuration and\n"
+    "                      the built-in fields, compare them to the goldens in file, and\n"
+    "                      check every other meshing path gives the same triangles\n"
+    "  --update-golden <file>\n"
+    "                      Write the goldens instead of comparing against them\n"
+    "\n"
+    "Service:\n"
+    "  --serve <socket>    Serve meshes of the built-in fields on a Unix domain socket\n"
+    "                      until interrupted, on --threads workers (default one per core)\n"
+    "  --cache-mb <n>      Megabytes of meshes the server keeps in memory (default 256)\n"
+    "  --load <socket> <n> Send n mesh requests to a server, varying the grid given, and\n"
+    "                      print throughput and latency percentiles\n"
+    "  --clients <n>       Connections the requests are spread over (default 4)\n"
+    "  --distinct <n>      Different meshes among the requests (default 16)\n"
+    "  --packed            Ask for 8 byte packed vertices\n"
+  );
+}
+
+// Scenes are evaluated a brick at a time rather than through their FieldFunc
+void generateField(PointGrid& pointGrid, FieldFunc func, bool sample = true) {
+  if (func == getScene) {
+    pointGrid.generateScalarField(activeScene(), sample);
+  } else {
+    pointGrid.generateScalarField(func, sample);
+  }
+}
+
+void printIslandReport(PointGrid& pointGrid, Params& params) {
+  if (params.minIslandPoints <= 0 && params.minIslandTriangles <= 0) return;
+  IslandReport& report = pointGrid.getIslandReport();
+  printf("Islands: %zu, largest %zu points, removed %zu with %zu points in %.1f ms\n",
+    report.numIslands, report.largestPoints, report.numRemoved, report.pointsRemoved, report.milliseconds);
+  size_t limit = 10;
+  for (size_t count : report.sizeHistogram) {
+    printf("  < %-10zu %zu\n", limit, count);
+    limit *= 10;
+  }
+}
+
+void printPipelineReport(PointGrid& pointGrid) {
+  TaskReport& report = pointGrid.getPipelineReport();
+  if (!report.numThreads) return;
+  printf("Pipeline: %.1f ms on %d threads, %d tasks stolen\n", report.wallMs, report.numThreads, report.numSteals);
+  for (StageReport& stage : report.stages) {
+    printf("  %-9s %6d tasks %10.1f ms busy  %5.1f%%  from %8.1f to %8.1f ms\n",
+      stage.name.c_str(), stage.numTasks, stage.busyMs, 100.0f * report.utilisation(stage), stage.firstStartMs, stage.lastEndMs);
+  }
+  for (size_t t = 0; t < report.threadBusyMs.size(); t++) {
+    printf("  thread %zu busy %5.1f%%\n", t, report.wallMs > 0.0f ? 100.0f * report.threadBusyMs[t] / report.wallMs : 0.0f);
+  }
+}
+
+// Counts the mesh instead of writing it, so benchmarks only time the mesher
+class CountingSink : public MeshSink {
+  public:
+    size_t numVertices = 0;
+    size_t numTriangles = 0;
+
+    void addVertices(const glm::vec3* v, const glm::vec3* n, size_t count) {
+      numVertices += count;
+    }
+    void addTriangles(const unsigned int* i, size_t count) {
+      numTriangles += count / 3;
+    }
+};
+
+// Writes the surface at each iso value to a file of its own, meshed in one pass
+bool writeLayers(PointGrid& pointGrid, Params& params, const std::string& outPath, const std::vector<float>& isoValues, bool quantize) {
+  size_t extension = outPath.find_last_of('.');
+  if (extension == std::string::npos) {
+    fprintf(stderr, "Unsupported output format: %s\n", outPath.c_str());
+    return false;
+  }
+
+  // Decimation buffers each layer, with the triangle budget split between them
+  DecimateOptions decimateOptions;
+  decimateOptions.fromParams(params);
+  decimateOptions.targetTriangles /= isoValues.size();
+
+  std::vector<std::string> paths;
+  std::vector<std::unique_ptr<MeshExporter>> exporters;
+  std::vector<std::unique_ptr<DecimatingSink>> decimating;
+  std::vector<std::unique_ptr<OptimizingSink>> optimizing;
+  std::vector<MeshSink*> sinks;
+  for (size_t l = 0; l < isoValues.size(); l++) {
+    std::string path = outPath.substr(0, extension) + "_" + std::to_string(l) + outPath.substr(extension);
+    auto exporter = createExporter(path);
+    if (!exporter || !exporter->open(path)) {
+      fprintf(stderr, "Could not open %s for writing\n", path.c_str());
+      return false;
+    }
+    glm::vec3 boundsMin, boundsMax;
+    getGridBounds(params, boundsMin, boundsMax);
+    if (quantize && !exporter->setQuantization(boundsMin, boundsMax)) {
+      fprintf(stderr, "Only glTF output can be quantised\n");
+      return false;
+    }
+    MeshSink* sink = exporter.get();
+    if (params.optimizeIndices) {
+      optimizing.emplace_back(new OptimizingSink(*sink));
+      sink = optimizing.back().get();
+    }
+    if (params.decimate) {
+      decimating.emplace_back(new DecimatingSink(*sink, decimateOptions));
+      sink = decimating.back().get();
+    }
+    sinks.push_back(sink);
+    paths.push_back(path);
+    exporters.push_back(std::move(exporter));
+  }
+
+  auto start = high_resolution_clock::now();
+  pointGrid.generateLayers(isoValues, sinks);
+  for (auto& sink : decimating) {
+    sink->finish();
+  }
+  for (auto& sink : optimizing) {
+    sink->finish();
+  }
+  bool ok = true;
+  for (size_t l = 0; l < exporters.size(); l++) {
+    if (!exporters[l]->close()) {
+      fprintf(stderr, "Failed to write %s\n", paths[l].c_str());
+      ok = false;
+      continue;
+    }
+    printf("%s: iso %g, %zu vertices, %zu triangles\n", paths[l].c_str(), isoValues[l], exporters[l]->getNumVertices(), exporters[l]->getNumTriangles());
+  }
+  printf("Mesh + export: %lld ms\n", (long long)duration_cast<milliseconds>(high_resolution_clock::now() - start).count());
+  return ok;
+}
+
+/**
+  NOTE:
+  Every built-in field is generated and meshed with
+  the given Params, and the median of the runs is
+  reported so one slow run does not skew the result.
+  The vertex cache misses of the mesh as meshed and as
+  optimised come from one more, untimed, run.
+*/
+void runBenchmark(Params& params, int runs) {
+  printf("%-10s %10s %10s %10s %8s %8s %10s %8s %8s\n", "field", "field ms", "mesh ms", "triangles", "acmr", "atvr", "opt ms", "acmr", "atvr");
+  for (int f = 0; f < numFields; f++) {
+    FieldFunc func = fields[f].func;
+    if (func == getScene && activeScene().empty()) continue;
+
+    Params fieldParams = params;
+    std::vector<double> fieldTimes;
+    std::vector<double> meshTimes;
+    size_t numTriangles = 0;
+    for (int run = 0; run < runs; run++) {
+      PointGrid pointGrid(fieldParams);
+      CountingSink sink;
+      auto start = high_resolution_clock::now();
+      generateField(pointGrid, func);
+      auto fieldDone = high_resolution_clock::now();
+      pointGrid.generateDrawData(sink);
+      auto meshDone = high_resolution_clock::now();
+
+      fieldTimes.push_back(duration<double, std::milli>(fieldDone - start).count());
+      meshTimes.push_back(duration<double, std::milli>(meshDone - fieldDone).count());
+      numTriangles = sink.numTriangles;
+    }
+    std::sort(fieldTimes.begin(), fieldTimes.end());
+    std::sort(meshTimes.begin(), meshTimes.end());
+
+    fieldParams.optimizeIndices = false;
+    fieldParams.showMarch = false;
+    PointGrid pointGrid(fieldParams);
+    generateField(pointGrid, func);
+    pointGrid.generateDrawData();
+    std::vector<glm::vec3>& vertices = pointGrid.getVertices();
+    std::vector<unsigned int>& indices = pointGrid.getIndices();
+    VertexCacheStats meshed = measureVertexCache(indices, vertices.size());
+    auto start = high_resolution_clock::now();
+    optimizeMesh(vertices, pointGrid.getNormals(), indices);
+    double optimizeTime = duration<double, std::milli>(high_resolution_clock::now() - start).count();
+    VertexCacheStats optimized = measureVertexCache(indices, vertices.size());
+
+    printf("%-10s %10.2f %10.2f %10zu %8.3f %8.3f %10.2f %8.3f %8.3f\n", fields[f].name, fieldTimes[runs / 2], meshTimes[runs / 2], numTriangles,
+      meshed.acmr, meshed.atvr, optimizeTime, optimized.acmr, optimized.atvr);
+  }
+}
+
+// Nearest rank, on sorted times
+double percentile(const std::vector<double>& sorted, double fraction) {
+  if (sorted.empty()) return 0.0;
+  size_t rank = (size_t)ceil(fraction * sorted.size());
+  return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+void printLatencies(const char* name, std::vector<double>& times) {
+  std::sort(times.begin(), times.end());
+  printf("%-8s %10.2f %10.2f %10.2f %10.2f\n", name, percentile(times, 0.5), percentile(times, 0.95), percentile(times, 0.99), times.empty() ? 0.0 : times.back());
+}
+
+/**
+  NOTE:
+  Replays a session recorded by the viewer with
+  --record. Every mesh event is generated and meshed
+  as the viewer would, bypassing the mesh cache, one
+  straight after the other: the viewer meshes on the
+  thread that draws, so the time between events never
+  overlaps the work and only the work is timed.
+*/
+bool replaySession(const std::string& path, TuningProfile& profile) {
+  std::vector<SessionEvent> events;
+  std::string error;
+  if (!readSession(path, events, error)) {
+    fprintf(stderr, "Could not read session %s: %s\n", path.c_str(), error.c_str());
+    return false;
+  }
+
+  Params params;
+  PointGrid pointGrid(params);
+  std::vector<double> fieldTimes;
+  std::vector<double> meshTimes;
+  std::vector<double> totalTimes;
+  size_t numSkipped = 0;
+  bool sceneLoaded = false;
+  for (SessionEvent& event : events) {
+    if (event.type == SESSION_SCENE) {
+      sceneLoaded = loadScene(event.scenePath, error);
+      if (!sceneLoaded) {
+        fprintf(stderr, "Could not load scene %s: %s\n", event.scenePath.c_str(), error.c_str());
+      }
+      continue;
+    }
+    FieldFunc func = getFieldByName(event.field);
+    if (!func || (func == getScene && !sceneLoaded)) {
+      numSkipped++;
+      continue;
+    }
+
+    // Meshed as the viewer did, or tuned as it would be when the log does not say
+    params = event.params;
+    if (!event.tuned) profile.apply(params);
+    auto start = high_resolution_clock::now();
+    generateField(pointGrid, func);
+    auto fieldDone = high_resolution_clock::now();
+    if (params.numLayers > 1) {
+      pointGrid.generateLayerDrawData(getLayerIsoValues(params));
+    } else {
+      pointGrid.generateDrawData();
+    }
+    auto meshDone = high_resolution_clock::now();
+
+    fieldTimes.push_back(duration<double, std::milli>(fieldDone - start).count());
+    meshTimes.push_back(duration<double, std::milli>(meshDone - fieldDone).count());
+    totalTimes.push_back(duration<double, std::milli>(meshDone - start).count());
+  }
+
+  printf("%s: %zu mesh events replayed", path.c_str(), totalTimes.size());
+  if (numSkipped) {
+    printf(", %zu skipped (unknown field or missing scene)", numSkipped);
+  }
+  printf("\n%-8s %10s %10s %10s %10s\n", "ms", "p50", "p95", "p99", "max");
+  printLatencies("field", fieldTimes);
+  printLatencies("mesh", meshTimes);
+  printLatencies("total", totalTimes);
+  return true;
+}
+
+// Calibrates the grid given and grids of twice and four times its density
+bool runTuning(Params& params, FieldFunc func, int runs, const std::string& profilePath) {
+  TuningProfile profile;
+  profile.load(profilePath);
+  for (int scale = 1; scale <= 4; scale *= 2) {
+    Params grid = params;
+    grid.density *= scale;
+    printf("%d x %d x %d grid:\n", grid.sizeX(), grid.sizeY(), grid.sizeZ());
+    TuningConfig config = calibrate(grid, func, runs, true, stdout);
+    printf("  best: %d field threads, chunk %d, %d mesh workers\n", config.fieldThreads, config.fieldChunk, config.meshWorkers);
+    profile.set(TuningProfile::bucketFor(grid), config);
+  }
+  if (!profile.save(profilePath)) {
+    fprintf(stderr, "Could not write %s\n", profilePath.c_str());
+    return false;
+  }
+  printf("Saved to %s\n", profilePath.c_str());
+  return true;
+}
+
+// Fails on any golden that differs or is missing, and on any path that disagrees with the reference
+bool runGolden(const std::string& path, bool update) {
+  auto start = high_resolution_clock::now();
+  RegressionReport report;
+  if (!runRegression(path, update, report, stdout)) return false;
+  long long ms = (long long)duration_cast<milliseconds>(high_resolution_clock::now() - start).count();
+
+  if (update) {
+    printf("Wrote %d goldens to %s\n", report.numCases, path.c_str());
+  } else {
+    printf("%d cases: %d differ from the goldens, %d have none\n", report.numCases, report.goldenFailures, report.numMissing);
+  }
+  printf("%d runs of other meshing paths: %d differ from the reference\n", report.numVariantRuns, report.variantFailures);
+  printf("%lld ms\n", ms);
+  return update ? report.variantFailures == 0 : report.passed();
+}
+
+MeshServer* runningServer = nullptr;
+
+void stopServer(int) {
+  if (runningServer) runningServer->stop();
+}
+
+bool runServer(const std::string& socketPath, int numWorkers, size_t cacheBytes) {
+  MeshServer server(numWorkers, cacheBytes);
+  if (!server.listen(socketPath)) return false;
+
+  // No SA_RESTART, so the signal also interrupts the server's accept
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stopServer;
+  sigemptyset(&action.sa_mask);
+  runningServer = &server;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  printf("Serving meshes on %s\n", socketPath.c_str());
+  fflush(stdout);
+  server.run();
+  runningServer = nullptr;
+  printf("%s", server.formatStats().c_str());
+  return true;
+}
+
+/**
+  NOTE:
+  Load for a server started with --serve. Requests
+  are numbered and taken in turn by the clients, each
+  on a connection of its own, and request r asks for
+  mesh r % numDistinct: the sphere, perlin and prism
+  fields in turn, with the iso value moved a little
+  further for every round of the three. So the first
+  requests for a mesh are usually meshed, or coalesced
+  when another client asked for it at the same time,
+  and the rest come from the cache.
+*/
+bool runLoad(const std::string& socketPath, Params& params, int numRequests, int numClients, int numDistinct, bool packed) {
+  const char* loadFields[] = { "sphere", "perlin", "prism" };
+  std::atomic<int> next(0);
+  std::atomic<int> numFailed(0);
+  std::atomic<size_t> numVertices(0);
+  std::mutex timesMutex;
+  std::vector<double> times[3];
+  std::vector<double> allTimes;
+
+  auto client = [&]() {
+    MeshClient connection;
+    std::string error;
+    if (!connection.connect(socketPath, error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      for (int r = next++; r < numRequests; r = next++) numFailed++;
+      return;
+    }
+    ClientMesh mesh;
+    for (int r = next++; r < numRequests; r = next++) {
+      int variant = r % numDistinct;
+      Params requestParams = params;
+      requestParams.isoValue += 0.01f * (variant / 3);
+      auto start = high_resolution_clock::now();
+      if (!connection.requestMesh(loadFields[variant % 3], requestParams, mesh, error, packed)) {
+        fprintf(stderr, "Request %d failed: %s\n", r, error.c_str());
+        numFailed++;
+        if (!connection.isConnected()) return;
+        continue;
+      }
+      double ms = duration<double, std::milli>(high_resolution_clock::now() - start).count();
+      numVertices += mesh.vertices.size();
+      std::lock_guard<std::mutex> lock(timesMutex);
+      times[std::min(mesh.source, (uint32_t)2)].push_back(ms);
+      allTimes.push_back(ms);
+    }
+  };
+
+  auto start = high_resolution_clock::now();
+  std::vector<std::thread> clients;
+  for (int i = 0; i < numClients; i++) {
+    clients.push_back(std::thread(client));
+  }
+  for (auto& thread : clients) {
+    thread.join();
+  }
+  double totalMs = duration<double, std::milli>(high_resolution_clock::now() - start).count();
+
+  printf("%zu requests on %d connections in %.1f ms, %.1f requests/s, %zu vertices received",
+    allTimes.size(), numClients, totalMs, allTimes.size() / (totalMs / 1000.0), (size_t)numVertices);
+  if (numFailed) {
+    printf(", %d failed", (int)numFailed);
+  }
+  printf("\n%-8s %10s %10s %10s %10s\n", "ms", "p50", "p95", "p99", "max");
+  printLatencies("meshed", times[MESH_MESHED]);
+  printLatencies("cached", times[MESH_FROM_CACHE]);
+  printLatencies("waited", times[MESH_COALESCED]);
+  printLatencies("all", allTimes);
+
+  MeshClient connection;
+  std::string stats;
+  std::string error;
+  if (connection.connect(socketPath, error) && connection.requestStats(stats, error)) {
+    printf("Server:\n%s", stats.c_str());
+  }
+  return numFailed == 0;
+}
+
+int main(int argc, char** argv) {
+  Params params;
+  FieldFunc func = getSphere;
+  std::string outPath;
+
+  std::string volumePath;
+  std::string rawPath;
+  int rawDims[3] = { 0, 0, 0 };
+  VoxelType rawType = VOXEL_UINT8;
+  VolumeLayout rawLayout = LAYOUT_X_FASTEST;
+  size_t headerBytes = 0;
+  int chunkSlabs = 64;
+
+  std::string saveFieldPath;
+  std::string loadFieldPath;
+  bool lossless = false;
+  int region[6] = { 0, 0, 0, INT_MAX, INT_MAX, INT_MAX };
+  int benchRuns = 0;
+  int numShards = 0;
+  std::string replayPath;
+  std::string goldenPath;
+  bool updateGolden = false;
+  bool explicitThreads = false;
+  bool explicitWorkers = false;
+  bool explicitBudget = false;
+  int tuneRuns = 0;
+  std::string profilePath = TuningProfile::defaultPath();
+  std::vector<float> layerValues;
+  bool quantize = false;
+  std::string servePath;
+  size_t cacheMegabytes = 256;
+  std::string loadPath;
+  int loadRequests = 0;
+  int loadClients = 4;
+  int loadDistinct = 16;
+  bool packed = false;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    bool hasVec3 = i + 3 < argc;
+
+    if ((arg == "-o" || arg == "--out") && hasValue) {
+      outPath = argv[++i];
+    } else if (arg == "--field" && hasValue) {
+      func = getFieldByName(argv[++i]);
+      if (!func) {
+        fprintf(stderr, "Unknown field: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (arg == "--scene" && hasValue) {
+      std::string error;
+      if (!loadScene(argv[++i], error)) {
+        fprintf(stderr, "Could not load scene: %s\n", error.c_str());
+        return 1;
+      }
+      func = getScene;
+    } else if (arg == "--radius" && hasValue) {
+      params.radius = atof(argv[++i]);
+    } else if (arg == "--offset" && hasVec3) {
+      params.xOffset = atof(argv[++i]);
+      params.yOffset = atof(argv[++i]);
+      params.zOffset = atof(argv[++i]);
+    } else if (arg == "--config" && hasValue) {
+      params.configIndex = atoi(argv[++i]);
+    } else if (arg == "--time" && hasValue) {
+      params.time = atof(argv[++i]);
+    } else if (arg == "--size" && hasVec3) {
+      params.numUnitsX = atoi(argv[++i]);
+      params.numUnitsY = atoi(argv[++i]);
+      params.numUnitsZ = atoi(argv[++i]);
+    } else if (arg == "--density" && hasValue) {
+      params.density = atof(argv[++i]);
+    } else if (arg == "--iso" && hasValue) {
+      params.isoValue = atof(argv[++i]);
+    } else if (arg == "--layers" && hasValue) {
+      // Comma separated, like 0.3,0.5,0.7
+      std::stringstream values(argv[++i]);
+      std::string value;
+      while (std::getline(values, value, ',')) {
+        layerValues.push_back(atof(value.c_str()));
+      }
+    } else if (arg == "--interpolate") {
+      params.interpolate = true;
+    } else if (arg == "--mesher" && hasValue) {
+      std::string mesher = argv[++i];
+      if (mesher == "mc") {
+        params.mesher = MESHER_MARCHING_CUBES;
+      } else if (mesher == "nets") {
+        params.mesher = MESHER_SURFACE_NETS;
+      } else if (mesher == "dc") {
+        params.mesher = MESHER_DUAL_CONTOURING;
+      } else if (mesher == "adaptive") {
+        params.mesher = MESHER_ADAPTIVE_CUBES;
+      } else {
+        fprintf(stderr, "Unknown mesher: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (arg == "--adaptive-error" && hasValue) {
+      params.adaptiveError = atof(argv[++i]);
+    } else if (arg == "--decimate" && hasValue) {
+      params.decimate = true;
+      params.triangleBudget = atoi(argv[++i]);
+      explicitBudget = true;
+    } else if (arg == "--max-error" && hasValue) {
+      params.decimate = true;
+      params.decimateError = atof(argv[++i]);
+      // No error at all would collapse the mesh to nothing, a tolerance of 0 means none is given
+      if (!(params.decimateError > 0.0f)) {
+        fprintf(stderr, "--max-error needs a distance greater than 0\n");
+        return 1;
+      }
+    } else if (arg == "--quantize") {
+      quantize = true;
+    } else if (arg == "--optimize") {
+      params.optimizeIndices = true;
+    } else if (arg == "--min-island" && hasValue) {
+      params.minIslandPoints = atoi(argv[++i]);
+    } else if (arg == "--min-island-tris" && hasValue) {
+      params.minIslandTriangles = atoi(argv[++i]);
+    } else if (arg == "--shards" && hasValue) {
+      numShards = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--workers" && hasValue) {
+      params.meshWorkers = std::max(1, atoi(argv[++i]));
+      explicitWorkers = true;
+    } else if (arg == "--threads" && hasValue) {
+      params.fieldThreads = std::max(1, atoi(argv[++i]));
+      explicitThreads = true;
+    } else if (arg == "--pipeline") {
+      params.pipelineBricks = true;
+    } else if (arg == "--tune" && hasValue) {
+      tuneRuns = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--profile" && hasValue) {
+      profilePath = argv[++i];
+    } else if (arg == "--volume" && hasValue) {
+      volumePath = argv[++i];
+    } else if (arg == "--raw" && hasValue) {
+      rawPath = argv[++i];
+    } else if (arg == "--dims" && hasVec3) {
+      rawDims[0] = atoi(argv[++i]);
+      rawDims[1] = atoi(argv[++i]);
+      rawDims[2] = atoi(argv[++i]);
+    } else if (arg == "--type" && hasValue) {
+      if (!parseVoxelType(argv[++i], rawType)) {
+        fprintf(stderr, "Unknown voxel type: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (arg == "--layout" && hasValue) {
+      rawLayout = std::string(argv[++i]) == "z" ? LAYOUT_Z_FASTEST : LAYOUT_X_FASTEST;
+    } else if (arg == "--header-bytes" && hasValue) {
+      headerBytes = strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--chunk" && hasValue) {
+      chunkSlabs = atoi(argv[++i]);
+    } else if (arg == "--save-field" && hasValue) {
+      saveFieldPath = argv[++i];
+    } else if (arg == "--lossless") {
+      lossless = true;
+    } else if (arg == "--load-field" && hasValue) {
+      loadFieldPath = argv[++i];
+    } else if (arg == "--region" && i + 6 < argc) {
+      for (int k = 0; k < 6; k++) {
+        region[k] = atoi(argv[++i]);
+      }
+    } else if (arg == "--replay" && hasValue) {
+      replayPath = argv[++i];
+    } else if (arg == "--golden" && hasValue) {
+      goldenPath = argv[++i];
+    } else if (arg == "--update-golden" && hasValue) {
+      goldenPath = argv[++i];
+      updateGolden = true;
+    } else if (arg == "--serve" && hasValue) {
+      servePath = argv[++i];
+    } else if (arg == "--cache-mb" && hasValue) {
+      cacheMegabytes = std::max(0, atoi(argv[++i]));
+    } else if (arg == "--load" && i + 2 < argc) {
+      loadPath = argv[++i];
+      loadRequests = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--clients" && hasValue) {
+      loadClients = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--distinct" && hasValue) {
+      loadDistinct = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--packed") {
+      packed = true;
+    } else if (arg == "--bench" && hasValue) {
+      benchRuns = std::max(1, atoi(argv[++i]));
+    } else if (arg == "-h" || arg == "--help") {
+      printUsage();
+      return 0;
+    } else {
+      fprintf(stderr, "Unknown or incomplete option: %s\n\n", arg.c_str());
+      printUsage();
+      return 1;
+    }
+  }
+
+  // The error alone stops decimation unless a budget was given too, in either order
+  if (params.decimateError > 0.0f && !explicitBudget) {
+    params.triangleBudget = 0;
+  }
+
+  if (!goldenPath.empty()) {
+    return runGolden(goldenPath, updateGolden) ? 0 : 1;
+  }
+
+  if (!servePath.empty()) {
+    return runServer(servePath, explicitThreads ? params.fieldThreads : 0, cacheMegabytes << 20) ? 0 : 1;
+  }
+
+  if (!loadPath.empty()) {
+    return runLoad(loadPath, params, loadRequests, loadClients, loadDistinct, packed) ? 0 : 1;
+  }
+
+  if (tuneRuns) {
+    return runTuning(params, func, tuneRuns, profilePath) ? 0 : 1;
+  }
+
+  // Settings given on the command line win over the calibrated ones
+  TuningProfile profile;
+  profile.load(profilePath);
+  Params tuned = params;
+  if (profile.apply(tuned)) {
+    if (!explicitThreads) {
+      params.fieldThreads = tuned.fieldThreads;
+      params.fieldChunk = tuned.fieldChunk;
+    }
+    if (!explicitWorkers) {
+      params.meshWorkers = tuned.meshWorkers;
+    }
+  }
+
+  if (!replayPath.empty()) {
+    return replaySession(replayPath, profile) ? 0 : 1;
+  }
+
+  if (benchRuns) {
+    runBenchmark(params, benchRuns);
+    return 0;
+  }
+
+  if (outPath.empty() && saveFieldPath.empty()) {
+    printUsage();
+    return 1;
+  }
+
+  PointGrid pointGrid(params);
+  pointGrid.coverIsoValues(layerValues);
+  if (!saveFieldPath.empty()) {
+    auto start = high_resolution_clock::now();
+    generateField(pointGrid, func);
+    auto fieldDone = high_resolution_clock::now();
+    if (!pointGrid.saveScalarField(saveFieldPath, getFieldName(func), lossless)) {
+      fprintf(stderr, "Failed to write %s\n", saveFieldPath.c_str());
+      return 1;
+    }
+    auto saveDone = high_resolution_clock::now();
+    printf("Field: %lld ms, Save: %lld ms\n",
+      (long long)duration_cast<milliseconds>(fieldDone - start).count(),
+      (long long)duration_cast<milliseconds>(saveDone - fieldDone).count());
+    if (outPath.empty()) return 0;
+  }
+
+  if (!layerValues.empty()) {
+    if (!volumePath.empty() || !rawPath.empty()) {
+      fprintf(stderr, "Layers need the whole field, so they cannot be meshed from a streamed volume\n");
+      return 1;
+    }
+    if (!loadFieldPath.empty()) {
+      if (!pointGrid.loadScalarField(loadFieldPath, region[0], region[1], region[2], region[3], region[4], region[5])) {
+        fprintf(stderr, "Could not load field %s\n", loadFieldPath.c_str());
+        return 1;
+      }
+    } else if (saveFieldPath.empty()) {
+      generateField(pointGrid, func);
+    }
+    printIslandReport(pointGrid, params);
+    return writeLayers(pointGrid, params, outPath, layerValues, quantize) ? 0 : 1;
+  }
+
+  auto exporter = createExporter(outPath);
+  if (!exporter) {
+    fprintf(stderr, "Unsupported output format: %s\n", outPath.c_str());
+    return 1;
+  }
+  if (!exporter->open(outPath)) {
+    fprintf(stderr, "Could not open %s for writing\n", outPath.c_str());
+    return 1;
+  }
+
+  VolumeFile volume;
+  bool useVolume = !volumePath.empty() || !rawPath.empty();
+  bool sharded = numShards > 0 || params.meshWorkers > 0;
+  if (sharded && params.mesher != MESHER_MARCHING_CUBES) {
+    // A calibrated worker count is simply not used where it does not apply
+    if (numShards > 0 || explicitWorkers) {
+      fprintf(stderr, "Sharded meshing needs the marching cubes mesher\n");
+      return 1;
+    }
+    sharded = false;
+  }
+  if (useVolume && (params.minIslandPoints > 0 || params.minIslandTriangles > 0)) {
+    fprintf(stderr, "Islands need the whole field, so they cannot be removed from a streamed volume\n");
+    return 1;
+  }
+  if (!volumePath.empty() && !volume.openNrrd(volumePath)) {
+    fprintf(stderr, "Could not read NRRD volume %s\n", volumePath.c_str());
+    return 1;
+  }
+  if (!rawPath.empty() && !volume.openRaw(rawPath, rawDims[0], rawDims[1], rawDims[2], rawType, rawLayout, headerBytes)) {
+    fprintf(stderr, "Could not map raw volume %s (check --dims and --type)\n", rawPath.c_str());
+    return 1;
+  }
+
+  auto start = high_resolution_clock::now();
+  if (!loadFieldPath.empty()) {
+    if (!pointGrid.loadScalarField(loadFieldPath, region[0], region[1], region[2], region[3], region[4], region[5])) {
+      fprintf(stderr, "Could not load field %s\n", loadFieldPath.c_str());
+      return 1;
+    }
+  } else if (!useVolume && saveFieldPath.empty()) {
+    // Sharded meshing fills the field in the memory it shares with its workers
+    generateField(pointGrid, func, !sharded);
+  }
+  auto fieldDone = high_resolution_clock::now();
+  printIslandReport(pointGrid, params);
+
+  // Positions are quantised across the grid, which volumes replace with their own
+  if (quantize) {
+    Params gridParams = params;
+    if (useVolume) {
+      gridParams.density = 1.0f;
+      gridParams.numUnitsX = volume.gridSizeX();
+      gridParams.numUnitsY = volume.gridSizeY();
+      gridParams.numUnitsZ = volume.gridSizeZ();
+    }
+    glm::vec3 boundsMin, boundsMax;
+    getGridBounds(gridParams, boundsMin, boundsMax);
+    if (!exporter->setQuantization(boundsMin, boundsMax)) {
+      fprintf(stderr, "Only glTF output can be quantised\n");
+      return 1;
+    }
+  }
+
+  // Decimation and optimisation need the whole mesh, so it is buffered rather than streamed
+  OptimizingSink optimizing(*exporter);
+  MeshSink& output = params.optimizeIndices ? (MeshSink&)optimizing : *exporter;
+  DecimateOptions decimateOptions;
+  decimateOptions.fromParams(params);
+  DecimatingSink decimating(output, decimateOptions);
+  MeshSink& sink = params.decimate ? (MeshSink&)decimating : output;
+  ShardReport shardReport;
+  if (useVolume && sharded) {
+    if (!pointGrid.generateShardedDrawData(volume, sink, params.meshWorkers, numShards, &shardReport)) {
+      fprintf(stderr, "Sharded meshing failed\n");
+      return 1;
+    }
+  } else if (useVolume) {
+    pointGrid.generateDrawData(volume, sink, chunkSlabs);
+  } else if (sharded) {
+    if (!pointGrid.generateShardedDrawData(sink, params.meshWorkers, numShards, &shardReport)) {
+      fprintf(stderr, "Sharded meshing failed\n");
+      return 1;
+    }
+  } else {
+    pointGrid.generateDrawData(sink);
+  }
+  if (params.decimate) {
+    decimating.finish();
+  }
+  if (params.optimizeIndices) {
+    optimizing.finish();
+  }
+  bool ok = exporter->close();
+  auto meshDone = high_resolution_clock::now();
+
+  if (!ok) {
+    fprintf(stderr, "Failed to write %s\n", outPath.c_str());
+    return 1;
+  }
+
+  printf("%s: %zu vertices, %zu triangles\n", outPath.c_str(), exporter->getNumVertices(), exporter->getNumTriangles());
+  printf("Field evaluations: %zu\n", pointGrid.getNumSamples());
+  if (sharded) {
+    printf("Shards: %d on %d workers, %d retried\n", shardReport.numShards, shardReport.numWorkers, shardReport.numRetries);
+  }
+  printPipelineReport(pointGrid);
+  printf("Field: %lld ms, Mesh + export: %lld ms\n",
+    (long long)duration_cast<milliseconds>(fieldDone - start).count(),
+    (long long)duration_cast<milliseconds>(meshDone - fieldDone).count());
+  return 0;
+}
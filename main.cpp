@@ -6,6 +6,7 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <thread>
 
 #include <GL/glew.h>
 
@@ -17,8 +18,14 @@ using namespace glm;
 
 #include "./src/controls.h"
 #include "./src/pointGrid.h"
+#include "./src/fields.h"
+#include "./src/meshCache.h"
+#include "./src/animationPlayer.h"
+#include "./src/vertexPacking.h"
+#include "./src/sessionLog.h"
+#include "./src/autoTuner.h"
+#include "./src/occlusionCuller.h"
 
-#include "./external/FastNoise.hpp"
 #include "./external/imgui/imgui.h"
 #include "./external/imgui/backends/imgui_impl_glfw.h"
 #include "./external/imgui/backends/imgui_impl_opengl3.h"
@@ -144,87 +151,6 @@ GLFWwindow* initWindow(int width, int height, GLFWwindow* window) {
   return w;
 }
 
-float getSphere(int x, int y, int z, Params& p) {
-  return 2 - sqrt(x * x + (y - p.sizeY()/2) * (y - p.sizeY()/2) + z * z) / p.radius;
-}
-
-float getPerlin(int x, int y, int z, Params& p) {
-  FastNoiseLite noise;
-  noise.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
-  noise.SetFractalType(FastNoiseLite::FractalType_DomainWarpIndependent);
-  noise.SetFrequency(0.05);
-  noise.SetFractalOctaves(3);
-  double val = (noise.GetNoise(x/p.density + p.xOffset, y/p.density + p.yOffset, z/p.density + p.zOffset) + 1.0)/2.0;
-
-  return y == 0 ? 1 : -y / float(p.numUnitsY) + val;
-}
-
-float getPrism(int x, int y, int z, Params& p) {
-  // Make a prism
-  if ((x > -p.sizeX()/2 + 1 && x < p.sizeX()/2 - 1) && (y > 1 && y < p.sizeY() - 1) && (z > -p.sizeZ()/2 + 1 && z < p.sizeZ()/2 - 1)) {
-    return 1;
-  }
-
-  return 0;
-}
-
-float getCubeConfigs(int x, int y, int z, Params& p) {
-  switch(p.configIndex) {
-    case 0:
-      return 0;
-    case 1:
-      if (x == -1 && y == 0 && z == 0) return 1;
-      break;
-    case 2:
-      if (z == 0 && y == 0) return 1;
-      break;
-    case 3:
-      if ((x == -1 && y == 0 && z == 0) || (x == 0 && y == 1 && z == 0)) return 1;
-      break;
-    case 4:
-      if ((x == -1 && y == 0 && z == 0) || (x == 0 && y == 1 && z == -1)) return 1;
-      break;
-    case 5:
-      if (y == 0 && (z == -1 || x == 0)) return 1;
-      break;
-    case 6:
-      if ((z == 0 && y == 0) || (z == -1 && y == 1 && x == 0)) return 1;
-      break;
-    case 7:
-      if ((x == -1 && y == 1 && z == 0) || (x == 0 && y == 0 && z == 0) || (x == 0 && y == 1 && z == -1)) return 1;
-      break;
-    case 8:
-      if (y == 0) return 1;
-      break;
-    case 9:
-      if ((y == 0 && (x == -1 || z == -1)) || (y == 1 && x == -1 && z == -1)) return 1;
-      break;
-    case 10:
-      if (x != z) return 1;
-      break;
-    case 11:
-      if ((y == 0 && (z == -1 || x == -1)) || (y == 1 && x == 0 && z == -1)) return 1;
-      break;
-    case 12:
-      if ((y == 0 && (z == -1 || x == 0)) || (y == 1 && z == 0 && x == -1)) return 1;
-      break;
-    case 13:
-      if ((y == 0 && x != z) || (y == 1 && x == z)) return 1;
-      break;
-    case 14:
-      if ((y == 0 && (z == -1 || x == 0)) || (y == 1 && x == -1 && z == -1)) return 1;
-      break;
-  }
-
-  return 0;
-}
-
-float templateFunc(int x, int y, int z, Params& p) {
-  if ((y == 0 && (z == -1 || x == -1)) || (y == 1 && x == -1 && z == -1)) return 1;
-
-  return 0;
-}
-
 void escapeCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
   auto params = (Params *)glfwGetWindowUserPointer(window);
   if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
@@ -237,39 +163,238 @@ void escapeCallback(GLFWwindow* window, int key, int scancode, int action, int m
   }
 }
 
+void uploadBuffer(GLenum target, GLuint buffer, size_t size, const void* data) {
+  glBindBuffer(target, buffer);
+  glBufferData(target, size, data, GL_STREAM_DRAW);
+}
+
+// How the mesh buffers were last filled, so they are drawn the same way
+struct VertexFormat {
+  bool packed = false;
+  glm::vec3 boundsMin;
+  glm::vec3 boundsMax;
+};
+
+/**
+  NOTE:
+  Packed vertices go into the vertex buffer alone, a
+  third of the size of the two float streams, and the
+  shader decodes them with the grid bounds they were
+  packed against.
+*/
+void uploadVertices(
+  Params &params,
+  VertexFormat &format,
+  GLuint vertexbuffer,
+  GLuint normalbuffer,
+  const glm::vec3* vertices,
+  const glm::vec3* normals,
+  size_t count
+) {
+  format.packed = params.packVertices;
+  if (!format.packed) {
+    uploadBuffer(GL_ARRAY_BUFFER, vertexbuffer, count * sizeof(glm::vec3), vertices);
+    uploadBuffer(GL_ARRAY_BUFFER, normalbuffer, count * sizeof(glm::vec3), normals);
+    return;
+  }
+  getGridBounds(params, format.boundsMin, format.boundsMax);
+  std::vector<PackedVertex> packed(count);
+  packVertices(vertices, normals, count, format.boundsMin, format.boundsMax, packed.data());
+  uploadBuffer(GL_ARRAY_BUFFER, vertexbuffer, count * sizeof(PackedVertex), packed.data());
+}
+
+/**
+  NOTE:
+  The points overlay is uploaded as a bit per grid
+  point rather than a position each, 1/128th of the
+  size, and drawn as one instanced point per grid
+  point. The point shader reads its bit from a buffer
+  texture and works out its position from its index.
+*/
+struct PointOverlay {
+  GLuint insideBuffer;
+  GLuint sampledBuffer;
+  GLuint insideTexture;
+  GLuint sampledTexture;
+  glm::ivec3 size = glm::ivec3(0);
+  float density = 1.0f;
+  bool allSampled = true;
+  size_t numPoints = 0;
+};
+
+void uploadPointMask(PointOverlay &overlay, PointMask &mask) {
+  overlay.size = mask.size;
+  overlay.density = mask.density;
+  overlay.allSampled = mask.sampled.empty();
+  overlay.numPoints = mask.numPoints();
+  uploadBuffer(GL_TEXTURE_BUFFER, overlay.insideBuffer, mask.inside.size() * sizeof(uint32_t), mask.inside.data());
+  uploadBuffer(GL_TEXTURE_BUFFER, overlay.sampledBuffer, mask.sampled.size() * sizeof(uint32_t), mask.sampled.data());
+  glBindTexture(GL_TEXTURE_BUFFER, overlay.insideTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, overlay.insideBuffer);
+  glBindTexture(GL_TEXTURE_BUFFER, overlay.sampledTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, overlay.sampledBuffer);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+// Records every mesh the viewer asks for when started with --record
+SessionRecorder sessionRecorder;
+// Calibrated with marching_cubes_cli --tune, if it has been run on this machine
+TuningProfile tuningProfile;
+
+/**
+  NOTE:
+  Meshes are looked up in the on-disk cache before
+  anything is generated. A hit is uploaded straight
+  from the mapped file, skipping both the scalar field
+  and the mesher. The points overlay is not cached, so
+  showing points always takes the full path, and it is
+  only made while it is shown.
+*/
 void rerender(
   PointGrid &pointGrid,
-  std::vector<glm::vec3> &vertices,
-  std::vector<glm::vec3> &normals,
-  std::vector<glm::vec4> &points,
-  std::vector<unsigned int> &indices,
+  Params &params,
+  MeshCache &meshCache,
+  size_t &numIndices,
+  PointOverlay &pointOverlay,
+  std::vector<int> &numTrisPerCube,
   GLuint &vertexbuffer,
   GLuint &normalbuffer,
-  GLuint &pointbuffer,
   GLuint &indexbuffer,
+  VertexFormat &vertexFormat,
+  std::vector<MeshLayer> &meshLayers,
   float (*currentFunc)(int, int, int, Params&)
 ) {
-  pointGrid.generateScalarField(currentFunc);
-  pointGrid.generateDrawData();
-  vertices = pointGrid.getVertices();
-  normals = pointGrid.getNormals();
-  points = pointGrid.getPoints();
-  indices = pointGrid.getIndices();
+  // Layered meshes are not cached, they are only a few iso values apart
+  bool layered = params.numLayers > 1;
+  meshLayers.clear();
+
+  std::string fieldName = getFieldName(currentFunc);
+  if (currentFunc == getScene) {
+    // Scenes are told apart by their source
+    fieldName += ":" + std::to_string(activeScene().getSourceHash());
+  }
+  uint64_t key = MeshCache::hashParams(fieldName, params);
+  // The grid size may have changed, and with it the best settings
+  tuningProfile.apply(params);
+  sessionRecorder.recordMesh(getFieldName(currentFunc), params);
+
+  CachedMesh cached;
+  if (!params.showPoints && !layered && meshCache.load(key, cached)) {
+    uploadVertices(params, vertexFormat, vertexbuffer, normalbuffer, cached.vertices, cached.normals, cached.numVertices);
+    uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer, cached.numIndices * sizeof(GLuint), cached.indices);
+    numTrisPerCube.assign(cached.numTrisPerCube, cached.numTrisPerCube + cached.numCubes);
+    numIndices = cached.numIndices;
+    pointOverlay.numPoints = 0;
+    return;
+  }
+
+  if (currentFunc == getScene) {
+    pointGrid.generateScalarField(activeScene());
+  } else {
+    pointGrid.generateScalarField(currentFunc);
+  }
+  if (layered) {
+    pointGrid.generateLayerDrawData(getLayerIsoValues(params));
+    meshLayers = pointGrid.getLayers();
+  } else {
+    pointGrid.generateDrawData();
+  }
+  std::vector<glm::vec3> &vertices = pointGrid.getVertices();
+  std::vector<glm::vec3> &normals = pointGrid.getNormals();
+  std::vector<unsigned int> &indices = pointGrid.getIndices();
+
+  uploadVertices(params, vertexFormat, vertexbuffer, normalbuffer, vertices.data(), normals.data(), vertices.size());
+  uploadPointMask(pointOverlay, pointGrid.getPointMask());
+  uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer, indices.size() * sizeof(GLuint), indices.data());
+  numTrisPerCube = pointGrid.getNumTrisPerCube();
+  numIndices = indices.size();
+
+  if (!layered) {
+    meshCache.store(key, vertices, normals, indices, numTrisPerCube);
+  }
+}
 
-  glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STREAM_DRAW);
+// GPU copy of one brick of the sculpted mesh, and the occluder standing in for it when culling
+struct BrickBuffers {
+  GLuint vertexbuffer;
+  GLuint normalbuffer;
+  GLuint indexbuffer;
+  size_t numIndices;
+  Occluder occluder;
+  bool hasOccluder;
+};
+
+void uploadBricks(PointGrid &pointGrid, std::vector<BrickBuffers> &brickBuffers, const std::vector<int> &changed) {
+  std::vector<MeshBrick> &bricks = pointGrid.getBricks();
+  while (brickBuffers.size() > bricks.size()) {
+    BrickBuffers &b = brickBuffers.back();
+    glDeleteBuffers(1, &b.vertexbuffer);
+    glDeleteBuffers(1, &b.normalbuffer);
+    glDeleteBuffers(1, &b.indexbuffer);
+    brickBuffers.pop_back();
+  }
+  while (brickBuffers.size() < bricks.size()) {
+    BrickBuffers b;
+    glGenBuffers(1, &b.vertexbuffer);
+    glGenBuffers(1, &b.normalbuffer);
+    glGenBuffers(1, &b.indexbuffer);
+    b.numIndices = 0;
+    b.hasOccluder = false;
+    brickBuffers.push_back(b);
+  }
+
+  for (int i : changed) {
+    MeshBrick &brick = bricks[i];
+    BrickBuffers &b = brickBuffers[i];
+    uploadBuffer(GL_ARRAY_BUFFER, b.vertexbuffer, brick.vertices.size() * sizeof(glm::vec3), brick.vertices.data());
+    uploadBuffer(GL_ARRAY_BUFFER, b.normalbuffer, brick.normals.size() * sizeof(glm::vec3), brick.normals.data());
+    uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, b.indexbuffer, brick.indices.size() * sizeof(GLuint), brick.indices.data());
+    b.numIndices = brick.indices.size();
+    b.hasOccluder = false;
+  }
+}
 
-  glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-  glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), &normals[0], GL_STREAM_DRAW);
+/**
+  NOTE:
+  Sculpting starts from a freshly generated field,
+  since a cached mesh may have skipped generating it,
+  and keeps its own mesh split into bricks. Leaving
+  sculpt mode goes back to the generated mesh.
+*/
+void startSculpting(
+  PointGrid &pointGrid,
+  std::vector<BrickBuffers> &brickBuffers,
+  float (*currentFunc)(int, int, int, Params&)
+) {
+  if (currentFunc == getScene) {
+    pointGrid.generateScalarField(activeScene());
+  } else {
+    pointGrid.generateScalarField(currentFunc);
+  }
+  pointGrid.generateBrickMeshes();
 
-  glBindBuffer(GL_ARRAY_BUFFER, pointbuffer);
-  glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(glm::vec4), &points[0], GL_STREAM_DRAW);
+  std::vector<int> all(pointGrid.getBricks().size());
+  for (size_t i = 0; i < all.size(); i++) {
+    all[i] = i;
+  }
+  uploadBricks(pointGrid, brickBuffers, all);
+}
 
-  glBindBuffer(GL_ARRAY_BUFFER, indexbuffer);
-  glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STREAM_DRAW);
+// Ray through the cursor, from the camera into the scene
+glm::vec3 getCursorRay(GLFWwindow* window, glm::mat4 &ProjectionMatrix, glm::mat4 &ViewMatrix) {
+  double cursorX, cursorY;
+  int width, height;
+  glfwGetCursorPos(window, &cursorX, &cursorY);
+  glfwGetWindowSize(window, &width, &height);
+
+  glm::vec4 ndc(2.0f * cursorX / width - 1.0f, 1.0f - 2.0f * cursorY / height, 1.0f, 1.0f);
+  glm::mat4 inverseViewProjection = glm::inverse(ProjectionMatrix * ViewMatrix);
+  glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+  glm::vec4 farPoint = inverseViewProjection * ndc;
+  return glm::normalize(glm::vec3(farPoint) / farPoint.w - glm::vec3(nearPoint) / nearPoint.w);
 }
 
-int main() {
+int main(int argc, char** argv) {
   Params params;
   Params oldParams;
   // These variables are used to dynamically update the vertices
@@ -282,6 +407,29 @@ int main() {
 
   float (*currentFunc)(int, int, int, Params&) = getSphere;
 
+  // A scene file may be given on the command line, and a session log to record to
+  char scenePath[256] = "";
+  std::string sceneError;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--record" && i + 1 < argc) {
+      if (!sessionRecorder.open(argv[++i])) {
+        fprintf(stderr, "Could not open %s for recording\n", argv[i]);
+      }
+    } else {
+      snprintf(scenePath, sizeof(scenePath), "%s", argv[i]);
+      if (loadScene(scenePath, sceneError)) {
+        currentFunc = getScene;
+      } else {
+        fprintf(stderr, "Could not load scene: %s\n", sceneError.c_str());
+      }
+    }
+  }
+  if (currentFunc == getScene) {
+    sessionRecorder.recordScene(scenePath);
+  }
+  tuningProfile.load(TuningProfile::defaultPath());
+
   PointGrid pointGrid(params);
 
   GLFWwindow* window = initWindow(params.width, params.height, window);
@@ -303,36 +451,42 @@ int main() {
   glGenVertexArrays(1, &VertexArrayID);
   glBindVertexArray(VertexArrayID);
 
-  pointGrid.generateScalarField(currentFunc);
-  pointGrid.generateDrawData();
-
-  std::vector<glm::vec3> vertices = pointGrid.getVertices();
-  std::vector<glm::vec3> normals = pointGrid.getNormals();
-  std::vector<glm::vec4> points = pointGrid.getPoints();
-  std::vector<GLuint> indices = pointGrid.getIndices();
-  std::vector<int> numTrisPerCube = pointGrid.getNumTrisPerCube();
-
-  // Create and bind vertex buffer
+  // Create the mesh buffers, filled in by rerender
   GLuint vertexbuffer;
   glGenBuffers(1, &vertexbuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STREAM_DRAW);
-
   GLuint indexbuffer;
   glGenBuffers(1, &indexbuffer);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
-  
-  // Create and bind normal buffer
   GLuint normalbuffer;
   glGenBuffers(1, &normalbuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-  glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), &normals[0], GL_STREAM_DRAW);
-
-  GLuint pointbuffer;
-  glGenBuffers(1, &pointbuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, pointbuffer);
-  glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(glm::vec4), &points[0], GL_STREAM_DRAW);
+  PointOverlay pointOverlay;
+  glGenBuffers(1, &pointOverlay.insideBuffer);
+  glGenBuffers(1, &pointOverlay.sampledBuffer);
+  glGenTextures(1, &pointOverlay.insideTexture);
+  glGenTextures(1, &pointOverlay.sampledTexture);
+
+  // Sculpting state, the brush is applied with the left mouse button while the cursor is shown
+  bool sculpting = false;
+  Brush brush;
+  std::vector<BrickBuffers> brickBuffers;
+  std::vector<int> changedBricks;
+  float (*sculptFunc)(int, int, int, Params&) = nullptr;
+  bool stroking = false;
+  OcclusionCuller occlusionCuller;
+  int cullThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  // Playback of time-varying fields, frames are meshed ahead on worker threads
+  AnimationPlayer player;
+  AnimationFrame animationFrame;
+  float animationFps = 30.0f;
+  float (*playingFunc)(int, int, int, Params&) = nullptr;
+
+  MeshCache meshCache;
+  size_t numIndices = 0;
+  std::vector<int> numTrisPerCube;
+  std::vector<MeshLayer> meshLayers;
+  VertexFormat vertexFormat;
+  rerender(pointGrid, params, meshCache, numIndices, pointOverlay, numTrisPerCube, vertexbuffer, normalbuffer, indexbuffer, vertexFormat, meshLayers, currentFunc);
+  oldParams = params;
 
   glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
   glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
@@ -363,6 +517,10 @@ int main() {
   GLuint heightID = glGetUniformLocation(programID, "height");
 
   GLuint useTerrainId = glGetUniformLocation(programID, "useTerrain");
+  GLuint meshColorID = glGetUniformLocation(programID, "meshColor");
+  GLuint packedVerticesID = glGetUniformLocation(programID, "packedVertices");
+  GLuint boundsMinID = glGetUniformLocation(programID, "boundsMin");
+  GLuint boundsSizeID = glGetUniformLocation(programID, "boundsSize");
 
   // Get location of uniform variables for light position to be used in shaders
   GLuint lightID = glGetUniformLocation(programID, "LightPosition_worldspace");
@@ -374,18 +532,51 @@ int main() {
   GLuint PointMatrixID = glGetUniformLocation(pointProgramID, "MVP");
   GLuint PointViewMatrixID = glGetUniformLocation(pointProgramID, "V");
   GLuint PointModelMatrixID = glGetUniformLocation(pointProgramID, "M");
+  GLuint PointInsideMaskID = glGetUniformLocation(pointProgramID, "insideMask");
+  GLuint PointSampledMaskID = glGetUniformLocation(pointProgramID, "sampledMask");
+  GLuint PointAllSampledID = glGetUniformLocation(pointProgramID, "allSampled");
+  GLuint PointGridSizeID = glGetUniformLocation(pointProgramID, "gridSize");
+  GLuint PointDensityID = glGetUniformLocation(pointProgramID, "density");
   
   int currFrame = 0;
   int currCube = 0;
   int totalTris = 0;
   do {
-    if (oldParams != params) {
+    // Only the time changes between frames, so nothing else needs to be redone
+    if (player.isPlaying() && player.takeFrame(animationFrame)) {
+      params.time = animationFrame.time;
+      oldParams.time = params.time;
+      uploadVertices(params, vertexFormat, vertexbuffer, normalbuffer, animationFrame.vertices.data(), animationFrame.normals.data(), animationFrame.vertices.size());
+      uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer, animationFrame.indices.size() * sizeof(GLuint), animationFrame.indices.data());
+      numIndices = animationFrame.indices.size();
+      pointOverlay.numPoints = 0;
+      numTrisPerCube.clear();
+      meshLayers = animationFrame.layers;
+    }
+
+    // A cache hit leaves the points buffer empty, so mesh again once they are shown
+    bool pointsMissing = params.showPoints && pointOverlay.numPoints == 0 && !player.isPlaying() && params.numLayers == 1;
+    if (oldParams != params || pointsMissing || (player.isPlaying() && playingFunc != currentFunc)) {
       oldParams = params;
       currCube = 0;
       currFrame = 0;
       totalTris = 0;
 
-      rerender(pointGrid, vertices, normals, points, indices, vertexbuffer, normalbuffer, pointbuffer, indexbuffer, currentFunc);
+      if (player.isPlaying()) {
+        // The shown frame stays up until the restarted player catches up
+        player.start(params, currentFunc, animationFps);
+        playingFunc = currentFunc;
+      } else if (sculpting) {
+        sculptFunc = nullptr;
+      } else {
+        rerender(pointGrid, params, meshCache, numIndices, pointOverlay, numTrisPerCube, vertexbuffer, normalbuffer, indexbuffer, vertexFormat, meshLayers, currentFunc);
+      }
+    }
+
+    // Changing the field or the grid throws the edits away
+    if (sculpting && sculptFunc != currentFunc) {
+      startSculpting(pointGrid, brickBuffers, currentFunc);
+      sculptFunc = currentFunc;
     }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -403,30 +594,56 @@ int main() {
 
     glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
 
+    if (sculpting && params.cursorEnabled && !io.WantCaptureMouse && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
+      glm::vec3 hit;
+      if (pointGrid.raycast(params.position, getCursorRay(window, ProjectionMatrix, ViewMatrix), hit)) {
+        brush.centre = hit;
+        pointGrid.applyBrush(brush);
+        pointGrid.remeshDirty(changedBricks);
+        uploadBricks(pointGrid, brickBuffers, changedBricks);
+        stroking = true;
+      }
+    } else if (stroking) {
+      // Everything painted while the button was held is undone together
+      pointGrid.commitEdit();
+      stroking = false;
+    }
+
     if (params.showMesh) {
       glUseProgram(programID);
 
+      // Sculpted bricks are always uploaded as floats
+      bool packed = vertexFormat.packed && !sculpting;
       glEnableVertexAttribArray(0);
-      glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-      glVertexAttribPointer(
-        0,
-        3,
-        GL_FLOAT,
-        GL_FALSE,
-        0,
-        (void*)0
-      );
-
       glEnableVertexAttribArray(1);
-      glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-      glVertexAttribPointer(
-        1,
-        3,
-        GL_FLOAT,
-        GL_FALSE,
-        0,
-        (void*)0
-      );
+      glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+      if (packed) {
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+        glVertexAttribPointer(1, 2, GL_BYTE, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+      } else {
+        glVertexAttribPointer(
+          0,
+          3,
+          GL_FLOAT,
+          GL_FALSE,
+          0,
+          (void*)0
+        );
+
+        glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+        glVertexAttribPointer(
+          1,
+          3,
+          GL_FLOAT,
+          GL_FALSE,
+          0,
+          (void*)0
+        );
+      }
+      glUniform1i(packedVerticesID, packed);
+      glm::vec3 boundsSize = vertexFormat.boundsMax - vertexFormat.boundsMin;
+      glUniform3f(boundsMinID, vertexFormat.boundsMin.x, vertexFormat.boundsMin.y, vertexFormat.boundsMin.z);
+      glUniform3f(boundsSizeID, boundsSize.x, boundsSize.y, boundsSize.z);
 
       // Send transformation to currently bound shader
       glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
@@ -437,13 +654,51 @@ int main() {
       glUniform1f(heightID, params.numUnitsY);
 
       glUniform1i(useTerrainId, params.useTerrain);
+      glUniform3f(meshColorID, 0.3f, 0.7f, 0.7f);
 
       // Send light position to shader
       glm::vec3 lightPos = params.position;
       glUniform3f(lightID, lightPos.x, lightPos.y + 10.0f, lightPos.z);
 
       // glDrawArrays(GL_TRIANGLES, 0, vertices.size());
-      if (params.showMarch && currCube < numTrisPerCube.size()) {
+      if (sculpting) {
+        // Occluders are made the first time a brick is drawn with culling on, within a quarter cube
+        if (params.occlusionCulling) {
+          std::vector<MeshBrick> &bricks = pointGrid.getBricks();
+          std::vector<const Occluder*> occluders;
+          for (size_t i = 0; i < brickBuffers.size(); i++) {
+            BrickBuffers &b = brickBuffers[i];
+            if (!b.numIndices) continue;
+            if (!b.hasOccluder) {
+              makeOccluder(bricks[i].vertices, bricks[i].normals, bricks[i].indices, 0.25f / params.density, b.occluder);
+              b.hasOccluder = true;
+            }
+            occluders.push_back(&b.occluder);
+          }
+          // The camera, wherever the controls put it: the static and orbit views are not at params.position
+          glm::vec3 eye = glm::vec3(glm::inverse(ViewMatrix)[3]);
+          occlusionCuller.render(MVP, eye, occluders, cullThreads);
+        }
+        for (BrickBuffers &b : brickBuffers) {
+          if (!b.numIndices) continue;
+          if (params.occlusionCulling && !occlusionCuller.isVisible(b.occluder.boundsMin, b.occluder.boundsMax)) continue;
+          glBindBuffer(GL_ARRAY_BUFFER, b.vertexbuffer);
+          glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+          glBindBuffer(GL_ARRAY_BUFFER, b.normalbuffer);
+          glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+          glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, b.indexbuffer);
+          glDrawElements(GL_TRIANGLES, b.numIndices, GL_UNSIGNED_INT, 0);
+        }
+        // The plain mesh draws with whatever index buffer is bound
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
+      } else if (meshLayers.size() > 1) {
+        // Each layer is drawn from its own range, shading from the lowest iso value to the highest
+        for (size_t i = 0; i < meshLayers.size(); i++) {
+          glm::vec3 color = glm::mix(glm::vec3(0.3f, 0.7f, 0.7f), glm::vec3(0.8f, 0.4f, 0.3f), i / (meshLayers.size() - 1.0f));
+          glUniform3f(meshColorID, color.x, color.y, color.z);
+          glDrawElements(GL_TRIANGLES, meshLayers[i].numIndices, GL_UNSIGNED_INT, (void*)(meshLayers[i].firstIndex * sizeof(GLuint)));
+        }
+      } else if (params.showMarch && currCube < numTrisPerCube.size()) {
         currFrame++;
         if (currFrame % params.waitTime == 0) {
           totalTris += numTrisPerCube[currCube];
@@ -452,30 +707,30 @@ int main() {
             currCube++;
           }
         }
-        glDrawElements(GL_TRIANGLES, indices.size() - (indices.size() - totalTris * 3), GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, totalTris * 3, GL_UNSIGNED_INT, 0);
       } else {
         if (currFrame > 0 && !params.showMarch) {
           currFrame = 0;
           currCube = 0;
           totalTris = 0;
         }
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
       }
     }
 
-    if (params.showPoints) {
+    if (params.showPoints && pointOverlay.numPoints) {
       glUseProgram(pointProgramID);
 
-      glEnableVertexAttribArray(3);
-      glBindBuffer(GL_ARRAY_BUFFER, pointbuffer);
-      glVertexAttribPointer(
-        3,
-        4,
-        GL_FLOAT,
-        GL_FALSE,
-        0,
-        (void*)0
-      );
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_BUFFER, pointOverlay.insideTexture);
+      glActiveTexture(GL_TEXTURE2);
+      glBindTexture(GL_TEXTURE_BUFFER, pointOverlay.sampledTexture);
+      glActiveTexture(GL_TEXTURE0);
+      glUniform1i(PointInsideMaskID, 1);
+      glUniform1i(PointSampledMaskID, 2);
+      glUniform1i(PointAllSampledID, pointOverlay.allSampled);
+      glUniform3i(PointGridSizeID, pointOverlay.size.x, pointOverlay.size.y, pointOverlay.size.z);
+      glUniform1f(PointDensityID, pointOverlay.density);
 
       // Send transformation to currently bound shader
       glUniformMatrix4fv(PointMatrixID, 1, GL_FALSE, &MVP[0][0]);
@@ -484,7 +739,8 @@ int main() {
       
       // Uncomment to make points appear on top of triangles
       // glClear(GL_DEPTH_BUFFER_BIT);
-      glDrawArrays(GL_POINTS, 0, points.size());
+      // One instance per grid point, placed by the shader from its instance ID
+      glDrawArraysInstanced(GL_POINTS, 0, 1, pointOverlay.numPoints);
     }
 
   {
@@ -497,9 +753,111 @@ int main() {
       ImGui::Checkbox("Show Mesh", &params.showMesh);
       ImGui::Checkbox("Interpolate", &params.interpolate);
       ImGui::SameLine();
+      ImGui::Checkbox("Pack Vertices", &params.packVertices);
+      ImGui::SameLine();
       ImGui::Checkbox("Show March", &params.showMarch);
 
+      ImGui::RadioButton("Marching Cubes", &params.mesher, MESHER_MARCHING_CUBES);
+      ImGui::SameLine();
+      ImGui::RadioButton("Surface Nets", &params.mesher, MESHER_SURFACE_NETS);
+      ImGui::SameLine();
+      ImGui::RadioButton("Dual Contouring", &params.mesher, MESHER_DUAL_CONTOURING);
+      ImGui::SameLine();
+      ImGui::RadioButton("Adaptive", &params.mesher, MESHER_ADAPTIVE_CUBES);
+      if (params.mesher == MESHER_ADAPTIVE_CUBES) {
+        ImGui::SliderFloat("Adaptive Error", &params.adaptiveError, 0.001f, 0.2f, "%.3f");
+      }
+
+      ImGui::Checkbox("Optimize Indices", &params.optimizeIndices);
+      ImGui::SameLine();
+      ImGui::Checkbox("Decimate", &params.decimate);
+      if (params.decimate) {
+        ImGui::SliderInt("Triangle Budget", &params.triangleBudget, 100, 100000);
+        ImGui::SliderFloat("Max Error", &params.decimateError, 0.0f, 1.0f);
+      }
+
       ImGui::SliderFloat("IsoValue", &params.isoValue, 0.0f, 1.0f);
+      ImGui::SliderInt("Layers", &params.numLayers, 1, 5);
+      if (params.numLayers > 1) {
+        ImGui::SliderFloat("Layer Spacing", &params.layerSpacing, -0.5f, 0.5f);
+      }
+      ImGui::SliderInt("Min Island Points", &params.minIslandPoints, 0, 1000);
+      ImGui::SliderInt("Min Island Triangles", &params.minIslandTriangles, 0, 1000);
+      IslandReport &islands = pointGrid.getIslandReport();
+      if (islands.numIslands) {
+        ImGui::Text("Islands: %zu, %zu removed (%zu points)", islands.numIslands, islands.numRemoved, islands.pointsRemoved);
+      }
+
+      // Only changes how the mesh is made, so it shows on the next remesh
+      ImGui::Checkbox("Pipeline Bricks", &params.pipelineBricks);
+      TaskReport &pipeline = pointGrid.getPipelineReport();
+      if (params.pipelineBricks && pipeline.numThreads) {
+        ImGui::Text("Pipeline: %.1f ms on %d threads", pipeline.wallMs, pipeline.numThreads);
+        for (StageReport &stage : pipeline.stages) {
+          ImGui::Text("  %-9s %5.1f%% busy", stage.name.c_str(), 100.0f * pipeline.utilisation(stage));
+        }
+      }
+
+      // Sculpted meshes always use marching cubes
+      if (ImGui::Checkbox("Sculpt", &sculpting)) {
+        sculptFunc = nullptr;
+        player.stop();
+        if (!sculpting) {
+          rerender(pointGrid, params, meshCache, numIndices, pointOverlay, numTrisPerCube, vertexbuffer, normalbuffer, indexbuffer, vertexFormat, meshLayers, currentFunc);
+        }
+      }
+      if (sculpting) {
+        ImGui::SameLine();
+        ImGui::RadioButton("Add", &brush.mode, BRUSH_ADD);
+        ImGui::SameLine();
+        ImGui::RadioButton("Subtract", &brush.mode, BRUSH_SUBTRACT);
+        ImGui::SameLine();
+        ImGui::RadioButton("Smooth", &brush.mode, BRUSH_SMOOTH);
+        ImGui::SliderFloat("Brush Radius", &brush.radius, 0.5f, 10.0f);
+        ImGui::SliderFloat("Brush Strength", &brush.strength, 0.01f, 1.0f);
+
+        FieldHistory &history = pointGrid.getHistory();
+        bool undone = false;
+        if (ImGui::Button("Undo") && history.canUndo()) {
+          undone = pointGrid.undoEdit();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Redo") && history.canRedo()) {
+          undone = pointGrid.redoEdit();
+        }
+        if (undone) {
+          pointGrid.remeshDirty(changedBricks);
+          uploadBricks(pointGrid, brickBuffers, changedBricks);
+        }
+        ImGui::SameLine();
+        ImGui::Text("History: %zu/%zu, %.1f MB", history.getDepth(), history.getNumSnapshots(), history.getMemoryUsed() / (1024.0 * 1024.0));
+
+        ImGui::Checkbox("Occlusion Culling", &params.occlusionCulling);
+        if (params.occlusionCulling) {
+          OcclusionStats &culled = occlusionCuller.stats;
+          ImGui::Text("Bricks: %d drawn, %d outside the view, %d hidden", culled.numTested - culled.numOutside - culled.numOccluded, culled.numOutside, culled.numOccluded);
+          ImGui::Text("Occluders: %d, %zu triangles, %.2f ms", culled.numOccluders, culled.numOccluderTriangles, culled.renderMs);
+        }
+      } else {
+        // Sculpted fields are frozen in time
+        if (ImGui::Button(player.isPlaying() ? "Pause" : "Play")) {
+          if (player.isPlaying()) {
+            player.stop();
+          } else {
+            params.showMarch = false;
+            player.start(params, currentFunc, animationFps);
+            playingFunc = currentFunc;
+          }
+        }
+        ImGui::SameLine();
+        ImGui::SliderFloat("Time", &params.time, 0.0f, 60.0f);
+        if (ImGui::SliderFloat("Frame Rate", &animationFps, 1.0f, 60.0f, "%.0f") && player.isPlaying()) {
+          player.start(params, currentFunc, animationFps);
+        }
+        if (player.isPlaying()) {
+          ImGui::Text("Frames: %zu shown, %zu dropped, %zu queued", player.getNumShown(), player.getNumDropped(), player.getNumQueued());
+        }
+      }
 
       ImGui::Separator();
 
@@ -514,23 +872,45 @@ int main() {
       ImGui::Separator();
       
       ImGui::BeginGroup();
-      for (auto func : { getSphere, getPerlin, getPrism, getCubeConfigs }) {
+      for (int i = 0; i < numFields; i++) {
+        auto func = fields[i].func;
+        if (func == getScene && activeScene().empty()) continue;
+
         if (func == currentFunc)
           ImGui::PushStyleColor(ImGuiCol_Button, (ImVec4)ImColor::HSV(0.45f, 0.6f, 0.6f));
         else
           ImGui::PushStyleColor(ImGuiCol_Button, (ImVec4)ImColor::HSV(0.6f, 0.8f, 0.6f));
 
-        if (ImGui::Button(func == getSphere ? "Sphere" : func == getPerlin ? "Perlin Noise" : func == getPrism ? "Prism" : "Cube Configs")) {
+        if (ImGui::Button(fields[i].label)) {
           params.showMarch = false;
           currentFunc = func;
           params.useTerrain = func == getPerlin;
-          rerender(pointGrid, vertices, normals, points, indices, vertexbuffer, normalbuffer, pointbuffer, indexbuffer, currentFunc);
+          rerender(pointGrid, params, meshCache, numIndices, pointOverlay, numTrisPerCube, vertexbuffer, normalbuffer, indexbuffer, vertexFormat, meshLayers, currentFunc);
         }
         ImGui::SameLine();
         ImGui::PopStyleColor();
       }
       ImGui::EndGroup();
 
+      // Scenes are re-read on every load, so they can be edited while the program runs
+      ImGui::InputText("Scene File", scenePath, sizeof(scenePath));
+      ImGui::SameLine();
+      if (ImGui::Button("Load")) {
+        // Workers read the scene, so they must be done before it is replaced
+        player.stop();
+        if (loadScene(scenePath, sceneError)) {
+          sessionRecorder.recordScene(scenePath);
+          sceneError.clear();
+          params.showMarch = false;
+          params.useTerrain = false;
+          currentFunc = getScene;
+          rerender(pointGrid, params, meshCache, numIndices, pointOverlay, numTrisPerCube, vertexbuffer, normalbuffer, indexbuffer, vertexFormat, meshLayers, currentFunc);
+        }
+      }
+      if (sceneError.size()) {
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", sceneError.c_str());
+      }
+
       if (currentFunc == getSphere) {
         ImGui::SliderFloat("Radius", &params.radius, 0.0f, 20.0f);
       }
@@ -545,7 +925,7 @@ int main() {
         if (ImGui::ArrowButton("##left", ImGuiDir_Left)) {
           if (params.configIndex > 0) {
             params.configIndex--;
-            rerender(pointGrid, vertices, normals, points, indices, vertexbuffer, normalbuffer, pointbuffer, indexbuffer, currentFunc);
+            rerender(pointGrid, params, meshCache, numIndices, pointOverlay, numTrisPerCube, vertexbuffer, normalbuffer, indexbuffer, vertexFormat, meshLayers, currentFunc);
           }
         }
         ImGui::SameLine();
@@ -554,7 +934,7 @@ int main() {
         if (ImGui::ArrowButton("##right", ImGuiDir_Right)) {
           if (params.configIndex < 14) {
             params.configIndex++;
-            rerender(pointGrid, vertices, normals, points, indices, vertexbuffer, normalbuffer, pointbuffer, indexbuffer, currentFunc);
+            rerender(pointGrid, params, meshCache, numIndices, pointOverlay, numTrisPerCube, vertexbuffer, normalbuffer, indexbuffer, vertexFormat, meshLayers, currentFunc);
           }
         }
       }
@@ -11,6 +11,7 @@ uniform mat4 MV;
 uniform vec3 LightPosition_worldspace;
 uniform float height;
 uniform bool useTerrain;
+uniform vec3 meshColor;
 
 void main(){
   vec3 LightColor = vec3(1,1,1);
@@ -37,7 +38,7 @@ void main(){
 
     MaterialSpecularColor = vec3(0,0,0);
   } else {
-    MaterialDiffuseColor = vec3(0.3,0.7,0.7);
+    MaterialDiffuseColor = meshColor;
     MaterialSpecularColor = vec3(0.3,0.3,0.3);
   }
 
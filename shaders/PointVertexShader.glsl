@@ -1,7 +1,12 @@
 #version 330 core
 
-layout(location = 3) in vec4 vertexPosition_modelspace;
-// layout(location = 1) in vec3 vertexColor;
+// A bit per grid point, 32 to a texel, in the order of PointGrid::coordsToIndex
+uniform usamplerBuffer insideMask;
+// Only used when some points were never sampled, as with adaptive meshing
+uniform usamplerBuffer sampledMask;
+uniform bool allSampled;
+uniform ivec3 gridSize;
+uniform float density;
 
 uniform mat4 MVP;
 uniform mat4 V;
@@ -9,14 +14,32 @@ uniform mat4 M;
 
 out float isInside;
 
+bool maskBit(usamplerBuffer mask, int i) {
+  return ((texelFetch(mask, i >> 5).r >> uint(i & 31)) & 1u) != 0u;
+}
+
 void main(){
-  gl_Position = MVP * vec4(vertexPosition_modelspace.xyz,1);
+  // One instance per grid point
+  int i = gl_InstanceID;
+  if (!allSampled && !maskBit(sampledMask, i)) {
+    // Outside the clip volume, so the point is dropped
+    gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+    gl_PointSize = 1.0;
+    isInside = 0.0;
+    return;
+  }
+  int x = i / (gridSize.y * gridSize.z);
+  int y = (i / gridSize.z) % gridSize.y;
+  int z = i % gridSize.z;
+  vec3 vertexPosition_modelspace = vec3(x - gridSize.x / 2, y, z - gridSize.z / 2) / density;
+
+  gl_Position = MVP * vec4(vertexPosition_modelspace,1);
 	
 	// Vector that goes from the vertex to the camera, in camera space.
 	// In camera space, the camera is at the origin (0,0,0).
-	vec3 vertexPosition_cameraspace = ( V * M * vec4(vertexPosition_modelspace.xyz,1)).xyz;
+	vec3 vertexPosition_cameraspace = ( V * M * vec4(vertexPosition_modelspace,1)).xyz;
 
-	isInside = vertexPosition_modelspace.w;
+	isInside = maskBit(insideMask, i) ? 1.0 : 0.0;
 	// Keep point size constant
 	gl_PointSize = 100.0 * (1.0 / -vertexPosition_cameraspace.z);
-}
\ No newline at end of file
+}
@@ -9,20 +9,40 @@ uniform mat4 V;
 uniform mat4 M;
 uniform vec3 LightPosition_worldspace;
 
+// Packed vertices hold positions relative to these bounds and octahedral normals
+uniform bool packedVertices;
+uniform vec3 boundsMin;
+uniform vec3 boundsSize;
+
 out vec3 Position_worldspace;
 out vec3 Normal_cameraspace;
 out vec3 EyeDirection_cameraspace;
 out vec3 LightDirection_cameraspace;
 
+vec3 octahedronDecode(vec2 e){
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (n.z < 0.0) {
+    n.xy = (1.0 - abs(n.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return normalize(n);
+}
+
 void main(){
-  gl_Position = MVP * vec4(vertexPosition_modelspace,1);
+  vec3 vertexPosition = vertexPosition_modelspace;
+  vec3 vertexNormal = vertexNormal_modelspace;
+  if (packedVertices) {
+    vertexPosition = boundsMin + vertexPosition_modelspace * boundsSize;
+    vertexNormal = octahedronDecode(vertexNormal_modelspace.xy);
+  }
+
+  gl_Position = MVP * vec4(vertexPosition,1);
 
   // Position of the vertex, in worldspace : M * position
-	Position_worldspace = (M * vec4(vertexPosition_modelspace,1)).xyz;
+	Position_worldspace = (M * vec4(vertexPosition,1)).xyz;
 	
 	// Vector that goes from the vertex to the camera, in camera space.
 	// In camera space, the camera is at the origin (0,0,0).
-	vec3 vertexPosition_cameraspace = ( V * M * vec4(vertexPosition_modelspace,1)).xyz;
+	vec3 vertexPosition_cameraspace = ( V * M * vec4(vertexPosition,1)).xyz;
 	EyeDirection_cameraspace = vec3(0,0,0) - vertexPosition_cameraspace;
 
 	// Vector that goes from the vertex to the light, in camera space. M is ommited because it's identity.
@@ -34,5 +54,5 @@ void main(){
 	gl_PointSize = 50.0 * (1.0 / -vertexPosition_cameraspace.z);
 	
 	// Normal of the the vertex, in camera space
-	Normal_cameraspace = ( V * M * vec4(vertexNormal_modelspace,0)).xyz; // Only correct if ModelMatrix does not scale the model ! Use its inverse transpose if not.
+	Normal_cameraspace = ( V * M * vec4(vertexNormal,0)).xyz; // Only correct if ModelMatrix does not scale the model ! Use its inverse transpose if not.
 }
\ No newline at end of file
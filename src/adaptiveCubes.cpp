@@ -0,0 +1,347 @@
+#include "pointGrid.h"
+#include <array>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+
+// Leaves start out as cubes of ADAPTIVE_ROOT_SIZE grid cells and are halved down to single cells
+const int ADAPTIVE_ROOT_SIZE = 16;
+
+// Grid coordinates packed 20 bits each, with room for a size or axis tag below
+static uint64_t packPoint(int x, int y, int z) {
+  return ((uint64_t)x << 40) | ((uint64_t)y << 20) | (uint64_t)z;
+}
+
+static uint64_t packNode(int x, int y, int z, int size) {
+  return packPoint(x, y, z) << 4 | (uint64_t)log2(size);
+}
+
+struct AdaptiveLeaf {
+  int origin[3];
+  int size;
+};
+
+/**
+  NOTE:
+  Adaptive extraction builds an octree over the grid.
+  A cube is split when the surface passes through it
+  and the field strays from the trilinear interpolation
+  of its corners by more than adaptiveError at any of
+  27 sample points, or when a sample falls on the other
+  side of the surface than interpolation says.
+  The field is only evaluated at the points the tree
+  asks for, instead of at every grid point.
+
+  Leaves of different sizes are joined without cracks
+  by building every leaf's polygons from the segments
+  on its faces, each face being cut up as finely as
+  the leaves on either side of it, and each edge split
+  at every leaf corner that lies on it. Two leaves
+  sharing a face therefore see exactly the same
+  segments, and the segments around a leaf always
+  close into loops, which are then triangulated.
+
+  Where a face polygon is ambiguous, every inside run
+  along its border gets its own segment, so both sides
+  resolve it the same way.
+*/
+void PointGrid::adaptiveMesh(MeshSink& sink, bool withPoints) {
+  int size[3] = { p.sizeX(), p.sizeY(), p.sizeZ() };
+  if (size[0] < 2 || size[1] < 2 || size[2] < 2) return;
+
+  // Samples are cached in a grid sized array, NaN until the tree asks for them
+  size_t numPoints = (size_t)size[0] * size[1] * size[2];
+  std::vector<float> samples(numPoints, NAN);
+  numSamples = 0;
+  auto sample = [&](int x, int y, int z) {
+    float& value = samples[coordsToIndex(x, y, z)];
+    if (std::isnan(value)) {
+      value = fieldFunc
+        ? fieldFunc(x - p.sizeX() / 2, y, z - p.sizeZ() / 2, p)
+        : scalarField[coordsToIndex(x, y, z)];
+      numSamples++;
+    }
+    return value;
+  };
+  auto inside = [&](int x, int y, int z) {
+    return sample(x, y, z) >= p.isoValue;
+  };
+
+  // Build the tree. Internal nodes are kept so faces can look across to their neighbours.
+  std::unordered_map<uint64_t, bool> nodes;
+  nodes.reserve(numPoints / 64);
+  std::vector<AdaptiveLeaf> leaves;
+  std::vector<AdaptiveLeaf> stack;
+  for (int x = 0; x < size[0] - 1; x += ADAPTIVE_ROOT_SIZE) {
+    for (int y = 0; y < size[1] - 1; y += ADAPTIVE_ROOT_SIZE) {
+      for (int z = 0; z < size[2] - 1; z += ADAPTIVE_ROOT_SIZE) {
+        stack.push_back({{x, y, z}, ADAPTIVE_ROOT_SIZE});
+      }
+    }
+  }
+  while (stack.size()) {
+    AdaptiveLeaf node = stack.back();
+    stack.pop_back();
+    int s = node.size;
+    int* o = node.origin;
+
+    // Cubes hanging over the edge of the grid are split until they fit
+    bool split = o[0] + s > size[0] - 1 || o[1] + s > size[1] - 1 || o[2] + s > size[2] - 1;
+    if (!split && s > 1) {
+      float corners[8];
+      for (int i = 0; i < 8; i++) {
+        corners[i] = sample(o[0] + s * (i%2), o[1] + s * ((i % 4) / 2), o[2] + s * (i / 4));
+      }
+      // Only cubes the surface passes through need to follow the field closely
+      int h = s / 2;
+      bool anyInside = false;
+      bool anyOutside = false;
+      bool signMismatch = false;
+      float deviation = 0.0f;
+      for (int i = 0; i < 27; i++) {
+        int a = i % 3;
+        int b = (i / 3) % 3;
+        int c = i / 9;
+
+        float u = a * 0.5f;
+        float v = b * 0.5f;
+        float w = c * 0.5f;
+        float expected =
+          corners[0] * (1 - u) * (1 - v) * (1 - w) + corners[1] * u * (1 - v) * (1 - w) +
+          corners[2] * (1 - u) * v * (1 - w) + corners[3] * u * v * (1 - w) +
+          corners[4] * (1 - u) * (1 - v) * w + corners[5] * u * (1 - v) * w +
+          corners[6] * (1 - u) * v * w + corners[7] * u * v * w;
+        float actual = sample(o[0] + a * h, o[1] + b * h, o[2] + c * h);
+        bool in = actual >= p.isoValue;
+        anyInside |= in;
+        anyOutside |= !in;
+        signMismatch |= in != (expected >= p.isoValue);
+        deviation = std::max(deviation, std::abs(actual - expected));
+      }
+      split = signMismatch || (anyInside && anyOutside && deviation > p.adaptiveError);
+    }
+
+    if (split && s > 1) {
+      nodes[packNode(o[0], o[1], o[2], s)] = false;
+      int h = s / 2;
+      for (int i = 0; i < 8; i++) {
+        AdaptiveLeaf child = {{o[0] + h * (i%2), o[1] + h * ((i % 4) / 2), o[2] + h * (i / 4)}, h};
+        if (child.origin[0] < size[0] - 1 && child.origin[1] < size[1] - 1 && child.origin[2] < size[2] - 1) {
+          stack.push_back(child);
+        }
+      }
+    } else {
+      nodes[packNode(o[0], o[1], o[2], s)] = true;
+      leaves.push_back(node);
+    }
+  }
+
+  // March in the same order as the uniform mesher
+  std::sort(leaves.begin(), leaves.end(), [](const AdaptiveLeaf& a, const AdaptiveLeaf& b) {
+    if (a.origin[0] != b.origin[0]) return a.origin[0] < b.origin[0];
+    if (a.origin[1] != b.origin[1]) return a.origin[1] < b.origin[1];
+    return a.origin[2] < b.origin[2];
+  });
+
+  // Every leaf corner, so edges can be split wherever a smaller neighbour has one
+  std::vector<bool> corners(numPoints, false);
+  for (auto& leaf : leaves) {
+    for (int i = 0; i < 8; i++) {
+      corners[coordsToIndex(leaf.origin[0] + leaf.size * (i%2), leaf.origin[1] + leaf.size * ((i % 4) / 2), leaf.origin[2] + leaf.size * (i / 4))] = true;
+    }
+  }
+
+  std::vector<glm::vec3> meshVertices;
+  std::vector<unsigned int> meshIndices;
+  std::unordered_map<uint64_t, unsigned int> crossingIds;
+
+  auto toWorld = [&](glm::vec3 g) {
+    return glm::vec3((g.x - p.sizeX()/2)/p.density, g.y/p.density, (g.z - p.sizeZ()/2)/p.density);
+  };
+
+  // The vertex on the segment between two neighbouring boundary points
+  auto crossing = [&](const std::array<int, 3>& a, const std::array<int, 3>& b) {
+    bool aFirst = a[0] + a[1] + a[2] < b[0] + b[1] + b[2];
+    const std::array<int, 3>& lo = aFirst ? a : b;
+    const std::array<int, 3>& hi = aFirst ? b : a;
+    int axis = lo[0] != hi[0] ? 0 : lo[1] != hi[1] ? 1 : 2;
+    uint64_t key = packPoint(lo[0], lo[1], lo[2]) << 2 | axis;
+    auto it = crossingIds.find(key);
+    if (it != crossingIds.end()) return it->second;
+
+    float valueLo = sample(lo[0], lo[1], lo[2]);
+    float valueHi = sample(hi[0], hi[1], hi[2]);
+    float t = 0.5f;
+    if (p.interpolate && std::abs(valueHi - valueLo) > 0.000001f) {
+      t = (p.isoValue - valueLo) / (valueHi - valueLo);
+    }
+    glm::vec3 from(lo[0], lo[1], lo[2]);
+    glm::vec3 to(hi[0], hi[1], hi[2]);
+    unsigned int id = meshVertices.size();
+    meshVertices.push_back(toWorld(from + t * (to - from)));
+    crossingIds.insert({key, id});
+    return id;
+  };
+
+  std::vector<std::array<int, 3>> polygon;
+  std::vector<bool> polygonInside;
+  std::unordered_map<unsigned int, unsigned int> next;
+  std::vector<AdaptiveLeaf> quads;
+
+  for (auto& leaf : leaves) {
+    int s = leaf.size;
+    const int* o = leaf.origin;
+
+    next.clear();
+    for (int axis = 0; axis < 3; axis++) {
+      int u = (axis + 1) % 3;
+      int v = (axis + 2) % 3;
+      for (int side = 0; side < 2; side++) {
+        int plane = o[axis] + side * s;
+
+        // Cut the face as finely as the leaves across it
+        quads.clear();
+        stack.clear();
+        AdaptiveLeaf whole;
+        whole.origin[axis] = plane;
+        whole.origin[u] = o[u];
+        whole.origin[v] = o[v];
+        whole.size = s;
+        stack.push_back(whole);
+        while (stack.size()) {
+          AdaptiveLeaf square = stack.back();
+          stack.pop_back();
+          int across[3] = { square.origin[0], square.origin[1], square.origin[2] };
+          across[axis] = side ? plane : plane - square.size;
+          auto it = nodes.find(packNode(across[0], across[1], across[2], square.size));
+          if (square.size > 1 && it != nodes.end() && !it->second) {
+            int h = square.size / 2;
+            for (int i = 0; i < 4; i++) {
+              AdaptiveLeaf half = square;
+              half.origin[u] += h * (i%2);
+              half.origin[v] += h * (i / 2);
+              half.size = h;
+              stack.push_back(half);
+            }
+          } else {
+            quads.push_back(square);
+          }
+        }
+
+        for (auto& quad : quads) {
+          // Walk the border anticlockwise seen from +axis, stopping at every leaf corner
+          polygon.clear();
+          int t = quad.size;
+          int du[4] = {1, 0, -1, 0};
+          int dv[4] = {0, 1, 0, -1};
+          std::array<int, 3> point = {quad.origin[0], quad.origin[1], quad.origin[2]};
+          for (int e = 0; e < 4; e++) {
+            for (int step = 0; step < t; step++) {
+              if (step == 0 || corners[coordsToIndex(point[0], point[1], point[2])]) {
+                polygon.push_back(point);
+              }
+              point[u] += du[e];
+              point[v] += dv[e];
+            }
+          }
+          // Seen from outside the leaf, the low face runs the other way
+          if (!side) {
+            std::reverse(polygon.begin(), polygon.end());
+          }
+
+          int n = polygon.size();
+          polygonInside.resize(n);
+          for (int i = 0; i < n; i++) {
+            polygonInside[i] = inside(polygon[i][0], polygon[i][1], polygon[i][2]);
+          }
+
+          // Join the crossings on either end of each inside run
+          for (int i = 0; i < n; i++) {
+            if (polygonInside[i] || !polygonInside[(i + 1) % n]) continue;
+            int j = (i + 1) % n;
+            while (polygonInside[(j + 1) % n]) {
+              j = (j + 1) % n;
+            }
+            unsigned int enter = crossing(polygon[i], polygon[(i + 1) % n]);
+            unsigned int leave = crossing(polygon[j], polygon[(j + 1) % n]);
+            next[leave] = enter;
+          }
+        }
+      }
+    }
+
+    // Follow the segments around into loops and fan them out. Leaves the
+    // surface misses have no segments, even when their corners differ
+    // from those of a smaller neighbour.
+    int trisPerCube = 0;
+    while (next.size()) {
+      std::vector<unsigned int> loop;
+      unsigned int start = next.begin()->first;
+      unsigned int current = start;
+      do {
+        loop.push_back(current);
+        auto it = next.find(current);
+        if (it == next.end()) break;
+        current = it->second;
+        next.erase(it);
+      } while (current != start);
+
+      if (loop.size() < 3) continue;
+      if (loop.size() <= 4) {
+        for (size_t i = 1; i + 1 < loop.size(); i++) {
+          meshIndices.push_back(loop[0]);
+          meshIndices.push_back(loop[i]);
+          meshIndices.push_back(loop[i + 1]);
+          trisPerCube++;
+        }
+      } else {
+        glm::vec3 centre(0.0f);
+        for (unsigned int id : loop) {
+          centre += meshVertices[id];
+        }
+        unsigned int centreId = meshVertices.size();
+        meshVertices.push_back(centre / (float)loop.size());
+        for (size_t i = 0; i < loop.size(); i++) {
+          meshIndices.push_back(centreId);
+          meshIndices.push_back(loop[i]);
+          meshIndices.push_back(loop[(i + 1) % loop.size()]);
+          trisPerCube++;
+        }
+      }
+    }
+    sink.addCube(trisPerCube);
+  }
+
+  // Triangles are wound inwards, so the outward normal is against their cross product
+  std::vector<glm::vec3> meshNormals(meshVertices.size(), glm::vec3(0));
+  for (size_t t = 0; t + 2 < meshIndices.size(); t += 3) {
+    glm::vec3 a = meshVertices[meshIndices[t]];
+    glm::vec3 areaNormal = -glm::cross(meshVertices[meshIndices[t + 1]] - a, meshVertices[meshIndices[t + 2]] - a);
+    for (int i = 0; i < 3; i++) {
+      meshNormals[meshIndices[t + i]] += areaNormal;
+    }
+  }
+  for (auto& n : meshNormals) {
+    float length = glm::length(n);
+    n = length > 0.0f ? n / length : glm::vec3(0.0f, 1.0f, 0.0f);
+  }
+
+  // Only the points the tree sampled are shown
+  if (withPoints) {
+    pointMask.reset(glm::ivec3(size[0], size[1], size[2]), p.density);
+    pointMask.sampled.assign(pointMask.inside.size(), 0);
+    for (size_t i = 0; i < numPoints; i++) {
+      float value = samples[i];
+      if (std::isnan(value)) continue;
+      PointMask::set(pointMask.sampled, i);
+      if (value >= p.isoValue) PointMask::set(pointMask.inside, i);
+    }
+  }
+
+  if (meshVertices.size()) {
+    sink.addVertices(&meshVertices[0], &meshNormals[0], meshVertices.size());
+  }
+  if (meshIndices.size()) {
+    sink.addTriangles(&meshIndices[0], meshIndices.size());
+  }
+}
@@ -0,0 +1,145 @@
+#include "animationPlayer.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace std::chrono;
+
+AnimationPlayer::~AnimationPlayer() {
+  stop();
+}
+
+void AnimationPlayer::start(Params& p, FieldFunc func, float framesPerSecond, int numWorkers, int queueSize) {
+  stop();
+
+  params = p;
+  this->func = func;
+  this->framesPerSecond = std::max(framesPerSecond, 0.1f);
+  this->queueSize = std::max(queueSize, 1);
+  startTime = p.time;
+  ready.clear();
+  nextFrame = 0;
+  shownFrame = -1;
+  numShown = 0;
+  numDropped = 0;
+  numGenerated = 0;
+  clockStart = steady_clock::now();
+  running = true;
+
+  if (numWorkers <= 0) {
+    numWorkers = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+  }
+  for (int i = 0; i < numWorkers; i++) {
+    workers.push_back(std::thread(&AnimationPlayer::work, this));
+  }
+}
+
+void AnimationPlayer::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+  }
+  frameShown.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+  ready.clear();
+}
+
+int AnimationPlayer::dueFrame() {
+  double elapsed = duration<double>(steady_clock::now() - clockStart).count();
+  return (int)floor(elapsed * framesPerSecond);
+}
+
+void AnimationPlayer::work() {
+  while (true) {
+    int index;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      frameShown.wait(lock, [&]() {
+        return !running || nextFrame <= shownFrame + queueSize;
+      });
+      if (!running) return;
+
+      // Frames the clock has already passed would never be shown
+      int due = dueFrame();
+      if (nextFrame < due) {
+        numDropped += due - nextFrame;
+        nextFrame = due;
+      }
+      index = nextFrame++;
+    }
+
+    AnimationFrame frame;
+    frame.index = index;
+    frame.time = startTime + index / framesPerSecond;
+    Params frameParams = params;
+    frameParams.time = frame.time;
+
+    PointGrid pointGrid(frameParams);
+    if (func == getScene) {
+      pointGrid.generateScalarField(activeScene());
+    } else {
+      pointGrid.generateScalarField(func);
+    }
+    // Same path as a single render, decimation included
+    if (frameParams.numLayers > 1) {
+      pointGrid.generateLayerDrawData(getLayerIsoValues(frameParams));
+      frame.layers = pointGrid.getLayers();
+    } else {
+      pointGrid.generateDrawData();
+    }
+    frame.vertices.swap(pointGrid.getVertices());
+    frame.normals.swap(pointGrid.getNormals());
+    frame.indices.swap(pointGrid.getIndices());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running) return;
+    numGenerated++;
+    if (index <= shownFrame) {
+      numDropped++;
+    } else {
+      ready[index] = std::move(frame);
+    }
+  }
+}
+
+bool AnimationPlayer::takeFrame(AnimationFrame& frame) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running) return false;
+
+    auto newest = ready.upper_bound(dueFrame());
+    if (newest == ready.begin()) return false;
+    newest--;
+
+    // Older frames that are ready are passed over for the newest one
+    numDropped += std::distance(ready.begin(), newest);
+    frame = std::move(newest->second);
+    shownFrame = newest->first;
+    ready.erase(ready.begin(), ++newest);
+    numShown++;
+  }
+  frameShown.notify_all();
+  return true;
+}
+
+size_t AnimationPlayer::getNumShown() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return numShown;
+}
+
+size_t AnimationPlayer::getNumDropped() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return numDropped;
+}
+
+size_t AnimationPlayer::getNumGenerated() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return numGenerated;
+}
+
+size_t AnimationPlayer::getNumQueued() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return ready.size();
+}
@@ -0,0 +1,80 @@
+#ifndef ANIMATIONPLAYER
+#define ANIMATIONPLAYER
+
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <glm/glm.hpp>
+
+#include "params.h"
+#include "fields.h"
+#include "pointGrid.h"
+
+struct AnimationFrame {
+  int index = -1;
+  float time = 0.0f;
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec3> normals;
+  std::vector<unsigned int> indices;
+  std::vector<MeshLayer> layers;
+};
+
+/**
+  NOTE:
+  Plays a field forward in time. Worker threads each
+  generate and mesh a whole frame, so while one frame
+  is drawn the next ones are already being built, and
+  playback runs at the rate the workers finish frames
+  rather than at the latency of a single frame.
+
+  Workers stay at most queueSize frames ahead of the
+  frame on screen. When they fall behind the clock
+  they jump to the frame that is due, and the frames
+  skipped over (or finished too late to be shown) are
+  counted as dropped.
+*/
+class AnimationPlayer {
+  Params params;
+  FieldFunc func = nullptr;
+  float framesPerSecond = 30.0f;
+  float startTime = 0.0f;
+  int queueSize = 4;
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable frameShown;
+  std::map<int, AnimationFrame> ready;
+  std::chrono::steady_clock::time_point clockStart;
+  bool running = false;
+  int nextFrame = 0;
+  int shownFrame = -1;
+
+  size_t numShown = 0;
+  size_t numDropped = 0;
+  size_t numGenerated = 0;
+
+  int dueFrame();
+  void work();
+
+  public:
+    ~AnimationPlayer();
+
+    // Plays func from params.time on, numWorkers 0 to keep one core for drawing
+    void start(Params& p, FieldFunc func, float framesPerSecond, int numWorkers = 0, int queueSize = 4);
+    void stop();
+    bool isPlaying() { return running; }
+
+    // Hands over the newest frame that is due, if it is newer than the one shown
+    bool takeFrame(AnimationFrame& frame);
+
+    // The workers count frames as they go, so these take the lock
+    size_t getNumShown();
+    size_t getNumDropped();
+    size_t getNumGenerated();
+    size_t getNumQueued();
+};
+
+#endif
@@ -0,0 +1,177 @@
+#include "autoTuner.h"
+#include "pointGrid.h"
+#include "meshSink.h"
+#include "meshCache.h"
+#include <cmath>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+using namespace std::chrono;
+
+// Field chunks tried, in x-planes
+const int TUNING_CHUNKS[] = { SDF_BRICK, 2 * SDF_BRICK, 4 * SDF_BRICK };
+
+std::string TuningProfile::defaultPath() {
+  const char* xdg = getenv("XDG_CONFIG_HOME");
+  if (xdg && *xdg) return std::string(xdg) + "/marching-cubes/tuning.txt";
+  const char* home = getenv("HOME");
+  if (home && *home) return std::string(home) + "/.config/marching-cubes/tuning.txt";
+  return "./tuning.txt";
+}
+
+int TuningProfile::bucketFor(Params& p) {
+  double numPoints = (double)p.sizeX() * p.sizeY() * p.sizeZ();
+  return numPoints > 1 ? (int)round(log2(numPoints)) : 0;
+}
+
+bool TuningProfile::load(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) return false;
+
+  buckets.clear();
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream values(line);
+    int bucket;
+    TuningConfig config;
+    if (values >> bucket >> config.fieldThreads >> config.fieldChunk >> config.meshWorkers >> config.fieldMs >> config.meshMs) {
+      buckets[bucket] = config;
+    }
+  }
+  return true;
+}
+
+bool TuningProfile::save(const std::string& path) {
+  size_t slash = path.find_last_of('/');
+  if (slash != std::string::npos && slash > 0 && !makeDirectories(path.substr(0, slash))) return false;
+
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file) return false;
+  fprintf(file, "# marching-cubes tuning profile\n");
+  fprintf(file, "# log2(grid points), field threads, field chunk, mesh workers, field ms, mesh ms\n");
+  for (auto& bucket : buckets) {
+    TuningConfig& c = bucket.second;
+    fprintf(file, "%d %d %d %d %.3f %.3f\n", bucket.first, c.fieldThreads, c.fieldChunk, c.meshWorkers, c.fieldMs, c.meshMs);
+  }
+  return fclose(file) == 0;
+}
+
+bool TuningProfile::find(Params& p, TuningConfig& config) {
+  if (buckets.empty()) return false;
+
+  int bucket = bucketFor(p);
+  auto above = buckets.lower_bound(bucket);
+  if (above == buckets.end() || (above != buckets.begin() && bucket - std::prev(above)->first < above->first - bucket)) {
+    above--;
+  }
+  config = above->second;
+  return true;
+}
+
+bool TuningProfile::apply(Params& p) {
+  TuningConfig config;
+  if (!find(p, config)) return false;
+  p.fieldThreads = config.fieldThreads;
+  p.fieldChunk = config.fieldChunk;
+  p.meshWorkers = config.meshWorkers;
+  return true;
+}
+
+class NullSink : public MeshSink {
+  public:
+    void addVertices(const glm::vec3* v, const glm::vec3* n, size_t count) {}
+    void addTriangles(const unsigned int* i, size_t count) {}
+};
+
+static float median(std::vector<float>& times) {
+  std::sort(times.begin(), times.end());
+  return times[times.size() / 2];
+}
+
+TuningConfig calibrate(Params& p, FieldFunc func, int runs, bool allowWorkers, FILE* log) {
+  runs = std::max(runs, 1);
+  Params params = p;
+  PointGrid pointGrid(params);
+  auto generate = [&]() {
+    if (func == getScene) {
+      pointGrid.generateScalarField(activeScene());
+    } else {
+      pointGrid.generateScalarField(func);
+    }
+  };
+
+  int numCores = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<int> threadCounts;
+  for (int threads = 1; threads < numCores; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(numCores);
+
+  TuningConfig best;
+  best.fieldMs = INFINITY;
+  for (int threads : threadCounts) {
+    for (int chunk : TUNING_CHUNKS) {
+      // A single thread fills the grid in one go, and chunks past the grid are all the same
+      if (chunk > SDF_BRICK && (threads == 1 || chunk / 2 >= params.sizeX())) continue;
+
+      params.fieldThreads = threads;
+      params.fieldChunk = chunk;
+      std::vector<float> times;
+      for (int run = 0; run < runs; run++) {
+        auto start = high_resolution_clock::now();
+        generate();
+        times.push_back(duration<float, std::milli>(high_resolution_clock::now() - start).count());
+      }
+      float time = median(times);
+      if (log) fprintf(log, "  field: %2d threads, chunk %3d  %10.2f ms\n", threads, chunk, time);
+      if (time < best.fieldMs) {
+        best.fieldMs = time;
+        best.fieldThreads = threads;
+        best.fieldChunk = chunk;
+      }
+    }
+  }
+
+  params.fieldThreads = best.fieldThreads;
+  params.fieldChunk = best.fieldChunk;
+  generate();
+
+  // Only marching cubes can be sharded
+  std::vector<int> workerCounts = { 0 };
+  if (allowWorkers && params.mesher == MESHER_MARCHING_CUBES) {
+    for (int workers : threadCounts) {
+      if (workers > 1) workerCounts.push_back(workers);
+    }
+  }
+  best.meshMs = INFINITY;
+  for (int workers : workerCounts) {
+    std::vector<float> times;
+    for (int run = 0; run < runs; run++) {
+      NullSink sink;
+      auto start = high_resolution_clock::now();
+      if (workers == 0) {
+        pointGrid.generateDrawData(sink);
+      } else if (!pointGrid.generateShardedDrawData(sink, workers)) {
+        break;
+      }
+      times.push_back(duration<float, std::milli>(high_resolution_clock::now() - start).count());
+    }
+    if (times.empty()) continue;
+
+    float time = median(times);
+    if (log) {
+      if (workers == 0) fprintf(log, "  mesh:  in process            %10.2f ms\n", time);
+      else fprintf(log, "  mesh:  %2d workers            %10.2f ms\n", workers, time);
+    }
+    if (time < best.meshMs) {
+      best.meshMs = time;
+      best.meshWorkers = workers;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,62 @@
+#ifndef AUTOTUNER
+#define AUTOTUNER
+
+#include <cstdio>
+#include <string>
+#include <map>
+
+#include "params.h"
+#include "fields.h"
+
+// The fastest tuning Params found for a bucket of grid sizes, and their median times
+struct TuningConfig {
+  int fieldThreads = 1;
+  int fieldChunk = 16;
+  int meshWorkers = 0;
+  float fieldMs = 0.0f;
+  float meshMs = 0.0f;
+};
+
+/**
+  NOTE:
+  The best settings depend on the machine and on the
+  size of the grid, so a profile keeps one config per
+  bucket of grid sizes, each bucket a power of two
+  of the number of grid points. A grid uses the config
+  of the nearest bucket that was calibrated.
+
+  Profiles are small text files, one bucket a line,
+  kept under $XDG_CONFIG_HOME/marching-cubes (or
+  ~/.config/marching-cubes) by default.
+*/
+class TuningProfile {
+  std::map<int, TuningConfig> buckets;
+
+  public:
+    static std::string defaultPath();
+    static int bucketFor(Params& p);
+
+    bool load(const std::string& path);
+    bool save(const std::string& path);
+    bool empty() { return buckets.empty(); }
+
+    void set(int bucket, const TuningConfig& config) { buckets[bucket] = config; }
+    bool find(Params& p, TuningConfig& config);
+    // Sets the tuning Params from the nearest bucket, false if there is none
+    bool apply(Params& p);
+};
+
+/**
+  NOTE:
+  Times generating and meshing func with each field
+  thread count (1, 2, 4, ... up to the core count) and
+  chunk size, then with marching cubes in process and
+  sharded over as many worker processes, and returns
+  the fastest of each. Every setting is timed runs
+  times and compared by its median. Sharding is only
+  tried when allowWorkers is set, since forking is not
+  safe in a program that runs other threads.
+*/
+TuningConfig calibrate(Params& p, FieldFunc func, int runs, bool allowWorkers, FILE* log = nullptr);
+
+#endif
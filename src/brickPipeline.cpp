@@ -0,0 +1,203 @@
+#include "pointGrid.h"
+#include <map>
+#include <array>
+#include <algorithm>
+
+// Only marching cubes meshes a brick from the field around it alone, and islands need all of it
+bool PointGrid::pipelinesField() {
+  return (
+    p.pipelineBricks &&
+    p.mesher == MESHER_MARCHING_CUBES &&
+    p.minIslandPoints <= 0 &&
+    p.minIslandTriangles <= 0 &&
+    fieldFunc
+  );
+}
+
+/**
+  NOTE:
+  Rather than filling the whole field and then meshing
+  it, every run of MESH_BRICK x-planes is filled by a
+  task of its own, and each brick goes through a chain
+  of tasks as soon as the planes under it are there:
+
+    field     fills a run of x-planes
+    classify  checks whether the surface crosses the
+              brick at all, most bricks it does not
+    mesh      marches the brick with a border of one
+              cube, so its normals are final
+    stitch    welds the brick to the ones before it
+              and passes it on to the sink
+
+  A brick needs the runs on either side of its own for
+  its border, so brick k is meshed while the planes of
+  run k + 2 are still being filled, and its planes are
+  read again while they are still in cache.
+
+  Stitching runs in brick order, one brick after the
+  other. Vertices on a brick's faces come out of every
+  brick that shares them with the same position and
+  normal, so they are welded by matching the two, as
+  between shards.
+*/
+void PointGrid::generatePipelinedDrawData(MeshSink& sink) {
+  int sizeX = p.sizeX();
+  int sizeY = p.sizeY();
+  int sizeZ = p.sizeZ();
+  fieldStorage.assign((size_t)sizeX * sizeY * sizeZ, 0.0f);
+  scalarField = fieldStorage.data();
+  fieldOriginX = 0;
+  numSamples = fieldStorage.size();
+  if (sizeX < 2 || sizeY < 2 || sizeZ < 2) return;
+
+  TaskGraph graph;
+  int fieldStage = graph.addStage("field");
+  int classifyStage = graph.addStage("classify");
+  int meshStage = graph.addStage("mesh");
+  int stitchStage = graph.addStage("stitch");
+
+  int numRuns = (sizeX + MESH_BRICK - 1) / MESH_BRICK;
+  std::vector<int> fieldTasks;
+  for (int run = 0; run < numRuns; run++) {
+    int x0 = run * MESH_BRICK;
+    int x1 = std::min(x0 + MESH_BRICK, sizeX);
+    fieldTasks.push_back(graph.addTask(fieldStage, [this, x0, x1]() {
+      fillPlanes(x0, x1);
+    }));
+  }
+
+  glm::ivec3 numCubes(sizeX - 1, sizeY - 1, sizeZ - 1);
+  glm::ivec3 counts(
+    (numCubes.x + MESH_BRICK - 1) / MESH_BRICK,
+    (numCubes.y + MESH_BRICK - 1) / MESH_BRICK,
+    (numCubes.z + MESH_BRICK - 1) / MESH_BRICK
+  );
+  int numBricks = counts.x * counts.y * counts.z;
+  std::vector<MeshBrick> meshes(numBricks);
+  std::vector<char> crossed(numBricks, 0);
+  std::vector<glm::ivec3> brickMins(numBricks);
+  std::vector<glm::ivec3> brickMaxs(numBricks);
+  float isoValue = p.isoValue;
+
+  auto planeX = [&](int x) { return (x - sizeX/2)/p.density; };
+  auto planeY = [&](int y) { return y/p.density; };
+  auto planeZ = [&](int z) { return (z - sizeZ/2)/p.density; };
+  // Vertices on the faces of the bricks stitched so far, by position and normal
+  std::map<std::array<float, 6>, unsigned int> seam;
+  unsigned int numVertices = 0;
+  int seamX = -1;
+
+  auto stitch = [&](int i) {
+    MeshBrick& mesh = meshes[i];
+    glm::ivec3 lo = brickMins[i];
+    glm::ivec3 hi = brickMaxs[i];
+    // A new column of bricks only shares vertices with the last one through the plane between them
+    if (lo.x != seamX) {
+      float lowX = planeX(lo.x);
+      for (auto it = seam.begin(); it != seam.end();) {
+        it = it->first[0] == lowX ? std::next(it) : seam.erase(it);
+      }
+      seamX = lo.x;
+    }
+    float faces[3][2] = {
+      {planeX(lo.x), planeX(hi.x)},
+      {planeY(lo.y), planeY(hi.y)},
+      {planeZ(lo.z), planeZ(hi.z)}
+    };
+
+    std::vector<unsigned int> remap(mesh.vertices.size());
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    for (size_t v = 0; v < mesh.vertices.size(); v++) {
+      glm::vec3& position = mesh.vertices[v];
+      glm::vec3& normal = mesh.normals[v];
+      bool onFace = false;
+      for (int a = 0; a < 3; a++) {
+        onFace = onFace || position[a] == faces[a][0] || position[a] == faces[a][1];
+      }
+      if (onFace) {
+        std::array<float, 6> key = {{position.x, position.y, position.z, normal.x, normal.y, normal.z}};
+        auto welded = seam.insert({key, numVertices + (unsigned int)vertices.size()});
+        if (!welded.second) {
+          remap[v] = welded.first->second;
+          continue;
+        }
+      }
+      remap[v] = numVertices + vertices.size();
+      vertices.push_back(position);
+      normals.push_back(normal);
+    }
+    for (unsigned int& index : mesh.indices) {
+      index = remap[index];
+    }
+    if (vertices.size()) {
+      sink.addVertices(&vertices[0], &normals[0], vertices.size());
+    }
+    if (mesh.indices.size()) {
+      sink.addTriangles(&mesh.indices[0], mesh.indices.size());
+    }
+    numVertices += vertices.size();
+    mesh = MeshBrick();
+  };
+
+  int lastStitch = -1;
+  int i = 0;
+  for (int bx = 0; bx < counts.x; bx++) {
+    for (int by = 0; by < counts.y; by++) {
+      for (int bz = 0; bz < counts.z; bz++, i++) {
+        glm::ivec3 lo(bx * MESH_BRICK, by * MESH_BRICK, bz * MESH_BRICK);
+        glm::ivec3 hi(
+          std::min(lo.x + MESH_BRICK, numCubes.x),
+          std::min(lo.y + MESH_BRICK, numCubes.y),
+          std::min(lo.z + MESH_BRICK, numCubes.z)
+        );
+        brickMins[i] = lo;
+        brickMaxs[i] = hi;
+
+        int classify = graph.addTask(classifyStage, [this, i, lo, hi, isoValue, &crossed]() {
+          bool anyInside = false;
+          bool anyOutside = false;
+          for (int x = lo.x; x <= hi.x && !(anyInside && anyOutside); x++) {
+            for (int y = lo.y; y <= hi.y; y++) {
+              const float* row = scalarField + coordsToIndex(x, y, 0);
+              for (int z = lo.z; z <= hi.z; z++) {
+                bool inside = row[z] >= isoValue;
+                anyInside = anyInside || inside;
+                anyOutside = anyOutside || !inside;
+              }
+            }
+          }
+          crossed[i] = anyInside && anyOutside;
+        });
+        // The brick's own points, then its border
+        graph.addDependency(fieldTasks[lo.x / MESH_BRICK], classify);
+        graph.addDependency(fieldTasks[hi.x / MESH_BRICK], classify);
+
+        int mesh = graph.addTask(meshStage, [this, i, lo, hi, &crossed, &meshes]() {
+          if (crossed[i]) {
+            meshRegion(lo, hi, meshes[i]);
+          }
+        });
+        graph.addDependency(classify, mesh);
+        if (lo.x > 0) {
+          graph.addDependency(fieldTasks[(lo.x - 1) / MESH_BRICK], mesh);
+        }
+        int borderRun = std::min(hi.x + 1, sizeX - 1) / MESH_BRICK;
+        if (borderRun != hi.x / MESH_BRICK) {
+          graph.addDependency(fieldTasks[borderRun], mesh);
+        }
+
+        int stitched = graph.addTask(stitchStage, [i, &stitch]() {
+          stitch(i);
+        });
+        graph.addDependency(mesh, stitched);
+        if (lastStitch >= 0) {
+          graph.addDependency(lastStitch, stitched);
+        }
+        lastStitch = stitched;
+      }
+    }
+  }
+
+  graph.run(std::max(p.fieldThreads, 1), &pipelineReport);
+}
@@ -0,0 +1,415 @@
+#include "decimator.h"
+#include <array>
+#include <queue>
+#include <thread>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+
+// Plane quadric, the upper triangle of the symmetric 4x4 matrix
+struct Quadric {
+  double a[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+  void addPlane(glm::dvec3 n, double d) {
+    a[0] += n.x * n.x; a[1] += n.x * n.y; a[2] += n.x * n.z; a[3] += n.x * d;
+    a[4] += n.y * n.y; a[5] += n.y * n.z; a[6] += n.y * d;
+    a[7] += n.z * n.z; a[8] += n.z * d;
+    a[9] += d * d;
+  }
+  void add(const Quadric& q) {
+    for (int i = 0; i < 10; i++) a[i] += q.a[i];
+  }
+  double evaluate(glm::vec3 v) const {
+    double x = v.x, y = v.y, z = v.z;
+    return a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+      + a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+      + a[7]*z*z + 2*a[8]*z
+      + a[9];
+  }
+  // Position with the least error, if the system is well conditioned
+  bool optimum(glm::vec3& v) const {
+    double det =
+      a[0] * (a[4] * a[7] - a[5] * a[5]) -
+      a[1] * (a[1] * a[7] - a[5] * a[2]) +
+      a[2] * (a[1] * a[5] - a[4] * a[2]);
+    if (std::abs(det) < 1e-10) return false;
+
+    double bx = -a[3], by = -a[6], bz = -a[8];
+    v.x = (bx * (a[4] * a[7] - a[5] * a[5]) - a[1] * (by * a[7] - a[5] * bz) + a[2] * (by * a[5] - a[4] * bz)) / det;
+    v.y = (a[0] * (by * a[7] - a[5] * bz) - bx * (a[1] * a[7] - a[5] * a[2]) + a[2] * (a[1] * bz - by * a[2])) / det;
+    v.z = (a[0] * (a[4] * bz - by * a[5]) - a[1] * (a[1] * bz - by * a[2]) + bx * (a[1] * a[5] - a[4] * a[2])) / det;
+    return true;
+  }
+};
+
+struct Collapse {
+  double cost;
+  int u;
+  int v;
+  unsigned int stampU;
+  unsigned int stampV;
+  glm::vec3 target;
+
+  bool operator< (const Collapse& c) const {
+    // Reversed so the priority queue pops the cheapest collapse
+    return cost > c.cost;
+  }
+};
+
+// One x-region of the mesh, with its own local vertex numbering
+struct Region {
+  std::vector<unsigned int> globalIds;
+  std::vector<glm::vec3> positions;
+  std::vector<char> locked;
+  std::vector<char> removed;
+  std::vector<unsigned int> stamps;
+  std::vector<Quadric> quadrics;
+  std::vector<std::vector<int>> vertexFaces;
+  std::vector<std::array<int, 3>> faces;
+  std::vector<char> faceRemoved;
+  size_t aliveFaces = 0;
+  size_t targetFaces = 0;
+  double maxCost = 0.0;
+
+  void decimate();
+
+  private:
+    std::priority_queue<Collapse> heap;
+
+    void pushEdge(int u, int v);
+    bool canCollapse(int u, int v, glm::vec3 target);
+    void collapse(int u, int v, glm::vec3 target);
+};
+
+void Region::pushEdge(int u, int v) {
+  if (locked[u] && locked[v]) return;
+  // A locked vertex keeps its place, so always collapse onto it
+  if (locked[u]) std::swap(u, v);
+
+  Quadric q = quadrics[u];
+  q.add(quadrics[v]);
+
+  glm::vec3 target;
+  if (locked[v]) {
+    target = positions[v];
+  } else if (!q.optimum(target)) {
+    glm::vec3 mid = (positions[u] + positions[v]) / 2.0f;
+    target = mid;
+    if (q.evaluate(positions[u]) < q.evaluate(target)) target = positions[u];
+    if (q.evaluate(positions[v]) < q.evaluate(target)) target = positions[v];
+  }
+  double cost = std::max(0.0, q.evaluate(target));
+  heap.push({cost, u, v, stamps[u], stamps[v], target});
+}
+
+bool Region::canCollapse(int u, int v, glm::vec3 target) {
+  // Link condition: the only vertices adjacent to both are those of the shared faces
+  std::vector<int> neighboursU;
+  int sharedFaces = 0;
+  for (int f : vertexFaces[u]) {
+    if (faceRemoved[f]) continue;
+    bool hasV = false;
+    for (int c : faces[f]) {
+      if (c == v) hasV = true;
+      if (c != u) neighboursU.push_back(c);
+    }
+    sharedFaces += hasV;
+  }
+  if (sharedFaces == 0) return false;
+
+  std::sort(neighboursU.begin(), neighboursU.end());
+  neighboursU.erase(std::unique(neighboursU.begin(), neighboursU.end()), neighboursU.end());
+  std::vector<int> common;
+  for (int f : vertexFaces[v]) {
+    if (faceRemoved[f]) continue;
+    for (int c : faces[f]) {
+      if (c != v && c != u && std::binary_search(neighboursU.begin(), neighboursU.end(), c)) {
+        common.push_back(c);
+      }
+    }
+  }
+  std::sort(common.begin(), common.end());
+  common.erase(std::unique(common.begin(), common.end()), common.end());
+  if ((int)common.size() != sharedFaces) return false;
+
+  // Reject collapses that would fold a remaining face over
+  for (int w : {u, v}) {
+    for (int f : vertexFaces[w]) {
+      if (faceRemoved[f]) continue;
+      const std::array<int, 3>& face = faces[f];
+      if ((face[0] == u || face[1] == u || face[2] == u) && (face[0] == v || face[1] == v || face[2] == v)) continue;
+
+      glm::vec3 p[3];
+      glm::vec3 moved[3];
+      for (int i = 0; i < 3; i++) {
+        p[i] = positions[face[i]];
+        moved[i] = face[i] == u || face[i] == v ? target : p[i];
+      }
+      glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+      glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+      float lengths = glm::length(before) * glm::length(after);
+      if (lengths <= 0.0f || glm::dot(before, after) < 0.2f * lengths) return false;
+    }
+  }
+  return true;
+}
+
+void Region::collapse(int u, int v, glm::vec3 target) {
+  for (int f : vertexFaces[u]) {
+    if (faceRemoved[f]) continue;
+    std::array<int, 3>& face = faces[f];
+    if (face[0] == v || face[1] == v || face[2] == v) {
+      faceRemoved[f] = true;
+      aliveFaces--;
+      continue;
+    }
+    for (int& c : face) {
+      if (c == u) c = v;
+    }
+    vertexFaces[v].push_back(f);
+  }
+  vertexFaces[u].clear();
+  removed[u] = true;
+  stamps[u]++;
+
+  std::vector<int>& facesV = vertexFaces[v];
+  facesV.erase(std::remove_if(facesV.begin(), facesV.end(), [&](int f) { return faceRemoved[f]; }), facesV.end());
+  positions[v] = target;
+  quadrics[v].add(quadrics[u]);
+  stamps[v]++;
+
+  std::vector<int> neighbours;
+  for (int f : facesV) {
+    for (int c : faces[f]) {
+      if (c != v) neighbours.push_back(c);
+    }
+  }
+  std::sort(neighbours.begin(), neighbours.end());
+  neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+  for (int w : neighbours) {
+    pushEdge(v, w);
+  }
+}
+
+void Region::decimate() {
+  size_t numVertices = positions.size();
+  quadrics.assign(numVertices, Quadric());
+  stamps.assign(numVertices, 0);
+  removed.assign(numVertices, false);
+  faceRemoved.assign(faces.size(), false);
+  aliveFaces = faces.size();
+
+  for (auto& face : faces) {
+    glm::dvec3 a = glm::dvec3(positions[face[0]]);
+    glm::dvec3 n = glm::cross(glm::dvec3(positions[face[1]]) - a, glm::dvec3(positions[face[2]]) - a);
+    double length = glm::length(n);
+    if (length <= 0.0) continue;
+    n /= length;
+    double d = -glm::dot(n, a);
+    for (int c : face) {
+      quadrics[c].addPlane(n, d);
+    }
+  }
+
+  for (auto& face : faces) {
+    for (int i = 0; i < 3; i++) {
+      int u = face[i];
+      int v = face[(i + 1) % 3];
+      if (u < v) pushEdge(u, v);
+    }
+  }
+
+  while (aliveFaces > targetFaces && !heap.empty()) {
+    Collapse c = heap.top();
+    heap.pop();
+    if (removed[c.u] || removed[c.v] || c.stampU != stamps[c.u] || c.stampV != stamps[c.v]) continue;
+    if (maxCost > 0.0 && c.cost > maxCost) break;
+    if (!canCollapse(c.u, c.v, c.target)) continue;
+    collapse(c.u, c.v, c.target);
+  }
+}
+
+struct PositionKey {
+  uint32_t bits[3];
+  bool operator== (const PositionKey& k) const {
+    return bits[0] == k.bits[0] && bits[1] == k.bits[1] && bits[2] == k.bits[2];
+  }
+};
+
+struct PositionHash {
+  size_t operator() (const PositionKey& k) const {
+    return (size_t)k.bits[0] * 73856093u ^ (size_t)k.bits[1] * 19349663u ^ (size_t)k.bits[2] * 83492791u;
+  }
+};
+
+void DecimateOptions::fromParams(Params& p) {
+  targetTriangles = p.triangleBudget;
+  maxError = p.decimateError;
+}
+
+size_t decimateMesh(
+  std::vector<glm::vec3>& vertices,
+  std::vector<glm::vec3>& normals,
+  std::vector<unsigned int>& indices,
+  const DecimateOptions& options
+) {
+  // Weld vertices that share a position
+  std::unordered_map<PositionKey, unsigned int, PositionHash> welded;
+  std::vector<unsigned int> remap(vertices.size());
+  std::vector<glm::vec3> positions;
+  for (size_t i = 0; i < vertices.size(); i++) {
+    PositionKey key;
+    memcpy(key.bits, &vertices[i], sizeof(key.bits));
+    auto it = welded.find(key);
+    if (it == welded.end()) {
+      it = welded.insert({key, (unsigned int)positions.size()}).first;
+      positions.push_back(vertices[i]);
+    }
+    remap[i] = it->second;
+  }
+
+  std::vector<std::array<unsigned int, 3>> faces;
+  for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+    std::array<unsigned int, 3> face = {remap[indices[t]], remap[indices[t + 1]], remap[indices[t + 2]]};
+    if (face[0] == face[1] || face[1] == face[2] || face[0] == face[2]) continue;
+    faces.push_back(face);
+  }
+  if (faces.empty()) return 0;
+
+  // Cut the mesh into x-regions by face centroid
+  int numRegions = options.numThreads > 0 ? options.numThreads : std::max(1u, std::thread::hardware_concurrency());
+  numRegions = std::max(1, std::min(numRegions, (int)(faces.size() / 4096)));
+  float minX = positions[0].x;
+  float maxX = positions[0].x;
+  for (auto& v : positions) {
+    minX = std::min(minX, v.x);
+    maxX = std::max(maxX, v.x);
+  }
+  float regionWidth = (maxX - minX) / numRegions + 1e-6f;
+
+  const int SHARED = -2;
+  std::vector<int> faceRegion(faces.size());
+  std::vector<int> vertexRegion(positions.size(), -1);
+  for (size_t f = 0; f < faces.size(); f++) {
+    float centroidX = (positions[faces[f][0]].x + positions[faces[f][1]].x + positions[faces[f][2]].x) / 3.0f;
+    int r = std::min(numRegions - 1, (int)((centroidX - minX) / regionWidth));
+    faceRegion[f] = r;
+    for (unsigned int c : faces[f]) {
+      if (vertexRegion[c] == -1) vertexRegion[c] = r;
+      else if (vertexRegion[c] != r) vertexRegion[c] = SHARED;
+    }
+  }
+
+  // Vertices on an open border are locked along with the shared ones
+  std::unordered_map<uint64_t, int> edgeUses;
+  for (auto& face : faces) {
+    for (int i = 0; i < 3; i++) {
+      uint64_t a = std::min(face[i], face[(i + 1) % 3]);
+      uint64_t b = std::max(face[i], face[(i + 1) % 3]);
+      edgeUses[a << 32 | b]++;
+    }
+  }
+  std::vector<char> locked(positions.size(), false);
+  for (auto& edge : edgeUses) {
+    if (edge.second != 2) {
+      locked[edge.first >> 32] = true;
+      locked[edge.first & 0xffffffff] = true;
+    }
+  }
+  for (size_t v = 0; v < positions.size(); v++) {
+    if (vertexRegion[v] == SHARED) locked[v] = true;
+  }
+
+  std::vector<Region> regions(numRegions);
+  std::vector<int> localIds(positions.size(), -1);
+  for (int r = 0; r < numRegions; r++) {
+    Region& region = regions[r];
+    for (size_t f = 0; f < faces.size(); f++) {
+      if (faceRegion[f] != r) continue;
+      std::array<int, 3> face;
+      for (int i = 0; i < 3; i++) {
+        unsigned int g = faces[f][i];
+        if (localIds[g] < 0) {
+          localIds[g] = region.positions.size();
+          region.globalIds.push_back(g);
+          region.positions.push_back(positions[g]);
+          region.locked.push_back(locked[g]);
+          region.vertexFaces.push_back({});
+        }
+        face[i] = localIds[g];
+        region.vertexFaces[face[i]].push_back(region.faces.size());
+      }
+      region.faces.push_back(face);
+    }
+    for (unsigned int g : region.globalIds) {
+      localIds[g] = -1;
+    }
+
+    region.targetFaces = options.targetTriangles > 0
+      ? (size_t)std::ceil((double)options.targetTriangles * region.faces.size() / faces.size())
+      : 0;
+    region.maxCost = (double)options.maxError * options.maxError;
+  }
+
+  std::vector<std::thread> threads;
+  for (int r = 1; r < numRegions; r++) {
+    threads.push_back(std::thread(&Region::decimate, &regions[r]));
+  }
+  regions[0].decimate();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // Gather the surviving faces, numbering vertices in order of first use
+  vertices.clear();
+  indices.clear();
+  std::vector<int> newIds(positions.size(), -1);
+  for (Region& region : regions) {
+    for (size_t f = 0; f < region.faces.size(); f++) {
+      if (region.faceRemoved[f]) continue;
+      for (int c : region.faces[f]) {
+        unsigned int g = region.globalIds[c];
+        if (newIds[g] < 0) {
+          newIds[g] = vertices.size();
+          vertices.push_back(region.positions[c]);
+        }
+        indices.push_back(newIds[g]);
+      }
+    }
+  }
+
+  // Triangles are wound inwards, so the outward normal is against their cross product
+  normals.assign(vertices.size(), glm::vec3(0));
+  for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+    glm::vec3 a = vertices[indices[t]];
+    glm::vec3 areaNormal = -glm::cross(vertices[indices[t + 1]] - a, vertices[indices[t + 2]] - a);
+    for (int i = 0; i < 3; i++) {
+      normals[indices[t + i]] += areaNormal;
+    }
+  }
+  for (auto& n : normals) {
+    float length = glm::length(n);
+    if (length > 0.0f) n /= length;
+  }
+  return indices.size() / 3;
+}
+
+void DecimatingSink::addVertices(const glm::vec3* v, const glm::vec3* n, size_t count) {
+  vertices.insert(vertices.end(), v, v + count);
+  normals.insert(normals.end(), n, n + count);
+}
+
+void DecimatingSink::addTriangles(const unsigned int* i, size_t count) {
+  indices.insert(indices.end(), i, i + count);
+}
+
+void DecimatingSink::finish() {
+  decimateMesh(vertices, normals, indices, options);
+  if (vertices.size()) {
+    sink.addVertices(&vertices[0], &normals[0], vertices.size());
+  }
+  if (indices.size()) {
+    sink.addTriangles(&indices[0], indices.size());
+  }
+}
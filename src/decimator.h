@@ -0,0 +1,59 @@
+#ifndef DECIMATOR
+#define DECIMATOR
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "params.h"
+#include "meshSink.h"
+
+struct DecimateOptions {
+  // Stop once the mesh has this many triangles, 0 for no budget
+  size_t targetTriangles = 0;
+  // Never make a collapse that moves the surface further than this, 0 for no limit
+  float maxError = 0.0f;
+  // Number of x-regions decimated in parallel, 0 to use every core
+  int numThreads = 0;
+
+  void fromParams(Params& p);
+};
+
+/**
+  NOTE:
+  Collapses edges in order of quadric error until the
+  triangle budget or the error tolerance is reached.
+  The mesh is welded by position first, since the
+  marching cubes mesher splits vertices whose normals
+  differ, and the normals are recomputed at the end.
+
+  The mesh is cut into x-regions that are decimated on
+  their own threads. Vertices shared between regions
+  and vertices on an open border are never moved, so
+  region seams and chunk edges stay watertight.
+
+  Returns the number of triangles left.
+*/
+size_t decimateMesh(
+  std::vector<glm::vec3>& vertices,
+  std::vector<glm::vec3>& normals,
+  std::vector<unsigned int>& indices,
+  const DecimateOptions& options
+);
+
+// Buffers a streamed mesh, then decimates it and passes it on when finished
+class DecimatingSink : public MeshSink {
+  MeshSink& sink;
+  DecimateOptions options;
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec3> normals;
+  std::vector<unsigned int> indices;
+
+  public:
+    DecimatingSink(MeshSink& sink, const DecimateOptions& options): sink(sink), options(options) {}
+
+    void addVertices(const glm::vec3* v, const glm::vec3* n, size_t count);
+    void addTriangles(const unsigned int* i, size_t count);
+    void finish();
+};
+
+#endif
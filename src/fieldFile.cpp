@@ -0,0 +1,411 @@
+#include "fieldFile.h"
+#include <cstring>
+#include <algorithm>
+
+const char FIELD_MAGIC[4] = { 'M', 'C', 'S', 'F' };
+const uint32_t FIELD_VERSION = 1;
+const size_t BRICK_ENTRY_BYTES = 8 + 4 + 1 + 4 + 4;
+
+void FieldHeader::fromParams(Params& p) {
+  sizeX = p.sizeX();
+  sizeY = p.sizeY();
+  sizeZ = p.sizeZ();
+  density = p.density;
+  numUnitsX = p.numUnitsX;
+  numUnitsY = p.numUnitsY;
+  numUnitsZ = p.numUnitsZ;
+  isoValue = p.isoValue;
+  interpolate = p.interpolate;
+  radius = p.radius;
+  xOffset = p.xOffset;
+  yOffset = p.yOffset;
+  zOffset = p.zOffset;
+  configIndex = p.configIndex;
+}
+
+void FieldHeader::toParams(Params& p) {
+  p.density = density;
+  p.numUnitsX = numUnitsX;
+  p.numUnitsY = numUnitsY;
+  p.numUnitsZ = numUnitsZ;
+  p.isoValue = isoValue;
+  p.interpolate = interpolate;
+  p.radius = radius;
+  p.xOffset = xOffset;
+  p.yOffset = yOffset;
+  p.zOffset = zOffset;
+  p.configIndex = configIndex;
+}
+
+// Values are stored in the machine's byte order, which is little endian on all our targets
+template <typename T>
+static void put(std::vector<unsigned char>& out, T value) {
+  const unsigned char* bytes = (const unsigned char*)&value;
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+static bool get(const unsigned char*& in, const unsigned char* end, T& value) {
+  if (in + sizeof(T) > end) return false;
+  memcpy(&value, in, sizeof(T));
+  in += sizeof(T);
+  return true;
+}
+
+/**
+  NOTE:
+  PackBits run length coding. A header byte h in
+  [0, 127] is followed by h + 1 literal bytes, one in
+  [-127, -1] by a single byte repeated 1 - h times.
+  Delta coded byte planes of smooth fields are mostly
+  runs of 0x00 and 0xff, which this handles well.
+*/
+static void packBits(const unsigned char* in, size_t n, std::vector<unsigned char>& out) {
+  size_t i = 0;
+  while (i < n) {
+    size_t run = 1;
+    while (i + run < n && run < 128 && in[i + run] == in[i]) run++;
+
+    if (run >= 2) {
+      out.push_back((unsigned char)(257 - run));
+      out.push_back(in[i]);
+      i += run;
+      continue;
+    }
+
+    size_t start = i;
+    size_t len = 0;
+    while (i < n && len < 128) {
+      if (i + 2 < n && in[i] == in[i + 1] && in[i] == in[i + 2]) break;
+      i++;
+      len++;
+    }
+    out.push_back((unsigned char)(len - 1));
+    out.insert(out.end(), in + start, in + start + len);
+  }
+}
+
+static bool unpackBits(const unsigned char* in, size_t size, unsigned char* out, size_t n) {
+  const unsigned char* end = in + size;
+  size_t o = 0;
+  while (in < end && o < n) {
+    int h = (signed char)*in++;
+    if (h >= 0) {
+      size_t len = h + 1;
+      if (in + len > end || o + len > n) return false;
+      memcpy(out + o, in, len);
+      in += len;
+      o += len;
+    } else if (h != -128) {
+      size_t len = 1 - h;
+      if (in >= end || o + len > n) return false;
+      memset(out + o, *in++, len);
+      o += len;
+    }
+  }
+  return o == n;
+}
+
+// Delta codes 16 or 32 bit words and splits them into byte planes
+template <typename T>
+static void encodeWords(const std::vector<T>& words, std::vector<unsigned char>& out) {
+  size_t n = words.size();
+  std::vector<unsigned char> planes(n * sizeof(T));
+  T last = 0;
+  for (size_t i = 0; i < n; i++) {
+    T delta = words[i] - last;
+    last = words[i];
+    for (size_t b = 0; b < sizeof(T); b++) {
+      planes[b * n + i] = (delta >> (8 * b)) & 0xff;
+    }
+  }
+  packBits(planes.data(), planes.size(), out);
+}
+
+template <typename T>
+static bool decodeWords(const unsigned char* in, size_t size, std::vector<T>& words) {
+  size_t n = words.size();
+  std::vector<unsigned char> planes(n * sizeof(T));
+  if (!unpackBits(in, size, planes.data(), planes.size())) return false;
+
+  T last = 0;
+  for (size_t i = 0; i < n; i++) {
+    T delta = 0;
+    for (size_t b = 0; b < sizeof(T); b++) {
+      delta |= (T)planes[b * n + i] << (8 * b);
+    }
+    last += delta;
+    words[i] = last;
+  }
+  return true;
+}
+
+static void encodeBrick(const std::vector<float>& values, float min, float max, bool lossless, BrickEntry& entry, std::vector<unsigned char>& out) {
+  entry.min = min;
+  entry.max = max;
+  if (min == max) {
+    entry.encoding = BRICK_UNIFORM;
+    return;
+  }
+
+  if (lossless) {
+    entry.encoding = BRICK_RAW;
+    std::vector<uint32_t> bits(values.size());
+    memcpy(bits.data(), values.data(), values.size() * sizeof(float));
+    encodeWords(bits, out);
+    return;
+  }
+
+  entry.encoding = BRICK_QUANTISED;
+  std::vector<uint16_t> steps(values.size());
+  float scale = 65535.0f / (max - min);
+  for (size_t i = 0; i < values.size(); i++) {
+    steps[i] = (uint16_t)std::min(65535.0f, (values[i] - min) * scale + 0.5f);
+  }
+  encodeWords(steps, out);
+}
+
+static bool decodeBrick(const unsigned char* in, size_t size, BrickEntry& entry, std::vector<float>& values) {
+  switch (entry.encoding) {
+    case BRICK_UNIFORM:
+      std::fill(values.begin(), values.end(), entry.min);
+      return true;
+    case BRICK_RAW: {
+      std::vector<uint32_t> bits(values.size());
+      if (!decodeWords(in, size, bits)) return false;
+      memcpy(values.data(), bits.data(), values.size() * sizeof(float));
+      return true;
+    }
+    case BRICK_QUANTISED: {
+      std::vector<uint16_t> steps(values.size());
+      if (!decodeWords(in, size, steps)) return false;
+      float scale = (entry.max - entry.min) / 65535.0f;
+      for (size_t i = 0; i < values.size(); i++) {
+        // Keep the end points exact so 0/1 fields survive
+        values[i] = steps[i] == 65535 ? entry.max : entry.min + steps[i] * scale;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+static int bricksAlong(int size) {
+  return (size + BRICK_SIZE - 1) / BRICK_SIZE;
+}
+
+bool writeFieldFile(const std::string& path, const float* field, FieldHeader& header, bool lossless) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) return false;
+
+  int bricksX = bricksAlong(header.sizeX);
+  int bricksY = bricksAlong(header.sizeY);
+  int bricksZ = bricksAlong(header.sizeZ);
+  size_t numBricks = (size_t)bricksX * bricksY * bricksZ;
+  size_t total = (size_t)header.sizeX * header.sizeY * header.sizeZ;
+
+  header.brickSize = BRICK_SIZE;
+  header.min = total ? *std::min_element(field, field + total) : 0.0f;
+  header.max = total ? *std::max_element(field, field + total) : 0.0f;
+
+  std::vector<unsigned char> head;
+  head.insert(head.end(), FIELD_MAGIC, FIELD_MAGIC + 4);
+  put<uint32_t>(head, FIELD_VERSION);
+  put<int32_t>(head, header.sizeX);
+  put<int32_t>(head, header.sizeY);
+  put<int32_t>(head, header.sizeZ);
+  put<int32_t>(head, header.brickSize);
+  put<float>(head, header.min);
+  put<float>(head, header.max);
+  put<float>(head, header.density);
+  put<int32_t>(head, header.numUnitsX);
+  put<int32_t>(head, header.numUnitsY);
+  put<int32_t>(head, header.numUnitsZ);
+  put<float>(head, header.isoValue);
+  put<uint8_t>(head, header.interpolate);
+  put<float>(head, header.radius);
+  put<float>(head, header.xOffset);
+  put<float>(head, header.yOffset);
+  put<float>(head, header.zOffset);
+  put<int32_t>(head, header.configIndex);
+  put<uint32_t>(head, header.fieldName.size());
+  head.insert(head.end(), header.fieldName.begin(), header.fieldName.end());
+  put<uint32_t>(head, numBricks);
+
+  // The index is written once the brick offsets are known
+  uint64_t offset = head.size() + numBricks * BRICK_ENTRY_BYTES;
+  fwrite(head.data(), 1, head.size(), file);
+  fseeko(file, offset, SEEK_SET);
+
+  std::vector<unsigned char> index;
+  std::vector<float> values;
+  std::vector<unsigned char> payload;
+  for (int bx = 0; bx < bricksX; bx++) {
+    for (int by = 0; by < bricksY; by++) {
+      for (int bz = 0; bz < bricksZ; bz++) {
+        int x0 = bx * BRICK_SIZE, x1 = std::min(x0 + BRICK_SIZE, header.sizeX);
+        int y0 = by * BRICK_SIZE, y1 = std::min(y0 + BRICK_SIZE, header.sizeY);
+        int z0 = bz * BRICK_SIZE, z1 = std::min(z0 + BRICK_SIZE, header.sizeZ);
+
+        values.clear();
+        for (int x = x0; x < x1; x++) {
+          for (int y = y0; y < y1; y++) {
+            const float* row = field + z0 + (size_t)header.sizeZ * (y + (size_t)header.sizeY * x);
+            values.insert(values.end(), row, row + (z1 - z0));
+          }
+        }
+        auto range = std::minmax_element(values.begin(), values.end());
+
+        BrickEntry entry;
+        payload.clear();
+        encodeBrick(values, *range.first, *range.second, lossless, entry, payload);
+        entry.offset = offset;
+        entry.size = payload.size();
+        fwrite(payload.data(), 1, payload.size(), file);
+        offset += payload.size();
+
+        put<uint64_t>(index, entry.offset);
+        put<uint32_t>(index, entry.size);
+        put<uint8_t>(index, entry.encoding);
+        put<float>(index, entry.min);
+        put<float>(index, entry.max);
+      }
+    }
+  }
+
+  fseeko(file, head.size(), SEEK_SET);
+  fwrite(index.data(), 1, index.size(), file);
+  bool ok = !ferror(file);
+  return fclose(file) == 0 && ok;
+}
+
+FieldFile::~FieldFile() {
+  close();
+}
+
+void FieldFile::close() {
+  if (file) {
+    fclose(file);
+    file = nullptr;
+  }
+}
+
+bool FieldFile::open(const std::string& path) {
+  close();
+  file = fopen(path.c_str(), "rb");
+  if (!file) return false;
+
+  // Everything up to the name has a fixed size
+  unsigned char fixed[4 + 4 * 12 + 1 + 4 * 6];
+  if (fread(fixed, 1, sizeof(fixed), file) != sizeof(fixed) || memcmp(fixed, FIELD_MAGIC, 4) != 0) {
+    close();
+    return false;
+  }
+
+  const unsigned char* in = fixed + 4;
+  const unsigned char* end = fixed + sizeof(fixed);
+  uint32_t version, nameLength;
+  uint8_t interpolate;
+  get(in, end, version);
+  get(in, end, header.sizeX);
+  get(in, end, header.sizeY);
+  get(in, end, header.sizeZ);
+  get(in, end, header.brickSize);
+  get(in, end, header.min);
+  get(in, end, header.max);
+  get(in, end, header.density);
+  get(in, end, header.numUnitsX);
+  get(in, end, header.numUnitsY);
+  get(in, end, header.numUnitsZ);
+  get(in, end, header.isoValue);
+  get(in, end, interpolate);
+  get(in, end, header.radius);
+  get(in, end, header.xOffset);
+  get(in, end, header.yOffset);
+  get(in, end, header.zOffset);
+  get(in, end, header.configIndex);
+  get(in, end, nameLength);
+  header.interpolate = interpolate;
+
+  if (version != FIELD_VERSION || header.brickSize != BRICK_SIZE || nameLength > 4096) {
+    close();
+    return false;
+  }
+
+  std::vector<char> name(nameLength);
+  uint32_t numBricks;
+  if (fread(name.data(), 1, nameLength, file) != nameLength || fread(&numBricks, sizeof(numBricks), 1, file) != 1) {
+    close();
+    return false;
+  }
+  header.fieldName.assign(name.begin(), name.end());
+
+  bricksX = bricksAlong(header.sizeX);
+  bricksY = bricksAlong(header.sizeY);
+  bricksZ = bricksAlong(header.sizeZ);
+  if (numBricks != (size_t)bricksX * bricksY * bricksZ) {
+    close();
+    return false;
+  }
+
+  std::vector<unsigned char> index(numBricks * BRICK_ENTRY_BYTES);
+  if (fread(index.data(), 1, index.size(), file) != index.size()) {
+    close();
+    return false;
+  }
+  bricks.resize(numBricks);
+  in = index.data();
+  end = index.data() + index.size();
+  for (auto& entry : bricks) {
+    get(in, end, entry.offset);
+    get(in, end, entry.size);
+    get(in, end, entry.encoding);
+    get(in, end, entry.min);
+    get(in, end, entry.max);
+  }
+  return true;
+}
+
+bool FieldFile::read(int x0, int y0, int z0, int x1, int y1, int z1, float* field) {
+  if (!file) return false;
+  x0 = std::max(x0, 0);
+  y0 = std::max(y0, 0);
+  z0 = std::max(z0, 0);
+  x1 = std::min(x1, header.sizeX);
+  y1 = std::min(y1, header.sizeY);
+  z1 = std::min(z1, header.sizeZ);
+
+  std::vector<unsigned char> payload;
+  std::vector<float> values;
+  for (int bx = x0 / BRICK_SIZE; bx < bricksAlong(x1); bx++) {
+    for (int by = y0 / BRICK_SIZE; by < bricksAlong(y1); by++) {
+      for (int bz = z0 / BRICK_SIZE; bz < bricksAlong(z1); bz++) {
+        BrickEntry& entry = bricks[bz + bricksZ * (by + bricksY * bx)];
+        int bx0 = bx * BRICK_SIZE, bx1 = std::min(bx0 + BRICK_SIZE, header.sizeX);
+        int by0 = by * BRICK_SIZE, by1 = std::min(by0 + BRICK_SIZE, header.sizeY);
+        int bz0 = bz * BRICK_SIZE, bz1 = std::min(bz0 + BRICK_SIZE, header.sizeZ);
+
+        payload.resize(entry.size);
+        if (entry.size && (fseeko(file, entry.offset, SEEK_SET) != 0 || fread(payload.data(), 1, entry.size, file) != entry.size)) {
+          return false;
+        }
+        values.resize((size_t)(bx1 - bx0) * (by1 - by0) * (bz1 - bz0));
+        if (!decodeBrick(payload.data(), payload.size(), entry, values)) {
+          return false;
+        }
+
+        // Copy the part of the brick inside the region
+        for (int x = std::max(x0, bx0); x < std::min(x1, bx1); x++) {
+          for (int y = std::max(y0, by0); y < std::min(y1, by1); y++) {
+            int zStart = std::max(z0, bz0);
+            int zEnd = std::min(z1, bz1);
+            const float* src = &values[(zStart - bz0) + (bz1 - bz0) * ((y - by0) + (size_t)(by1 - by0) * (x - bx0))];
+            float* dst = field + zStart + (size_t)header.sizeZ * (y + (size_t)header.sizeY * x);
+            std::copy(src, src + (zEnd - zStart), dst);
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,90 @@
+#ifndef FIELDFILE
+#define FIELDFILE
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "params.h"
+
+/**
+  NOTE:
+  Scalar fields are stored as bricks of BRICK_SIZE^3
+  points, each compressed on its own and listed in an
+  index so any region can be read without touching the
+  rest of the file. A brick is either
+    - uniform: every value equal, nothing is stored
+    - quantised: 16 bit steps between the brick's min
+      and max, which is exact for 0/1 fields
+    - raw: the float bits, for lossless files
+  Quantised and raw bricks are delta coded along z,
+  split into byte planes and run length encoded.
+
+  The header records the Params the field was generated
+  with, so loading it restores the grid it belongs to.
+*/
+const int BRICK_SIZE = 16;
+
+enum BrickEncoding {
+  BRICK_UNIFORM = 0,
+  BRICK_QUANTISED = 1,
+  BRICK_RAW = 2
+};
+
+struct FieldHeader {
+  int sizeX = 0;
+  int sizeY = 0;
+  int sizeZ = 0;
+  int brickSize = BRICK_SIZE;
+  float min = 0.0f;
+  float max = 0.0f;
+  std::string fieldName;
+
+  // Generating Params
+  float density = 1.0f;
+  int numUnitsX = 0;
+  int numUnitsY = 0;
+  int numUnitsZ = 0;
+  float isoValue = 0.5f;
+  bool interpolate = false;
+  float radius = 0.0f;
+  float xOffset = 0.0f;
+  float yOffset = 0.0f;
+  float zOffset = 0.0f;
+  int configIndex = 0;
+
+  void fromParams(Params& p);
+  void toParams(Params& p);
+};
+
+struct BrickEntry {
+  uint64_t offset;
+  uint32_t size;
+  uint8_t encoding;
+  float min;
+  float max;
+};
+
+// Writes a full field, laid out in PointGrid::coordsToIndex order
+bool writeFieldFile(const std::string& path, const float* field, FieldHeader& header, bool lossless);
+
+class FieldFile {
+  FILE* file = nullptr;
+  FieldHeader header;
+  std::vector<BrickEntry> bricks;
+  int bricksX = 0;
+  int bricksY = 0;
+  int bricksZ = 0;
+
+  public:
+    ~FieldFile();
+    bool open(const std::string& path);
+    void close();
+    FieldHeader& getHeader() { return header; }
+
+    // Decodes the bricks overlapping [x0, x1) x [y0, y1) x [z0, z1) into a full size field
+    bool read(int x0, int y0, int z0, int x1, int y1, int z1, float* field);
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "fieldHistory.h"
+#include <algorithm>
+
+void FieldHistory::reset(int sizeX, int sizeY, int sizeZ) {
+  size = glm::ivec3(sizeX, sizeY, sizeZ);
+  brickCounts = glm::ivec3(
+    (sizeX + HISTORY_BRICK - 1) / HISTORY_BRICK,
+    (sizeY + HISTORY_BRICK - 1) / HISTORY_BRICK,
+    (sizeZ + HISTORY_BRICK - 1) / HISTORY_BRICK
+  );
+  saved.assign(brickCounts.x * brickCounts.y * brickCounts.z, nullptr);
+  touched.clear();
+  snapshots.clear();
+  position = 0;
+  memoryUsed = 0;
+}
+
+void FieldHistory::brickBounds(int brick, glm::ivec3& lo, glm::ivec3& hi) {
+  int bz = brick % brickCounts.z;
+  int by = (brick / brickCounts.z) % brickCounts.y;
+  int bx = brick / (brickCounts.z * brickCounts.y);
+  lo = glm::ivec3(bx, by, bz) * HISTORY_BRICK;
+  hi = glm::ivec3(
+    std::min(lo.x + HISTORY_BRICK, size.x) - 1,
+    std::min(lo.y + HISTORY_BRICK, size.y) - 1,
+    std::min(lo.z + HISTORY_BRICK, size.z) - 1
+  );
+}
+
+FieldHistory::BrickRef FieldHistory::copyBrick(const float* field, int brick) {
+  glm::ivec3 lo, hi;
+  brickBounds(brick, lo, hi);
+  auto data = std::make_shared<std::vector<float>>();
+  data->reserve((size_t)(hi.x - lo.x + 1) * (hi.y - lo.y + 1) * (hi.z - lo.z + 1));
+  for (int x = lo.x; x <= hi.x; x++) {
+    for (int y = lo.y; y <= hi.y; y++) {
+      const float* row = field + (size_t)size.z * (y + (size_t)size.y * x);
+      data->insert(data->end(), row + lo.z, row + hi.z + 1);
+    }
+  }
+  return data;
+}
+
+void FieldHistory::writeBrick(float* field, int brick, const std::vector<float>& data) {
+  glm::ivec3 lo, hi;
+  brickBounds(brick, lo, hi);
+  const float* next = data.data();
+  int rowLength = hi.z - lo.z + 1;
+  for (int x = lo.x; x <= hi.x; x++) {
+    for (int y = lo.y; y <= hi.y; y++) {
+      float* row = field + (size_t)size.z * (y + (size_t)size.y * x);
+      std::copy(next, next + rowLength, row + lo.z);
+      next += rowLength;
+    }
+  }
+}
+
+// Copies can be shared by several snapshots, so each is only counted once
+void FieldHistory::updateMemoryUsed() {
+  std::set<const std::vector<float>*> copies;
+  for (auto& brick : saved) {
+    if (brick) copies.insert(brick.get());
+  }
+  for (auto& snapshot : snapshots) {
+    for (auto& change : snapshot.changes) {
+      copies.insert(change.before.get());
+      copies.insert(change.after.get());
+    }
+  }
+  memoryUsed = 0;
+  for (auto copy : copies) {
+    memoryUsed += copy->size() * sizeof(float);
+  }
+}
+
+void FieldHistory::touch(const float* field, glm::ivec3 lo, glm::ivec3 hi) {
+  if (saved.empty()) return;
+  if (touched.empty()) {
+    touchedMin = lo;
+    touchedMax = hi;
+  } else {
+    touchedMin = glm::ivec3(std::min(touchedMin.x, lo.x), std::min(touchedMin.y, lo.y), std::min(touchedMin.z, lo.z));
+    touchedMax = glm::ivec3(std::max(touchedMax.x, hi.x), std::max(touchedMax.y, hi.y), std::max(touchedMax.z, hi.z));
+  }
+
+  glm::ivec3 brickMin, brickMax;
+  for (int a = 0; a < 3; a++) {
+    brickMin[a] = std::max(lo[a], 0) / HISTORY_BRICK;
+    brickMax[a] = std::min(hi[a], size[a] - 1) / HISTORY_BRICK;
+  }
+
+  for (int bx = brickMin.x; bx <= brickMax.x; bx++) {
+    for (int by = brickMin.y; by <= brickMax.y; by++) {
+      for (int bz = brickMin.z; bz <= brickMax.z; bz++) {
+        int brick = bz + brickCounts.z * (by + brickCounts.y * bx);
+        if (touched.count(brick)) continue;
+        // Untouched bricks still match their saved copy, so only never edited ones are copied
+        if (!saved[brick]) {
+          saved[brick] = copyBrick(field, brick);
+        }
+        touched.insert(brick);
+      }
+    }
+  }
+}
+
+bool FieldHistory::commit(const float* field) {
+  if (touched.empty()) return false;
+
+  Snapshot snapshot;
+  for (int brick : touched) {
+    Change change;
+    change.brick = brick;
+    change.before = saved[brick];
+    change.after = copyBrick(field, brick);
+    saved[brick] = change.after;
+    snapshot.changes.push_back(change);
+  }
+  snapshot.editMin = touchedMin;
+  snapshot.editMax = touchedMax;
+  touched.clear();
+
+  // A new stroke replaces whatever could have been redone
+  snapshots.resize(position);
+  snapshots.push_back(snapshot);
+  position++;
+  if (snapshots.size() > maxSnapshots) {
+    snapshots.erase(snapshots.begin());
+    position--;
+  }
+  updateMemoryUsed();
+  return true;
+}
+
+/**
+  NOTE:
+  Snapshots are restored brick by brick, but only the
+  points the stroke edited can differ, so only they
+  are reported as changed and need remeshing.
+*/
+void FieldHistory::restore(float* field, bool after, glm::ivec3& changedMin, glm::ivec3& changedMax) {
+  Snapshot& snapshot = snapshots[position];
+  for (auto& change : snapshot.changes) {
+    BrickRef& data = after ? change.after : change.before;
+    writeBrick(field, change.brick, *data);
+    saved[change.brick] = data;
+  }
+  changedMin = snapshot.editMin;
+  changedMax = snapshot.editMax;
+}
+
+bool FieldHistory::undo(float* field, glm::ivec3& changedMin, glm::ivec3& changedMax) {
+  commit(field);
+  if (position == 0) return false;
+  position--;
+  restore(field, false, changedMin, changedMax);
+  return true;
+}
+
+bool FieldHistory::redo(float* field, glm::ivec3& changedMin, glm::ivec3& changedMax) {
+  if (!canRedo()) return false;
+  restore(field, true, changedMin, changedMax);
+  position++;
+  return true;
+}
@@ -0,0 +1,78 @@
+#ifndef FIELDHISTORY
+#define FIELDHISTORY
+
+#include <vector>
+#include <memory>
+#include <set>
+#include <glm/glm.hpp>
+
+// Bricks of HISTORY_BRICK^3 grid points are the unit of copying
+const int HISTORY_BRICK = 16;
+
+/**
+  NOTE:
+  Undo history for edits to a dense field. The field
+  itself stays the working copy, while the history
+  keeps reference counted copies of the bricks that
+  edits touched. A brick is copied once before its
+  first edit and once after each stroke that changes
+  it, and snapshots share the copies, so a snapshot
+  only costs the bricks its stroke touched.
+*/
+class FieldHistory {
+  typedef std::shared_ptr<const std::vector<float>> BrickRef;
+
+  // One brick changed by a stroke, as it was before and after
+  struct Change {
+    int brick;
+    BrickRef before;
+    BrickRef after;
+  };
+  // A stroke, with the grid points it edited
+  struct Snapshot {
+    std::vector<Change> changes;
+    glm::ivec3 editMin;
+    glm::ivec3 editMax;
+  };
+
+  glm::ivec3 size;
+  glm::ivec3 brickCounts;
+  // The copy matching each brick of the field, empty until the brick is first edited
+  std::vector<BrickRef> saved;
+  std::set<int> touched;
+  glm::ivec3 touchedMin;
+  glm::ivec3 touchedMax;
+  std::vector<Snapshot> snapshots;
+  size_t position = 0;
+  size_t memoryUsed = 0;
+
+  BrickRef copyBrick(const float* field, int brick);
+  void writeBrick(float* field, int brick, const std::vector<float>& data);
+  void brickBounds(int brick, glm::ivec3& lo, glm::ivec3& hi);
+  void restore(float* field, bool after, glm::ivec3& changedMin, glm::ivec3& changedMax);
+  void updateMemoryUsed();
+
+  public:
+    // Oldest snapshots are dropped beyond this many
+    size_t maxSnapshots = 64;
+
+    void reset(int sizeX, int sizeY, int sizeZ);
+
+    // Call before changing the grid points in [lo, hi] of a field laid out like PointGrid's
+    void touch(const float* field, glm::ivec3 lo, glm::ivec3 hi);
+    // Ends a stroke, returns false if nothing was touched since the last one
+    bool commit(const float* field);
+
+    // Restore the field, giving the grid points that changed
+    bool undo(float* field, glm::ivec3& changedMin, glm::ivec3& changedMax);
+    bool redo(float* field, glm::ivec3& changedMin, glm::ivec3& changedMax);
+
+    bool canUndo() { return position > 0 || !touched.empty(); }
+    bool canRedo() { return position < snapshots.size() && touched.empty(); }
+    size_t getDepth() { return position; }
+    size_t getNumSnapshots() { return snapshots.size(); }
+    // Bytes held by brick copies
+    size_t getMemoryUsed() { return memoryUsed; }
+};
+
+#endif
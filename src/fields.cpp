@@ -0,0 +1,235 @@
+#include <cmath>
+#include <algorithm>
+
+#include "fields.h"
+#include "../external/FastNoise.hpp"
+
+/**
+  NOTE:
+  Each built-in field is a functor that reads its
+  Params once when it is made. The FieldFunc versions
+  build one per call, while fillBuiltInField builds
+  one per grid so the loop can inline the field.
+*/
+struct SphereField {
+  int centreY;
+  float radius;
+
+  // The sphere breathes over time
+  SphereField(Params& p): centreY(p.sizeY()/2), radius(p.radius * (1 + 0.25f * sinf(p.time))) {}
+  float operator()(int x, int y, int z) const {
+    return 2 - sqrt(x * x + (y - centreY) * (y - centreY) + z * z) / radius;
+  }
+};
+
+// Distance in noise space between the slices Perlin time moves through
+const float PERLIN_TIME_SPACING = 97.0f;
+
+/**
+  NOTE:
+  FastNoiseLite has no 4D noise, so time moves through
+  a series of 3D slices set far apart along z, blending
+  each into the next over one unit of time. At whole
+  times only one slice is sampled.
+*/
+struct PerlinField {
+  FastNoiseLite noise;
+  float density;
+  float xOffset;
+  float yOffset;
+  float zOffset;
+  int numUnitsY;
+  float sliceOffset;
+  float nextSliceWeight;
+
+  PerlinField(Params& p):
+    density(p.density), xOffset(p.xOffset), yOffset(p.yOffset), zOffset(p.zOffset), numUnitsY(p.numUnitsY) {
+    noise.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
+    noise.SetFractalType(FastNoiseLite::FractalType_DomainWarpIndependent);
+    noise.SetFrequency(0.05);
+    noise.SetFractalOctaves(3);
+
+    float slice = floorf(p.time);
+    float blend = p.time - slice;
+    sliceOffset = slice * PERLIN_TIME_SPACING;
+    nextSliceWeight = blend * blend * (3 - 2 * blend);
+  }
+  float operator()(int x, int y, int z) const {
+    float sampleZ = z/density + zOffset + sliceOffset;
+    double n = noise.GetNoise(x/density + xOffset, y/density + yOffset, sampleZ);
+    if (nextSliceWeight > 0) {
+      double next = noise.GetNoise(x/density + xOffset, y/density + yOffset, sampleZ + PERLIN_TIME_SPACING);
+      n += (next - n) * nextSliceWeight;
+    }
+    double val = (n + 1.0)/2.0;
+
+    return y == 0 ? 1 : -y / float(numUnitsY) + val;
+  }
+};
+
+struct PrismField {
+  int halfX;
+  int sizeY;
+  int halfZ;
+
+  PrismField(Params& p): halfX(p.sizeX()/2), sizeY(p.sizeY()), halfZ(p.sizeZ()/2) {}
+  float operator()(int x, int y, int z) const {
+    // Make a prism
+    if ((x > -halfX + 1 && x < halfX - 1) && (y > 1 && y < sizeY - 1) && (z > -halfZ + 1 && z < halfZ - 1)) {
+      return 1;
+    }
+
+    return 0;
+  }
+};
+
+float getSphere(int x, int y, int z, Params& p) {
+  return SphereField(p)(x, y, z);
+}
+
+float getPerlin(int x, int y, int z, Params& p) {
+  return PerlinField(p)(x, y, z);
+}
+
+float getPrism(int x, int y, int z, Params& p) {
+  return PrismField(p)(x, y, z);
+}
+
+float getCubeConfigs(int x, int y, int z, Params& p) {
+  switch(p.configIndex) {
+    case 0:
+      return 0;
+    case 1:
+      if (x == -1 && y == 0 && z == 0) return 1;
+      break;
+    case 2:
+      if (z == 0 && y == 0) return 1;
+      break;
+    case 3:
+      if ((x == -1 && y == 0 && z == 0) || (x == 0 && y == 1 && z == 0)) return 1;
+      break;
+    case 4:
+      if ((x == -1 && y == 0 && z == 0) || (x == 0 && y == 1 && z == -1)) return 1;
+      break;
+    case 5:
+      if (y == 0 && (z == -1 || x == 0)) return 1;
+      break;
+    case 6:
+      if ((z == 0 && y == 0) || (z == -1 && y == 1 && x == 0)) return 1;
+      break;
+    case 7:
+      if ((x == -1 && y == 1 && z == 0) || (x == 0 && y == 0 && z == 0) || (x == 0 && y == 1 && z == -1)) return 1;
+      break;
+    case 8:
+      if (y == 0) return 1;
+      break;
+    case 9:
+      if ((y == 0 && (x == -1 || z == -1)) || (y == 1 && x == -1 && z == -1)) return 1;
+      break;
+    case 10:
+      if (x != z) return 1;
+      break;
+    case 11:
+      if ((y == 0 && (z == -1 || x == -1)) || (y == 1 && x == 0 && z == -1)) return 1;
+      break;
+    case 12:
+      if ((y == 0 && (z == -1 || x == 0)) || (y == 1 && z == 0 && x == -1)) return 1;
+      break;
+    case 13:
+      if ((y == 0 && x != z) || (y == 1 && x == z)) return 1;
+      break;
+    case 14:
+      if ((y == 0 && (z == -1 || x == 0)) || (y == 1 && x == -1 && z == -1)) return 1;
+      break;
+  }
+
+  return 0;
+}
+
+SdfProgram& activeScene() {
+  static SdfProgram scene;
+  return scene;
+}
+
+bool loadScene(const std::string& path, std::string& error) {
+  SdfProgram scene;
+  if (!scene.load(path, error)) return false;
+  activeScene() = scene;
+  return true;
+}
+
+// Point by point fallback; dense grids are filled a brick at a time by SdfProgram::evaluateGrid
+float getScene(int x, int y, int z, Params& p) {
+  return activeScene().evaluate(x, y, z, p);
+}
+
+// Wraps a FieldFunc that only needs its Params, as the cube configs do
+template <FieldFunc func>
+struct FuncField {
+  Params& p;
+
+  FuncField(Params& p): p(p) {}
+  float operator()(int x, int y, int z) const {
+    return func(x, y, z, p);
+  }
+};
+
+template <typename Field>
+void fillGrid(float* field, Params& p, int x0, int x1) {
+  Field func(p);
+  int sizeX = p.sizeX();
+  int sizeY = p.sizeY();
+  int sizeZ = p.sizeZ();
+  size_t i = (size_t)x0 * sizeY * sizeZ;
+  for (int x = x0; x < std::min(sizeX, x1); x++) {
+    for (int y = 0; y < sizeY; y++) {
+      for (int z = 0; z < sizeZ; z++) {
+        field[i++] = func(x - sizeX / 2, y, z - sizeZ / 2);
+      }
+    }
+  }
+}
+
+bool fillBuiltInField(FieldFunc func, float* field, Params& p, int x0, int x1) {
+  if (func == getSphere) {
+    fillGrid<SphereField>(field, p, x0, x1);
+  } else if (func == getPerlin) {
+    fillGrid<PerlinField>(field, p, x0, x1);
+  } else if (func == getPrism) {
+    fillGrid<PrismField>(field, p, x0, x1);
+  } else if (func == getCubeConfigs) {
+    fillGrid<FuncField<getCubeConfigs>>(field, p, x0, x1);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+float templateFunc(int x, int y, int z, Params& p) {
+  if ((y == 0 && (z == -1 || x == -1)) || (y == 1 && x == -1 && z == -1)) return 1;
+
+  return 0;
+}
+
+const Field fields[] = {
+  { "sphere", "Sphere", getSphere },
+  { "perlin", "Perlin Noise", getPerlin },
+  { "prism", "Prism", getPrism },
+  { "configs", "Cube Configs", getCubeConfigs },
+  { "scene", "Scene", getScene },
+};
+const int numFields = sizeof(fields) / sizeof(fields[0]);
+
+FieldFunc getFieldByName(const std::string& name) {
+  for (int i = 0; i < numFields; i++) {
+    if (name == fields[i].name) return fields[i].func;
+  }
+  return nullptr;
+}
+
+const char* getFieldName(FieldFunc func) {
+  for (int i = 0; i < numFields; i++) {
+    if (func == fields[i].func) return fields[i].name;
+  }
+  return "unknown";
+}
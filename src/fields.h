@@ -0,0 +1,40 @@
+#ifndef FIELDS
+#define FIELDS
+
+#include <string>
+#include <climits>
+
+#include "params.h"
+#include "sdfGraph.h"
+
+typedef float (*FieldFunc)(int, int, int, Params&);
+
+float getSphere(int x, int y, int z, Params& p);
+float getPerlin(int x, int y, int z, Params& p);
+float getPrism(int x, int y, int z, Params& p);
+float getCubeConfigs(int x, int y, int z, Params& p);
+float getScene(int x, int y, int z, Params& p);
+float templateFunc(int x, int y, int z, Params& p);
+
+// Fills the x-planes [x0, x1) of a grid laid out in PointGrid::coordsToIndex order,
+// false if func is not built in
+bool fillBuiltInField(FieldFunc func, float* field, Params& p, int x0 = 0, int x1 = INT_MAX);
+
+// The scene getScene evaluates, loaded from a text file
+SdfProgram& activeScene();
+bool loadScene(const std::string& path, std::string& error);
+
+// Built-in fields, addressable by name from the command line
+struct Field {
+  const char* name;
+  const char* label;
+  FieldFunc func;
+};
+
+extern const Field fields[];
+extern const int numFields;
+
+FieldFunc getFieldByName(const std::string& name);
+const char* getFieldName(FieldFunc func);
+
+#endif
@@ -0,0 +1,170 @@
+#include "pointGrid.h"
+#include <cstdio>
+#include <cmath>
+#include <climits>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+using namespace std::chrono;
+
+const unsigned int OUTSIDE = UINT_MAX;
+
+// Path halving. Parents always have smaller indices than their children.
+static unsigned int findRoot(std::vector<unsigned int>& labels, unsigned int i) {
+  while (labels[i] != i) {
+    labels[i] = labels[labels[i]];
+    i = labels[i];
+  }
+  return i;
+}
+
+// The smaller root is kept, so each island's root is its first point
+static void unite(std::vector<unsigned int>& labels, unsigned int a, unsigned int b) {
+  a = findRoot(labels, a);
+  b = findRoot(labels, b);
+  if (a < b) {
+    labels[b] = a;
+  } else if (b < a) {
+    labels[a] = b;
+  }
+}
+
+/**
+  NOTE:
+  Union-find over the inside grid points. The grid is
+  cut into runs of x-planes that are joined up on
+  their own threads, which only ever touch labels in
+  their own run, and the planes where the runs meet
+  are joined afterwards.
+
+  Since a point's parent always comes before it, one
+  pass in index order then turns the parents into
+  island numbers: the parent has been numbered by the
+  time its children are reached.
+*/
+void PointGrid::findIslands(std::vector<unsigned int>& labels, std::vector<Island>& islands, int numThreads) {
+  labels.clear();
+  islands.clear();
+  if (!scalarField || fieldOriginX != 0) return;
+
+  int sizeX = p.sizeX();
+  int sizeY = p.sizeY();
+  int sizeZ = p.sizeZ();
+  size_t planeSize = (size_t)sizeY * sizeZ;
+  labels.resize(planeSize * sizeX);
+  float isoValue = p.isoValue;
+
+  auto joinPlanes = [&](int x0, int x1) {
+    for (int x = x0; x < x1; x++) {
+      for (int y = 0; y < sizeY; y++) {
+        for (int z = 0; z < sizeZ; z++) {
+          unsigned int i = coordsToIndex(x, y, z);
+          if (scalarField[i] < isoValue) {
+            labels[i] = OUTSIDE;
+            continue;
+          }
+          labels[i] = i;
+          if (z > 0 && labels[i - 1] != OUTSIDE) unite(labels, i, i - 1);
+          if (y > 0 && labels[i - sizeZ] != OUTSIDE) unite(labels, i, i - sizeZ);
+          if (x > x0 && labels[i - planeSize] != OUTSIDE) unite(labels, i, i - planeSize);
+        }
+      }
+    }
+  };
+
+  if (numThreads <= 0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  numThreads = std::max(1, std::min(numThreads, sizeX / 8));
+  int perThread = (sizeX + numThreads - 1) / numThreads;
+  std::vector<std::thread> threads;
+  for (int x0 = 0; x0 < sizeX; x0 += perThread) {
+    threads.push_back(std::thread(joinPlanes, x0, std::min(sizeX, x0 + perThread)));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (int x0 = perThread; x0 < sizeX; x0 += perThread) {
+    for (unsigned int i = coordsToIndex(x0, 0, 0); i < coordsToIndex(x0 + 1, 0, 0); i++) {
+      if (labels[i] != OUTSIDE && labels[i - planeSize] != OUTSIDE) unite(labels, i, i - planeSize);
+    }
+  }
+
+  for (int x = 0; x < sizeX; x++) {
+    for (int y = 0; y < sizeY; y++) {
+      for (int z = 0; z < sizeZ; z++) {
+        unsigned int i = coordsToIndex(x, y, z);
+        if (labels[i] == OUTSIDE) continue;
+        if (labels[i] == i) {
+          labels[i] = islands.size();
+          islands.push_back(Island());
+        } else {
+          labels[i] = labels[labels[i]];
+        }
+
+        // Neighbours further on are still parents or OUTSIDE, which is all that is checked
+        Island& island = islands[labels[i]];
+        island.numPoints++;
+        island.numCrossings +=
+          (x > 0 && labels[i - planeSize] == OUTSIDE) + (x < sizeX - 1 && labels[i + planeSize] == OUTSIDE) +
+          (y > 0 && labels[i - sizeZ] == OUTSIDE) + (y < sizeY - 1 && labels[i + sizeZ] == OUTSIDE) +
+          (z > 0 && labels[i - 1] == OUTSIDE) + (z < sizeZ - 1 && labels[i + 1] == OUTSIDE);
+      }
+    }
+  }
+}
+
+/**
+  NOTE:
+  Removing an island lowers its points to the lowest
+  value in the field, so they read as empty space.
+  Every grid edge out of an island ends outside it, so
+  nothing is left for a mesher to place on them, and
+  the fragments cost no triangles at all rather than
+  being meshed and thrown away.
+*/
+void PointGrid::removeSmallIslands() {
+  islandReport = IslandReport();
+  if (p.minIslandPoints <= 0 && p.minIslandTriangles <= 0) return;
+  auto start = high_resolution_clock::now();
+
+  std::vector<unsigned int> labels;
+  std::vector<Island> islands;
+  findIslands(labels, islands);
+
+  std::vector<bool> removed(islands.size(), false);
+  for (size_t k = 0; k < islands.size(); k++) {
+    Island& island = islands[k];
+    removed[k] = island.numPoints < (size_t)std::max(p.minIslandPoints, 0) ||
+      island.estimatedTriangles() < (size_t)std::max(p.minIslandTriangles, 0);
+
+    islandReport.largestPoints = std::max(islandReport.largestPoints, island.numPoints);
+    size_t bucket = 0;
+    for (size_t limit = 10; island.numPoints >= limit; limit *= 10) {
+      bucket++;
+    }
+    if (islandReport.sizeHistogram.size() <= bucket) {
+      islandReport.sizeHistogram.resize(bucket + 1, 0);
+    }
+    islandReport.sizeHistogram[bucket]++;
+    if (removed[k]) {
+      islandReport.numRemoved++;
+      islandReport.pointsRemoved += island.numPoints;
+    }
+  }
+  islandReport.numIslands = islands.size();
+
+  if (islandReport.numRemoved) {
+    float empty = *std::min_element(scalarField, scalarField + labels.size());
+    // A field that is inside everywhere is all one island, which may still be too small
+    if (empty >= p.isoValue) {
+      empty = std::nextafter(p.isoValue, -INFINITY);
+    }
+    for (size_t i = 0; i < labels.size(); i++) {
+      if (labels[i] != OUTSIDE && removed[labels[i]]) {
+        scalarField[i] = empty;
+      }
+    }
+  }
+  islandReport.milliseconds = duration<float, std::milli>(high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,268 @@
+#include "meshCache.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char CACHE_MAGIC[4] = { 'M', 'C', 'M', 'C' };
+// Bump whenever the mesher output changes, so stale entries are never hit
+const uint32_t CACHE_VERSION = 2;
+
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint64_t numVertices;
+  uint64_t numIndices;
+  uint64_t numCubes;
+};
+
+CachedMesh::~CachedMesh() {
+  unmap();
+}
+
+void CachedMesh::unmap() {
+  if (mapping) {
+    munmap(mapping, mappingSize);
+    mapping = nullptr;
+  }
+  vertices = nullptr;
+  normals = nullptr;
+  indices = nullptr;
+  numTrisPerCube = nullptr;
+  numVertices = numIndices = numCubes = 0;
+}
+
+bool CachedMesh::map(const std::string& path) {
+  unmap();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+    close(fd);
+    return false;
+  }
+  mappingSize = st.st_size;
+  void* addr = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return false;
+  mapping = addr;
+
+  const CacheHeader* header = (const CacheHeader*)mapping;
+  size_t expected = sizeof(CacheHeader)
+    + header->numVertices * 2 * sizeof(glm::vec3)
+    + header->numIndices * sizeof(unsigned int)
+    + header->numCubes * sizeof(int);
+  if (memcmp(header->magic, CACHE_MAGIC, 4) != 0 || header->version != CACHE_VERSION || expected != mappingSize) {
+    unmap();
+    return false;
+  }
+
+  const unsigned char* data = (const unsigned char*)mapping + sizeof(CacheHeader);
+  numVertices = header->numVertices;
+  numIndices = header->numIndices;
+  numCubes = header->numCubes;
+  vertices = (const glm::vec3*)data;
+  normals = vertices + numVertices;
+  indices = (const unsigned int*)(normals + numVertices);
+  numTrisPerCube = (const int*)(indices + numIndices);
+  return true;
+}
+
+static void hashBytes(uint64_t& hash, const void* data, size_t size) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+}
+
+template <typename T>
+static void hashValue(uint64_t& hash, T value) {
+  hashBytes(hash, &value, sizeof(value));
+}
+
+bool makeDirectories(const std::string& path) {
+  for (size_t i = 1; i <= path.size(); i++) {
+    if (i == path.size() || path[i] == '/') {
+      std::string part = path.substr(0, i);
+      if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    }
+  }
+  return true;
+}
+
+MeshCache::MeshCache(const std::string& directory, size_t maxBytes): directory(directory), maxBytes(maxBytes) {}
+
+std::string MeshCache::defaultDirectory() {
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  if (xdg && *xdg) return std::string(xdg) + "/marching-cubes";
+  const char* home = getenv("HOME");
+  if (home && *home) return std::string(home) + "/.cache/marching-cubes";
+  return "./mesh_cache";
+}
+
+/**
+  NOTE:
+  Only the Params that change the mesh of the given
+  field are hashed. Rendering settings such as
+  showMesh or the camera position are left out, and
+  so are the parameters of the other fields.
+*/
+uint64_t MeshCache::hashParams(const std::string& fieldName, Params& p) {
+  uint64_t hash = 14695981039346656037ULL;
+  hashBytes(hash, fieldName.data(), fieldName.size());
+  hashValue(hash, CACHE_VERSION);
+
+  hashValue(hash, p.density);
+  hashValue(hash, p.numUnitsX);
+  hashValue(hash, p.numUnitsY);
+  hashValue(hash, p.numUnitsZ);
+  hashValue(hash, p.isoValue);
+  hashValue(hash, (uint8_t)p.interpolate);
+  hashValue(hash, p.mesher);
+  if (p.mesher == MESHER_ADAPTIVE_CUBES) {
+    hashValue(hash, p.adaptiveError);
+  }
+  hashValue(hash, (uint8_t)p.decimate);
+  if (p.decimate) {
+    hashValue(hash, p.triangleBudget);
+    hashValue(hash, p.decimateError);
+  }
+  // Left out when off, so meshes cached before the option stay valid
+  if (p.optimizeIndices && !p.showMarch) {
+    hashValue(hash, (uint8_t)1);
+  }
+  // Show March needs the triangles per cube, which pipelined and decimated meshes are cached without
+  if (p.showMarch) {
+    hashValue(hash, (uint8_t)2);
+  }
+  // Adaptive meshing samples the field lazily, so islands are never removed there
+  if ((p.minIslandPoints > 0 || p.minIslandTriangles > 0) && p.mesher != MESHER_ADAPTIVE_CUBES) {
+    hashValue(hash, p.minIslandPoints);
+    hashValue(hash, p.minIslandTriangles);
+  }
+
+  // Scene names carry the hash of their source, which is all that matters
+  bool isScene = fieldName.compare(0, 6, "scene:") == 0;
+  bool known = isScene || fieldName == "sphere" || fieldName == "perlin" || fieldName == "prism" || fieldName == "configs";
+  if (fieldName == "sphere" || !known) {
+    hashValue(hash, p.radius);
+  }
+  if (fieldName == "perlin" || !known) {
+    hashValue(hash, p.xOffset);
+    hashValue(hash, p.yOffset);
+    hashValue(hash, p.zOffset);
+  }
+  if (fieldName == "configs" || !known) {
+    hashValue(hash, p.configIndex);
+  }
+  // Only animated fields depend on time, and leaving out time 0 keeps older entries valid
+  bool animated = isScene || fieldName == "sphere" || fieldName == "perlin" || !known;
+  if (animated && p.time != 0.0f) {
+    hashValue(hash, p.time);
+  }
+  return hash;
+}
+
+std::string MeshCache::entryPath(uint64_t key) {
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.mesh", (unsigned long long)key);
+  return directory + name;
+}
+
+bool MeshCache::load(uint64_t key, CachedMesh& mesh) {
+  std::string path = entryPath(key);
+  if (!mesh.map(path)) return false;
+
+  // Mark as recently used
+  utime(path.c_str(), nullptr);
+  return true;
+}
+
+bool MeshCache::store(
+  uint64_t key,
+  std::vector<glm::vec3>& vertices,
+  std::vector<glm::vec3>& normals,
+  std::vector<unsigned int>& indices,
+  std::vector<int>& numTrisPerCube
+) {
+  if (!makeDirectories(directory)) return false;
+
+  // Write to a temporary name first, so a crash never leaves a truncated entry
+  std::string path = entryPath(key);
+  std::string tmpPath = path + ".tmp";
+  FILE* file = fopen(tmpPath.c_str(), "wb");
+  if (!file) return false;
+
+  CacheHeader header;
+  memcpy(header.magic, CACHE_MAGIC, 4);
+  header.version = CACHE_VERSION;
+  header.key = key;
+  header.numVertices = vertices.size();
+  header.numIndices = indices.size();
+  header.numCubes = numTrisPerCube.size();
+
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(vertices.data(), sizeof(glm::vec3), vertices.size(), file);
+  fwrite(normals.data(), sizeof(glm::vec3), normals.size(), file);
+  fwrite(indices.data(), sizeof(unsigned int), indices.size(), file);
+  fwrite(numTrisPerCube.data(), sizeof(int), numTrisPerCube.size(), file);
+  bool ok = !ferror(file);
+  ok = fclose(file) == 0 && ok;
+
+  if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    unlink(tmpPath.c_str());
+    return false;
+  }
+  evict();
+  return true;
+}
+
+void MeshCache::evict() {
+  DIR* dir = opendir(directory.c_str());
+  if (!dir) return;
+
+  struct Entry {
+    std::string path;
+    double modified;
+    size_t size;
+  };
+  std::vector<Entry> entries;
+  size_t total = 0;
+
+  struct dirent* ent;
+  while ((ent = readdir(dir)) != nullptr) {
+    std::string name = ent->d_name;
+    if (name.size() < 5 || name.compare(name.size() - 5, 5, ".mesh") != 0) continue;
+
+    std::string path = directory + "/" + name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) continue;
+#ifdef __APPLE__
+    double modified = st.st_mtimespec.tv_sec + st.st_mtimespec.tv_nsec * 1e-9;
+#else
+    double modified = st.st_mtim.tv_sec + st.st_mtim.tv_nsec * 1e-9;
+#endif
+    entries.push_back({ path, modified, (size_t)st.st_size });
+    total += st.st_size;
+  }
+  closedir(dir);
+
+  std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+    return a.modified < b.modified;
+  });
+  for (size_t i = 0; i < entries.size() && total > maxBytes; i++) {
+    if (unlink(entries[i].path.c_str()) == 0) {
+      total -= entries[i].size;
+    }
+  }
+}
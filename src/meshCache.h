@@ -0,0 +1,75 @@
+#ifndef MESHCACHE
+#define MESHCACHE
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "params.h"
+
+// Creates path and any missing parents
+bool makeDirectories(const std::string& path);
+
+// A cache entry mapped straight from disk, ready to be handed to glBufferData
+class CachedMesh {
+  void* mapping = nullptr;
+  size_t mappingSize = 0;
+
+  public:
+    const glm::vec3* vertices = nullptr;
+    const glm::vec3* normals = nullptr;
+    const unsigned int* indices = nullptr;
+    const int* numTrisPerCube = nullptr;
+    size_t numVertices = 0;
+    size_t numIndices = 0;
+    size_t numCubes = 0;
+
+    CachedMesh() {}
+    CachedMesh(const CachedMesh&) = delete;
+    CachedMesh& operator=(const CachedMesh&) = delete;
+    ~CachedMesh();
+
+    bool map(const std::string& path);
+    void unmap();
+};
+
+/**
+  NOTE:
+  Meshes are cached on disk under a hash of the field
+  name and the Params that affect that field's mesh,
+  so returning to a setting (or starting the program
+  again) skips both field generation and meshing.
+  The field name is hashed rather than the function
+  pointer, which changes from one run to the next.
+
+  Each entry is a single file whose arrays are 4 byte
+  aligned, so a hit is just an mmap. Hits refresh the
+  file's modification time, and the least recently
+  used entries are removed when the directory grows
+  past maxBytes.
+*/
+class MeshCache {
+  std::string directory;
+  size_t maxBytes;
+
+  std::string entryPath(uint64_t key);
+  void evict();
+
+  public:
+    MeshCache(const std::string& directory = defaultDirectory(), size_t maxBytes = 256 << 20);
+
+    static std::string defaultDirectory();
+    static uint64_t hashParams(const std::string& fieldName, Params& p);
+
+    bool load(uint64_t key, CachedMesh& mesh);
+    bool store(
+      uint64_t key,
+      std::vector<glm::vec3>& vertices,
+      std::vector<glm::vec3>& normals,
+      std::vector<unsigned int>& indices,
+      std::vector<int>& numTrisPerCube
+    );
+};
+
+#endif
@@ -0,0 +1,142 @@
+#include "meshClient.h"
+#include "sessionLog.h"
+#include "vertexPacking.h"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+MeshClient::~MeshClient() {
+  close();
+}
+
+bool MeshClient::connect(const std::string& socketPath, std::string& error) {
+  close();
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    error = "socket path too long";
+    return false;
+  }
+  strcpy(address.sun_path, socketPath.c_str());
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || ::connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+    error = std::string("could not connect to ") + socketPath + ": " + strerror(errno);
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MeshClient::close() {
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+// Errors from the server leave the connection usable, broken frames do not
+bool MeshClient::readReply(uint32_t expectedType, std::string& payload, std::string& error) {
+  FrameHeader header;
+  if (!readFrameHeader(fd, header)) {
+    error = "connection lost";
+    close();
+    return false;
+  }
+  if (header.type == FRAME_ERROR && header.length <= MAX_REQUEST_BYTES) {
+    payload.assign(header.length, '\0');
+    if (!readAll(fd, &payload[0], payload.size())) {
+      error = "connection lost";
+      close();
+      return false;
+    }
+    error = payload;
+    return false;
+  }
+  if (header.type != expectedType) {
+    error = "unexpected reply";
+    close();
+    return false;
+  }
+  payload.assign(header.length, '\0');
+  if (!readAll(fd, &payload[0], payload.size())) {
+    error = "connection lost";
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool MeshClient::requestMesh(const std::string& field, Params& p, ClientMesh& mesh, std::string& error, bool packed) {
+  if (fd < 0) {
+    error = "not connected";
+    return false;
+  }
+  std::string text = field + formatMeshParams(p);
+  MeshRequestHeader request;
+  request.flags = packed ? MESH_PACKED : 0;
+  request.textLength = text.size();
+  std::string payload((const char*)&request, sizeof(request));
+  payload += text;
+  if (!writeFrame(fd, FRAME_MESH_REQUEST, payload)) {
+    error = "connection lost";
+    close();
+    return false;
+  }
+
+  std::string reply;
+  if (!readReply(FRAME_MESH, reply, error)) return false;
+  MeshFrameHeader header;
+  if (reply.size() < sizeof(header)) {
+    error = "truncated mesh";
+    return false;
+  }
+  memcpy(&header, reply.data(), sizeof(header));
+  bool isPacked = header.flags & MESH_PACKED;
+  size_t vertexBytes = header.numVertices * (isPacked ? sizeof(PackedVertex) : 2 * sizeof(glm::vec3));
+  if (reply.size() != sizeof(header) + vertexBytes + header.numIndices * sizeof(unsigned int)) {
+    error = "truncated mesh";
+    return false;
+  }
+
+  const char* data = reply.data() + sizeof(header);
+  size_t numVertices = header.numVertices;
+  mesh.vertices.resize(numVertices);
+  mesh.normals.resize(numVertices);
+  mesh.indices.resize(header.numIndices);
+  if (isPacked) {
+    glm::vec3 boundsMin(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    glm::vec3 boundsMax(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    const PackedVertex* vertices = (const PackedVertex*)data;
+    for (size_t v = 0; v < numVertices; v++) {
+      mesh.vertices[v] = unpackPosition(vertices[v].position, boundsMin, boundsMax);
+      mesh.normals[v] = unpackNormal(vertices[v].normal);
+    }
+  } else if (numVertices) {
+    memcpy(&mesh.vertices[0], data, numVertices * sizeof(glm::vec3));
+    memcpy(&mesh.normals[0], data + numVertices * sizeof(glm::vec3), numVertices * sizeof(glm::vec3));
+  }
+  if (header.numIndices) {
+    memcpy(&mesh.indices[0], data + vertexBytes, header.numIndices * sizeof(unsigned int));
+  }
+  mesh.source = header.source;
+  mesh.meshMs = header.meshMs;
+  return true;
+}
+
+bool MeshClient::requestStats(std::string& stats, std::string& error) {
+  if (fd < 0) {
+    error = "not connected";
+    return false;
+  }
+  if (!writeFrameHeader(fd, FRAME_STATS_REQUEST, 0)) {
+    error = "connection lost";
+    close();
+    return false;
+  }
+  return readReply(FRAME_STATS, stats, error);
+}
@@ -0,0 +1,51 @@
+#ifndef MESHCLIENT
+#define MESHCLIENT
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "params.h"
+#include "meshProtocol.h"
+
+struct ClientMesh {
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec3> normals;
+  std::vector<unsigned int> indices;
+  // One of MeshSource
+  uint32_t source = 0;
+  // Time the server spent meshing it, whichever request that was for
+  float meshMs = 0.0f;
+};
+
+/**
+  NOTE:
+  A connection to a MeshServer. Requests are answered
+  in order on the one connection, so a client that
+  wants several meshes at once opens a connection for
+  each. Asking for packed vertices sends a third of
+  the bytes, which are unpacked again here, at the
+  precision of vertexPacking.h.
+*/
+class MeshClient {
+  int fd = -1;
+
+  bool readReply(uint32_t expectedType, std::string& payload, std::string& error);
+
+  public:
+    MeshClient() {}
+    MeshClient(const MeshClient&) = delete;
+    MeshClient& operator=(const MeshClient&) = delete;
+    ~MeshClient();
+
+    bool connect(const std::string& socketPath, std::string& error);
+    void close();
+    bool isConnected() { return fd >= 0; }
+
+    // field is a built-in field name; the server's errors come back in error
+    bool requestMesh(const std::string& field, Params& p, ClientMesh& mesh, std::string& error, bool packed = false);
+    bool requestStats(std::string& stats, std::string& error);
+};
+
+#endif
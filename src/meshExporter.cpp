@@ -0,0 +1,401 @@
+#include "meshExporter.h"
+#include "vertexPacking.h"
+#include <cstring>
+#include <cstdint>
+#include <cctype>
+#include <algorithm>
+
+// Large enough that formatting and fwrite overhead disappears behind the disk
+const size_t BUFFER_SIZE = 1 << 22;
+
+MeshExporter::MeshExporter(): buffer(BUFFER_SIZE) {}
+
+MeshExporter::~MeshExporter() {
+  if (file) {
+    fclose(file);
+  }
+}
+
+bool MeshExporter::open(const std::string& path) {
+  file = fopen(path.c_str(), "wb");
+  return file != nullptr;
+}
+
+bool MeshExporter::close() {
+  if (!file) return false;
+  flush();
+  bool ok = !ferror(file);
+  ok = fclose(file) == 0 && ok;
+  file = nullptr;
+  return ok;
+}
+
+void MeshExporter::write(const void* data, size_t size) {
+  if (used + size > buffer.size()) {
+    flush();
+    if (size > buffer.size()) {
+      fwrite(data, 1, size, file);
+      return;
+    }
+  }
+  memcpy(&buffer[used], data, size);
+  used += size;
+}
+
+void MeshExporter::flush() {
+  if (used) {
+    fwrite(&buffer[0], 1, used, file);
+    used = 0;
+  }
+}
+
+bool MeshExporter::appendSpool(FILE* spool) {
+  flush();
+  rewind(spool);
+  size_t read;
+  while ((read = fread(&buffer[0], 1, buffer.size(), spool)) > 0) {
+    fwrite(&buffer[0], 1, read, file);
+  }
+  bool ok = !ferror(spool);
+  fclose(spool);
+  return ok;
+}
+
+// Averaged vertex normals are not unit length, which most tools expect
+static glm::vec3 unitNormal(const glm::vec3& n) {
+  float len = glm::length(n);
+  return len > 0 ? n / len : n;
+}
+
+static bool isLittleEndian() {
+  const uint16_t one = 1;
+  return *(const unsigned char*)&one == 1;
+}
+
+/**
+  NOTE:
+  Formats a float with six decimals, the same precision
+  used for the vertex keys. This is several times faster
+  than printf and keeps OBJ export limited by the disk.
+*/
+static char* formatFloat(char* out, float value) {
+  if (!(value == value) || value > 1e12f || value < -1e12f) {
+    *out++ = '0';
+    return out;
+  }
+  if (value < 0) {
+    *out++ = '-';
+    value = -value;
+  }
+  unsigned long long scaled = (unsigned long long)(value * 1000000.0 + 0.5);
+  unsigned long long whole = scaled / 1000000;
+  unsigned int frac = scaled % 1000000;
+
+  char digits[24];
+  int n = 0;
+  do {
+    digits[n++] = '0' + whole % 10;
+    whole /= 10;
+  } while (whole);
+  while (n) *out++ = digits[--n];
+
+  *out++ = '.';
+  for (unsigned int d = 100000; d; d /= 10) {
+    *out++ = '0' + frac / d % 10;
+  }
+  return out;
+}
+
+static char* formatUint(char* out, unsigned long long value) {
+  char digits[24];
+  int n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  while (n) *out++ = digits[--n];
+  return out;
+}
+
+/**
+  PLY
+*/
+PlyExporter::~PlyExporter() {
+  if (faces) fclose(faces);
+}
+
+bool PlyExporter::open(const std::string& path) {
+  if (!MeshExporter::open(path)) return false;
+  faces = tmpfile();
+  if (!faces) return false;
+
+  // Counts are patched in place on close, so they get a fixed width
+  std::string header = "ply\n";
+  header += isLittleEndian() ? "format binary_little_endian 1.0\n" : "format binary_big_endian 1.0\n";
+  header += "comment generated by marching_cubes\n";
+  header += "element vertex ";
+  vertexCountOffset = header.size();
+  header += "0000000000\n";
+  header += "property float x\nproperty float y\nproperty float z\n";
+  header += "property float nx\nproperty float ny\nproperty float nz\n";
+  header += "element face ";
+  faceCountOffset = header.size();
+  header += "0000000000\n";
+  header += "property list uchar uint vertex_indices\n";
+  header += "end_header\n";
+  write(header.data(), header.size());
+  return true;
+}
+
+void PlyExporter::addVertices(const glm::vec3* vertices, const glm::vec3* normals, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    glm::vec3 n = unitNormal(normals[i]);
+    float record[6] = { vertices[i].x, vertices[i].y, vertices[i].z, n.x, n.y, n.z };
+    write(record, sizeof(record));
+  }
+  numVertices += count;
+}
+
+void PlyExporter::addTriangles(const unsigned int* indices, size_t count) {
+  const size_t recordSize = 1 + 3 * sizeof(uint32_t);
+  std::vector<unsigned char> records(count / 3 * recordSize);
+  unsigned char* out = records.data();
+  for (size_t i = 0; i + 2 < count; i += 3) {
+    *out++ = 3;
+    for (int k = 0; k < 3; k++) {
+      uint32_t index = indices[i + k];
+      memcpy(out, &index, sizeof(index));
+      out += sizeof(index);
+    }
+  }
+  fwrite(records.data(), 1, records.size(), faces);
+  numTriangles += count / 3;
+}
+
+bool PlyExporter::close() {
+  if (!file) return false;
+  bool ok = appendSpool(faces);
+  faces = nullptr;
+
+  char counts[16];
+  snprintf(counts, sizeof(counts), "%010zu", numVertices);
+  fseek(file, vertexCountOffset, SEEK_SET);
+  fwrite(counts, 1, 10, file);
+
+  snprintf(counts, sizeof(counts), "%010zu", numTriangles);
+  fseek(file, faceCountOffset, SEEK_SET);
+  fwrite(counts, 1, 10, file);
+
+  return MeshExporter::close() && ok;
+}
+
+/**
+  OBJ
+*/
+bool ObjExporter::open(const std::string& path) {
+  if (!MeshExporter::open(path)) return false;
+  const char* header = "# generated by marching_cubes\n";
+  write(header, strlen(header));
+  return true;
+}
+
+void ObjExporter::addVertices(const glm::vec3* vertices, const glm::vec3* normals, size_t count) {
+  char line[160];
+  for (size_t i = 0; i < count; i++) {
+    glm::vec3 n = unitNormal(normals[i]);
+    char* out = line;
+    *out++ = 'v';
+    for (int k = 0; k < 3; k++) {
+      *out++ = ' ';
+      out = formatFloat(out, vertices[i][k]);
+    }
+    *out++ = '\n';
+    *out++ = 'v';
+    *out++ = 'n';
+    for (int k = 0; k < 3; k++) {
+      *out++ = ' ';
+      out = formatFloat(out, n[k]);
+    }
+    *out++ = '\n';
+    write(line, out - line);
+  }
+  numVertices += count;
+
+  // Triangles whose vertices are all written now follow them, in the order they came
+  size_t kept = 0;
+  for (size_t i = 0; i + 2 < pending.size(); i += 3) {
+    const unsigned int* face = &pending[i];
+    if (std::max(face[0], std::max(face[1], face[2])) < numVertices) {
+      writeFaces(face, 3);
+    } else {
+      std::copy(face, face + 3, pending.begin() + kept);
+      kept += 3;
+    }
+  }
+  pending.resize(kept);
+}
+
+void ObjExporter::addTriangles(const unsigned int* indices, size_t count) {
+  pending.insert(pending.end(), indices, indices + count / 3 * 3);
+  numTriangles += count / 3;
+}
+
+// Any faces still held refer past the last vertex, and are written anyway so none are lost
+bool ObjExporter::close() {
+  if (!file) return false;
+  if (!pending.empty()) {
+    writeFaces(pending.data(), pending.size());
+    pending.clear();
+  }
+  return MeshExporter::close();
+}
+
+void ObjExporter::writeFaces(const unsigned int* indices, size_t count) {
+  char line[96];
+  for (size_t i = 0; i + 2 < count; i += 3) {
+    char* out = line;
+    *out++ = 'f';
+    for (int k = 0; k < 3; k++) {
+      // OBJ indices are 1-based, and the normal shares the vertex index
+      *out++ = ' ';
+      out = formatUint(out, indices[i + k] + 1ULL);
+      *out++ = '/';
+      *out++ = '/';
+      out = formatUint(out, indices[i + k] + 1ULL);
+    }
+    *out++ = '\n';
+    write(line, out - line);
+  }
+}
+
+/**
+  glTF
+*/
+GltfExporter::~GltfExporter() {
+  if (faces) fclose(faces);
+}
+
+bool GltfExporter::open(const std::string& path) {
+  gltfPath = path;
+  size_t dot = path.find_last_of('.');
+  std::string binPath = (dot == std::string::npos ? path : path.substr(0, dot)) + ".bin";
+  size_t slash = binPath.find_last_of("/\\");
+  binName = slash == std::string::npos ? binPath : binPath.substr(slash + 1);
+
+  if (!MeshExporter::open(binPath)) return false;
+  faces = tmpfile();
+  return faces != nullptr;
+}
+
+bool GltfExporter::setQuantization(glm::vec3 boundsMin, glm::vec3 boundsMax) {
+  quantized = true;
+  // A cube on the longest side, so the node's scale is uniform and leaves the normals alone
+  glm::vec3 size = boundsMax - boundsMin;
+  float extent = std::max(size.x, std::max(size.y, size.z));
+  quantizeMin = boundsMin;
+  quantizeMax = boundsMin + glm::vec3(extent);
+  return true;
+}
+
+void GltfExporter::addVertices(const glm::vec3* vertices, const glm::vec3* normals, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (numVertices + i == 0) {
+      boundsMin = vertices[i];
+      boundsMax = vertices[i];
+    }
+    boundsMin = glm::min(boundsMin, vertices[i]);
+    boundsMax = glm::max(boundsMax, vertices[i]);
+
+    glm::vec3 n = unitNormal(normals[i]);
+    if (!quantized) {
+      float record[6] = { vertices[i].x, vertices[i].y, vertices[i].z, n.x, n.y, n.z };
+      write(record, sizeof(record));
+      continue;
+    }
+
+    // Components are padded so both attributes stay 4 byte aligned
+    uint16_t position[4] = { 0, 0, 0, 0 };
+    packPosition(vertices[i], quantizeMin, quantizeMax, position);
+    int8_t normal[4] = { packSnorm(n.x), packSnorm(n.y), packSnorm(n.z), 0 };
+    for (int a = 0; a < 3; a++) {
+      if (numVertices + i == 0 || position[a] < packedMin[a]) packedMin[a] = position[a];
+      if (numVertices + i == 0 || position[a] > packedMax[a]) packedMax[a] = position[a];
+    }
+    write(position, sizeof(position));
+    write(normal, sizeof(normal));
+  }
+  numVertices += count;
+}
+
+void GltfExporter::addTriangles(const unsigned int* indices, size_t count) {
+  fwrite(indices, sizeof(unsigned int), count / 3 * 3, faces);
+  numTriangles += count / 3;
+}
+
+bool GltfExporter::close() {
+  if (!file) return false;
+  bool ok = appendSpool(faces);
+  faces = nullptr;
+  ok = MeshExporter::close() && ok;
+
+  FILE* json = fopen(gltfPath.c_str(), "w");
+  if (!json) return false;
+
+  size_t vertexStride = quantized ? 12 : 24;
+  size_t vertexBytes = numVertices * vertexStride;
+  size_t indexBytes = numTriangles * 3 * sizeof(unsigned int);
+  bool empty = numVertices == 0 || numTriangles == 0;
+
+  fprintf(json, "{\n");
+  fprintf(json, "  \"asset\": { \"version\": \"2.0\", \"generator\": \"marching_cubes\" },\n");
+  fprintf(json, "  \"scene\": 0,\n");
+  if (empty) {
+    fprintf(json, "  \"scenes\": [ { \"nodes\": [] } ]\n");
+    fprintf(json, "}\n");
+    return fclose(json) == 0 && ok;
+  }
+  fprintf(json, "  \"scenes\": [ { \"nodes\": [ 0 ] } ],\n");
+  if (quantized) {
+    // The node's transform maps the 16 bit steps back onto the bounds
+    glm::vec3 step = (quantizeMax - quantizeMin) / 65535.0f;
+    fprintf(json, "  \"extensionsUsed\": [ \"KHR_mesh_quantization\" ],\n");
+    fprintf(json, "  \"extensionsRequired\": [ \"KHR_mesh_quantization\" ],\n");
+    fprintf(json, "  \"nodes\": [ { \"mesh\": 0, \"translation\": [ %.9g, %.9g, %.9g ], \"scale\": [ %.9g, %.9g, %.9g ] } ],\n",
+      quantizeMin.x, quantizeMin.y, quantizeMin.z, step.x, step.y, step.z);
+  } else {
+    fprintf(json, "  \"nodes\": [ { \"mesh\": 0 } ],\n");
+  }
+  fprintf(json, "  \"meshes\": [ { \"primitives\": [ { \"attributes\": { \"POSITION\": 0, \"NORMAL\": 1 }, \"indices\": 2 } ] } ],\n");
+  fprintf(json, "  \"buffers\": [ { \"uri\": \"%s\", \"byteLength\": %zu } ],\n", binName.c_str(), vertexBytes + indexBytes);
+  fprintf(json, "  \"bufferViews\": [\n");
+  fprintf(json, "    { \"buffer\": 0, \"byteOffset\": 0, \"byteLength\": %zu, \"byteStride\": %zu, \"target\": 34962 },\n", vertexBytes, vertexStride);
+  fprintf(json, "    { \"buffer\": 0, \"byteOffset\": %zu, \"byteLength\": %zu, \"target\": 34963 }\n", vertexBytes, indexBytes);
+  fprintf(json, "  ],\n");
+  fprintf(json, "  \"accessors\": [\n");
+  if (quantized) {
+    fprintf(json, "    { \"bufferView\": 0, \"byteOffset\": 0, \"componentType\": 5123, \"count\": %zu, \"type\": \"VEC3\", ", numVertices);
+    fprintf(json, "\"min\": [ %u, %u, %u ], \"max\": [ %u, %u, %u ] },\n",
+      (unsigned)packedMin[0], (unsigned)packedMin[1], (unsigned)packedMin[2], (unsigned)packedMax[0], (unsigned)packedMax[1], (unsigned)packedMax[2]);
+    fprintf(json, "    { \"bufferView\": 0, \"byteOffset\": 8, \"componentType\": 5120, \"normalized\": true, \"count\": %zu, \"type\": \"VEC3\" },\n", numVertices);
+  } else {
+    fprintf(json, "    { \"bufferView\": 0, \"byteOffset\": 0, \"componentType\": 5126, \"count\": %zu, \"type\": \"VEC3\", ", numVertices);
+    fprintf(json, "\"min\": [ %.9g, %.9g, %.9g ], \"max\": [ %.9g, %.9g, %.9g ] },\n",
+      boundsMin.x, boundsMin.y, boundsMin.z, boundsMax.x, boundsMax.y, boundsMax.z);
+    fprintf(json, "    { \"bufferView\": 0, \"byteOffset\": 12, \"componentType\": 5126, \"count\": %zu, \"type\": \"VEC3\" },\n", numVertices);
+  }
+  fprintf(json, "    { \"bufferView\": 1, \"byteOffset\": 0, \"componentType\": 5125, \"count\": %zu, \"type\": \"SCALAR\" }\n", numTriangles * 3);
+  fprintf(json, "  ]\n");
+  fprintf(json, "}\n");
+  return fclose(json) == 0 && ok;
+}
+
+std::unique_ptr<MeshExporter> createExporter(const std::string& path) {
+  size_t dot = path.find_last_of('.');
+  std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+  for (auto& c : ext) c = tolower(c);
+
+  if (ext == "ply") return std::unique_ptr<MeshExporter>(new PlyExporter());
+  if (ext == "obj") return std::unique_ptr<MeshExporter>(new ObjExporter());
+  if (ext == "gltf") return std::unique_ptr<MeshExporter>(new GltfExporter());
+  return nullptr;
+}
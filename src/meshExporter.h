@@ -0,0 +1,117 @@
+#ifndef MESHEXPORTER
+#define MESHEXPORTER
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "meshSink.h"
+
+/**
+  NOTE:
+  Exporters are mesh sinks that write straight to disk.
+  Nothing but a fixed size output buffer is kept in
+  memory, so the mesh never has to exist as a whole.
+  Formats that need the vertex count before the faces
+  (PLY, glTF) spool their triangles to a temporary file
+  and append it once the vertex count is known.
+*/
+class MeshExporter : public MeshSink {
+  protected:
+    FILE* file = nullptr;
+    std::vector<char> buffer;
+    size_t used = 0;
+
+    size_t numVertices = 0;
+    size_t numTriangles = 0;
+
+    void write(const void* data, size_t size);
+    void flush();
+    bool appendSpool(FILE* spool);
+
+  public:
+    MeshExporter();
+    virtual ~MeshExporter();
+
+    virtual bool open(const std::string& path);
+    virtual bool close();
+    // Store positions in 16 bit steps across these bounds, false if the format cannot
+    virtual bool setQuantization(glm::vec3 boundsMin, glm::vec3 boundsMax) { return false; }
+
+    size_t getNumVertices() { return numVertices; }
+    size_t getNumTriangles() { return numTriangles; }
+};
+
+// Binary little endian PLY with per-vertex normals
+class PlyExporter : public MeshExporter {
+  FILE* faces = nullptr;
+  long vertexCountOffset = 0;
+  long faceCountOffset = 0;
+
+  public:
+    ~PlyExporter();
+    bool open(const std::string& path);
+    bool close();
+    void addVertices(const glm::vec3* vertices, const glm::vec3* normals, size_t count);
+    void addTriangles(const unsigned int* indices, size_t count);
+};
+
+/**
+  NOTE:
+  Wavefront OBJ, with vertices and faces interleaved.
+  Faces may only refer to vertices already written, so
+  a slab's triangles are held until the vertices they
+  use arrive with the next slab, a slab or two of
+  indices at a time.
+*/
+class ObjExporter : public MeshExporter {
+  std::vector<unsigned int> pending;
+
+  void writeFaces(const unsigned int* indices, size_t count);
+
+  public:
+    bool open(const std::string& path);
+    bool close();
+    void addVertices(const glm::vec3* vertices, const glm::vec3* normals, size_t count);
+    void addTriangles(const unsigned int* indices, size_t count);
+};
+
+/**
+  NOTE:
+  glTF 2.0 JSON with a single external .bin holding
+  vertices then indices. Quantised files use the
+  KHR_mesh_quantization extension: 16 bit positions
+  scaled back by the node's transform and normalised
+  byte normals, 12 bytes a vertex instead of 24.
+  glTF wants three component normals, so they are not
+  octahedral as in the viewer.
+*/
+class GltfExporter : public MeshExporter {
+  FILE* faces = nullptr;
+  std::string gltfPath;
+  std::string binName;
+  glm::vec3 boundsMin = glm::vec3(0);
+  glm::vec3 boundsMax = glm::vec3(0);
+
+  bool quantized = false;
+  glm::vec3 quantizeMin;
+  glm::vec3 quantizeMax;
+  uint16_t packedMin[3];
+  uint16_t packedMax[3];
+
+  public:
+    ~GltfExporter();
+    bool open(const std::string& path);
+    bool close();
+    bool setQuantization(glm::vec3 boundsMin, glm::vec3 boundsMax);
+    void addVertices(const glm::vec3* vertices, const glm::vec3* normals, size_t count);
+    void addTriangles(const unsigned int* indices, size_t count);
+};
+
+// Picks the exporter from the file extension (.ply, .obj or .gltf)
+std::unique_ptr<MeshExporter> createExporter(const std::string& path);
+
+#endif
@@ -0,0 +1,249 @@
+#include "meshOptimizer.h"
+#include <cmath>
+#include <climits>
+#include <algorithm>
+
+// Forsyth's scoring constants
+const float CACHE_DECAY_POWER = 1.5f;
+const float LAST_TRIANGLE_SCORE = 0.75f;
+const float VALENCE_BOOST_SCALE = 2.0f;
+const float VALENCE_BOOST_POWER = 0.5f;
+const int MAX_SCORED_VALENCE = 64;
+const size_t OVERDRAW_CLUSTER = 64;
+
+VertexCacheStats measureVertexCache(const std::vector<unsigned int>& indices, size_t numVertices, int cacheSize) {
+  VertexCacheStats stats;
+  if (indices.empty()) return stats;
+
+  // A vertex is still cached while fewer than cacheSize misses followed its own
+  std::vector<size_t> insertedAt(numVertices, 0);
+  size_t misses = 0;
+  size_t numUsed = 0;
+  for (unsigned int index : indices) {
+    if (insertedAt[index] == 0) {
+      numUsed++;
+    } else if (misses - insertedAt[index] < (size_t)cacheSize) {
+      continue;
+    }
+    misses++;
+    insertedAt[index] = misses;
+  }
+  stats.acmr = (float)misses / (indices.size() / 3);
+  stats.atvr = (float)misses / numUsed;
+  return stats;
+}
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t numVertices) {
+  size_t numTriangles = indices.size() / 3;
+  if (numTriangles == 0) return;
+
+  float cacheScores[OPTIMIZER_CACHE_SIZE];
+  for (int i = 0; i < OPTIMIZER_CACHE_SIZE; i++) {
+    // The last triangle's vertices get a fixed score, so it is not simply repeated
+    cacheScores[i] = i < 3 ? LAST_TRIANGLE_SCORE : powf(1.0f - (i - 3) / (float)(OPTIMIZER_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+  }
+  float valenceScores[MAX_SCORED_VALENCE + 1];
+  valenceScores[0] = 0.0f;
+  for (int i = 1; i <= MAX_SCORED_VALENCE; i++) {
+    valenceScores[i] = VALENCE_BOOST_SCALE * powf((float)i, -VALENCE_BOOST_POWER);
+  }
+  auto score = [&](int cachePosition, unsigned int remaining) {
+    if (remaining == 0) return -1.0f;
+    float s = valenceScores[std::min(remaining, (unsigned int)MAX_SCORED_VALENCE)];
+    return cachePosition < 0 ? s : s + cacheScores[cachePosition];
+  };
+
+  // The triangles not yet emitted that use each vertex, packed per vertex
+  std::vector<unsigned int> remaining(numVertices, 0);
+  for (unsigned int index : indices) {
+    remaining[index]++;
+  }
+  std::vector<size_t> offsets(numVertices + 1, 0);
+  for (size_t v = 0; v < numVertices; v++) {
+    offsets[v + 1] = offsets[v] + remaining[v];
+  }
+  std::vector<unsigned int> adjacency(indices.size());
+  std::vector<size_t> filled(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < indices.size(); i++) {
+    adjacency[filled[indices[i]]++] = i / 3;
+  }
+
+  std::vector<int> cachePosition(numVertices, -1);
+  std::vector<float> vertexScores(numVertices);
+  for (size_t v = 0; v < numVertices; v++) {
+    vertexScores[v] = score(-1, remaining[v]);
+  }
+  std::vector<float> triangleScores(numTriangles);
+  int best = 0;
+  for (size_t t = 0; t < numTriangles; t++) {
+    triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+    if (triangleScores[t] > triangleScores[best]) best = t;
+  }
+
+  std::vector<bool> emitted(numTriangles, false);
+  std::vector<unsigned int> ordered;
+  ordered.reserve(indices.size());
+  std::vector<unsigned int> cache;
+  std::vector<unsigned int> nextCache;
+  size_t nextUnemitted = 0;
+  while (ordered.size() < indices.size()) {
+    // Nothing next to the cache is left, so carry on in the original order
+    if (best < 0) {
+      while (emitted[nextUnemitted]) nextUnemitted++;
+      best = nextUnemitted;
+    }
+    emitted[best] = true;
+
+    nextCache.clear();
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = indices[3 * best + k];
+      ordered.push_back(v);
+
+      unsigned int* active = &adjacency[offsets[v]];
+      unsigned int* found = std::find(active, active + remaining[v], (unsigned int)best);
+      std::swap(*found, active[remaining[v] - 1]);
+      remaining[v]--;
+
+      if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end()) {
+        nextCache.push_back(v);
+      }
+    }
+    for (unsigned int v : cache) {
+      if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end()) {
+        nextCache.push_back(v);
+      }
+    }
+
+    // Vertices pushed out of the cache are rescored as well
+    for (size_t i = 0; i < nextCache.size(); i++) {
+      unsigned int v = nextCache[i];
+      cachePosition[v] = i < OPTIMIZER_CACHE_SIZE ? i : -1;
+      float newScore = score(cachePosition[v], remaining[v]);
+      float change = newScore - vertexScores[v];
+      vertexScores[v] = newScore;
+      for (unsigned int j = 0; j < remaining[v]; j++) {
+        triangleScores[adjacency[offsets[v] + j]] += change;
+      }
+    }
+    if (nextCache.size() > OPTIMIZER_CACHE_SIZE) {
+      nextCache.resize(OPTIMIZER_CACHE_SIZE);
+    }
+    std::swap(cache, nextCache);
+
+    best = -1;
+    float bestScore = -1.0f;
+    for (unsigned int v : cache) {
+      for (unsigned int j = 0; j < remaining[v]; j++) {
+        unsigned int t = adjacency[offsets[v] + j];
+        if (triangleScores[t] > bestScore) {
+          bestScore = triangleScores[t];
+          best = t;
+        }
+      }
+    }
+  }
+  indices.swap(ordered);
+}
+
+void optimizeOverdraw(const std::vector<glm::vec3>& vertices, const std::vector<glm::vec3>& normals, std::vector<unsigned int>& indices) {
+  size_t numTriangles = indices.size() / 3;
+  if (numTriangles == 0) return;
+
+  // Clusters of at least OVERDRAW_CLUSTER triangles start where the cache order loses locality
+  std::vector<size_t> clusterStarts;
+  std::vector<size_t> insertedAt(vertices.size(), 0);
+  size_t misses = 0;
+  for (size_t t = 0; t < numTriangles; t++) {
+    int triangleMisses = 0;
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = indices[3 * t + k];
+      if (insertedAt[v] == 0 || misses - insertedAt[v] >= OPTIMIZER_CACHE_SIZE) {
+        misses++;
+        insertedAt[v] = misses;
+        triangleMisses++;
+      }
+    }
+    if (t == 0 || (triangleMisses >= 2 && t - clusterStarts.back() >= OVERDRAW_CLUSTER)) {
+      clusterStarts.push_back(t);
+    }
+  }
+  clusterStarts.push_back(numTriangles);
+
+  glm::vec3 meshCentre(0.0f);
+  for (auto& v : vertices) {
+    meshCentre += v;
+  }
+  meshCentre /= (float)vertices.size();
+
+  // Clusters facing outwards from the centre are drawn first
+  size_t numClusters = clusterStarts.size() - 1;
+  std::vector<float> facing(numClusters);
+  for (size_t c = 0; c < numClusters; c++) {
+    glm::vec3 centre(0.0f);
+    glm::vec3 normal(0.0f);
+    for (size_t i = 3 * clusterStarts[c]; i < 3 * clusterStarts[c + 1]; i++) {
+      centre += vertices[indices[i]];
+      normal += normals[indices[i]];
+    }
+    centre /= (float)(3 * (clusterStarts[c + 1] - clusterStarts[c]));
+    float length = glm::length(normal);
+    facing[c] = length > 0.0f ? glm::dot(centre - meshCentre, normal / length) : 0.0f;
+  }
+  std::vector<size_t> order(numClusters);
+  for (size_t c = 0; c < numClusters; c++) {
+    order[c] = c;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return facing[a] > facing[b];
+  });
+
+  std::vector<unsigned int> ordered;
+  ordered.reserve(indices.size());
+  for (size_t c : order) {
+    ordered.insert(ordered.end(), indices.begin() + 3 * clusterStarts[c], indices.begin() + 3 * clusterStarts[c + 1]);
+  }
+  indices.swap(ordered);
+}
+
+void optimizeVertexFetch(std::vector<glm::vec3>& vertices, std::vector<glm::vec3>& normals, std::vector<unsigned int>& indices) {
+  std::vector<unsigned int> remap(vertices.size(), UINT_MAX);
+  std::vector<glm::vec3> orderedVertices;
+  std::vector<glm::vec3> orderedNormals;
+  orderedVertices.reserve(vertices.size());
+  orderedNormals.reserve(normals.size());
+  for (unsigned int& index : indices) {
+    if (remap[index] == UINT_MAX) {
+      remap[index] = orderedVertices.size();
+      orderedVertices.push_back(vertices[index]);
+      orderedNormals.push_back(normals[index]);
+    }
+    index = remap[index];
+  }
+  vertices.swap(orderedVertices);
+  normals.swap(orderedNormals);
+}
+
+void optimizeMesh(std::vector<glm::vec3>& vertices, std::vector<glm::vec3>& normals, std::vector<unsigned int>& indices) {
+  optimizeVertexCache(indices, vertices.size());
+  optimizeOverdraw(vertices, normals, indices);
+  optimizeVertexFetch(vertices, normals, indices);
+}
+
+void OptimizingSink::addVertices(const glm::vec3* v, const glm::vec3* n, size_t count) {
+  vertices.insert(vertices.end(), v, v + count);
+  normals.insert(normals.end(), n, n + count);
+}
+
+void OptimizingSink::addTriangles(const unsigned int* i, size_t count) {
+  indices.insert(indices.end(), i, i + count);
+}
+
+void OptimizingSink::finish() {
+  optimizeMesh(vertices, normals, indices);
+  if (vertices.size()) {
+    sink.addVertices(&vertices[0], &normals[0], vertices.size());
+  }
+  if (indices.size()) {
+    sink.addTriangles(&indices[0], indices.size());
+  }
+}
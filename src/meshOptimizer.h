@@ -0,0 +1,62 @@
+#ifndef MESHOPTIMIZER
+#define MESHOPTIMIZER
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "meshSink.h"
+
+// Size of the LRU cache the triangle order is optimised for
+const int OPTIMIZER_CACHE_SIZE = 32;
+
+// Misses of a FIFO post-transform cache, per triangle (ACMR) and per vertex (ATVR)
+struct VertexCacheStats {
+  float acmr = 0.0f;
+  float atvr = 0.0f;
+};
+
+VertexCacheStats measureVertexCache(const std::vector<unsigned int>& indices, size_t numVertices, int cacheSize = 16);
+
+/**
+  NOTE:
+  Reorders triangles for the post-transform vertex
+  cache with Forsyth's linear-speed algorithm: each
+  vertex is scored by its place in a simulated LRU
+  cache and by how few triangles still use it, and
+  the best scoring triangle next to the cache is
+  emitted next.
+*/
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t numVertices);
+
+/**
+  NOTE:
+  Splits the cache order into clusters where it loses
+  locality anyway, and draws the clusters facing away
+  from the centre of the mesh first. From outside,
+  near surfaces then tend to be drawn before the ones
+  they hide, so fewer fragments are shaded twice.
+*/
+void optimizeOverdraw(const std::vector<glm::vec3>& vertices, const std::vector<glm::vec3>& normals, std::vector<unsigned int>& indices);
+
+// Renumbers vertices in the order triangles first use them, dropping unused ones
+void optimizeVertexFetch(std::vector<glm::vec3>& vertices, std::vector<glm::vec3>& normals, std::vector<unsigned int>& indices);
+
+// All three, in order
+void optimizeMesh(std::vector<glm::vec3>& vertices, std::vector<glm::vec3>& normals, std::vector<unsigned int>& indices);
+
+// Buffers a streamed mesh, then optimises it and passes it on when finished
+class OptimizingSink : public MeshSink {
+  MeshSink& sink;
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec3> normals;
+  std::vector<unsigned int> indices;
+
+  public:
+    OptimizingSink(MeshSink& sink): sink(sink) {}
+
+    void addVertices(const glm::vec3* v, const glm::vec3* n, size_t count);
+    void addTriangles(const unsigned int* i, size_t count);
+    void finish();
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "meshProtocol.h"
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// No SIGPIPE when a client hangs up mid-frame, the write just fails
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+bool writeAll(int fd, const void* data, size_t length) {
+  const char* bytes = (const char*)data;
+  while (length > 0) {
+    ssize_t written = send(fd, bytes, length, MSG_NOSIGNAL);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return false;
+    bytes += written;
+    length -= written;
+  }
+  return true;
+}
+
+bool readAll(int fd, void* data, size_t length) {
+  char* bytes = (char*)data;
+  while (length > 0) {
+    ssize_t count = recv(fd, bytes, length, 0);
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) return false;
+    bytes += count;
+    length -= count;
+  }
+  return true;
+}
+
+bool writeFrameHeader(int fd, uint32_t type, uint64_t length) {
+  FrameHeader header;
+  header.magic = MESH_FRAME_MAGIC;
+  header.type = type;
+  header.length = length;
+  return writeAll(fd, &header, sizeof(header));
+}
+
+bool writeFrame(int fd, uint32_t type, const std::string& payload) {
+  return writeFrameHeader(fd, type, payload.size()) && writeAll(fd, payload.data(), payload.size());
+}
+
+bool readFrameHeader(int fd, FrameHeader& header) {
+  return readAll(fd, &header, sizeof(header)) && header.magic == MESH_FRAME_MAGIC;
+}
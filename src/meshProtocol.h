@@ -0,0 +1,85 @@
+#ifndef MESHPROTOCOL
+#define MESHPROTOCOL
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+  NOTE:
+  What the mesh server and its clients send over the
+  socket. Every message is a frame: a header giving
+  its type and the length of the payload after it, in
+  the byte order of the machine, since both ends are
+  always on the same one.
+
+    mesh request   MeshRequestHeader, then the text of
+                   the request: a field name and the
+                   " key=value" pairs of a session log
+    stats request  no payload
+    mesh           MeshFrameHeader, then the vertices,
+                   either positions then normals as
+                   floats or PackedVertex, then the
+                   indices as uint32
+    stats          text, a "name value" pair a line
+    error          text
+*/
+const uint32_t MESH_FRAME_MAGIC = 0x3153434d; // "MCS1"
+
+enum MeshFrameType {
+  FRAME_MESH_REQUEST = 1,
+  FRAME_STATS_REQUEST = 2,
+  FRAME_MESH = 3,
+  FRAME_STATS = 4,
+  FRAME_ERROR = 5
+};
+
+// Requests are a field name and some numbers, anything longer is not one
+const uint64_t MAX_REQUEST_BYTES = 64 << 10;
+
+struct FrameHeader {
+  uint32_t magic;
+  uint32_t type;
+  uint64_t length;
+};
+
+enum MeshRequestFlags {
+  // Send vertices as PackedVertex, 8 bytes instead of 24
+  MESH_PACKED = 1
+};
+
+struct MeshRequestHeader {
+  uint32_t flags;
+  uint32_t textLength;
+};
+
+enum MeshSource {
+  // Meshed for this request
+  MESH_MESHED = 0,
+  MESH_FROM_CACHE = 1,
+  // Meshed for another request for the same mesh that was already in flight
+  MESH_COALESCED = 2
+};
+
+struct MeshFrameHeader {
+  uint32_t flags;
+  uint32_t source;
+  uint64_t numVertices;
+  uint64_t numIndices;
+  // What packed positions are relative to
+  float boundsMin[3];
+  float boundsMax[3];
+  // Time the server spent generating and meshing, whoever it was for
+  float meshMs;
+  uint32_t padding;
+};
+
+// Both retry on short writes and reads, and fail once the other end has gone
+bool writeAll(int fd, const void* data, size_t length);
+bool readAll(int fd, void* data, size_t length);
+
+bool writeFrameHeader(int fd, uint32_t type, uint64_t length);
+bool writeFrame(int fd, uint32_t type, const std::string& payload);
+bool readFrameHeader(int fd, FrameHeader& header);
+
+#endif
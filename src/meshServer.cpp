@@ -0,0 +1,368 @@
+#include "meshServer.h"
+#include "meshProtocol.h"
+#include "meshCache.h"
+#include "pointGrid.h"
+#include "fields.h"
+#include "sessionLog.h"
+#include "vertexPacking.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std::chrono;
+
+MeshServer::MeshServer(int numWorkers, size_t maxCacheBytes) : maxCacheBytes(maxCacheBytes), stopRequested(false) {
+  if (numWorkers <= 0) {
+    numWorkers = std::max((int)std::thread::hardware_concurrency(), 1);
+  }
+  this->numWorkers = numWorkers;
+  for (int i = 0; i < numWorkers; i++) {
+    workers.push_back(std::thread(&MeshServer::work, this));
+  }
+}
+
+MeshServer::~MeshServer() {
+  stopWorkers();
+  if (listenFd >= 0) {
+    close(listenFd);
+    unlink(socketPath.c_str());
+  }
+}
+
+bool MeshServer::listen(const std::string& path) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+    return false;
+  }
+  strcpy(address.sun_path, path.c_str());
+
+  // A socket file that nothing answers on is left over from a server that died
+  int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (probe >= 0) {
+    bool answered = connect(probe, (sockaddr*)&address, sizeof(address)) == 0;
+    close(probe);
+    if (answered) {
+      fprintf(stderr, "A server is already listening on %s\n", path.c_str());
+      return false;
+    }
+  }
+  unlink(path.c_str());
+
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    fprintf(stderr, "Could not create socket: %s\n", strerror(errno));
+    return false;
+  }
+  if (bind(listenFd, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(listenFd, SOMAXCONN) < 0) {
+    fprintf(stderr, "Could not listen on %s: %s\n", path.c_str(), strerror(errno));
+    close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+  socketPath = path;
+  return true;
+}
+
+void MeshServer::run() {
+  while (!stopRequested) {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      if (stopRequested) break;
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      fprintf(stderr, "Could not accept connection: %s\n", strerror(errno));
+      break;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    connections.push_back(fd);
+    std::thread(&MeshServer::serve, this, fd).detach();
+  }
+
+  // Connections waiting on a mesh still get it, since the workers keep going until they are closed
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (int fd : connections) {
+      shutdown(fd, SHUT_RDWR);
+    }
+    connectionsClosed.wait(lock, [&]() { return connections.empty(); });
+  }
+  stopWorkers();
+  close(listenFd);
+  listenFd = -1;
+  unlink(socketPath.c_str());
+}
+
+// shutdown is async-signal-safe and wakes the accept in run on Linux, a signal does elsewhere
+void MeshServer::stop() {
+  stopRequested = true;
+  if (listenFd >= 0) {
+    shutdown(listenFd, SHUT_RDWR);
+  }
+}
+
+void MeshServer::stopWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  jobsQueued.notify_all();
+  for (auto& worker : workers) {
+    if (worker.joinable()) worker.join();
+  }
+}
+
+std::shared_ptr<const ServerMesh> MeshServer::getMesh(const std::string& field, Params& p, uint32_t& source) {
+  Params params = p;
+  // Only the triangles are sent, so nothing needs to be kept for drawing
+  params.showPoints = false;
+  params.showMarch = false;
+  // The workers are the server's parallelism, a client does not get to start threads of its own
+  Params defaults;
+  params.fieldThreads = defaults.fieldThreads;
+  params.fieldChunk = defaults.fieldChunk;
+  params.pipelineBricks = defaults.pipelineBricks;
+  source = MESH_MESHED;
+
+  // The scene is whatever the server loaded last, so it is not the client's to name
+  std::string error;
+  FieldFunc func = getFieldByName(field);
+  size_t numPoints = (size_t)std::max(params.sizeX(), 0) * std::max(params.sizeY(), 0) * std::max(params.sizeZ(), 0);
+  if (!func || func == getScene) {
+    error = "unknown field " + field;
+  } else if (params.density <= 0.0f || numPoints == 0) {
+    error = "empty grid";
+  } else if (numPoints > MAX_GRID_POINTS) {
+    error = "grid of " + std::to_string(numPoints) + " points is too large";
+  }
+  if (!error.empty()) {
+    std::shared_ptr<ServerMesh> mesh = std::make_shared<ServerMesh>();
+    mesh->error = error;
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.numRequests++;
+    stats.numErrors++;
+    return mesh;
+  }
+  uint64_t key = MeshCache::hashParams(field, params);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  stats.numRequests++;
+  auto cached = cache.find(key);
+  if (cached != cache.end()) {
+    recent.splice(recent.begin(), recent, cached->second.recent);
+    stats.numCacheHits++;
+    source = MESH_FROM_CACHE;
+    return cached->second.mesh;
+  }
+
+  std::shared_ptr<PendingMesh> pending;
+  auto flying = inFlight.find(key);
+  if (flying != inFlight.end()) {
+    pending = flying->second;
+    stats.numCoalesced++;
+    source = MESH_COALESCED;
+  } else {
+    pending = std::make_shared<PendingMesh>();
+    inFlight[key] = pending;
+    Job job;
+    job.key = key;
+    job.field = field;
+    job.params = params;
+    job.numPoints = numPoints;
+    job.pending = pending;
+    jobs.push_back(job);
+    jobsQueued.notify_one();
+  }
+  meshesDone.wait(lock, [&]() { return pending->done; });
+  return pending->mesh;
+}
+
+// Meshed as the viewer would, so decimation and index optimisation apply too
+static std::shared_ptr<ServerMesh> meshField(const std::string& field, Params& params) {
+  std::shared_ptr<ServerMesh> mesh = std::make_shared<ServerMesh>();
+  auto start = steady_clock::now();
+  PointGrid pointGrid(params);
+  pointGrid.generateScalarField(getFieldByName(field));
+  pointGrid.generateDrawData();
+  mesh->vertices.swap(pointGrid.getVertices());
+  mesh->normals.swap(pointGrid.getNormals());
+  mesh->indices.swap(pointGrid.getIndices());
+  getGridBounds(params, mesh->boundsMin, mesh->boundsMax);
+  mesh->meshMs = duration<float, std::milli>(steady_clock::now() - start).count();
+  return mesh;
+}
+
+void MeshServer::work() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    numIdle++;
+    jobsQueued.wait(lock, [&]() { return stopping || !jobs.empty(); });
+    numIdle--;
+    // Queued jobs are still meshed when stopping, someone is waiting on each of them
+    if (jobs.empty()) return;
+
+    std::vector<Job> batch;
+    batch.push_back(jobs.front());
+    jobs.pop_front();
+    // An idle worker would mesh the rest sooner, and a busy one takes no more than its share of the queue
+    if (batch[0].numPoints < SMALL_JOB_POINTS && numIdle == 0) {
+      size_t batchPoints = batch[0].numPoints;
+      size_t share = jobs.size() / numWorkers;
+      for (auto it = jobs.begin(); it != jobs.end() && batch.size() <= share;) {
+        if (it->numPoints < SMALL_JOB_POINTS && batchPoints + it->numPoints <= BATCH_POINTS) {
+          batchPoints += it->numPoints;
+          batch.push_back(*it);
+          it = jobs.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      if (batch.size() > 1) {
+        stats.numBatches++;
+        stats.numBatchedJobs += batch.size();
+      }
+    }
+    lock.unlock();
+
+    // Each mesh is handed over as soon as it is done, not when the whole batch is
+    for (Job& job : batch) {
+      std::shared_ptr<const ServerMesh> mesh = meshField(job.field, job.params);
+      lock.lock();
+      stats.numMeshed++;
+      insertIntoCache(job.key, mesh);
+      job.pending->mesh = mesh;
+      job.pending->done = true;
+      inFlight.erase(job.key);
+      meshesDone.notify_all();
+      lock.unlock();
+    }
+    lock.lock();
+  }
+}
+
+// Called with the mutex held
+void MeshServer::insertIntoCache(uint64_t key, std::shared_ptr<const ServerMesh> mesh) {
+  size_t numBytes = mesh->numBytes();
+  if (numBytes > maxCacheBytes || cache.count(key)) return;
+  recent.push_front(key);
+  CacheEntry entry;
+  entry.mesh = mesh;
+  entry.recent = recent.begin();
+  cache[key] = entry;
+  stats.cacheBytes += numBytes;
+
+  while (stats.cacheBytes > maxCacheBytes) {
+    auto oldest = cache.find(recent.back());
+    stats.cacheBytes -= oldest->second.mesh->numBytes();
+    cache.erase(oldest);
+    recent.pop_back();
+    stats.numEvictions++;
+  }
+  stats.cacheEntries = cache.size();
+}
+
+// Written straight from the mesh, packed a run of vertices at a time if asked to be
+bool MeshServer::sendMesh(int fd, const ServerMesh& mesh, uint32_t flags, uint32_t source) {
+  size_t numVertices = mesh.vertices.size();
+  bool packed = flags & MESH_PACKED;
+  MeshFrameHeader header;
+  memset(&header, 0, sizeof(header));
+  header.flags = packed ? MESH_PACKED : 0;
+  header.source = source;
+  header.numVertices = numVertices;
+  header.numIndices = mesh.indices.size();
+  for (int a = 0; a < 3; a++) {
+    header.boundsMin[a] = mesh.boundsMin[a];
+    header.boundsMax[a] = mesh.boundsMax[a];
+  }
+  header.meshMs = mesh.meshMs;
+
+  size_t vertexBytes = numVertices * (packed ? sizeof(PackedVertex) : 2 * sizeof(glm::vec3));
+  size_t length = sizeof(header) + vertexBytes + mesh.indices.size() * sizeof(unsigned int);
+  if (!writeFrameHeader(fd, FRAME_MESH, length) || !writeAll(fd, &header, sizeof(header))) return false;
+
+  if (packed) {
+    const size_t RUN = 4096;
+    PackedVertex run[RUN];
+    for (size_t v = 0; v < numVertices; v += RUN) {
+      size_t count = std::min(RUN, numVertices - v);
+      packVertices(&mesh.vertices[v], &mesh.normals[v], count, mesh.boundsMin, mesh.boundsMax, run);
+      if (!writeAll(fd, run, count * sizeof(PackedVertex))) return false;
+    }
+  } else if (numVertices) {
+    if (!writeAll(fd, &mesh.vertices[0], numVertices * sizeof(glm::vec3))) return false;
+    if (!writeAll(fd, &mesh.normals[0], numVertices * sizeof(glm::vec3))) return false;
+  }
+  return mesh.indices.empty() || writeAll(fd, &mesh.indices[0], mesh.indices.size() * sizeof(unsigned int));
+}
+
+void MeshServer::serve(int fd) {
+  FrameHeader header;
+  while (readFrameHeader(fd, header)) {
+    if (header.type == FRAME_STATS_REQUEST && header.length == 0) {
+      if (!writeFrame(fd, FRAME_STATS, formatStats())) break;
+      continue;
+    }
+    if (header.type != FRAME_MESH_REQUEST || header.length < sizeof(MeshRequestHeader) || header.length > MAX_REQUEST_BYTES) {
+      writeFrame(fd, FRAME_ERROR, "malformed request");
+      break;
+    }
+    std::string payload(header.length, '\0');
+    if (!readAll(fd, &payload[0], payload.size())) break;
+    MeshRequestHeader request;
+    memcpy(&request, payload.data(), sizeof(request));
+    if (request.textLength != payload.size() - sizeof(request)) {
+      writeFrame(fd, FRAME_ERROR, "malformed request");
+      break;
+    }
+
+    std::istringstream text(payload.substr(sizeof(request)));
+    std::string field;
+    std::string rest;
+    text >> field;
+    std::getline(text, rest);
+    Params params;
+    parseMeshParams(rest, params);
+
+    uint32_t source;
+    std::shared_ptr<const ServerMesh> mesh = getMesh(field, params, source);
+    bool sent = mesh->error.empty() ? sendMesh(fd, *mesh, request.flags, source) : writeFrame(fd, FRAME_ERROR, mesh->error);
+    if (!sent) break;
+  }
+
+  // Closed under the lock, so run never shuts down a descriptor that has been reused
+  std::lock_guard<std::mutex> lock(mutex);
+  connections.erase(std::find(connections.begin(), connections.end(), fd));
+  close(fd);
+  connectionsClosed.notify_all();
+}
+
+ServerStats MeshServer::getStats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+std::string MeshServer::formatStats() {
+  ServerStats s = getStats();
+  std::ostringstream text;
+  text << "workers " << numWorkers << "\n";
+  text << "requests " << s.numRequests << "\n";
+  text << "cacheHits " << s.numCacheHits << "\n";
+  text << "coalesced " << s.numCoalesced << "\n";
+  text << "meshed " << s.numMeshed << "\n";
+  text << "errors " << s.numErrors << "\n";
+  text << "batches " << s.numBatches << "\n";
+  text << "batchedJobs " << s.numBatchedJobs << "\n";
+  text << "evictions " << s.numEvictions << "\n";
+  text << "cacheEntries " << s.cacheEntries << "\n";
+  text << "cacheBytes " << s.cacheBytes << "\n";
+  return text.str();
+}
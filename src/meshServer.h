@@ -0,0 +1,152 @@
+#ifndef MESHSERVER
+#define MESHSERVER
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <glm/glm.hpp>
+
+#include "params.h"
+
+struct ServerMesh {
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec3> normals;
+  std::vector<unsigned int> indices;
+  glm::vec3 boundsMin;
+  glm::vec3 boundsMax;
+  float meshMs = 0.0f;
+  // Set instead of the mesh when the request could not be meshed
+  std::string error;
+
+  size_t numBytes() const {
+    return vertices.size() * sizeof(glm::vec3) * 2 + indices.size() * sizeof(unsigned int);
+  }
+};
+
+struct ServerStats {
+  size_t numRequests = 0;
+  size_t numCacheHits = 0;
+  // Requests that waited on the same mesh being meshed for another one
+  size_t numCoalesced = 0;
+  size_t numMeshed = 0;
+  size_t numErrors = 0;
+  // Runs of small jobs a busy worker took from the queue at once, and the jobs in them
+  size_t numBatches = 0;
+  size_t numBatchedJobs = 0;
+  size_t numEvictions = 0;
+  size_t cacheBytes = 0;
+  size_t cacheEntries = 0;
+};
+
+/**
+  NOTE:
+  A long running meshing service on a Unix domain
+  socket, so only processes on this machine can reach
+  it. Each connection gets a thread of its own that
+  reads requests, which are a built-in field and the
+  Params of its mesh, and writes back the meshes in
+  the framing of meshProtocol.h.
+
+  A request is looked up in an in-memory cache of the
+  meshes sent most recently first, under the same key
+  as the mesh cache on disk. If the same mesh is being
+  meshed for another request right now, the request
+  waits for that one instead of meshing it twice.
+  Otherwise it is queued for a pool of workers.
+
+  A worker takes the job at the front of the queue. If
+  it is small and every other worker is busy too, it
+  also takes its share of the small jobs queued behind
+  it, up to BATCH_POINTS grid points in all, and meshes
+  them one after the other without going back to the
+  queue. While any worker is idle, jobs are taken one
+  at a time, so a burst is spread over the whole pool
+  rather than meshed in series by one worker.
+
+  Finished meshes go into the cache, and the least
+  recently used are evicted once it holds more than
+  maxCacheBytes.
+*/
+class MeshServer {
+  struct PendingMesh {
+    bool done = false;
+    std::shared_ptr<const ServerMesh> mesh;
+  };
+
+  struct Job {
+    uint64_t key;
+    std::string field;
+    Params params;
+    size_t numPoints;
+    std::shared_ptr<PendingMesh> pending;
+  };
+
+  struct CacheEntry {
+    std::shared_ptr<const ServerMesh> mesh;
+    std::list<uint64_t>::iterator recent;
+  };
+
+  int numWorkers;
+  size_t maxCacheBytes;
+  std::string socketPath;
+  int listenFd = -1;
+
+  // Guards everything below
+  std::mutex mutex;
+  std::condition_variable jobsQueued;
+  std::condition_variable meshesDone;
+  std::deque<Job> jobs;
+  std::map<uint64_t, std::shared_ptr<PendingMesh>> inFlight;
+  std::map<uint64_t, CacheEntry> cache;
+  // Most recently used first
+  std::list<uint64_t> recent;
+  ServerStats stats;
+  bool stopping = false;
+  // Workers waiting for a job
+  int numIdle = 0;
+  // Open connections, each served by a detached thread
+  std::vector<int> connections;
+  std::condition_variable connectionsClosed;
+
+  std::atomic<bool> stopRequested;
+  std::vector<std::thread> workers;
+
+  void work();
+  void stopWorkers();
+  void serve(int fd);
+  bool sendMesh(int fd, const ServerMesh& mesh, uint32_t flags, uint32_t source);
+  void insertIntoCache(uint64_t key, std::shared_ptr<const ServerMesh> mesh);
+
+  public:
+    // Jobs of fewer grid points than this are batched
+    static const size_t SMALL_JOB_POINTS = 64 * 64 * 64;
+    static const size_t BATCH_POINTS = 4 * SMALL_JOB_POINTS;
+    // Larger grids are turned away rather than risk running out of memory
+    static const size_t MAX_GRID_POINTS = (size_t)1 << 27;
+
+    // numWorkers of 0 is one per core
+    MeshServer(int numWorkers = 0, size_t maxCacheBytes = 256 << 20);
+    ~MeshServer();
+
+    // Binds the socket, replacing one left behind by a server that did not shut down
+    bool listen(const std::string& path);
+    // Accepts connections until stop is called, then waits for them and the workers to finish
+    void run();
+    // Safe to call from a signal handler
+    void stop();
+
+    // Meshes field with p, or finds it in the cache; source is one of MeshSource
+    std::shared_ptr<const ServerMesh> getMesh(const std::string& field, Params& p, uint32_t& source);
+    ServerStats getStats();
+    std::string formatStats();
+};
+
+#endif
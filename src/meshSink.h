@@ -0,0 +1,25 @@
+#ifndef MESHSINK
+#define MESHSINK
+
+#include <cstddef>
+#include <glm/glm.hpp>
+
+/**
+  NOTE:
+  The mesher hands its output to a sink one slab
+  (one x-layer of cubes) at a time. Triangles of a
+  slab arrive as soon as the slab is done, while its
+  vertices are held back until the next slab has been
+  meshed, since only then are their averaged normals
+  final. Vertices always arrive in index order, so a
+  sink can write them out and forget them.
+*/
+class MeshSink {
+  public:
+    virtual ~MeshSink() {}
+    virtual void addVertices(const glm::vec3* vertices, const glm::vec3* normals, size_t count) = 0;
+    virtual void addTriangles(const unsigned int* indices, size_t count) = 0;
+    virtual void addCube(int numTris) {}
+};
+
+#endif
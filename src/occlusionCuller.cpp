@@ -0,0 +1,340 @@
+#include "occlusionCuller.h"
+#include "decimator.h"
+#include "taskGraph.h"
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+using namespace std::chrono;
+
+void makeOccluder(
+  const std::vector<glm::vec3>& vertices,
+  const std::vector<glm::vec3>& normals,
+  const std::vector<unsigned int>& indices,
+  float maxError,
+  Occluder& occluder
+) {
+  occluder = Occluder();
+  if (indices.empty()) return;
+  occluder.boundsMin = occluder.boundsMax = vertices[0];
+  for (const glm::vec3& v : vertices) {
+    occluder.boundsMin = glm::min(occluder.boundsMin, v);
+    occluder.boundsMax = glm::max(occluder.boundsMax, v);
+  }
+
+  std::vector<glm::vec3> decimatedNormals = normals;
+  occluder.vertices = vertices;
+  occluder.indices = indices;
+  DecimateOptions options;
+  options.targetTriangles = std::max(indices.size() / 12, (size_t)1);
+  options.maxError = maxError;
+  // Occluders are remade a brick at a time while sculpting, on the thread that draws
+  options.numThreads = 1;
+  decimateMesh(occluder.vertices, decimatedNormals, occluder.indices, options);
+}
+
+// A triangle set up for the pixels it covers, in pixels of the depth buffer
+struct ScreenTriangle {
+  // Edge functions a * x + b * y + c, a pixel centre is inside where all three are >= 0
+  float a[3];
+  float b[3];
+  float c[3];
+  // Depth across the triangle, as za * x + zb * y + zc
+  float za;
+  float zb;
+  float zc;
+  int minX;
+  int minY;
+  int maxX;
+  int maxY;
+};
+
+// Pixel coordinates and depth in [0, 1] of a clip space position in front of the near plane
+static glm::vec3 toScreen(glm::vec4 clip) {
+  return glm::vec3(
+    (clip.x / clip.w * 0.5f + 0.5f) * OcclusionCuller::WIDTH,
+    (clip.y / clip.w * 0.5f + 0.5f) * OcclusionCuller::HEIGHT,
+    clip.z / clip.w * 0.5f + 0.5f
+  );
+}
+
+static void setupTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, std::vector<ScreenTriangle>& triangles) {
+  float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+  if (!(std::fabs(area) > 1e-6f)) return;
+  // Occluders are drawn from both sides, so every triangle is turned counter-clockwise
+  if (area < 0.0f) {
+    std::swap(v1, v2);
+    area = -area;
+  }
+
+  ScreenTriangle t;
+  float minX = std::min(v0.x, std::min(v1.x, v2.x));
+  float maxX = std::max(v0.x, std::max(v1.x, v2.x));
+  float minY = std::min(v0.y, std::min(v1.y, v2.y));
+  float maxY = std::max(v0.y, std::max(v1.y, v2.y));
+  if (maxX < 0.0f || maxY < 0.0f || minX > OcclusionCuller::WIDTH || minY > OcclusionCuller::HEIGHT) return;
+  t.minX = std::max((int)std::floor(minX), 0);
+  t.minY = std::max((int)std::floor(minY), 0);
+  t.maxX = std::min((int)std::ceil(maxX), OcclusionCuller::WIDTH - 1);
+  t.maxY = std::min((int)std::ceil(maxY), OcclusionCuller::HEIGHT - 1);
+
+  glm::vec3 v[3] = { v0, v1, v2 };
+  for (int e = 0; e < 3; e++) {
+    glm::vec3 from = v[e];
+    glm::vec3 to = v[(e + 1) % 3];
+    t.a[e] = from.y - to.y;
+    t.b[e] = to.x - from.x;
+    t.c[e] = -(t.a[e] * from.x + t.b[e] * from.y);
+  }
+  t.za = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+  t.zb = ((v1.x - v0.x) * (v2.z - v0.z) - (v2.x - v0.x) * (v1.z - v0.z)) / area;
+  t.zc = v0.z - t.za * v0.x - t.zb * v0.y;
+  triangles.push_back(t);
+}
+
+// Cuts off the part of a triangle in front of the near plane, leaving up to two triangles
+static void clipTriangle(const glm::vec4* clip, std::vector<ScreenTriangle>& triangles) {
+  glm::vec4 polygon[4];
+  int numVertices = 0;
+  for (int i = 0; i < 3; i++) {
+    glm::vec4 from = clip[i];
+    glm::vec4 to = clip[(i + 1) % 3];
+    float fromDistance = from.z + from.w;
+    float toDistance = to.z + to.w;
+    if (fromDistance >= 0.0f) {
+      polygon[numVertices++] = from;
+    }
+    if ((fromDistance >= 0.0f) != (toDistance >= 0.0f)) {
+      polygon[numVertices++] = glm::mix(from, to, fromDistance / (fromDistance - toDistance));
+    }
+  }
+  for (int i = 2; i < numVertices; i++) {
+    glm::vec3 v0 = toScreen(polygon[0]);
+    glm::vec3 v1 = toScreen(polygon[i - 1]);
+    glm::vec3 v2 = toScreen(polygon[i]);
+    setupTriangle(v0, v1, v2, triangles);
+  }
+}
+
+static void rasterise(const ScreenTriangle& t, glm::ivec2 tileMin, glm::ivec2 tileMax, float* depth) {
+  int x0 = std::max(t.minX, tileMin.x);
+  int x1 = std::min(t.maxX, tileMax.x - 1);
+  int y0 = std::max(t.minY, tileMin.y);
+  int y1 = std::min(t.maxY, tileMax.y - 1);
+  for (int y = y0; y <= y1; y++) {
+    float py = y + 0.5f;
+    float c0 = t.b[0] * py + t.c[0];
+    float c1 = t.b[1] * py + t.c[1];
+    float c2 = t.b[2] * py + t.c[2];
+    float zRow = t.zb * py + t.zc;
+    float* row = depth + y * OcclusionCuller::WIDTH;
+    // No branches and nothing carried from one pixel to the next, so this vectorises
+    for (int x = x0; x <= x1; x++) {
+      float px = x + 0.5f;
+      bool inside = (t.a[0] * px + c0 >= 0.0f) & (t.a[1] * px + c1 >= 0.0f) & (t.a[2] * px + c2 >= 0.0f);
+      float z = std::min(t.za * px + zRow, row[x]);
+      row[x] = inside ? z : row[x];
+    }
+  }
+}
+
+OcclusionCuller::OcclusionCuller() : viewProjection(1.0f) {
+  glm::ivec2 size(WIDTH, HEIGHT);
+  while (true) {
+    levelSizes.push_back(size);
+    levels.push_back(std::vector<float>(size.x * size.y, 1.0f));
+    if (size.x == 1 && size.y == 1) break;
+    size = glm::max(size / 2, glm::ivec2(1));
+  }
+}
+
+enum BoxProjection {
+  BOX_OUTSIDE = 0,
+  // In front of the camera and at least partly in view
+  BOX_ON_SCREEN = 1,
+  // Crossing the near plane, so it cannot be bounded on screen
+  BOX_AT_CAMERA = 2
+};
+
+static int projectBox(const glm::mat4& viewProjection, glm::vec3 boundsMin, glm::vec3 boundsMax, glm::vec2& screenMin, glm::vec2& screenMax, float& nearest) {
+  screenMin = glm::vec2(INFINITY);
+  screenMax = glm::vec2(-INFINITY);
+  nearest = INFINITY;
+  int numBehind = 0;
+  for (int i = 0; i < 8; i++) {
+    glm::vec3 corner(
+      i & 1 ? boundsMax.x : boundsMin.x,
+      i & 2 ? boundsMax.y : boundsMin.y,
+      i & 4 ? boundsMax.z : boundsMin.z
+    );
+    glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+    if (clip.z + clip.w < 0.0f) {
+      numBehind++;
+      continue;
+    }
+    glm::vec3 screen = toScreen(clip);
+    screenMin = glm::min(screenMin, glm::vec2(screen.x, screen.y));
+    screenMax = glm::max(screenMax, glm::vec2(screen.x, screen.y));
+    nearest = std::min(nearest, screen.z);
+  }
+  if (numBehind) {
+    return numBehind == 8 ? BOX_OUTSIDE : BOX_AT_CAMERA;
+  }
+  bool outside = (
+    screenMax.x < 0.0f || screenMax.y < 0.0f ||
+    screenMin.x > OcclusionCuller::WIDTH || screenMin.y > OcclusionCuller::HEIGHT ||
+    nearest > 1.0f
+  );
+  return outside ? BOX_OUTSIDE : BOX_ON_SCREEN;
+}
+
+void OcclusionCuller::render(
+  const glm::mat4& viewProjection,
+  glm::vec3 eye,
+  const std::vector<const Occluder*>& occluders,
+  int numThreads
+) {
+  auto start = steady_clock::now();
+  this->viewProjection = viewProjection;
+  stats = OcclusionStats();
+
+  // The nearest occluders in view, by the distance from the eye to their boxes
+  std::vector<std::pair<float, const Occluder*>> inView;
+  for (const Occluder* occluder : occluders) {
+    glm::vec2 screenMin, screenMax;
+    float nearest;
+    if (!occluder->numTriangles()) continue;
+    if (projectBox(viewProjection, occluder->boundsMin, occluder->boundsMax, screenMin, screenMax, nearest) == BOX_OUTSIDE) continue;
+    glm::vec3 closest = glm::clamp(eye, occluder->boundsMin, occluder->boundsMax);
+    inView.push_back(std::make_pair(glm::length(closest - eye), occluder));
+  }
+  std::sort(inView.begin(), inView.end(), [](const std::pair<float, const Occluder*>& a, const std::pair<float, const Occluder*>& b) {
+    return a.first < b.first;
+  });
+  std::vector<const Occluder*> chosen;
+  for (auto& candidate : inView) {
+    if (stats.numOccluderTriangles >= maxOccluderTriangles) break;
+    chosen.push_back(candidate.second);
+    stats.numOccluderTriangles += candidate.second->numTriangles();
+  }
+  stats.numOccluders = chosen.size();
+  hasOccluders = !chosen.empty();
+
+  std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+  std::vector<std::vector<ScreenTriangle>> triangles(chosen.size());
+
+  TaskGraph graph;
+  int transformStage = graph.addStage("transform");
+  int rasterStage = graph.addStage("raster");
+  int pyramidStage = graph.addStage("pyramid");
+  std::vector<int> transforms;
+  for (size_t i = 0; i < chosen.size(); i++) {
+    transforms.push_back(graph.addTask(transformStage, [this, i, &chosen, &triangles]() {
+      const Occluder& occluder = *chosen[i];
+      std::vector<glm::vec4> clip(occluder.vertices.size());
+      std::vector<glm::vec3> screen(occluder.vertices.size());
+      for (size_t v = 0; v < clip.size(); v++) {
+        clip[v] = this->viewProjection * glm::vec4(occluder.vertices[v], 1.0f);
+        if (clip[v].z + clip[v].w >= 0.0f) screen[v] = toScreen(clip[v]);
+      }
+      triangles[i].reserve(occluder.numTriangles());
+      for (size_t f = 0; f + 2 < occluder.indices.size(); f += 3) {
+        const unsigned int* face = &occluder.indices[f];
+        glm::vec4 corners[3] = { clip[face[0]], clip[face[1]], clip[face[2]] };
+        // Only the few triangles reaching past the near plane need clipping
+        bool inFront = true;
+        for (int k = 0; k < 3; k++) {
+          inFront = inFront && corners[k].z + corners[k].w >= 0.0f;
+        }
+        if (inFront) {
+          setupTriangle(screen[face[0]], screen[face[1]], screen[face[2]], triangles[i]);
+        } else {
+          clipTriangle(corners, triangles[i]);
+        }
+      }
+    }));
+  }
+
+  std::vector<int> tiles;
+  for (int ty = 0; ty < HEIGHT; ty += TILE_HEIGHT) {
+    for (int tx = 0; tx < WIDTH; tx += TILE_WIDTH) {
+      glm::ivec2 tileMin(tx, ty);
+      glm::ivec2 tileMax(std::min(tx + TILE_WIDTH, (int)WIDTH), std::min(ty + TILE_HEIGHT, (int)HEIGHT));
+      int tile = graph.addTask(rasterStage, [this, tileMin, tileMax, &triangles]() {
+        float* depth = levels[0].data();
+        for (auto& occluderTriangles : triangles) {
+          for (const ScreenTriangle& t : occluderTriangles) {
+            if (t.maxX < tileMin.x || t.minX >= tileMax.x || t.maxY < tileMin.y || t.minY >= tileMax.y) continue;
+            rasterise(t, tileMin, tileMax, depth);
+          }
+        }
+      });
+      for (int transform : transforms) {
+        graph.addDependency(transform, tile);
+      }
+      tiles.push_back(tile);
+    }
+  }
+
+  int pyramid = graph.addTask(pyramidStage, [this]() {
+    for (size_t l = 1; l < levels.size(); l++) {
+      glm::ivec2 size = levelSizes[l];
+      glm::ivec2 below = levelSizes[l - 1];
+      for (int y = 0; y < size.y; y++) {
+        for (int x = 0; x < size.x; x++) {
+          int x0 = std::min(2 * x, below.x - 1);
+          int x1 = std::min(2 * x + 1, below.x - 1);
+          int y0 = std::min(2 * y, below.y - 1);
+          int y1 = std::min(2 * y + 1, below.y - 1);
+          const std::vector<float>& depth = levels[l - 1];
+          levels[l][y * size.x + x] = std::max(
+            std::max(depth[y0 * below.x + x0], depth[y0 * below.x + x1]),
+            std::max(depth[y1 * below.x + x0], depth[y1 * below.x + x1])
+          );
+        }
+      }
+    }
+  });
+  for (int tile : tiles) {
+    graph.addDependency(tile, pyramid);
+  }
+
+  // Threads are started for each render, so each has to be worth a few thousand triangles and a tile
+  int numTiles = tiles.size();
+  int worthThreads = 1 + (int)(stats.numOccluderTriangles / TRIANGLES_PER_THREAD);
+  graph.run(std::min(numThreads, std::min(numTiles, worthThreads)));
+  stats.renderMs = duration<float, std::milli>(steady_clock::now() - start).count();
+}
+
+bool OcclusionCuller::isVisible(glm::vec3 boundsMin, glm::vec3 boundsMax) {
+  stats.numTested++;
+  glm::vec2 screenMin, screenMax;
+  float nearest;
+  int projection = projectBox(viewProjection, boundsMin, boundsMax, screenMin, screenMax, nearest);
+  if (projection == BOX_OUTSIDE) {
+    stats.numOutside++;
+    return false;
+  }
+  if (projection == BOX_AT_CAMERA || !hasOccluders) return true;
+
+  int x0 = glm::clamp((int)std::floor(screenMin.x), 0, WIDTH - 1);
+  int x1 = glm::clamp((int)std::floor(screenMax.x), 0, WIDTH - 1);
+  int y0 = glm::clamp((int)std::floor(screenMin.y), 0, HEIGHT - 1);
+  int y1 = glm::clamp((int)std::floor(screenMax.y), 0, HEIGHT - 1);
+  size_t level = 0;
+  while (level + 1 < levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)) {
+    level++;
+  }
+
+  int width = levelSizes[level].x;
+  float farthest = 0.0f;
+  for (int y = y0 >> level; y <= y1 >> level; y++) {
+    for (int x = x0 >> level; x <= x1 >> level; x++) {
+      farthest = std::max(farthest, levels[level][y * width + x]);
+    }
+  }
+  if (nearest > farthest) {
+    stats.numOccluded++;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,95 @@
+#ifndef OCCLUSIONCULLER
+#define OCCLUSIONCULLER
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// A simplified copy of a chunk's mesh, drawn into the depth buffer in place of the real one
+struct Occluder {
+  std::vector<glm::vec3> vertices;
+  std::vector<unsigned int> indices;
+  glm::vec3 boundsMin = glm::vec3(0.0f);
+  glm::vec3 boundsMax = glm::vec3(0.0f);
+
+  size_t numTriangles() const { return indices.size() / 3; }
+};
+
+// About a quarter of the mesh's triangles, never moved further than maxError from it
+void makeOccluder(
+  const std::vector<glm::vec3>& vertices,
+  const std::vector<glm::vec3>& normals,
+  const std::vector<unsigned int>& indices,
+  float maxError,
+  Occluder& occluder
+);
+
+struct OcclusionStats {
+  int numOccluders = 0;
+  size_t numOccluderTriangles = 0;
+  // Boxes tested since the last render, and the ones outside the view or hidden
+  int numTested = 0;
+  int numOutside = 0;
+  int numOccluded = 0;
+  float renderMs = 0.0f;
+};
+
+/**
+  NOTE:
+  Culls chunks hidden behind nearer ones, entirely on
+  the CPU. Each frame the occluders of the chunks
+  nearest the camera, up to maxOccluderTriangles, are
+  rasterised into a small depth buffer: each one is
+  transformed by a task of its own, then each tile of
+  the buffer is filled by another, from every
+  triangle overlapping it. Pixels are covered a row at
+  a time by plain loops over the edge functions, with
+  no branches, so optimised builds vectorise them on
+  x86 and ARM alike.
+
+  A pyramid is built on top of the buffer, each texel
+  the farthest depth of the four below it. A chunk's
+  bounding box is hidden when its nearest corner is
+  farther than the farthest depth under the rectangle
+  it covers on screen, read from the level where that
+  rectangle is at most two texels across.
+
+  Occluders are decimated within a fraction of a cube
+  and the buffer samples pixel centres, so a chunk
+  seen through a gap narrower than a pixel of the
+  buffer can be culled. At WIDTH x HEIGHT that is a
+  few pixels of the window.
+*/
+class OcclusionCuller {
+  // levels[0] is the depth buffer, each level after it half the size
+  std::vector<std::vector<float>> levels;
+  std::vector<glm::ivec2> levelSizes;
+  glm::mat4 viewProjection;
+  bool hasOccluders = false;
+
+  public:
+    static const int WIDTH = 256;
+    static const int HEIGHT = 128;
+    static const int TILE_WIDTH = 64;
+    static const int TILE_HEIGHT = 32;
+    // Occluder triangles for each thread after the first
+    static const size_t TRIANGLES_PER_THREAD = 8000;
+
+    size_t maxOccluderTriangles = 20000;
+    OcclusionStats stats;
+
+    OcclusionCuller();
+
+    // Clears the buffer and draws the occluders nearest eye into it, on up to numThreads threads
+    void render(
+      const glm::mat4& viewProjection,
+      glm::vec3 eye,
+      const std::vector<const Occluder*>& occluders,
+      int numThreads
+    );
+    // False when the box is outside the view, or behind the occluders drawn by render
+    bool isVisible(glm::vec3 boundsMin, glm::vec3 boundsMax);
+
+    const std::vector<float>& getDepth() { return levels[0]; }
+};
+
+#endif
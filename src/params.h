@@ -1,6 +1,16 @@
+#ifndef PARAMS
+#define PARAMS
+
 #include <glm/glm.hpp>
 using namespace glm;
 
+enum Mesher {
+  MESHER_MARCHING_CUBES = 0,
+  MESHER_SURFACE_NETS = 1,
+  MESHER_DUAL_CONTOURING = 2,
+  MESHER_ADAPTIVE_CUBES = 3
+};
+
 struct Params {
   // Window Params
   int width = 1024;
@@ -12,6 +22,30 @@ struct Params {
   int numUnitsY = 40;
   int numUnitsZ = 40;
   float isoValue = 0.5f;
+  int mesher = MESHER_MARCHING_CUBES;
+  float adaptiveError = 0.02f;
+  bool decimate = false;
+  int triangleBudget = 10000;
+  float decimateError = 0.0f;
+  // Reorder the mesh for the GPU's vertex cache, unless Show March needs cube order
+  bool optimizeIndices = false;
+  // Animation time in seconds, for the fields that change over time
+  float time = 0.0f;
+  // Extra surfaces at isoValue + n * layerSpacing, meshed in the same pass
+  int numLayers = 1;
+  float layerSpacing = 0.1f;
+  // Inside regions with fewer grid points or (estimated) triangles are removed before meshing
+  int minIslandPoints = 0;
+  int minIslandTriangles = 0;
+  // Tuning Params, which change how fast a mesh is made but never the mesh itself
+  int fieldThreads = 1;
+  // x-planes a field thread fills at a time, rounded up to a whole SDF brick
+  int fieldChunk = 16;
+  // Worker processes for sharded marching cubes in the CLI, 0 to mesh in process
+  int meshWorkers = 0;
+  // Evaluate the field brick by brick while marching cubes meshes the bricks already filled,
+  // on fieldThreads threads
+  bool pipelineBricks = false;
   int sizeX() { return numUnitsX * density; }
   int sizeY() { return numUnitsY * density; }
   int sizeZ() { return numUnitsZ * density; }
@@ -24,6 +58,10 @@ struct Params {
   bool showPoints = false;
   bool interpolate = false;
   bool useTerrain = false;
+  // Upload 8 byte packed vertices instead of float positions and normals
+  bool packVertices = false;
+  // Skip sculpt bricks hidden behind nearer ones, tested against a depth buffer drawn on the CPU
+  bool occlusionCulling = false;
   glm::vec3 position = glm::vec3(0.0, 30, 45);
 
   // Sphere Params
@@ -47,6 +85,18 @@ struct Params {
       p.showMesh == showMesh &&
       p.showMarch == showMarch &&
       p.interpolate == interpolate &&
+      p.packVertices == packVertices &&
+      p.mesher == mesher &&
+      p.adaptiveError == adaptiveError &&
+      p.decimate == decimate &&
+      p.triangleBudget == triangleBudget &&
+      p.decimateError == decimateError &&
+      p.optimizeIndices == optimizeIndices &&
+      p.time == time &&
+      p.numLayers == numLayers &&
+      p.layerSpacing == layerSpacing &&
+      p.minIslandPoints == minIslandPoints &&
+      p.minIslandTriangles == minIslandTriangles &&
       p.xOffset == xOffset &&
       p.yOffset == yOffset &&
       p.zOffset == zOffset &&
@@ -57,4 +107,6 @@ struct Params {
   bool operator!= (const Params& p) {
     return !(*this == p);
   }
-};
\ No newline at end of file
+};
+
+#endif
@@ -1,4 +1,8 @@
 #include "pointGrid.h"
+#include "fieldFile.h"
+#include "decimator.h"
+#include "meshOptimizer.h"
+#include "fields.h"
 #include <string>
 #include <vector>
 #include <array>
@@ -6,6 +10,10 @@
 #include <set>
 #include <map>
 #include <chrono>
+#include <algorithm>
+#include <climits>
+#include <thread>
+#include <atomic>
 using namespace std::chrono;
 
 PointGrid::PointGrid(
@@ -14,20 +22,142 @@ PointGrid::PointGrid(
 
 PointGrid::~PointGrid() {}
 
-void PointGrid::generateScalarField(std::function<float(int, int, int, Params&)> func) {
-  scalarField = new float[p.sizeX() * p.sizeY() * p.sizeZ()];
-  for (int sX = 0; sX < p.sizeX(); sX ++) {
-    for (int sY = 0; sY < p.sizeY(); sY++) {
-      for (int sZ = 0; sZ < p.sizeZ(); sZ++) {
-        int pX = sX - p.sizeX() / 2;
-        int pY = sY;
-        int pZ = sZ - p.sizeZ() / 2;
-
-        // this->scalarField[sX * sizeY * sizeZ + sY * sizeZ + sZ] = (sin(pX + pY * pZ + pZ * 3) + 1.0f) / 2.0f;
-        scalarField[coordsToIndex(sX, sY, sZ)] = func(pX, pY, pZ, p);
+void PointGrid::generateScalarField(std::function<float(int, int, int, Params&)> func, bool sample) {
+  fieldFunc = func;
+  sdfProgram = nullptr;
+  sampleField(sample);
+}
+
+void PointGrid::generateScalarField(const SdfProgram& program, bool sample) {
+  fieldFunc = [&program](int x, int y, int z, Params& p) {
+    return program.evaluate(x, y, z, p);
+  };
+  sdfProgram = &program;
+  sampleField(sample);
+}
+
+void PointGrid::sampleField(bool sample) {
+  invalidateRanges();
+  pipelineReport = TaskReport();
+  // Sampled lazily by the adaptive mesher, or brick by brick while meshing
+  if (!sample || p.mesher == MESHER_ADAPTIVE_CUBES || pipelinesField()) {
+    fieldStorage.clear();
+    scalarField = nullptr;
+    fieldOriginX = 0;
+    return;
+  }
+  fillScalarField();
+}
+
+void PointGrid::fillPlanes(int x0, int x1) {
+  // Built-in fields have a loop of their own with the field inlined
+  auto builtIn = fieldFunc.target<FieldFunc>();
+  if (sdfProgram) {
+    float isoMin, isoMax;
+    getIsoRange(isoMin, isoMax);
+    sdfProgram->evaluateGrid(scalarField, p, isoMin, isoMax, x0, x1);
+  } else if (!builtIn || !fillBuiltInField(*builtIn, scalarField, p, x0, x1)) {
+    for (int sX = x0; sX < x1; sX ++) {
+      for (int sY = 0; sY < p.sizeY(); sY++) {
+        for (int sZ = 0; sZ < p.sizeZ(); sZ++) {
+          int pX = sX - p.sizeX() / 2;
+          int pY = sY;
+          int pZ = sZ - p.sizeZ() / 2;
+
+          // this->scalarField[sX * sizeY * sizeZ + sY * sizeZ + sZ] = (sin(pX + pY * pZ + pZ * 3) + 1.0f) / 2.0f;
+          scalarField[coordsToIndex(sX, sY, sZ)] = fieldFunc(pX, pY, pZ, p);
+        }
+      }
+    }
+  }
+}
+
+void PointGrid::getIsoRange(float& isoMin, float& isoMax) {
+  std::vector<float> isoValues = getLayerIsoValues(p);
+  isoValues.insert(isoValues.end(), extraIsoValues.begin(), extraIsoValues.end());
+  isoMin = isoMax = p.isoValue;
+  for (float isoValue : isoValues) {
+    isoMin = std::min(isoMin, isoValue);
+    isoMax = std::max(isoMax, isoValue);
+  }
+}
+
+void PointGrid::fillScalarField() {
+  fieldStorage.assign((size_t)p.sizeX() * p.sizeY() * p.sizeZ(), 0.0f);
+  fillScalarField(fieldStorage.data());
+}
+
+void PointGrid::fillScalarField(float* field) {
+  scalarField = field;
+  fieldOriginX = 0;
+  numSamples = (size_t)p.sizeX() * p.sizeY() * p.sizeZ();
+  getIsoRange(filledIsoMin, filledIsoMax);
+
+  // Threads take chunks of planes in turn, whole SDF bricks so scenes are split where they already are
+  int sizeX = p.sizeX();
+  int chunk = (std::max(p.fieldChunk, 1) + SDF_BRICK - 1) / SDF_BRICK * SDF_BRICK;
+  int numThreads = std::min(std::max(p.fieldThreads, 1), (sizeX + chunk - 1) / chunk);
+  if (numThreads <= 1) {
+    fillPlanes(0, sizeX);
+  } else {
+    std::atomic<int> nextChunk(0);
+    auto work = [&]() {
+      for (int x0 = nextChunk++ * chunk; x0 < sizeX; x0 = nextChunk++ * chunk) {
+        fillPlanes(x0, std::min(sizeX, x0 + chunk));
       }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++) {
+      threads.push_back(std::thread(work));
+    }
+    for (auto& thread : threads) {
+      thread.join();
     }
   }
+  removeSmallIslands();
+}
+
+bool PointGrid::saveScalarField(const std::string& path, const std::string& fieldName, bool lossless) {
+  size_t size = (size_t)p.sizeX() * p.sizeY() * p.sizeZ();
+  if (!scalarField && fieldFunc) {
+    fillScalarField();
+  }
+  if (!scalarField || fieldOriginX != 0 || fieldStorage.size() != size) return false;
+
+  FieldHeader header;
+  header.fromParams(p);
+  header.fieldName = fieldName;
+  return writeFieldFile(path, scalarField, header, lossless);
+}
+
+bool PointGrid::loadScalarField(const std::string& path) {
+  return loadScalarField(path, 0, 0, 0, INT_MAX, INT_MAX, INT_MAX);
+}
+
+/**
+  NOTE:
+  Loading restores the Params the field was generated
+  with. When only a region is loaded the rest of the
+  grid is filled with the field's minimum, so it reads
+  as outside and the region's surface is closed off.
+*/
+bool PointGrid::loadScalarField(const std::string& path, int x0, int y0, int z0, int x1, int y1, int z1) {
+  FieldFile file;
+  if (!file.open(path)) return false;
+
+  FieldHeader& header = file.getHeader();
+  header.toParams(p);
+  if (p.sizeX() != header.sizeX || p.sizeY() != header.sizeY || p.sizeZ() != header.sizeZ) return false;
+
+  invalidateRanges();
+  fieldStorage.assign((size_t)p.sizeX() * p.sizeY() * p.sizeZ(), header.min);
+  scalarField = fieldStorage.data();
+  fieldOriginX = 0;
+  fieldFunc = nullptr;
+  sdfProgram = nullptr;
+  if (!file.read(x0, y0, z0, x1, y1, z1, scalarField)) return false;
+  removeSmallIslands();
+  return true;
 }
 
 /**
@@ -82,230 +212,786 @@ void getEdgeSets(
   }
 }
 
+// Collects the streamed mesh back into the PointGrid buffers
+class DrawDataSink : public MeshSink {
+  std::vector<glm::vec3>& vertices;
+  std::vector<glm::vec3>& normals;
+  std::vector<unsigned int>& indices;
+  std::vector<int>& numTrisPerCube;
+
+  public:
+    DrawDataSink(
+      std::vector<glm::vec3>& vertices,
+      std::vector<glm::vec3>& normals,
+      std::vector<unsigned int>& indices,
+      std::vector<int>& numTrisPerCube
+    ): vertices(vertices), normals(normals), indices(indices), numTrisPerCube(numTrisPerCube) {}
+
+    void addVertices(const glm::vec3* v, const glm::vec3* n, size_t count) {
+      vertices.insert(vertices.end(), v, v + count);
+      normals.insert(normals.end(), n, n + count);
+    }
+    void addTriangles(const unsigned int* i, size_t count) {
+      indices.insert(indices.end(), i, i + count);
+    }
+    void addCube(int numTris) {
+      numTrisPerCube.push_back(numTris);
+    }
+};
+
 void PointGrid::generateDrawData() {
   // Clear old data
   vertices.clear();
   normals.clear();
-  points.clear();
+  pointMask.clear();
   indices.clear();
   numTrisPerCube.clear();
 
-  std::map<std::string, int> vertexMap;
-  std::map<std::string, std::vector<glm::vec3>> normalMap;
-  for (int x = 0; x < p.sizeX() - 1; x++) {
-    for (int y = 0; y < p.sizeY() - 1; y++) {
-      for (int z = 0; z < p.sizeZ() - 1; z++) {
+  DrawDataSink sink(vertices, normals, indices, numTrisPerCube);
+  // Show March needs the cubes in order, so it waits for the whole field
+  if (!scalarField && pipelinesField() && !p.showMarch) {
+    generatePipelinedDrawData(sink);
+    if (p.showPoints) generatePointMask();
+  } else {
+    if (!scalarField && fieldFunc && p.mesher != MESHER_ADAPTIVE_CUBES) {
+      fillScalarField();
+    }
+    meshSlabs(sink, p.showPoints);
+  }
+
+  if (p.decimate) {
+    DecimateOptions options;
+    options.fromParams(p);
+    decimateMesh(vertices, normals, indices, options);
+    // Triangles no longer belong to cubes, so there is nothing to march through
+    numTrisPerCube.clear();
+  }
+  // Show March draws the triangles cube by cube, so they keep their order then
+  if (p.optimizeIndices && !p.showMarch) {
+    optimizeMesh(vertices, normals, indices);
+    numTrisPerCube.clear();
+  }
+}
+
+void PointGrid::generateDrawData(MeshSink& sink) {
+  if (!scalarField && pipelinesField()) {
+    generatePipelinedDrawData(sink);
+    return;
+  }
+  if (!scalarField && fieldFunc && p.mesher != MESHER_ADAPTIVE_CUBES) {
+    fillScalarField();
+  }
+  meshSlabs(sink, false);
+}
+
+/**
+  NOTE:
+  A vertex created in slab x lies between the planes
+  x and x + 1, so it can only be shared with slab x + 1.
+  We therefore only keep the vertex maps of the current
+  and previous slab alive, which bounds memory by the
+  area of a slab rather than the size of the mesh.
+*/
+void PointGrid::meshSlabs(MeshSink& sink, bool withPoints, std::function<void(int)> loadSlab) {
+  // Streamed volumes are never fully resident, so they are meshed uniformly
+  if (p.mesher == MESHER_ADAPTIVE_CUBES && !loadSlab) {
+    adaptiveMesh(sink, withPoints);
+    return;
+  }
+
+  if (p.mesher == MESHER_SURFACE_NETS || p.mesher == MESHER_DUAL_CONTOURING) {
+    netSlabs(sink, loadSlab);
+  } else {
+    // Resolve the mode once so the cube loop is specialised for it
+    glm::ivec3 cubeMin(0, 0, 0);
+    glm::ivec3 cubeMax(p.sizeX() - 1, p.sizeY() - 1, p.sizeZ() - 1);
+    if (p.interpolate) {
+      marchSlabs<true>(sink, loadSlab, cubeMin, cubeMax);
+    } else {
+      marchSlabs<false>(sink, loadSlab, cubeMin, cubeMax);
+    }
+  }
+  if (withPoints && !loadSlab) {
+    generatePointMask();
+  }
+}
+
+void PointGrid::generatePointMask() {
+  if (!scalarField && fieldFunc && p.mesher != MESHER_ADAPTIVE_CUBES) {
+    fillScalarField();
+  }
+  size_t count = (size_t)p.sizeX() * p.sizeY() * p.sizeZ();
+  if (!scalarField || fieldOriginX != 0 || fieldStorage.size() != count) return;
+
+  pointMask.reset(glm::ivec3(p.sizeX(), p.sizeY(), p.sizeZ()), p.density);
+  float isoValue = p.isoValue;
+  for (size_t i = 0; i < count; i++) {
+    if (scalarField[i] >= isoValue) {
+      PointMask::set(pointMask.inside, i);
+    }
+  }
+}
+
+/**
+  NOTE:
+  Triangulates one cube that the surface at isoValue
+  passes through, given its corner values and which
+  corners are inside, and returns its triangle count.
+*/
+template <bool Interpolate>
+int PointGrid::marchCube(
+  int x, int y, int z,
+  const float* values,
+  std::array<bool, 8>& activeNodes,
+  int numActiveNodes,
+  float isoValue,
+  SlabVertices& previous,
+  SlabVertices& current,
+  std::vector<unsigned int>& slabIndices
+) {
+  int sizeX = p.sizeX();
+  int sizeZ = p.sizeZ();
+  float density = p.density;
+
+
+  std::vector<std::vector<std::array<int, 2>>> edgeSets = {};
+  std::set<int> seenNodes;
+  int nextSet = 0;
+  while (seenNodes.size() < (numActiveNodes <= 4 ? numActiveNodes : 8 - numActiveNodes)) {
+    getEdgeSets(activeNodes, edgeSets, seenNodes, numActiveNodes <= 4, nextSet, nextSet);
+    nextSet++;
+  }
+
+  /**
+    NOTE:
+    A cube configuration is unambiguous when:
+    All the active nodes (or inactive if #active nodes > 4)
+    are adjacent to another identical node AND
+    (iff #active nodes > 2) there is one node that is
+    adjacent to 2 other identical nodes
+  */
+  glm::vec3 avgPos;
+  glm::vec3 avgIntersection;
+  std::set<int> usedActiveNodes = {};
+  std::vector<std::vector<std::array<glm::vec3, 3>>> intersectionSets = {};
+  std::vector<glm::vec3> faceNormals = {};
+  for (int set = 0; set < edgeSets.size(); set++) {
+    intersectionSets.push_back({});
+    avgPos = glm::vec3(0.0, 0.0, 0.0);
+    avgIntersection = glm::vec3(0.0, 0.0, 0.0);
+    for (auto edge : edgeSets[set]) {
+      // Active Node
+      int a = edge[0];
+      // Inactive Node
+      int b = edge[1];
+      float pXa = (x - sizeX/2 + a%2)/density;
+      float pYa = (y + (a % 4) / 2)/density;
+      float pZa = (z - sizeZ/2 + a / 4)/density;
+
+      float pXb = (x - sizeX/2 + b%2)/density;
+      float pYb = (y + (b % 4) / 2)/density;
+      float pZb = (z - sizeZ/2 + b / 4)/density;
+
+      glm::vec3 pointA(pXa, pYa, pZa);
+      glm::vec3 pointB(pXb, pYb, pZb);
+      
+      auto intersection = (pointA + pointB) / 2.0f;
+      
+      // Only add active node to avgPos
+      avgPos += pointA;
+      avgIntersection += intersection;
+      usedActiveNodes.insert(a);
+
+
+      intersectionSets[set].push_back({intersection, pointA, pointB});
+    }
+    avgPos /= edgeSets[set].size();
+    avgIntersection /= edgeSets[set].size();
+
+    // Calculate face normal
+    glm::vec3 faceNormal = glm::normalize(
+      avgIntersection - avgPos
+    );
+    faceNormals.push_back(faceNormal);
+  }
+
+  int trisPerCube = 0;
+  for (int currentSet = 0; currentSet < intersectionSets.size(); currentSet++) {
+    auto& points = intersectionSets[currentSet];
+    auto& edges = edgeSets[currentSet];
+
+    int numTris = 0;
+    int currentPoint = 0;
+    std::vector<int> usedPoints;
+    std::array<int, 2> lastEdge = {-1, -1};
+    // Specific case where we cannot just use the nearest points
+    // We must ensure there is always a "plateau" area
+    if (points.size() == 5) {
+      // Find the point that is horizontally adjacent to 2 other points
+      int numAdjacent = 0;
+      for (int i = 0; i < points.size(); i++) {
+        for (int j = 0; j < points.size(); j++) {
+          if (i == j) continue;
+          if (glm::distance(points[i][0], points[j][0]) == 1.0) {
+            numAdjacent++;
+          }
+        }
+        if (numAdjacent == 2) {
+          currentPoint = i;
+          break;
+        }
+        numAdjacent = 0;
+      }
+    }
+    
+    while (numTris < points.size() - 2) {
+      usedPoints.push_back(currentPoint);
+      // Select first point
+      int indexA = currentPoint;
+      auto pointA = points[currentPoint];
+      // std::cout << "Point A: " << pointA.x << ", " << pointA.y << ", " << pointA.z << std::endl;
+      // Get nearest point
+      float minDist = 1000000;
+      int minIndex = -1;
+      for (int i = 0; i < points.size(); i++) {
+        if (std::find(usedPoints.begin(), usedPoints.end(), i) != usedPoints.end()) continue;
+        float dist = glm::distance(pointA[0], points[i][0]);
+        if (dist < minDist) {
+          minDist = dist;
+          minIndex = i;
+        }
+      }
+      // Select second point
+      auto pointB = points[minIndex];
+      // std::cout << "Point B: " << pointB.x << ", " << pointB.y << ", " << pointB.z << std::endl;
+
+      // Get second nearest point
+      float nextMinDist = 1000000;
+      int nextMinIndex = -1;
+      bool bothHyp = false;
+
+      if (lastEdge[0] > -1) {
+        if (lastEdge[0] == currentPoint) {
+          nextMinIndex = lastEdge[1];
+        } else {
+          nextMinIndex = lastEdge[0];
+        }
+      } else {
+        for (int i = 0; i < points.size(); i++) {
+          if (i == minIndex || i == currentPoint) continue;
+          float dist = glm::distance(pointA[0], points[i][0]);
+          if (dist < nextMinDist) {
+            nextMinDist = dist;
+            nextMinIndex = i;
+          }
+        }
+      }
+    
+      // Select third point
+      auto pointC = points[nextMinIndex];
+      // std::cout << "Point C: " << pointC.x << ", " << pointC.y << ", " << pointC.z << std::endl;
+
+      lastEdge[0] = minIndex;
+      lastEdge[1] = nextMinIndex;
+
+      // Save point for next iteration
+      currentPoint = nextMinIndex;
+      // std::cout << "Current Triangle: " << numTris << std::endl;
+
+      auto& edgeA = edges[indexA];
+      auto& edgeB = edges[minIndex];
+      auto& edgeC = edges[nextMinIndex];
+      auto p1Interpolated = getInterpolatedIntersection<Interpolate>(isoValue, pointA[1], pointA[2], values[edgeA[0]], values[edgeA[1]]);
+      auto p2Interpolated = getInterpolatedIntersection<Interpolate>(isoValue, pointB[1], pointB[2], values[edgeB[0]], values[edgeB[1]]);
+      auto p3Interpolated = getInterpolatedIntersection<Interpolate>(isoValue, pointC[1], pointC[2], values[edgeC[0]], values[edgeC[1]]);
+
+      // Calculate the triangle normal using winding direction and compare it to the face normal
+      // If the triangle normal is in the opposite direction, swap the points
+      auto currentNormal = glm::cross(glm::normalize(p2Interpolated - p1Interpolated), glm::normalize(p3Interpolated - p1Interpolated));
+      if (glm::dot(currentNormal, faceNormals[currentSet]) > -0.0001) {
+        std::swap(p2Interpolated, p3Interpolated);
+      } else {
+        currentNormal = -currentNormal;
+      }
+
+      // For VBO Indexing
+      updateIndices<Interpolate>(p1Interpolated, currentNormal, previous, current, slabIndices);
+      updateIndices<Interpolate>(p2Interpolated, currentNormal, previous, current, slabIndices);
+      updateIndices<Interpolate>(p3Interpolated, currentNormal, previous, current, slabIndices);
+
+      numTris++;
+    }
+    trisPerCube += numTris;
+  }
+  return trisPerCube;
+}
+
+template <bool Interpolate>
+void PointGrid::marchSlabs(MeshSink& sink, std::function<void(int)>& loadSlab, glm::ivec3 cubeMin, glm::ivec3 cubeMax) {
+  int sizeY = p.sizeY();
+  int sizeZ = p.sizeZ();
+  float isoValue = p.isoValue;
+
+  // Offsets of the cube's corners from its first corner in the field
+  int cornerOffsets[8];
+  for (int i = 0; i < 8; i++) {
+    cornerOffsets[i] = (i / 4) + sizeZ * (((i % 4) / 2) + sizeY * (i % 2));
+  }
+
+  SlabVertices previous;
+  SlabVertices current;
+  std::vector<unsigned int> slabIndices;
+  for (int x = cubeMin.x; x < cubeMax.x; x++) {
+    if (loadSlab) {
+      loadSlab(x);
+    }
+    for (int y = cubeMin.y; y < cubeMax.y; y++) {
+      const float* row = scalarField + coordsToIndex(x, y, 0);
+      for (int z = cubeMin.z; z < cubeMax.z; z++) {
         int numActiveNodes = 0;
         std::array<bool, 8> activeNodes;
-        std::vector<int> intersectedEdges;
+        float values[8];
 
         for (int i = 0; i < 8; i++) {
-          int pX = x + i%2;
-          int pY = y + (i % 4) / 2;
-          int pZ = z + i / 4;
-          bool active = false;
-          if (scalarField[coordsToIndex(pX, pY, pZ)] >= p.isoValue) {
-            active = true;
-            numActiveNodes++;
-          }
-
+          values[i] = row[z + cornerOffsets[i]];
+          bool active = values[i] >= isoValue;
+          numActiveNodes += active;
           activeNodes[i] = active;
-          if ((pX == x || pX == p.sizeX() - 1) && (pY == y || pY == p.sizeY() - 1) && (pZ == z || pZ == p.sizeZ() - 1))
-            points.push_back(glm::vec4((pX - p.sizeX() / 2)/p.density, pY/p.density, (pZ - p.sizeZ() / 2)/p.density, active ? 1.0f : 0.0f));
         }
 
-        std::vector<std::vector<std::array<int, 2>>> edgeSets = {};
-        std::set<int> seenNodes;
-        int nextSet = 0;
-        while (seenNodes.size() < (numActiveNodes <= 4 ? numActiveNodes : 8 - numActiveNodes)) {
-          getEdgeSets(activeNodes, edgeSets, seenNodes, numActiveNodes <= 4, nextSet, nextSet);
-          nextSet++;
+        // Most cubes are nowhere near the surface
+        if (numActiveNodes == 0 || numActiveNodes == 8) {
+          sink.addCube(0);
+          continue;
         }
 
-        /**
-          NOTE:
-          A cube configuration is unambiguous when:
-          All the active nodes (or inactive if #active nodes > 4)
-          are adjacent to another identical node AND
-          (iff #active nodes > 2) there is one node that is
-          adjacent to 2 other identical nodes
-        */
-        glm::vec3 avgPos;
-        glm::vec3 avgIntersection;
-        std::set<int> usedActiveNodes = {};
-        std::vector<std::vector<std::array<glm::vec3, 3>>> intersectionSets = {};
-        std::vector<glm::vec3> faceNormals = {};
-        for (int set = 0; set < edgeSets.size(); set++) {
-          intersectionSets.push_back({});
-          avgPos = glm::vec3(0.0, 0.0, 0.0);
-          avgIntersection = glm::vec3(0.0, 0.0, 0.0);
-          for (auto edge : edgeSets[set]) {
-            // Active Node
-            int a = edge[0];
-            // Inactive Node
-            int b = edge[1];
-            float pXa = (x - p.sizeX()/2 + a%2)/p.density;
-            float pYa = (y + (a % 4) / 2)/p.density;
-            float pZa = (z - p.sizeZ()/2 + a / 4)/p.density;
-
-            float pXb = (x - p.sizeX()/2 + b%2)/p.density;
-            float pYb = (y + (b % 4) / 2)/p.density;
-            float pZb = (z - p.sizeZ()/2 + b / 4)/p.density;
-
-            glm::vec3 pointA(pXa, pYa, pZa);
-            glm::vec3 pointB(pXb, pYb, pZb);
-            
-            auto intersection = (pointA + pointB) / 2.0f;
-            
-            // Only add active node to avgPos
-            avgPos += pointA;
-            avgIntersection += intersection;
-            usedActiveNodes.insert(a);
-
-
-            intersectionSets[set].push_back({intersection, pointA, pointB});
-          }
-          avgPos /= edgeSets[set].size();
-          avgIntersection /= edgeSets[set].size();
-
-          // Calculate face normal
-          glm::vec3 faceNormal = glm::normalize(
-            avgIntersection - avgPos
-          );
-          faceNormals.push_back(faceNormal);
+        int trisPerCube = marchCube<Interpolate>(x, y, z, values, activeNodes, numActiveNodes, isoValue, previous, current, slabIndices);
+        sink.addCube(trisPerCube);
+      }
+    }
+
+    if (slabIndices.size()) {
+      sink.addTriangles(&slabIndices[0], slabIndices.size());
+      slabIndices.clear();
+    }
+
+    // Vertices of the previous slab can no longer be shared
+    flushSlab(previous, sink);
+    std::swap(previous, current);
+    current = SlabVertices();
+    current.firstIndex = previous.firstIndex + previous.vertices.size();
+  }
+  flushSlab(previous, sink);
+}
+
+/**
+  NOTE:
+  Nested surfaces share a single sweep over the field.
+  Each cube's corners are read once, and only the iso
+  values between its smallest and largest corner cut
+  it, so a binary search over the sorted values finds
+  the layers to triangulate and every other cube is
+  skipped for all of them at once. Each layer keeps
+  its own slab vertices and goes to its own sink, so
+  its indices start at zero like any other mesh.
+*/
+template <bool Interpolate>
+void PointGrid::marchLayers(const std::vector<float>& isoValues, const std::vector<MeshSink*>& sinks) {
+  int sizeX = p.sizeX();
+  int sizeY = p.sizeY();
+  int sizeZ = p.sizeZ();
+  size_t numLayers = isoValues.size();
+
+  int cornerOffsets[8];
+  for (int i = 0; i < 8; i++) {
+    cornerOffsets[i] = (i / 4) + sizeZ * (((i % 4) / 2) + sizeY * (i % 2));
+  }
+
+  std::vector<SlabVertices> previous(numLayers);
+  std::vector<SlabVertices> current(numLayers);
+  std::vector<std::vector<unsigned int>> slabIndices(numLayers);
+  for (int x = 0; x < sizeX - 1; x++) {
+    for (int y = 0; y < sizeY - 1; y++) {
+      const float* row = scalarField + coordsToIndex(x, y, 0);
+      for (int z = 0; z < sizeZ - 1; z++) {
+        float values[8];
+        float lo = row[z];
+        float hi = lo;
+        for (int i = 0; i < 8; i++) {
+          values[i] = row[z + cornerOffsets[i]];
+          lo = std::min(lo, values[i]);
+          hi = std::max(hi, values[i]);
         }
 
-        int trisPerCube = 0;
-        for (int currentSet = 0; currentSet < intersectionSets.size(); currentSet++) {
-          auto points = intersectionSets[currentSet];
-
-          int numTris = 0;
-          int currentPoint = 0;
-          std::vector<int> usedPoints;
-          std::array<int, 2> lastEdge = {-1, -1};
-          // Specific case where we cannot just use the nearest points
-          // We must ensure there is always a "plateau" area
-          if (points.size() == 5) {
-            // Find the point that is horizontally adjacent to 2 other points
-            int numAdjacent = 0;
-            for (int i = 0; i < points.size(); i++) {
-              for (int j = 0; j < points.size(); j++) {
-                if (i == j) continue;
-                if (glm::distance(points[i][0], points[j][0]) == 1.0) {
-                  numAdjacent++;
-                }
-              }
-              if (numAdjacent == 2) {
-                currentPoint = i;
-                break;
-              }
-              numAdjacent = 0;
-            }
+        // A layer cuts the cube when some corners are below it and some are not
+        auto layer = std::upper_bound(isoValues.begin(), isoValues.end(), lo);
+        for (; layer != isoValues.end() && *layer <= hi; layer++) {
+          size_t l = layer - isoValues.begin();
+          int numActiveNodes = 0;
+          std::array<bool, 8> activeNodes;
+          for (int i = 0; i < 8; i++) {
+            activeNodes[i] = values[i] >= *layer;
+            numActiveNodes += activeNodes[i];
           }
-          
-          while (numTris < points.size() - 2) {
-            usedPoints.push_back(currentPoint);
-            // Select first point
-            auto pointA = points[currentPoint];
-            // std::cout << "Point A: " << pointA.x << ", " << pointA.y << ", " << pointA.z << std::endl;
-            // Get nearest point
-            float minDist = 1000000;
-            int minIndex = -1;
-            for (int i = 0; i < points.size(); i++) {
-              if (std::find(usedPoints.begin(), usedPoints.end(), i) != usedPoints.end()) continue;
-              float dist = glm::distance(pointA[0], points[i][0]);
-              if (dist < minDist) {
-                minDist = dist;
-                minIndex = i;
-              }
-            }
-            // Select second point
-            auto pointB = points[minIndex];
-            // std::cout << "Point B: " << pointB.x << ", " << pointB.y << ", " << pointB.z << std::endl;
-
-            // Get second nearest point
-            float nextMinDist = 1000000;
-            int nextMinIndex = -1;
-            bool bothHyp = false;
-
-            if (lastEdge[0] > -1) {
-              if (lastEdge[0] == currentPoint) {
-                nextMinIndex = lastEdge[1];
-              } else {
-                nextMinIndex = lastEdge[0];
-              }
-            } else {
-              for (int i = 0; i < points.size(); i++) {
-                if (i == minIndex || i == currentPoint) continue;
-                float dist = glm::distance(pointA[0], points[i][0]);
-                if (dist < nextMinDist) {
-                  nextMinDist = dist;
-                  nextMinIndex = i;
-                }
-              }
-            }
-          
-            // Select third point
-            auto pointC = points[nextMinIndex];
-            // std::cout << "Point C: " << pointC.x << ", " << pointC.y << ", " << pointC.z << std::endl;
-
-            lastEdge[0] = minIndex;
-            lastEdge[1] = nextMinIndex;
-
-            // Save point for next iteration
-            currentPoint = nextMinIndex;
-            // std::cout << "Current Triangle: " << numTris << std::endl;
-
-            auto p1Interpolated = getInterpolatedIntersection(pointA[1], pointA[2]);
-            auto p2Interpolated = getInterpolatedIntersection(pointB[1], pointB[2]);
-            auto p3Interpolated = getInterpolatedIntersection(pointC[1], pointC[2]);
-
-            // Calculate the triangle normal using winding direction and compare it to the face normal
-            // If the triangle normal is in the opposite direction, swap the points
-            auto currentNormal = glm::cross(glm::normalize(p2Interpolated - p1Interpolated), glm::normalize(p3Interpolated - p1Interpolated));
-            if (glm::dot(currentNormal, faceNormals[currentSet]) > -0.0001) {
-              std::swap(p2Interpolated, p3Interpolated);
-            } else {
-              currentNormal = -currentNormal;
-            }
-
-            // For VBO Indexing
-            updateIndices(p1Interpolated, currentNormal, vertexMap, normalMap);
-            updateIndices(p2Interpolated, currentNormal, vertexMap, normalMap);
-            updateIndices(p3Interpolated, currentNormal, vertexMap, normalMap);
-
-            numTris++;
+          marchCube<Interpolate>(x, y, z, values, activeNodes, numActiveNodes, *layer, previous[l], current[l], slabIndices[l]);
+        }
+      }
+    }
+
+    for (size_t l = 0; l < numLayers; l++) {
+      if (slabIndices[l].size()) {
+        sinks[l]->addTriangles(&slabIndices[l][0], slabIndices[l].size());
+        slabIndices[l].clear();
+      }
+      flushSlab(previous[l], *sinks[l]);
+      std::swap(previous[l], current[l]);
+      current[l] = SlabVertices();
+      current[l].firstIndex = previous[l].firstIndex + previous[l].vertices.size();
+    }
+  }
+  for (size_t l = 0; l < numLayers; l++) {
+    flushSlab(previous[l], *sinks[l]);
+  }
+}
+
+std::vector<float> getLayerIsoValues(Params& p) {
+  std::vector<float> isoValues;
+  for (int i = 0; i < p.numLayers; i++) {
+    isoValues.push_back(p.isoValue + i * p.layerSpacing);
+  }
+  return isoValues;
+}
+
+void PointGrid::generateLayers(const std::vector<float>& isoValues, const std::vector<MeshSink*>& sinks) {
+  // A scene filled for other iso values has constant bricks the layers may cross, so it is filled again
+  if (sdfProgram && scalarField && !isoValues.empty()) {
+    auto range = std::minmax_element(isoValues.begin(), isoValues.end());
+    if (*range.first < filledIsoMin || *range.second > filledIsoMax) {
+      coverIsoValues(isoValues);
+      fillScalarField();
+    }
+  }
+  // Only marching cubes has a shared sweep, the other meshers make a pass per layer
+  if (p.mesher != MESHER_MARCHING_CUBES) {
+    float isoValue = p.isoValue;
+    for (size_t l = 0; l < isoValues.size(); l++) {
+      p.isoValue = isoValues[l];
+      meshSlabs(*sinks[l], false);
+    }
+    p.isoValue = isoValue;
+    return;
+  }
+  if (!scalarField && fieldFunc) {
+    fillScalarField();
+  }
+  if (!scalarField) return;
+
+  // The sweep searches the iso values, so they are sorted along with their sinks
+  std::vector<size_t> order(isoValues.size());
+  for (size_t l = 0; l < order.size(); l++) {
+    order[l] = l;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return isoValues[a] < isoValues[b];
+  });
+  std::vector<float> sortedValues;
+  std::vector<MeshSink*> sortedSinks;
+  for (size_t l : order) {
+    sortedValues.push_back(isoValues[l]);
+    sortedSinks.push_back(sinks[l]);
+  }
+
+  if (p.interpolate) {
+    marchLayers<true>(sortedValues, sortedSinks);
+  } else {
+    marchLayers<false>(sortedValues, sortedSinks);
+  }
+}
+
+/**
+  NOTE:
+  The layers end up one after another in the usual
+  draw buffers, and getLayers gives the range of the
+  index buffer each one is drawn from. When decimating,
+  the triangle budget is split evenly between them.
+*/
+void PointGrid::generateLayerDrawData(const std::vector<float>& isoValues) {
+  vertices.clear();
+  normals.clear();
+  pointMask.clear();
+  indices.clear();
+  numTrisPerCube.clear();
+  layers.clear();
+
+  size_t numLayers = isoValues.size();
+  std::vector<std::vector<glm::vec3>> layerVertices(numLayers);
+  std::vector<std::vector<glm::vec3>> layerNormals(numLayers);
+  std::vector<std::vector<unsigned int>> layerIndices(numLayers);
+  std::vector<std::vector<int>> layerCubes(numLayers);
+  std::vector<DrawDataSink> layerSinks;
+  std::vector<MeshSink*> sinks;
+  layerSinks.reserve(numLayers);
+  for (size_t l = 0; l < numLayers; l++) {
+    layerSinks.emplace_back(layerVertices[l], layerNormals[l], layerIndices[l], layerCubes[l]);
+    sinks.push_back(&layerSinks[l]);
+  }
+  generateLayers(isoValues, sinks);
+
+  DecimateOptions options;
+  options.fromParams(p);
+  if (numLayers) {
+    options.targetTriangles /= numLayers;
+  }
+  for (size_t l = 0; l < numLayers; l++) {
+    if (p.decimate) {
+      decimateMesh(layerVertices[l], layerNormals[l], layerIndices[l], options);
+    }
+    if (p.optimizeIndices) {
+      optimizeMesh(layerVertices[l], layerNormals[l], layerIndices[l]);
+    }
+
+    MeshLayer layer;
+    layer.isoValue = isoValues[l];
+    layer.firstIndex = indices.size();
+    layer.numIndices = layerIndices[l].size();
+    layers.push_back(layer);
+
+    unsigned int firstVertex = vertices.size();
+    for (unsigned int index : layerIndices[l]) {
+      indices.push_back(firstVertex + index);
+    }
+    vertices.insert(vertices.end(), layerVertices[l].begin(), layerVertices[l].end());
+    normals.insert(normals.end(), layerNormals[l].begin(), layerNormals[l].end());
+  }
+}
+
+void PointGrid::generateBrickMeshes() {
+  // Adaptive meshing leaves the field unsampled, but brushes need all of it
+  if (!scalarField && fieldFunc) {
+    fillScalarField();
+  }
+  brickCounts = glm::ivec3(
+    (p.sizeX() - 1 + MESH_BRICK - 1) / MESH_BRICK,
+    (p.sizeY() - 1 + MESH_BRICK - 1) / MESH_BRICK,
+    (p.sizeZ() - 1 + MESH_BRICK - 1) / MESH_BRICK
+  );
+  bricks.assign(brickCounts.x * brickCounts.y * brickCounts.z, MeshBrick());
+  int i = 0;
+  for (int bx = 0; bx < brickCounts.x; bx++) {
+    for (int by = 0; by < brickCounts.y; by++) {
+      for (int bz = 0; bz < brickCounts.z; bz++, i++) {
+        meshBrick(bx, by, bz, bricks[i]);
+      }
+    }
+  }
+  dirty = false;
+  history.reset(p.sizeX(), p.sizeY(), p.sizeZ());
+}
+
+void PointGrid::meshBrick(int bx, int by, int bz, MeshBrick& brick) {
+  glm::ivec3 size(p.sizeX() - 1, p.sizeY() - 1, p.sizeZ() - 1);
+  glm::ivec3 brickMin(bx * MESH_BRICK, by * MESH_BRICK, bz * MESH_BRICK);
+  glm::ivec3 brickMax(
+    std::min(brickMin.x + MESH_BRICK, size.x),
+    std::min(brickMin.y + MESH_BRICK, size.y),
+    std::min(brickMin.z + MESH_BRICK, size.z)
+  );
+  meshRegion(brickMin, brickMax, brick);
+}
+
+/**
+  NOTE:
+  A region is meshed with a border of one cube around
+  it, so vertices on its faces average the normals of
+  the triangles on both sides, just as they would in
+  the full mesh. The border's triangles are dropped
+  afterwards, since they belong to the neighbours.
+*/
+void PointGrid::meshRegion(glm::ivec3 brickMin, glm::ivec3 brickMax, MeshBrick& brick) {
+  glm::ivec3 size(p.sizeX() - 1, p.sizeY() - 1, p.sizeZ() - 1);
+  glm::ivec3 cubeMin(std::max(brickMin.x - 1, 0), std::max(brickMin.y - 1, 0), std::max(brickMin.z - 1, 0));
+  glm::ivec3 cubeMax(std::min(brickMax.x + 1, size.x), std::min(brickMax.y + 1, size.y), std::min(brickMax.z + 1, size.z));
+
+  std::vector<glm::vec3> borderVertices;
+  std::vector<glm::vec3> borderNormals;
+  std::vector<unsigned int> borderIndices;
+  std::vector<int> trisPerCube;
+  DrawDataSink sink(borderVertices, borderNormals, borderIndices, trisPerCube);
+  std::function<void(int)> noSlabs;
+  if (p.interpolate) {
+    marchSlabs<true>(sink, noSlabs, cubeMin, cubeMax);
+  } else {
+    marchSlabs<false>(sink, noSlabs, cubeMin, cubeMax);
+  }
+
+  // Triangles arrive in cube order, so each cube's can be kept or skipped in turn
+  brick.vertices.clear();
+  brick.normals.clear();
+  brick.indices.clear();
+  std::vector<int> remap(borderVertices.size(), -1);
+  size_t next = 0;
+  int cube = 0;
+  for (int x = cubeMin.x; x < cubeMax.x; x++) {
+    for (int y = cubeMin.y; y < cubeMax.y; y++) {
+      for (int z = cubeMin.z; z < cubeMax.z; z++, cube++) {
+        size_t count = trisPerCube[cube] * 3;
+        bool inBrick = x >= brickMin.x && x < brickMax.x && y >= brickMin.y && y < brickMax.y && z >= brickMin.z && z < brickMax.z;
+        for (size_t i = next; inBrick && i < next + count; i++) {
+          unsigned int index = borderIndices[i];
+          if (remap[index] < 0) {
+            remap[index] = brick.vertices.size();
+            brick.vertices.push_back(borderVertices[index]);
+            brick.normals.push_back(borderNormals[index]);
           }
-          trisPerCube += numTris;
+          brick.indices.push_back(remap[index]);
         }
-        numTrisPerCube.push_back(trisPerCube);
+        next += count;
+      }
+    }
+  }
+}
+
+// Swaps x and z back for volumes that were presented transposed
+class TransposedSink : public MeshSink {
+  MeshSink& sink;
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec3> normals;
+  std::vector<unsigned int> indices;
+
+  public:
+    TransposedSink(MeshSink& sink): sink(sink) {}
+
+    void addVertices(const glm::vec3* v, const glm::vec3* n, size_t count) {
+      vertices.resize(count);
+      normals.resize(count);
+      for (size_t i = 0; i < count; i++) {
+        vertices[i] = glm::vec3(v[i].z, v[i].y, v[i].x);
+        normals[i] = glm::vec3(n[i].z, n[i].y, n[i].x);
+      }
+      sink.addVertices(vertices.data(), normals.data(), count);
+    }
+    void addTriangles(const unsigned int* i, size_t count) {
+      // Mirroring flips the winding, so swap two corners of every triangle
+      indices.assign(i, i + count);
+      for (size_t t = 0; t + 2 < count; t += 3) {
+        std::swap(indices[t + 1], indices[t + 2]);
       }
+      sink.addTriangles(indices.data(), count);
+    }
+    void addCube(int numTris) {
+      sink.addCube(numTris);
     }
+};
+
+/**
+  NOTE:
+  Volumes are meshed out of core: only chunkSlabs + 1
+  x-planes of the field are resident at a time, the
+  extra plane being shared with the next chunk. While
+  a chunk is meshed the next one is prefetched and the
+  previous one is released.
+*/
+void PointGrid::generateDrawData(VolumeFile& volume, MeshSink& sink, int chunkSlabs) {
+  p.density = 1.0f;
+  p.numUnitsX = volume.gridSizeX();
+  p.numUnitsY = volume.gridSizeY();
+  p.numUnitsZ = volume.gridSizeZ();
+  chunkSlabs = std::max(1, chunkSlabs);
+  invalidateRanges();
+
+  int windowEnd = -1;
+  auto loadSlab = [&](int x) {
+    if (x + 1 < windowEnd) return;
+
+    int planes = std::min(chunkSlabs + 1, p.sizeX() - x);
+    volume.release(fieldOriginX, x - fieldOriginX);
+    fieldOriginX = x;
+    windowEnd = x + planes;
+
+    scalarField = volume.mapPlanes(x, planes);
+    if (!scalarField) {
+      fieldStorage.resize((size_t)planes * p.sizeY() * p.sizeZ());
+      volume.readPlanes(x, planes, fieldStorage.data());
+      scalarField = fieldStorage.data();
+    }
+    volume.prefetch(windowEnd, chunkSlabs + 1);
+  };
+
+  fieldOriginX = 0;
+  if (volume.isTransposed()) {
+    TransposedSink transposed(sink);
+    meshSlabs(transposed, false, loadSlab);
+  } else {
+    meshSlabs(sink, false, loadSlab);
   }
-  for (auto it = normalMap.begin(); it != normalMap.end(); it++) {
+
+  // The window no longer describes a full field
+  fieldStorage.clear();
+  scalarField = nullptr;
+  fieldOriginX = 0;
+}
+
+// Only the worker processes read the volume, the coordinator never holds any of it
+bool PointGrid::generateShardedDrawData(VolumeFile& volume, MeshSink& sink, int numWorkers, int numShards, ShardReport* report) {
+  p.density = 1.0f;
+  p.numUnitsX = volume.gridSizeX();
+  p.numUnitsY = volume.gridSizeY();
+  p.numUnitsZ = volume.gridSizeZ();
+  invalidateRanges();
+  fieldStorage.clear();
+  scalarField = nullptr;
+  fieldOriginX = 0;
+
+  // A shard's cubes and the border cube either side of them
+  auto loadShard = [&](int x0, int x1) {
+    int first = std::max(x0 - 1, 0);
+    int planes = std::min(x1 + 2, p.sizeX()) - first;
+    fieldOriginX = first;
+    scalarField = volume.mapPlanes(first, planes);
+    if (!scalarField) {
+      fieldStorage.resize((size_t)planes * p.sizeY() * p.sizeZ());
+      volume.readPlanes(first, planes, fieldStorage.data());
+      scalarField = fieldStorage.data();
+    }
+  };
+  bool ok;
+  if (volume.isTransposed()) {
+    TransposedSink transposed(sink);
+    ok = meshShards(transposed, numWorkers, numShards, report, loadShard);
+  } else {
+    ok = meshShards(sink, numWorkers, numShards, report, loadShard);
+  }
+  scalarField = nullptr;
+  fieldOriginX = 0;
+  return ok;
+}
+
+void PointGrid::flushSlab(SlabVertices& slab, MeshSink& sink) {
+  for (auto it = slab.normalMap.begin(); it != slab.normalMap.end(); it++) {
     auto normal = it->second;
     glm::vec3 avgNormal = glm::vec3(0);
     for (auto n : normal) {
       avgNormal += n;
     }
     avgNormal /= normal.size();
-    normals[vertexMap[it->first]] = avgNormal;
+    slab.normals[slab.vertexMap[it->first] - slab.firstIndex] = avgNormal;
+  }
+
+  if (slab.vertices.size()) {
+    sink.addVertices(&slab.vertices[0], &slab.normals[0], slab.vertices.size());
   }
 }
 
-glm::vec3 PointGrid::getInterpolatedIntersection(glm::vec3& point1, glm::vec3& point2) {
-  if (!p.interpolate) {
+template <bool Interpolate>
+glm::vec3 PointGrid::getInterpolatedIntersection(float isoValue, glm::vec3& point1, glm::vec3& point2, float valP1, float valP2) {
+  if (!Interpolate) {
     return (point1 + point2) / 2.0f;
   }
 
-  auto valP1 = scalarField[coordsToIndex(point1.x * p.density + p.sizeX()/2, point1.y * p.density, point1.z * p.density + p.sizeZ()/2)];
-  auto valP2 = scalarField[coordsToIndex(point2.x * p.density + p.sizeX()/2, point2.y * p.density, point2.z * p.density + p.sizeZ()/2)];
-
-  
   if (abs(valP1 - valP2) < 0.000001) {
     return point1;
   }
-  auto mu = (p.isoValue - valP1) / (valP2 - valP1);
+  auto mu = (isoValue - valP1) / (valP2 - valP1);
   return point1 + mu * (point2 - point1);
 }
 
@@ -327,23 +1013,35 @@ std::string vectorToKey(glm::vec3 vec) {
   return std::to_string(vec.x) + "," + std::to_string(vec.y) + "," + std::to_string(vec.z);
 }
 
+template <bool Interpolate>
 void PointGrid::updateIndices(
   glm::vec3& point,
   glm::vec3& normal,
-  std::map<std::string, int>& vertexMap,
-  std::map<std::string, std::vector<glm::vec3>>& normalMap
+  SlabVertices& previous,
+  SlabVertices& current,
+  std::vector<unsigned int>& slabIndices
 ) {
   auto pointKey = vectorToKey(point);
-  if (!vertexMap.count(pointKey) || (glm::dot(normal, normalMap[pointKey][0]) < 1 && !p.interpolate)) {
-    vertexMap.insert({pointKey, vertices.size()});
-    normalMap.insert({pointKey, {normal}});
+  SlabVertices* owner = nullptr;
+  if (current.vertexMap.count(pointKey)) {
+    owner = &current;
+  } else if (previous.vertexMap.count(pointKey)) {
+    owner = &previous;
+  }
 
-    indices.push_back(vertices.size());
-    vertices.push_back(point);
-    normals.push_back(normal);
+  if (!owner || (!Interpolate && glm::dot(normal, owner->normalMap[pointKey][0]) < 1)) {
+    unsigned int index = current.firstIndex + current.vertices.size();
+    if (!owner) {
+      current.vertexMap.insert({pointKey, index});
+      current.normalMap.insert({pointKey, {normal}});
+    }
+
+    slabIndices.push_back(index);
+    current.vertices.push_back(point);
+    current.normals.push_back(normal);
   } else {
-    normalMap[pointKey].push_back(normal);
-    indices.push_back(vertexMap[pointKey]);
+    owner->normalMap[pointKey].push_back(normal);
+    slabIndices.push_back(owner->vertexMap[pointKey]);
   }
 }
 
@@ -355,10 +1053,6 @@ std::vector<glm::vec3>& PointGrid::getNormals() {
   return normals;
 }
 
-std::vector<glm::vec4>& PointGrid::getPoints() {
-  return points;
-}
-
 std::vector<unsigned int>& PointGrid::getIndices() {
   return indices;
 }
@@ -6,8 +6,123 @@
 #include <glm/glm.hpp>
 #include <functional>
 #include <map>
+#include <string>
+#include <array>
+#include <cstdint>
 
 #include "params.h"
+#include "meshSink.h"
+#include "volumeFile.h"
+#include "sdfGraph.h"
+#include "fieldHistory.h"
+#include "taskGraph.h"
+
+// Vertices created while meshing one slab, held until their normals are final
+struct SlabVertices {
+  unsigned int firstIndex = 0;
+  std::map<std::string, int> vertexMap;
+  std::map<std::string, std::vector<glm::vec3>> normalMap;
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec3> normals;
+};
+
+enum BrushMode {
+  BRUSH_ADD = 0,
+  BRUSH_SUBTRACT = 1,
+  BRUSH_SMOOTH = 2
+};
+
+// A spherical edit of the field, in world coordinates
+struct Brush {
+  glm::vec3 centre;
+  float radius = 2.0f;
+  float strength = 0.1f;
+  int mode = BRUSH_ADD;
+};
+
+/**
+  NOTE:
+  The points overlay only needs to know whether each
+  grid point is inside, so it keeps a bit per point, in
+  the order of coordsToIndex, and the shader works out
+  where the point is from its index. Adaptive meshing
+  only samples some of the points, so it also keeps a
+  bit per point that was sampled.
+*/
+struct PointMask {
+  glm::ivec3 size = glm::ivec3(0);
+  float density = 1.0f;
+  std::vector<uint32_t> inside;
+  // Empty when every point was sampled
+  std::vector<uint32_t> sampled;
+
+  size_t numPoints() const { return inside.empty() ? 0 : (size_t)size.x * size.y * size.z; }
+  void clear() {
+    size = glm::ivec3(0);
+    inside.clear();
+    sampled.clear();
+  }
+  void reset(glm::ivec3 gridSize, float gridDensity) {
+    size = gridSize;
+    density = gridDensity;
+    inside.assign(((size_t)size.x * size.y * size.z + 31) / 32, 0);
+    sampled.clear();
+  }
+  static void set(std::vector<uint32_t>& bits, size_t i) { bits[i >> 5] |= 1u << (i & 31); }
+};
+
+// Cubes meshed together, so an edit only remeshes and uploads the bricks it touches
+const int MESH_BRICK = 16;
+struct MeshBrick {
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec3> normals;
+  std::vector<unsigned int> indices;
+};
+
+// Blocks of QUERY_BLOCK^3 cubes are the finest level skipped by surface queries
+const int QUERY_BLOCK = 4;
+// One surface of a layered mesh, drawn from its own range of the index buffer
+struct MeshLayer {
+  float isoValue;
+  size_t firstIndex = 0;
+  size_t numIndices = 0;
+};
+// The iso values of the layers Params asks for, starting at isoValue
+std::vector<float> getLayerIsoValues(Params& p);
+
+// A connected region of grid points inside the surface, 6-connected
+struct Island {
+  size_t numPoints = 0;
+  // Grid edges the surface crosses, each a vertex in marching cubes
+  size_t numCrossings = 0;
+  // Euler's formula for a closed surface of genus 0, F = 2V - 4
+  size_t estimatedTriangles() const { return numCrossings > 2 ? 2 * numCrossings - 4 : 0; }
+};
+
+struct IslandReport {
+  size_t numIslands = 0;
+  size_t numRemoved = 0;
+  size_t pointsRemoved = 0;
+  size_t largestPoints = 0;
+  // Islands with fewer points than 10, 100, 1000, ... and the rest
+  std::vector<size_t> sizeHistogram;
+  float milliseconds = 0.0f;
+};
+
+struct ShardReport {
+  int numShards = 0;
+  int numWorkers = 0;
+  // Shards meshed again after their worker died or failed
+  int numRetries = 0;
+};
+
+struct RayHit {
+  bool hit = false;
+  glm::vec3 position;
+  glm::vec3 normal;
+  // Along the ray, in world units
+  float distance = 0.0f;
+};
 
 class PointGrid {
   Params& p;
@@ -16,10 +131,89 @@ class PointGrid {
   std::vector<glm::vec3> vertices;
   std::vector<glm::vec3> normals;
   
-  std::vector<glm::vec4> points;
+  PointMask pointMask;
   std::vector<int> numTrisPerCube;
+  std::vector<MeshLayer> layers;
+
+  // The field either lives in fieldStorage or is borrowed from a mapped volume.
+  // It may only hold the x-planes starting at fieldOriginX.
+  std::vector<float> fieldStorage;
+  float* scalarField = nullptr;
+  int fieldOriginX = 0;
+
+  // Adaptive meshing samples the field function on demand instead
+  std::function<float(int, int, int, Params&)> fieldFunc;
+  const SdfProgram* sdfProgram = nullptr;
+  size_t numSamples = 0;
+  // Scene bricks are filled with a constant where no iso value in this range can cross them
+  std::vector<float> extraIsoValues;
+  float filledIsoMin = 0.0f;
+  float filledIsoMax = 0.0f;
+  void getIsoRange(float& isoMin, float& isoMax);
+
+  // withPoints also fills the points overlay, after the mesh rather than in the cube loop
+  void meshSlabs(MeshSink& sink, bool withPoints, std::function<void(int)> loadSlab = nullptr);
+  // Marching cubes over the cubes in [cubeMin, cubeMax), instantiated per mode
+  // so the cube loop does not test it
+  template <bool Interpolate>
+  void marchSlabs(MeshSink& sink, std::function<void(int)>& loadSlab, glm::ivec3 cubeMin, glm::ivec3 cubeMax);
+  template <bool Interpolate>
+  int marchCube(
+    int x, int y, int z,
+    const float* values,
+    std::array<bool, 8>& activeNodes,
+    int numActiveNodes,
+    float isoValue,
+    SlabVertices& previous,
+    SlabVertices& current,
+    std::vector<unsigned int>& slabIndices
+  );
+  template <bool Interpolate>
+  void marchLayers(const std::vector<float>& isoValues, const std::vector<MeshSink*>& sinks);
+  void flushSlab(SlabVertices& slab, MeshSink& sink);
+  void netSlabs(MeshSink& sink, std::function<void(int)> loadSlab);
+  void adaptiveMesh(MeshSink& sink, bool withPoints);
+  void sampleField(bool sample = true);
+  void fillScalarField();
+  // Fills field, which the grid then reads but does not own
+  void fillScalarField(float* field);
+  void fillPlanes(int x0, int x1);
+  void removeSmallIslands();
+  IslandReport islandReport;
+
+  // Sculpting keeps a mesh per brick, and the grid points edited since the last remesh
+  std::vector<MeshBrick> bricks;
+  glm::ivec3 brickCounts;
+  bool dirty = false;
+  glm::ivec3 dirtyMin;
+  glm::ivec3 dirtyMax;
+  FieldHistory history;
 
-  float* scalarField;
+  void meshBrick(int bx, int by, int bz, MeshBrick& brick);
+  // The cubes in [brickMin, brickMax), with normals as in the full mesh
+  void meshRegion(glm::ivec3 brickMin, glm::ivec3 brickMax, MeshBrick& brick);
+  void markDirty(glm::ivec3 lo, glm::ivec3 hi);
+
+  // Field evaluation and marching cubes chained per brick, see brickPipeline.cpp
+  bool pipelinesField();
+  void generatePipelinedDrawData(MeshSink& sink);
+  TaskReport pipelineReport;
+
+  // Forks the shard workers, each of which calls loadShard with its cubes' x range before meshing them
+  bool meshShards(MeshSink& sink, int numWorkers, int numShards, ShardReport* report, std::function<void(int, int)> loadShard);
+
+  // Min and max of the field per block, for each level of a pyramid of blocks
+  std::vector<std::vector<glm::vec2>> rangeLevels;
+  std::vector<glm::ivec3> rangeCounts;
+  bool rangesDirty = false;
+  glm::ivec3 rangesDirtyMin;
+  glm::ivec3 rangesDirtyMax;
+
+  void invalidateRanges();
+  void markRangesDirty(glm::ivec3 lo, glm::ivec3 hi);
+  void updateRanges();
+  float sampleTrilinear(glm::vec3 g) const;
+  RayHit traceRay(glm::vec3 origin, glm::vec3 direction) const;
 
   public:
     PointGrid(Params& params);
@@ -28,23 +222,70 @@ class PointGrid {
     std::vector<glm::vec3>& getNormals();
     std::vector<unsigned int>& getIndices();
 
-    std::vector<glm::vec4>& getPoints();
-    std::vector<unsigned int>& getPointIndices();
+    // Filled by generateDrawData only while Show Points is on
+    PointMask& getPointMask() { return pointMask; }
+    void generatePointMask();
     
     std::vector<int>& getNumTrisPerCube();
+    size_t getNumSamples() { return numSamples; }
 
-    void generateScalarField(std::function<float(int, int, int, Params&)> func);
+    // With sample false the field is only filled once a mesher needs it, see generateShardedDrawData
+    void generateScalarField(std::function<float(int, int, int, Params&)> func, bool sample = true);
+    void generateScalarField(const SdfProgram& program, bool sample = true);
+    // Scene fields filled from now on are right at these iso values too, not only the ones Params asks for
+    void coverIsoValues(const std::vector<float>& isoValues) { extraIsoValues = isoValues; }
+    bool saveScalarField(const std::string& path, const std::string& fieldName, bool lossless = false);
+    bool loadScalarField(const std::string& path);
+    bool loadScalarField(const std::string& path, int x0, int y0, int z0, int x1, int y1, int z1);
     void generateDrawData();
+    void generateDrawData(MeshSink& sink);
+    void generateDrawData(VolumeFile& volume, MeshSink& sink, int chunkSlabs);
+
+    // Marching cubes in forked worker processes, a run of x-slabs each, see shardedMeshing.cpp
+    bool generateShardedDrawData(MeshSink& sink, int numWorkers, int numShards = 0, ShardReport* report = nullptr);
+    // Each worker reads its shard's planes straight from the mapped volume
+    bool generateShardedDrawData(VolumeFile& volume, MeshSink& sink, int numWorkers, int numShards = 0, ShardReport* report = nullptr);
+
+    // A surface per iso value (sorted ascending), meshed in one pass over the field
+    void generateLayers(const std::vector<float>& isoValues, const std::vector<MeshSink*>& sinks);
+    void generateLayerDrawData(const std::vector<float>& isoValues);
+    std::vector<MeshLayer>& getLayers() { return layers; }
+
+    // Labels every grid point with its island, or UINT_MAX when outside
+    void findIslands(std::vector<unsigned int>& labels, std::vector<Island>& islands, int numThreads = 0);
+    // From the last field filtered by minIslandPoints or minIslandTriangles
+    IslandReport& getIslandReport() { return islandReport; }
+    // From the last mesh made with pipelineBricks, empty otherwise
+    TaskReport& getPipelineReport() { return pipelineReport; }
+
+    // Surface queries on the resident field, in world coordinates
+    bool raycast(glm::vec3 origin, glm::vec3 direction, glm::vec3& hit);
+    void raycast(const std::vector<glm::vec3>& origins, const std::vector<glm::vec3>& directions, std::vector<RayHit>& hits, int numThreads = 0);
+    bool closestPoint(glm::vec3 point, float maxDistance, glm::vec3& closest);
+
+    // Sculpting
+    void generateBrickMeshes();
+    std::vector<MeshBrick>& getBricks() { return bricks; }
+    void applyBrush(const Brush& brush);
+    void remeshDirty(std::vector<int>& changed);
+    // Strokes are undone as a whole, so commit one when the brush is released
+    bool commitEdit() { return scalarField && history.commit(scalarField); }
+    bool undoEdit();
+    bool redoEdit();
+    FieldHistory& getHistory() { return history; }
     unsigned int coordsToIndex(int x, int y, int z) {
-      return z + p.sizeZ() * (y + p.sizeY() * x);
+      return z + p.sizeZ() * (y + p.sizeY() * (x - fieldOriginX));
     };
+    template <bool Interpolate>
     void updateIndices(
       glm::vec3& point,
       glm::vec3& normal,
-      std::map<std::string, int>& vertexMap,
-      std::map<std::string, std::vector<glm::vec3>>& normalMap
+      SlabVertices& previous,
+      SlabVertices& current,
+      std::vector<unsigned int>& slabIndices
     );
-    glm::vec3 getInterpolatedIntersection(glm::vec3& point1, glm::vec3& point2);
+    template <bool Interpolate>
+    glm::vec3 getInterpolatedIntersection(float isoValue, glm::vec3& point1, glm::vec3& point2, float valP1, float valP2);
 };
 
 #endif
\ No newline at end of file
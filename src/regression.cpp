@@ -0,0 +1,413 @@
+#include "regression.h"
+#include "pointGrid.h"
+#include "fields.h"
+#include "sdfGraph.h"
+#include <cmath>
+#include <cstdint>
+#include <climits>
+#include <vector>
+#include <map>
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+
+typedef std::function<float(int, int, int, Params&)> FieldFunction;
+
+// Positions and normals are compared to these steps, so float noise between implementations does not count
+const float POSITION_STEP = 1e-4f;
+const float NORMAL_STEP = 1e-3f;
+
+struct RegressionCase {
+  std::string name;
+  Params params;
+  FieldFunction func;
+};
+
+// What the golden file keeps of a mesh
+struct MeshSummary {
+  size_t numTriangles = 0;
+  // Edges of one triangle only, where the surface is open, and of more than two
+  size_t boundaryEdges = 0;
+  size_t nonManifoldEdges = 0;
+  uint64_t hash = 0;
+
+  bool operator== (const MeshSummary& s) const {
+    return numTriangles == s.numTriangles && boundaryEdges == s.boundaryEdges && nonManifoldEdges == s.nonManifoldEdges && hash == s.hash;
+  }
+  bool operator!= (const MeshSummary& s) const {
+    return !(*this == s);
+  }
+};
+
+class CollectingSink : public MeshSink {
+  public:
+    MeshBrick mesh;
+
+    void addVertices(const glm::vec3* v, const glm::vec3* n, size_t count) {
+      mesh.vertices.insert(mesh.vertices.end(), v, v + count);
+      mesh.normals.insert(mesh.normals.end(), n, n + count);
+    }
+    void addTriangles(const unsigned int* i, size_t count) {
+      mesh.indices.insert(mesh.indices.end(), i, i + count);
+    }
+};
+
+typedef std::array<int64_t, 3> CanonicalPoint;
+// Position then normal
+typedef std::array<int64_t, 6> CanonicalCorner;
+typedef std::array<CanonicalCorner, 3> CanonicalTriangle;
+
+static int64_t quantise(float value, float step) {
+  return std::isnan(value) ? INT64_MIN : (int64_t)std::llround(value / step);
+}
+
+/**
+  NOTE:
+  A mesh in canonical form is its list of triangles,
+  each with its corners quantised and rotated so the
+  smallest comes first, which keeps the winding, and
+  the list sorted. Two meshes with the same triangles
+  then compare equal however their vertices were
+  shared, numbered or ordered.
+*/
+static void canonicalise(const MeshBrick& mesh, std::vector<CanonicalTriangle>& triangles) {
+  triangles.clear();
+  for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+    CanonicalTriangle triangle;
+    for (int c = 0; c < 3; c++) {
+      const glm::vec3& v = mesh.vertices[mesh.indices[t + c]];
+      const glm::vec3& n = mesh.normals[mesh.indices[t + c]];
+      triangle[c] = {{
+        quantise(v.x, POSITION_STEP), quantise(v.y, POSITION_STEP), quantise(v.z, POSITION_STEP),
+        quantise(n.x, NORMAL_STEP), quantise(n.y, NORMAL_STEP), quantise(n.z, NORMAL_STEP)
+      }};
+    }
+    std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+    triangles.push_back(triangle);
+  }
+  std::sort(triangles.begin(), triangles.end());
+}
+
+static MeshSummary summarise(const std::vector<CanonicalTriangle>& triangles) {
+  MeshSummary summary;
+  summary.numTriangles = triangles.size();
+
+  // FNV-1a over the canonical triangles
+  uint64_t hash = 14695981039346656037ULL;
+  std::map<std::pair<CanonicalPoint, CanonicalPoint>, int> edges;
+  for (const CanonicalTriangle& triangle : triangles) {
+    for (const CanonicalCorner& corner : triangle) {
+      for (int64_t value : corner) {
+        for (int b = 0; b < 8; b++) {
+          hash ^= (uint64_t)(value >> (8 * b)) & 0xff;
+          hash *= 1099511628211ULL;
+        }
+      }
+    }
+    for (int c = 0; c < 3; c++) {
+      const CanonicalCorner& a = triangle[c];
+      const CanonicalCorner& b = triangle[(c + 1) % 3];
+      CanonicalPoint pa = {{a[0], a[1], a[2]}};
+      CanonicalPoint pb = {{b[0], b[1], b[2]}};
+      edges[std::make_pair(std::min(pa, pb), std::max(pa, pb))]++;
+    }
+  }
+  for (auto& edge : edges) {
+    if (edge.second == 1) summary.boundaryEdges++;
+    if (edge.second > 2) summary.nonManifoldEdges++;
+  }
+  summary.hash = hash;
+  return summary;
+}
+
+static const char* mesherName(int mesher) {
+  switch (mesher) {
+    case MESHER_SURFACE_NETS: return "nets";
+    case MESHER_DUAL_CONTOURING: return "dc";
+    case MESHER_ADAPTIVE_CUBES: return "adaptive";
+    default: return "mc";
+  }
+}
+
+static void addCase(std::vector<RegressionCase>& cases, const std::string& name, Params params, FieldFunction func) {
+  RegressionCase c;
+  c.name = name + "-" + mesherName(params.mesher) + (params.interpolate ? "-interp" : "-flat");
+  c.params = params;
+  c.func = func;
+  cases.push_back(c);
+}
+
+static void buildCases(std::vector<RegressionCase>& cases) {
+  char name[64];
+  for (int interpolate = 0; interpolate < 2; interpolate++) {
+    Params params;
+    params.interpolate = interpolate;
+
+    // The configs sit on the two planes either side of the origin
+    params.numUnitsX = params.numUnitsY = params.numUnitsZ = 4;
+    for (int config = 0; config <= 14; config++) {
+      params.configIndex = config;
+      snprintf(name, sizeof(name), "config-%02d", config);
+      addCase(cases, name, params, getCubeConfigs);
+    }
+    params.configIndex = 0;
+
+    // One cube, its corners in the order marchSlabs reads them
+    params.numUnitsX = params.numUnitsY = params.numUnitsZ = 2;
+    for (int corners = 0; corners < 256; corners++) {
+      snprintf(name, sizeof(name), "cube-%03d", corners);
+      addCase(cases, name, params, [corners](int x, int y, int z, Params& p) {
+        int gx = x + p.sizeX() / 2;
+        int gz = z + p.sizeZ() / 2;
+        return (corners >> (gx + 2 * y + 4 * gz)) & 1 ? 1.0f : 0.0f;
+      });
+    }
+
+    const int meshers[] = { MESHER_MARCHING_CUBES, MESHER_SURFACE_NETS, MESHER_DUAL_CONTOURING, MESHER_ADAPTIVE_CUBES };
+    for (int mesher : meshers) {
+      // The other meshers do not interpolate differently, so they are run once
+      if (mesher != MESHER_MARCHING_CUBES && !interpolate) continue;
+      params.mesher = mesher;
+      // At fractional densities corner values once came from float positions truncated to the wrong point
+      const float densities[] = { 1.0f, 2.0f, 3.0f, 2.7f };
+      params.numUnitsX = params.numUnitsY = params.numUnitsZ = 20;
+      for (float density : densities) {
+        params.density = density;
+        snprintf(name, sizeof(name), "sphere-d%g", density);
+        addCase(cases, name, params, getSphere);
+        snprintf(name, sizeof(name), "prism-d%g", density);
+        addCase(cases, name, params, getPrism);
+      }
+      const float perlinDensities[] = { 1.0f, 2.0f, 1.5f };
+      params.numUnitsX = params.numUnitsZ = 30;
+      params.numUnitsY = 15;
+      for (float density : perlinDensities) {
+        params.density = density;
+        snprintf(name, sizeof(name), "perlin-d%g", density);
+        addCase(cases, name, params, getPerlin);
+      }
+      params.density = 1.0f;
+    }
+  }
+}
+
+struct MeshVariant {
+  const char* name;
+  // False when the variant could not mesh the case at all
+  std::function<bool(Params&, FieldFunction&, MeshBrick&)> mesh;
+  // Pipelined, sharded and brick meshing are built on the marching cubes sweep alone
+  bool marchingCubesOnly = false;
+};
+
+static void buildVariants(std::vector<MeshVariant>& variants) {
+  variants.push_back({"viewer", [](Params& params, FieldFunction& func, MeshBrick& mesh) {
+    PointGrid grid(params);
+    grid.generateScalarField(func);
+    grid.generateDrawData();
+    mesh.vertices = grid.getVertices();
+    mesh.normals = grid.getNormals();
+    mesh.indices = grid.getIndices();
+    return true;
+  }});
+  variants.push_back({"threads", [](Params& params, FieldFunction& func, MeshBrick& mesh) {
+    params.fieldThreads = 4;
+    PointGrid grid(params);
+    grid.generateScalarField(func);
+    CollectingSink sink;
+    grid.generateDrawData(sink);
+    mesh = sink.mesh;
+    return true;
+  }});
+  for (int threads : {1, 4}) {
+    variants.push_back({threads == 1 ? "pipeline" : "pipeline-4", [threads](Params& params, FieldFunction& func, MeshBrick& mesh) {
+      params.pipelineBricks = true;
+      params.fieldThreads = threads;
+      PointGrid grid(params);
+      grid.generateScalarField(func);
+      CollectingSink sink;
+      grid.generateDrawData(sink);
+      mesh = sink.mesh;
+      return true;
+    }, true});
+  }
+  variants.push_back({"sharded", [](Params& params, FieldFunction& func, MeshBrick& mesh) {
+    PointGrid grid(params);
+    grid.generateScalarField(func);
+    CollectingSink sink;
+    bool ok = grid.generateShardedDrawData(sink, 2, 3);
+    mesh = sink.mesh;
+    return ok;
+  }, true});
+  variants.push_back({"bricks", [](Params& params, FieldFunction& func, MeshBrick& mesh) {
+    PointGrid grid(params);
+    grid.generateScalarField(func);
+    grid.generateBrickMeshes();
+    for (MeshBrick& brick : grid.getBricks()) {
+      unsigned int first = mesh.vertices.size();
+      mesh.vertices.insert(mesh.vertices.end(), brick.vertices.begin(), brick.vertices.end());
+      mesh.normals.insert(mesh.normals.end(), brick.normals.begin(), brick.normals.end());
+      for (unsigned int index : brick.indices) {
+        mesh.indices.push_back(first + index);
+      }
+    }
+    return true;
+  }, true});
+  variants.push_back({"layers", [](Params& params, FieldFunction& func, MeshBrick& mesh) {
+    PointGrid grid(params);
+    grid.generateScalarField(func);
+    CollectingSink sink;
+    std::vector<MeshSink*> sinks = { &sink };
+    grid.generateLayers({params.isoValue}, sinks);
+    mesh = sink.mesh;
+    return true;
+  }});
+}
+
+// A scene far enough from most of the grid that its bricks are skipped
+static const char* LAYER_SCENE = "(union (translate 0 9 0 (sphere 4)) (translate 0 3 0 (box 5 1 5)))";
+
+// Each layer of a scene must be the surface its iso value gives on its own, skipped bricks and all
+static void checkSceneLayers(RegressionReport& report, FILE* log) {
+  SdfProgram scene;
+  std::string error;
+  if (!scene.compile(LAYER_SCENE, error)) {
+    report.variantFailures++;
+    if (log) fprintf(log, "  FAIL scene-layers: %s\n", error.c_str());
+    return;
+  }
+  const std::vector<float> isoValues = { 0.5f, -3.0f, 2.0f };
+  std::vector<CanonicalTriangle> reference;
+  std::vector<CanonicalTriangle> triangles;
+  for (int interpolate = 0; interpolate < 2; interpolate++) {
+    Params params;
+    params.interpolate = interpolate;
+    params.numUnitsX = params.numUnitsY = params.numUnitsZ = 24;
+    params.density = 2.0f;
+    PointGrid grid(params);
+    grid.generateScalarField(scene);
+    std::vector<CollectingSink> layers(isoValues.size());
+    std::vector<MeshSink*> sinks;
+    for (CollectingSink& sink : layers) {
+      sinks.push_back(&sink);
+    }
+    grid.generateLayers(isoValues, sinks);
+
+    for (size_t l = 0; l < isoValues.size(); l++) {
+      report.numVariantRuns++;
+      Params single = params;
+      single.isoValue = isoValues[l];
+      PointGrid singleGrid(single);
+      singleGrid.generateScalarField(scene);
+      CollectingSink sink;
+      singleGrid.generateDrawData(sink);
+      canonicalise(sink.mesh, reference);
+      canonicalise(layers[l].mesh, triangles);
+      if (triangles != reference) {
+        report.variantFailures++;
+        if (log) {
+          fprintf(log, "  FAIL scene-layers-%s iso %g: %zu triangles, on its own %zu\n",
+            interpolate ? "interp" : "flat", isoValues[l], triangles.size(), reference.size());
+        }
+      }
+    }
+  }
+}
+
+static bool readGoldens(const std::string& path, std::map<std::string, MeshSummary>& goldens) {
+  std::ifstream in(path);
+  if (!in) return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream values(line);
+    std::string name;
+    MeshSummary summary;
+    if (values >> name >> summary.numTriangles >> summary.boundaryEdges >> summary.nonManifoldEdges >> std::hex >> summary.hash) {
+      goldens[name] = summary;
+    }
+  }
+  return true;
+}
+
+bool runRegression(const std::string& goldenPath, bool update, RegressionReport& report, FILE* log) {
+  std::map<std::string, MeshSummary> goldens;
+  if (!update && !readGoldens(goldenPath, goldens)) {
+    fprintf(stderr, "Could not read goldens from %s\n", goldenPath.c_str());
+    return false;
+  }
+  FILE* out = nullptr;
+  if (update) {
+    out = fopen(goldenPath.c_str(), "w");
+    if (!out) {
+      fprintf(stderr, "Could not write goldens to %s\n", goldenPath.c_str());
+      return false;
+    }
+    fprintf(out, "# marching-cubes regression goldens\n");
+    fprintf(out, "# case, triangles, boundary edges, non-manifold edges, hash\n");
+  }
+
+  std::vector<RegressionCase> cases;
+  buildCases(cases);
+  std::vector<MeshVariant> variants;
+  buildVariants(variants);
+
+  report = RegressionReport();
+  std::vector<CanonicalTriangle> reference;
+  std::vector<CanonicalTriangle> triangles;
+  for (RegressionCase& c : cases) {
+    report.numCases++;
+    Params params = c.params;
+    PointGrid grid(params);
+    grid.generateScalarField(c.func);
+    CollectingSink sink;
+    grid.generateDrawData(sink);
+    canonicalise(sink.mesh, reference);
+    MeshSummary summary = summarise(reference);
+
+    if (update) {
+      fprintf(out, "%s %zu %zu %zu %016llx\n", c.name.c_str(), summary.numTriangles, summary.boundaryEdges, summary.nonManifoldEdges, (unsigned long long)summary.hash);
+    } else {
+      auto golden = goldens.find(c.name);
+      if (golden == goldens.end()) {
+        report.numMissing++;
+        if (log) fprintf(log, "  MISSING %s\n", c.name.c_str());
+      } else if (golden->second != summary) {
+        report.goldenFailures++;
+        if (log) {
+          fprintf(log, "  FAIL %s: %zu triangles, %zu boundary and %zu non-manifold edges, golden has %zu, %zu and %zu%s\n",
+            c.name.c_str(), summary.numTriangles, summary.boundaryEdges, summary.nonManifoldEdges,
+            golden->second.numTriangles, golden->second.boundaryEdges, golden->second.nonManifoldEdges,
+            golden->second.hash != summary.hash ? ", triangles differ" : "");
+        }
+      }
+    }
+
+    for (MeshVariant& variant : variants) {
+      if (variant.marchingCubesOnly && c.params.mesher != MESHER_MARCHING_CUBES) continue;
+      report.numVariantRuns++;
+      Params variantParams = c.params;
+      MeshBrick mesh;
+      bool ok = variant.mesh(variantParams, c.func, mesh);
+      if (ok) {
+        canonicalise(mesh, triangles);
+      }
+      if (!ok || triangles != reference) {
+        report.variantFailures++;
+        if (log) {
+          if (!ok) fprintf(log, "  FAIL %s %s: could not mesh\n", c.name.c_str(), variant.name);
+          else fprintf(log, "  FAIL %s %s: %zu triangles, reference has %zu\n", c.name.c_str(), variant.name, triangles.size(), reference.size());
+        }
+      }
+    }
+  }
+
+  checkSceneLayers(report, log);
+
+  if (out && fclose(out) != 0) {
+    fprintf(stderr, "Could not write goldens to %s\n", goldenPath.c_str());
+    return false;
+  }
+  return true;
+}
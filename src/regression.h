@@ -0,0 +1,42 @@
+#ifndef REGRESSION
+#define REGRESSION
+
+#include <cstdio>
+#include <string>
+
+struct RegressionReport {
+  int numCases = 0;
+  // Other implementations meshed against the reference, and the ones that disagreed
+  int numVariantRuns = 0;
+  int variantFailures = 0;
+  int goldenFailures = 0;
+  // Cases the golden file has no line for
+  int numMissing = 0;
+
+  bool passed() const { return !variantFailures && !goldenFailures && !numMissing; }
+};
+
+/**
+  NOTE:
+  Meshes a fixed set of cases: the 15 cube configs,
+  all 256 corner configurations of a single cube, and
+  the sphere, prism and perlin fields at a few
+  densities, fractional ones included, with every
+  mesher, with and without interpolation. Each case is
+  meshed by the serial slab mesher, the reference, and
+  its summary, triangle hash included, is compared
+  against the golden file at goldenPath, or written
+  there when update is set.
+
+  Every other way of making the same mesh is run on
+  the case and must give exactly the same triangles as
+  the reference: the viewer's buffers, threaded fields
+  and the layer path for every mesher, and the
+  pipelined and sharded meshers and sculpt bricks for
+  marching cubes. So must each layer
+  of a scene meshed at several iso values at once,
+  against the scene meshed at that iso value alone.
+*/
+bool runRegression(const std::string& goldenPath, bool update, RegressionReport& report, FILE* log);
+
+#endif
@@ -0,0 +1,135 @@
+#include "pointGrid.h"
+#include <cmath>
+#include <algorithm>
+
+/**
+  NOTE:
+  Brushes change the field in place, weighted by a
+  smooth falloff that reaches zero at their radius.
+  Smoothing blends each point towards the average of
+  its neighbours as they were before the stroke.
+*/
+void PointGrid::applyBrush(const Brush& brush) {
+  if (!scalarField || fieldOriginX != 0 || brush.radius <= 0.0f) return;
+
+  glm::ivec3 size(p.sizeX(), p.sizeY(), p.sizeZ());
+  glm::vec3 centre(brush.centre.x * p.density + size.x / 2, brush.centre.y * p.density, brush.centre.z * p.density + size.z / 2);
+  float radius = brush.radius * p.density;
+
+  glm::ivec3 lo, hi;
+  for (int a = 0; a < 3; a++) {
+    lo[a] = std::max(0, (int)std::ceil(centre[a] - radius));
+    hi[a] = std::min(size[a] - 1, (int)std::floor(centre[a] + radius));
+    if (lo[a] > hi[a]) return;
+  }
+
+  history.touch(scalarField, lo, hi);
+
+  // Smoothing reads neighbours, so it works from a copy of the region and its border
+  glm::ivec3 copyMin(std::max(lo.x - 1, 0), std::max(lo.y - 1, 0), std::max(lo.z - 1, 0));
+  glm::ivec3 copyMax(std::min(hi.x + 1, size.x - 1), std::min(hi.y + 1, size.y - 1), std::min(hi.z + 1, size.z - 1));
+  glm::ivec3 copySize = copyMax - copyMin + glm::ivec3(1);
+  std::vector<float> before;
+  auto copied = [&](int x, int y, int z) {
+    x = std::min(std::max(x, copyMin.x), copyMax.x) - copyMin.x;
+    y = std::min(std::max(y, copyMin.y), copyMax.y) - copyMin.y;
+    z = std::min(std::max(z, copyMin.z), copyMax.z) - copyMin.z;
+    return before[z + copySize.z * (y + copySize.y * x)];
+  };
+  if (brush.mode == BRUSH_SMOOTH) {
+    before.reserve((size_t)copySize.x * copySize.y * copySize.z);
+    for (int x = copyMin.x; x <= copyMax.x; x++) {
+      for (int y = copyMin.y; y <= copyMax.y; y++) {
+        for (int z = copyMin.z; z <= copyMax.z; z++) {
+          before.push_back(scalarField[coordsToIndex(x, y, z)]);
+        }
+      }
+    }
+  }
+
+  float radiusSquared = radius * radius;
+  for (int x = lo.x; x <= hi.x; x++) {
+    for (int y = lo.y; y <= hi.y; y++) {
+      for (int z = lo.z; z <= hi.z; z++) {
+        glm::vec3 offset = glm::vec3(x, y, z) - centre;
+        float distanceSquared = glm::dot(offset, offset);
+        if (distanceSquared > radiusSquared) continue;
+
+        float falloff = 1.0f - distanceSquared / radiusSquared;
+        falloff *= falloff;
+        float& value = scalarField[coordsToIndex(x, y, z)];
+        if (brush.mode == BRUSH_ADD) {
+          value += brush.strength * falloff;
+        } else if (brush.mode == BRUSH_SUBTRACT) {
+          value -= brush.strength * falloff;
+        } else {
+          float average = (
+            copied(x - 1, y, z) + copied(x + 1, y, z) +
+            copied(x, y - 1, z) + copied(x, y + 1, z) +
+            copied(x, y, z - 1) + copied(x, y, z + 1)
+          ) / 6.0f;
+          value += (average - value) * std::min(1.0f, brush.strength * falloff);
+        }
+      }
+    }
+  }
+
+  markDirty(lo, hi);
+}
+
+void PointGrid::markDirty(glm::ivec3 lo, glm::ivec3 hi) {
+  markRangesDirty(lo, hi);
+  if (!dirty) {
+    dirtyMin = lo;
+    dirtyMax = hi;
+    dirty = true;
+  } else {
+    dirtyMin = glm::ivec3(std::min(dirtyMin.x, lo.x), std::min(dirtyMin.y, lo.y), std::min(dirtyMin.z, lo.z));
+    dirtyMax = glm::ivec3(std::max(dirtyMax.x, hi.x), std::max(dirtyMax.y, hi.y), std::max(dirtyMax.z, hi.z));
+  }
+}
+
+// Restoring a snapshot only rewrites its bricks, so only they are remeshed
+bool PointGrid::undoEdit() {
+  glm::ivec3 lo, hi;
+  if (!scalarField || !history.undo(scalarField, lo, hi)) return false;
+  markDirty(lo, hi);
+  return true;
+}
+
+bool PointGrid::redoEdit() {
+  glm::ivec3 lo, hi;
+  if (!scalarField || !history.redo(scalarField, lo, hi)) return false;
+  markDirty(lo, hi);
+  return true;
+}
+
+/**
+  NOTE:
+  An edited point changes the two cubes on either side
+  of it along each axis, and the normals of their
+  vertices also come from the next cube out. Only the
+  bricks holding one of those cubes are remeshed.
+*/
+void PointGrid::remeshDirty(std::vector<int>& changed) {
+  changed.clear();
+  if (!dirty || bricks.empty()) return;
+  dirty = false;
+
+  glm::ivec3 lastCube(p.sizeX() - 2, p.sizeY() - 2, p.sizeZ() - 2);
+  glm::ivec3 brickMin, brickMax;
+  for (int a = 0; a < 3; a++) {
+    brickMin[a] = std::max(dirtyMin[a] - 2, 0) / MESH_BRICK;
+    brickMax[a] = std::min(dirtyMax[a] + 1, lastCube[a]) / MESH_BRICK;
+  }
+
+  for (int bx = brickMin.x; bx <= brickMax.x; bx++) {
+    for (int by = brickMin.y; by <= brickMax.y; by++) {
+      for (int bz = brickMin.z; bz <= brickMax.z; bz++) {
+        int i = bz + brickCounts.z * (by + brickCounts.y * bx);
+        meshBrick(bx, by, bz, bricks[i]);
+        changed.push_back(i);
+      }
+    }
+  }
+}
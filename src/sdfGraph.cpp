@@ -0,0 +1,519 @@
+#include "sdfGraph.h"
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "../external/FastNoise.hpp"
+
+// Points per side of the bricks the grid is evaluated in
+
+// Registers 0 to 2 hold the positions being evaluated
+const int SDF_POSITION = 0;
+
+// Conservative bound on the slope of the noise, per unit of frequency and amplitude
+const float SDF_NOISE_SLOPE = 3.0f;
+
+static std::vector<std::string> tokenize(const std::string& source) {
+  std::vector<std::string> tokens;
+  std::string token;
+  bool comment = false;
+  for (char c : source) {
+    if (comment) {
+      comment = c != '\n';
+      continue;
+    }
+    if (c == '#' || c == '(' || c == ')' || isspace((unsigned char)c)) {
+      if (token.size()) {
+        tokens.push_back(token);
+        token.clear();
+      }
+      if (c == '(' || c == ')') tokens.push_back(std::string(1, c));
+      comment = c == '#';
+    } else {
+      token += c;
+    }
+  }
+  if (token.size()) tokens.push_back(token);
+  return tokens;
+}
+
+struct SdfNodeInfo {
+  const char* name;
+  SdfOp op;
+  int numConstants;
+  // Child expressions, or -1 for two or more
+  int numChildren;
+};
+
+static const SdfNodeInfo nodeInfos[] = {
+  { "translate", SDF_TRANSLATE, 3, 1 },
+  { "scale", SDF_SCALE, 1, 1 },
+  { "rotate", SDF_ROTATE, 3, 1 },
+  { "spin", SDF_SPIN, 1, 1 },
+  { "drift", SDF_DRIFT, 3, 1 },
+  { "sphere", SDF_SPHERE, 1, 0 },
+  { "box", SDF_BOX, 3, 0 },
+  { "torus", SDF_TORUS, 2, 0 },
+  { "cylinder", SDF_CYLINDER, 2, 0 },
+  { "plane", SDF_PLANE, 4, 0 },
+  { "noise", SDF_NOISE, 2, 0 },
+  { "union", SDF_UNION, 0, -1 },
+  { "intersect", SDF_INTERSECT, 0, -1 },
+  { "subtract", SDF_SUBTRACT, 0, -1 },
+  { "add", SDF_ADD, 0, -1 },
+  { "smooth_union", SDF_SMOOTH_UNION, 1, -1 },
+  { "smooth_intersect", SDF_SMOOTH_INTERSECT, 1, -1 },
+  { "smooth_subtract", SDF_SMOOTH_SUBTRACT, 1, -1 },
+  { "round", SDF_OFFSET, 1, 1 },
+  { "shell", SDF_SHELL, 1, 1 },
+};
+
+static bool parseFloat(const std::string& token, float& value) {
+  char* end;
+  value = strtof(token.c_str(), &end);
+  return !token.empty() && *end == '\0';
+}
+
+/**
+  NOTE:
+  Nodes are compiled depth first into a flat list of
+  instructions, each one writing a fresh register, so
+  the program needs no stack at run time. Transforms
+  write new position registers and hand them to their
+  child, and combinations of more than two children
+  are folded into a chain of binary instructions.
+*/
+int SdfProgram::parseNode(const std::vector<std::string>& tokens, size_t& pos, int position, float& nodeLipschitz, std::string& error) {
+  if (pos >= tokens.size() || tokens[pos] != "(") {
+    error = "expected '(' " + (pos < tokens.size() ? "before '" + tokens[pos] + "'" : std::string("at the end"));
+    return -1;
+  }
+  pos++;
+  if (pos >= tokens.size()) {
+    error = "unexpected end of scene";
+    return -1;
+  }
+
+  std::string name = tokens[pos++];
+  const SdfNodeInfo* info = nullptr;
+  for (auto& candidate : nodeInfos) {
+    if (name == candidate.name) info = &candidate;
+  }
+  if (!info) {
+    error = "unknown node '" + name + "'";
+    return -1;
+  }
+
+  SdfInstruction instruction = {};
+  instruction.op = info->op;
+  for (int i = 0; i < info->numConstants; i++) {
+    if (pos >= tokens.size() || !parseFloat(tokens[pos], instruction.c[i])) {
+      error = "'" + name + "' expects " + std::to_string(info->numConstants) + " numbers";
+      return -1;
+    }
+    pos++;
+  }
+
+  // Transforms feed a new position to their child
+  if (info->op == SDF_TRANSLATE || info->op == SDF_SCALE || info->op == SDF_ROTATE || info->op == SDF_SPIN || info->op == SDF_DRIFT) {
+    if (info->op == SDF_SCALE && instruction.c[0] <= 0.0f) {
+      error = "'scale' must be positive";
+      return -1;
+    }
+    if (info->op == SDF_ROTATE) {
+      // The point is turned back by the inverse, the transpose of R = Rz Ry Rx
+      float ax = instruction.c[0] * (float)M_PI / 180.0f;
+      float ay = instruction.c[1] * (float)M_PI / 180.0f;
+      float az = instruction.c[2] * (float)M_PI / 180.0f;
+      float rx[3][3] = {{1, 0, 0}, {0, cosf(ax), -sinf(ax)}, {0, sinf(ax), cosf(ax)}};
+      float ry[3][3] = {{cosf(ay), 0, sinf(ay)}, {0, 1, 0}, {-sinf(ay), 0, cosf(ay)}};
+      float rz[3][3] = {{cosf(az), -sinf(az), 0}, {sinf(az), cosf(az), 0}, {0, 0, 1}};
+      float ryx[3][3];
+      for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+          ryx[r][c] = ry[r][0] * rx[0][c] + ry[r][1] * rx[1][c] + ry[r][2] * rx[2][c];
+        }
+      }
+      for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+          instruction.c[c * 3 + r] = rz[r][0] * ryx[0][c] + rz[r][1] * ryx[1][c] + rz[r][2] * ryx[2][c];
+        }
+      }
+    }
+    instruction.dst = numRegisters;
+    instruction.a = position;
+    numRegisters += 3;
+    instructions.push_back(instruction);
+
+    int child = parseNode(tokens, pos, instruction.dst, nodeLipschitz, error);
+    if (child < 0) return -1;
+    if (info->op == SDF_SCALE) {
+      // Distances measured in the scaled space are scaled back
+      SdfInstruction multiply = {};
+      multiply.op = SDF_MULTIPLY;
+      multiply.dst = numRegisters++;
+      multiply.a = child;
+      multiply.c[0] = instruction.c[0];
+      instructions.push_back(multiply);
+      child = multiply.dst;
+    }
+    if (pos >= tokens.size() || tokens[pos] != ")") {
+      error = "'" + name + "' takes a single expression";
+      return -1;
+    }
+    pos++;
+    return child;
+  }
+
+  if (info->numChildren == 0) {
+    if (info->op == SDF_PLANE) {
+      glm::vec3 n(instruction.c[0], instruction.c[1], instruction.c[2]);
+      if (glm::length(n) <= 0.0f) {
+        error = "'plane' needs a non zero normal";
+        return -1;
+      }
+      n = glm::normalize(n);
+      instruction.c[0] = n.x;
+      instruction.c[1] = n.y;
+      instruction.c[2] = n.z;
+    }
+    nodeLipschitz = info->op == SDF_NOISE
+      ? std::abs(instruction.c[0] * instruction.c[1]) * SDF_NOISE_SLOPE
+      : 1.0f;
+    instruction.dst = numRegisters++;
+    instruction.a = position;
+    instructions.push_back(instruction);
+  } else if (info->numChildren == 1) {
+    int child = parseNode(tokens, pos, position, nodeLipschitz, error);
+    if (child < 0) return -1;
+    instruction.dst = numRegisters++;
+    instruction.a = child;
+    instructions.push_back(instruction);
+  } else {
+    std::vector<int> children;
+    std::vector<float> lipschitzes;
+    while (pos < tokens.size() && tokens[pos] == "(") {
+      float childLipschitz;
+      int child = parseNode(tokens, pos, position, childLipschitz, error);
+      if (child < 0) return -1;
+      children.push_back(child);
+      lipschitzes.push_back(childLipschitz);
+    }
+    if (children.size() < 2) {
+      error = "'" + name + "' needs at least two expressions";
+      return -1;
+    }
+
+    // Sums add their slopes, every other combination keeps the steepest
+    nodeLipschitz = 0.0f;
+    for (float l : lipschitzes) {
+      nodeLipschitz = info->op == SDF_ADD ? nodeLipschitz + l : std::max(nodeLipschitz, l);
+    }
+
+    int left = children[0];
+    for (size_t i = 1; i < children.size(); i++) {
+      instruction.dst = numRegisters++;
+      instruction.a = left;
+      instruction.b = children[i];
+      instructions.push_back(instruction);
+      left = instruction.dst;
+    }
+  }
+
+  if (pos >= tokens.size() || tokens[pos] != ")") {
+    error = "expected ')' after '" + name + "'";
+    return -1;
+  }
+  pos++;
+  return instructions.back().dst;
+}
+
+bool SdfProgram::compile(const std::string& source, std::string& error) {
+  instructions.clear();
+  numRegisters = 3;
+  result = -1;
+
+  sourceHash = 14695981039346656037ULL;
+  for (char c : source) {
+    sourceHash ^= (unsigned char)c;
+    sourceHash *= 1099511628211ULL;
+  }
+
+  std::vector<std::string> tokens = tokenize(source);
+  size_t pos = 0;
+  int root = parseNode(tokens, pos, SDF_POSITION, lipschitz, error);
+  if (root < 0) {
+    instructions.clear();
+    return false;
+  }
+  if (pos != tokens.size()) {
+    error = "a scene is a single expression, found '" + tokens[pos] + "' after it";
+    instructions.clear();
+    return false;
+  }
+  result = root;
+  return true;
+}
+
+bool SdfProgram::load(const std::string& path, std::string& error) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    error = "could not open " + path;
+    return false;
+  }
+  std::stringstream source;
+  source << file.rdbuf();
+  return compile(source.str(), error);
+}
+
+/**
+  NOTE:
+  Every instruction is a plain loop over the batch with
+  no branches between lanes, which the compiler turns
+  into vector code, so the per point cost of walking the
+  graph is paid once per brick instead.
+*/
+void SdfProgram::run(float* registers, int count, float time) const {
+  static thread_local FastNoiseLite noise;
+  noise.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
+  noise.SetFrequency(1.0f);
+
+  for (const SdfInstruction& in : instructions) {
+    float* __restrict dst = registers + (size_t)in.dst * count;
+    const float* __restrict a = registers + (size_t)in.a * count;
+    const float* __restrict b = registers + (size_t)in.b * count;
+    const float* __restrict ax = a;
+    const float* __restrict ay = a + count;
+    const float* __restrict az = a + 2 * count;
+    const float* c = in.c;
+
+    switch (in.op) {
+      case SDF_TRANSLATE:
+        for (int i = 0; i < count; i++) {
+          dst[i] = ax[i] - c[0];
+          dst[i + count] = ay[i] - c[1];
+          dst[i + 2 * count] = az[i] - c[2];
+        }
+        break;
+      case SDF_SCALE:
+        for (int i = 0; i < count; i++) {
+          dst[i] = ax[i] / c[0];
+          dst[i + count] = ay[i] / c[0];
+          dst[i + 2 * count] = az[i] / c[0];
+        }
+        break;
+      case SDF_SPIN: {
+        // Turning the point back by the angle reached so far turns the shape forwards
+        float angle = c[0] * time * (float)M_PI / 180.0f;
+        float cosAngle = cosf(angle);
+        float sinAngle = sinf(angle);
+        for (int i = 0; i < count; i++) {
+          dst[i] = cosAngle * ax[i] - sinAngle * az[i];
+          dst[i + count] = ay[i];
+          dst[i + 2 * count] = sinAngle * ax[i] + cosAngle * az[i];
+        }
+        break;
+      }
+      case SDF_DRIFT:
+        for (int i = 0; i < count; i++) {
+          dst[i] = ax[i] - c[0] * time;
+          dst[i + count] = ay[i] - c[1] * time;
+          dst[i + 2 * count] = az[i] - c[2] * time;
+        }
+        break;
+      case SDF_ROTATE:
+        for (int i = 0; i < count; i++) {
+          dst[i] = c[0] * ax[i] + c[1] * ay[i] + c[2] * az[i];
+          dst[i + count] = c[3] * ax[i] + c[4] * ay[i] + c[5] * az[i];
+          dst[i + 2 * count] = c[6] * ax[i] + c[7] * ay[i] + c[8] * az[i];
+        }
+        break;
+      case SDF_SPHERE:
+        for (int i = 0; i < count; i++) {
+          dst[i] = sqrtf(ax[i] * ax[i] + ay[i] * ay[i] + az[i] * az[i]) - c[0];
+        }
+        break;
+      case SDF_BOX:
+        for (int i = 0; i < count; i++) {
+          float qx = fabsf(ax[i]) - c[0];
+          float qy = fabsf(ay[i]) - c[1];
+          float qz = fabsf(az[i]) - c[2];
+          float ox = std::max(qx, 0.0f);
+          float oy = std::max(qy, 0.0f);
+          float oz = std::max(qz, 0.0f);
+          dst[i] = sqrtf(ox * ox + oy * oy + oz * oz) + std::min(std::max(qx, std::max(qy, qz)), 0.0f);
+        }
+        break;
+      case SDF_TORUS:
+        for (int i = 0; i < count; i++) {
+          float qx = sqrtf(ax[i] * ax[i] + az[i] * az[i]) - c[0];
+          dst[i] = sqrtf(qx * qx + ay[i] * ay[i]) - c[1];
+        }
+        break;
+      case SDF_CYLINDER:
+        for (int i = 0; i < count; i++) {
+          float dx = sqrtf(ax[i] * ax[i] + az[i] * az[i]) - c[0];
+          float dy = fabsf(ay[i]) - c[1];
+          float ox = std::max(dx, 0.0f);
+          float oy = std::max(dy, 0.0f);
+          dst[i] = std::min(std::max(dx, dy), 0.0f) + sqrtf(ox * ox + oy * oy);
+        }
+        break;
+      case SDF_PLANE:
+        for (int i = 0; i < count; i++) {
+          dst[i] = c[0] * ax[i] + c[1] * ay[i] + c[2] * az[i] - c[3];
+        }
+        break;
+      case SDF_NOISE:
+        for (int i = 0; i < count; i++) {
+          dst[i] = c[1] * noise.GetNoise(ax[i] * c[0], ay[i] * c[0], az[i] * c[0]);
+        }
+        break;
+      case SDF_UNION:
+        for (int i = 0; i < count; i++) {
+          dst[i] = std::min(a[i], b[i]);
+        }
+        break;
+      case SDF_INTERSECT:
+        for (int i = 0; i < count; i++) {
+          dst[i] = std::max(a[i], b[i]);
+        }
+        break;
+      case SDF_SUBTRACT:
+        for (int i = 0; i < count; i++) {
+          dst[i] = std::max(a[i], -b[i]);
+        }
+        break;
+      case SDF_ADD:
+        for (int i = 0; i < count; i++) {
+          dst[i] = a[i] + b[i];
+        }
+        break;
+      case SDF_SMOOTH_UNION:
+        for (int i = 0; i < count; i++) {
+          float h = std::min(std::max(0.5f + 0.5f * (b[i] - a[i]) / c[0], 0.0f), 1.0f);
+          dst[i] = b[i] + (a[i] - b[i]) * h - c[0] * h * (1.0f - h);
+        }
+        break;
+      case SDF_SMOOTH_INTERSECT:
+        for (int i = 0; i < count; i++) {
+          float h = std::min(std::max(0.5f - 0.5f * (b[i] - a[i]) / c[0], 0.0f), 1.0f);
+          dst[i] = b[i] + (a[i] - b[i]) * h + c[0] * h * (1.0f - h);
+        }
+        break;
+      case SDF_SMOOTH_SUBTRACT:
+        for (int i = 0; i < count; i++) {
+          float h = std::min(std::max(0.5f - 0.5f * (a[i] + b[i]) / c[0], 0.0f), 1.0f);
+          dst[i] = a[i] + (-b[i] - a[i]) * h + c[0] * h * (1.0f - h);
+        }
+        break;
+      case SDF_OFFSET:
+        for (int i = 0; i < count; i++) {
+          dst[i] = a[i] - c[0];
+        }
+        break;
+      case SDF_SHELL:
+        for (int i = 0; i < count; i++) {
+          dst[i] = fabsf(a[i]) - c[0];
+        }
+        break;
+      case SDF_MULTIPLY:
+        for (int i = 0; i < count; i++) {
+          dst[i] = a[i] * c[0];
+        }
+        break;
+    }
+  }
+}
+
+float SdfProgram::evaluate(int x, int y, int z, Params& p) const {
+  if (empty()) return 0.0f;
+  static thread_local std::vector<float> registers;
+  registers.resize(numRegisters);
+  registers[SDF_POSITION] = x / p.density;
+  registers[SDF_POSITION + 1] = y / p.density;
+  registers[SDF_POSITION + 2] = z / p.density;
+  run(registers.data(), 1, p.time);
+  return 0.5f - registers[result];
+}
+
+/**
+  NOTE:
+  Before a brick is evaluated, the distance at its
+  centre and the program's Lipschitz bound give an
+  interval containing every distance in the brick and
+  one cell around it. When the interval holds no
+  surface at any iso value in [isoMin, isoMax], the
+  brick is filled with the centre value, which lies on
+  the same side of each of them as every true value,
+  so no cube edge touching the brick can cross any of
+  those surfaces.
+*/
+void SdfProgram::evaluateGrid(float* field, Params& p, float isoMin, float isoMax, int x0, int x1) const {
+  int sizeX = p.sizeX();
+  int sizeY = p.sizeY();
+  int sizeZ = p.sizeZ();
+  int xEnd = std::min(sizeX, x1);
+  if (x0 >= xEnd) return;
+  if (empty()) {
+    std::fill(field + (size_t)x0 * sizeY * sizeZ, field + (size_t)xEnd * sizeY * sizeZ, 0.0f);
+    return;
+  }
+
+  const int brickPoints = SDF_BRICK * SDF_BRICK * SDF_BRICK;
+  std::vector<float> registers((size_t)numRegisters * brickPoints);
+  std::vector<float> centre(numRegisters);
+  // Field values are 0.5 minus the distance, so the highest iso value is the nearest surface
+  float nearestSurface = 0.5f - isoMax;
+  float farthestSurface = 0.5f - isoMin;
+  float reach = (std::sqrt(3.0f) * (SDF_BRICK - 1) / 2 + 1) / p.density;
+
+  for (int bx = x0; bx < xEnd; bx += SDF_BRICK) {
+    for (int by = 0; by < sizeY; by += SDF_BRICK) {
+      for (int bz = 0; bz < sizeZ; bz += SDF_BRICK) {
+        int nx = std::min(SDF_BRICK, xEnd - bx);
+        int ny = std::min(SDF_BRICK, sizeY - by);
+        int nz = std::min(SDF_BRICK, sizeZ - bz);
+
+        centre[SDF_POSITION] = (bx + (SDF_BRICK - 1) / 2.0f - sizeX / 2) / p.density;
+        centre[SDF_POSITION + 1] = (by + (SDF_BRICK - 1) / 2.0f) / p.density;
+        centre[SDF_POSITION + 2] = (bz + (SDF_BRICK - 1) / 2.0f - sizeZ / 2) / p.density;
+        run(centre.data(), 1, p.time);
+        float centreDistance = centre[result];
+
+        float bound = lipschitz * reach;
+        bool skip = centreDistance + bound < nearestSurface || centreDistance - bound > farthestSurface;
+        int count = nx * ny * nz;
+        float* positionX = registers.data() + (size_t)SDF_POSITION * count;
+        float* positionY = positionX + count;
+        float* positionZ = positionY + count;
+        if (!skip) {
+          int i = 0;
+          for (int x = 0; x < nx; x++) {
+            for (int y = 0; y < ny; y++) {
+              for (int z = 0; z < nz; z++, i++) {
+                positionX[i] = (bx + x - sizeX / 2) / p.density;
+                positionY[i] = (by + y) / p.density;
+                positionZ[i] = (bz + z - sizeZ / 2) / p.density;
+              }
+            }
+          }
+          run(registers.data(), count, p.time);
+        }
+
+        const float* distances = registers.data() + (size_t)result * count;
+        int i = 0;
+        for (int x = 0; x < nx; x++) {
+          for (int y = 0; y < ny; y++) {
+            float* row = field + ((size_t)(bx + x) * sizeY + by + y) * sizeZ + bz;
+            for (int z = 0; z < nz; z++, i++) {
+              row[z] = 0.5f - (skip ? centreDistance : distances[i]);
+            }
+          }
+        }
+      }
+    }
+  }
+}
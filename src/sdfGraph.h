@@ -0,0 +1,98 @@
+#ifndef SDFGRAPH
+#define SDFGRAPH
+
+#include <cstdint>
+#include <climits>
+#include <string>
+#include <vector>
+
+#include "params.h"
+
+/**
+  NOTE:
+  Scenes are signed distance fields described as nested
+  expressions, for example
+
+    (smooth_union 1.5
+      (sphere 6)
+      (translate 0 -4 0 (box 12 1 12)))
+
+  Primitives: sphere r, box hx hy hz, torus R r,
+  cylinder r hy, plane nx ny nz h (h along the
+  normal), noise frequency amplitude.
+  Transforms: translate x y z, scale s, rotate x y z
+  (degrees), round r, shell t.
+  Animated transforms: spin degrees-per-second (about
+  y), drift vx vy vz (units per second).
+  Combinations: union, intersect, subtract, add,
+  smooth_union k, smooth_intersect k, smooth_subtract k.
+  Everything after a # on a line is a comment.
+
+  Distances are in world units, with the origin at the
+  bottom centre of the grid. The field value is
+  0.5 - distance, so the default iso value of 0.5
+  lies on the surface.
+*/
+// Dense grids are evaluated in bricks of SDF_BRICK^3 points
+const int SDF_BRICK = 16;
+
+enum SdfOp {
+  SDF_TRANSLATE,
+  SDF_SCALE,
+  SDF_ROTATE,
+  SDF_SPIN,
+  SDF_DRIFT,
+  SDF_SPHERE,
+  SDF_BOX,
+  SDF_TORUS,
+  SDF_CYLINDER,
+  SDF_PLANE,
+  SDF_NOISE,
+  SDF_UNION,
+  SDF_INTERSECT,
+  SDF_SUBTRACT,
+  SDF_ADD,
+  SDF_SMOOTH_UNION,
+  SDF_SMOOTH_INTERSECT,
+  SDF_SMOOTH_SUBTRACT,
+  SDF_OFFSET,
+  SDF_SHELL,
+  SDF_MULTIPLY
+};
+
+// One step of the compiled program, applied to a whole batch of points at once
+struct SdfInstruction {
+  SdfOp op;
+  int dst;
+  int a;
+  int b;
+  float c[9];
+};
+
+class SdfProgram {
+  std::vector<SdfInstruction> instructions;
+  int numRegisters = 0;
+  int result = -1;
+  // Bound on how fast the distance can change, for skipping bricks
+  float lipschitz = 1.0f;
+  uint64_t sourceHash = 0;
+
+  int parseNode(const std::vector<std::string>& tokens, size_t& pos, int position, float& lipschitz, std::string& error);
+  void run(float* registers, int count, float time) const;
+
+  public:
+    bool compile(const std::string& source, std::string& error);
+    bool load(const std::string& path, std::string& error);
+    bool empty() const { return result < 0; }
+    uint64_t getSourceHash() const { return sourceHash; }
+
+    // Field value at a grid point, as a FieldFunc would return it
+    float evaluate(int x, int y, int z, Params& p) const;
+
+    // Fills a field laid out in PointGrid::coordsToIndex order, a brick at a time,
+    // exact wherever a surface at an iso value in [isoMin, isoMax] could pass.
+    // Only the x-planes in [x0, x1) are filled; x0 should be a multiple of SDF_BRICK.
+    void evaluateGrid(float* field, Params& p, float isoMin, float isoMax, int x0 = 0, int x1 = INT_MAX) const;
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "sessionLog.h"
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <map>
+
+using namespace std::chrono;
+
+// Calls f(name, member) for every Params member a mesh event records
+template <typename F>
+static void visitMeshParams(Params& p, F&& f) {
+  f("density", p.density);
+  f("numUnitsX", p.numUnitsX);
+  f("numUnitsY", p.numUnitsY);
+  f("numUnitsZ", p.numUnitsZ);
+  f("isoValue", p.isoValue);
+  f("mesher", p.mesher);
+  f("adaptiveError", p.adaptiveError);
+  f("interpolate", p.interpolate);
+  f("decimate", p.decimate);
+  f("triangleBudget", p.triangleBudget);
+  f("decimateError", p.decimateError);
+  f("optimizeIndices", p.optimizeIndices);
+  f("time", p.time);
+  f("numLayers", p.numLayers);
+  f("layerSpacing", p.layerSpacing);
+  f("minIslandPoints", p.minIslandPoints);
+  f("minIslandTriangles", p.minIslandTriangles);
+  f("showMarch", p.showMarch);
+  f("showPoints", p.showPoints);
+  f("radius", p.radius);
+  f("xOffset", p.xOffset);
+  f("yOffset", p.yOffset);
+  f("zOffset", p.zOffset);
+  f("configIndex", p.configIndex);
+  // How it was meshed, which does not change the mesh but does the time it took
+  f("fieldThreads", p.fieldThreads);
+  f("fieldChunk", p.fieldChunk);
+  f("pipelineBricks", p.pipelineBricks);
+  f("packVertices", p.packVertices);
+}
+
+struct ParamWriter {
+  std::string& text;
+
+  void operator()(const char* name, float value) {
+    char pair[96];
+    snprintf(pair, sizeof(pair), " %s=%.9g", name, value);
+    text += pair;
+  }
+  void operator()(const char* name, int value) {
+    text += std::string(" ") + name + "=" + std::to_string(value);
+  }
+  void operator()(const char* name, bool value) {
+    text += std::string(" ") + name + "=" + (value ? "1" : "0");
+  }
+};
+
+struct ParamReader {
+  std::map<std::string, std::string>& values;
+
+  void operator()(const char* name, float& value) {
+    auto it = values.find(name);
+    if (it != values.end()) value = strtof(it->second.c_str(), nullptr);
+  }
+  void operator()(const char* name, int& value) {
+    auto it = values.find(name);
+    if (it != values.end()) value = atoi(it->second.c_str());
+  }
+  void operator()(const char* name, bool& value) {
+    auto it = values.find(name);
+    if (it != values.end()) value = atoi(it->second.c_str()) != 0;
+  }
+};
+
+SessionRecorder::~SessionRecorder() {
+  close();
+}
+
+bool SessionRecorder::open(const std::string& path) {
+  close();
+  file = fopen(path.c_str(), "w");
+  if (!file) return false;
+  start = steady_clock::now();
+  fprintf(file, "# marching-cubes session\n");
+  return true;
+}
+
+void SessionRecorder::close() {
+  if (file) {
+    fclose(file);
+    file = nullptr;
+  }
+}
+
+double SessionRecorder::now() {
+  return duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+void SessionRecorder::recordScene(const std::string& path) {
+  if (!file) return;
+  fprintf(file, "%.3f scene %s\n", now(), path.c_str());
+  fflush(file);
+}
+
+// Flushed straight away, since the sessions worth replaying are often the ones that end badly
+void SessionRecorder::recordMesh(const std::string& field, Params& p) {
+  if (!file) return;
+  fprintf(file, "%.3f mesh %s%s\n", now(), field.c_str(), formatMeshParams(p).c_str());
+  fflush(file);
+}
+
+std::string formatMeshParams(Params& p) {
+  std::string text;
+  visitMeshParams(p, ParamWriter{text});
+  return text;
+}
+
+void parseMeshParams(const std::string& text, Params& p) {
+  std::istringstream tokens(text);
+  std::map<std::string, std::string> values;
+  std::string pair;
+  while (tokens >> pair) {
+    size_t equals = pair.find('=');
+    if (equals != std::string::npos) {
+      values[pair.substr(0, equals)] = pair.substr(equals + 1);
+    }
+  }
+  visitMeshParams(p, ParamReader{values});
+}
+
+bool readSession(const std::string& path, std::vector<SessionEvent>& events, std::string& error) {
+  std::ifstream in(path);
+  if (!in) {
+    error = "could not open " + path;
+    return false;
+  }
+
+  std::string line;
+  int lineNumber = 0;
+  while (std::getline(in, line)) {
+    lineNumber++;
+    if (line.empty() || line[0] == '#') continue;
+
+    std::istringstream tokens(line);
+    SessionEvent event;
+    std::string type;
+    if (!(tokens >> event.time >> type)) {
+      error = "line " + std::to_string(lineNumber) + ": expected a time and an event";
+      return false;
+    }
+    if (type == "scene") {
+      event.type = SESSION_SCENE;
+      std::getline(tokens >> std::ws, event.scenePath);
+    } else if (type == "mesh" && tokens >> event.field) {
+      event.type = SESSION_MESH;
+      std::string rest;
+      std::getline(tokens, rest);
+      parseMeshParams(rest, event.params);
+      event.tuned = rest.find(" fieldThreads=") != std::string::npos;
+    } else {
+      error = "line " + std::to_string(lineNumber) + ": unknown event " + type;
+      return false;
+    }
+    events.push_back(event);
+  }
+  return true;
+}
@@ -0,0 +1,67 @@
+#ifndef SESSIONLOG
+#define SESSIONLOG
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "params.h"
+
+enum SessionEventType {
+  // A scene file was loaded, so later scene meshes can be replayed
+  SESSION_SCENE = 0,
+  // The viewer meshed field with params
+  SESSION_MESH = 1
+};
+
+struct SessionEvent {
+  int type = SESSION_MESH;
+  // Milliseconds since recording started
+  double time = 0.0;
+  std::string field;
+  std::string scenePath;
+  Params params;
+  // Logs from before the tuning Params were recorded leave them at their defaults
+  bool tuned = false;
+};
+
+/**
+  NOTE:
+  A session log is a text file with one event a line:
+  its time in milliseconds, then either
+
+    scene <path>
+    mesh <field> density=2 isoValue=0.5 ...
+
+  Mesh events list every Params member that changes
+  the mesh, so each one can be replayed on its own and
+  a log stays readable when new members are added,
+  and the tuning members it was meshed with, so a
+  replay takes as long as the session did. Members a
+  log does not mention keep their defaults.
+*/
+class SessionRecorder {
+  FILE* file = nullptr;
+  std::chrono::steady_clock::time_point start;
+
+  double now();
+
+  public:
+    ~SessionRecorder();
+
+    bool open(const std::string& path);
+    void close();
+    bool isRecording() { return file != nullptr; }
+
+    void recordScene(const std::string& path);
+    void recordMesh(const std::string& field, Params& p);
+};
+
+// The mesh Params as the " key=value" pairs of a mesh event, and back; members not given are left alone
+std::string formatMeshParams(Params& p);
+void parseMeshParams(const std::string& text, Params& p);
+
+bool readSession(const std::string& path, std::vector<SessionEvent>& events, std::string& error);
+
+#endif
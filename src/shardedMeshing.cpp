@@ -0,0 +1,311 @@
+#include "pointGrid.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <map>
+#include <deque>
+#include <array>
+#include <thread>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// A shard whose worker dies this many times fails the whole mesh
+const int MAX_SHARD_ATTEMPTS = 3;
+
+struct ShardHeader {
+  uint64_t numVertices;
+  uint64_t numIndices;
+};
+
+// Every attempt at a shard hands its mesh back in a shared memory object of its own
+static std::string shardObjectName(pid_t coordinator, int shard, int attempt) {
+  char name[64];
+  snprintf(name, sizeof(name), "/marching-cubes-%d-%d-%d", (int)coordinator, shard, attempt);
+  return name;
+}
+
+static size_t shardBytes(const ShardHeader& header) {
+  return sizeof(ShardHeader) + 2 * header.numVertices * sizeof(glm::vec3) + header.numIndices * sizeof(unsigned int);
+}
+
+static bool writeShard(const std::string& name, const MeshBrick& shard) {
+  int fd = shm_open(name.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+  if (fd < 0) return false;
+
+  ShardHeader header = {shard.vertices.size(), shard.indices.size()};
+  size_t size = shardBytes(header);
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return false;
+  }
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) return false;
+
+  char* out = (char*)memory;
+  memcpy(out, &header, sizeof(header));
+  out += sizeof(header);
+  if (header.numVertices) {
+    memcpy(out, shard.vertices.data(), header.numVertices * sizeof(glm::vec3));
+    out += header.numVertices * sizeof(glm::vec3);
+    memcpy(out, shard.normals.data(), header.numVertices * sizeof(glm::vec3));
+    out += header.numVertices * sizeof(glm::vec3);
+  }
+  if (header.numIndices) {
+    memcpy(out, shard.indices.data(), header.numIndices * sizeof(unsigned int));
+  }
+  munmap(memory, size);
+  return true;
+}
+
+// The object is unlinked as soon as it is open, whether or not it turns out whole
+static bool readShard(const std::string& name, MeshBrick& shard) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) return false;
+  shm_unlink(name.c_str());
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(ShardHeader)) {
+    close(fd);
+    return false;
+  }
+  void* memory = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) return false;
+
+  const char* in = (const char*)memory;
+  ShardHeader header;
+  memcpy(&header, in, sizeof(header));
+  in += sizeof(header);
+  bool whole = header.numVertices <= (size_t)info.st_size && header.numIndices <= (size_t)info.st_size && shardBytes(header) == (size_t)info.st_size;
+  if (whole) {
+    const glm::vec3* vertices = (const glm::vec3*)in;
+    const glm::vec3* normals = vertices + header.numVertices;
+    const unsigned int* indices = (const unsigned int*)(normals + header.numVertices);
+    shard.vertices.assign(vertices, vertices + header.numVertices);
+    shard.normals.assign(normals, normals + header.numVertices);
+    shard.indices.assign(indices, indices + header.numIndices);
+  }
+  munmap(memory, info.st_size);
+  return whole;
+}
+
+/**
+  NOTE:
+  The coordinator fills the field straight into shared
+  memory, or moves it there when it was filled before,
+  and forks a worker per shard, at most numWorkers at
+  a time. Each worker meshes its run of x-slabs with
+  a border of one cube on either side, like a sculpt
+  brick, writes the mesh to a shared memory object and
+  exits. A worker that dies or fails leaves no object
+  behind, and its shard is queued again.
+
+  Vertices on the plane between two shards come out
+  of both with the same position and, thanks to the
+  border, the same normal, so they are welded by
+  matching the two. Shards are passed to the sink in
+  order as soon as the ones before them are done.
+
+  The field object is unlinked as soon as it is
+  mapped, so nothing is left behind if the coordinator
+  itself dies. When meshing is over a field that was
+  filled here is dropped, to be filled again if it is
+  needed, and one that was moved is copied back into
+  the grid's own storage. Volumes are never copied at
+  all: each worker reads its own planes of the mapped
+  file, see the VolumeFile overload.
+*/
+bool PointGrid::generateShardedDrawData(MeshSink& sink, int numWorkers, int numShards, ShardReport* report) {
+  size_t count = (size_t)p.sizeX() * p.sizeY() * p.sizeZ();
+  bool filled = scalarField != nullptr;
+  if (!filled && !fieldFunc) return false;
+  if (filled && (fieldOriginX != 0 || fieldStorage.size() != count)) return false;
+
+  pid_t coordinator = getpid();
+  std::string fieldObject = shardObjectName(coordinator, -1, 0);
+  int fd = shm_open(fieldObject.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "Could not create shared memory for the field\n");
+    return false;
+  }
+  shm_unlink(fieldObject.c_str());
+  size_t fieldBytes = count * sizeof(float);
+  void* shared = ftruncate(fd, fieldBytes) == 0 ? mmap(nullptr, fieldBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (shared == MAP_FAILED) {
+    fprintf(stderr, "Could not map %zu bytes of shared memory for the field\n", fieldBytes);
+    return false;
+  }
+  if (filled) {
+    memcpy(shared, scalarField, fieldBytes);
+    std::vector<float>().swap(fieldStorage);
+    scalarField = (float*)shared;
+  } else {
+    fillScalarField((float*)shared);
+  }
+
+  // The workers' copies of the grid already point at the shared field
+  bool ok = meshShards(sink, numWorkers, numShards, report, nullptr);
+
+  if (filled) {
+    fieldStorage.assign(scalarField, scalarField + count);
+    scalarField = fieldStorage.data();
+  } else {
+    scalarField = nullptr;
+  }
+  munmap(shared, fieldBytes);
+  return ok;
+}
+
+bool PointGrid::meshShards(MeshSink& sink, int numWorkers, int numShards, ShardReport* report, std::function<void(int, int)> loadShard) {
+  int numCubesX = p.sizeX() - 1;
+  if (numWorkers <= 0) {
+    numWorkers = std::max(1u, std::thread::hardware_concurrency());
+  }
+  if (numShards <= 0) {
+    numShards = numWorkers;
+  }
+  numShards = std::max(1, std::min(numShards, numCubesX));
+  pid_t coordinator = getpid();
+
+  auto shardStart = [&](int shard) {
+    return (int)((long long)numCubesX * shard / numShards);
+  };
+  int sizeX = p.sizeX();
+  float density = p.density;
+  auto planeX = [&](int x) {
+    return (x - sizeX/2)/density;
+  };
+
+  std::deque<int> pending;
+  for (int shard = 0; shard < numShards; shard++) {
+    pending.push_back(shard);
+  }
+  std::vector<int> attempts(numShards, 0);
+  std::vector<MeshBrick> meshes(numShards);
+  std::vector<bool> finished(numShards, false);
+  std::map<pid_t, int> running;
+  int numRetries = 0;
+  bool ok = true;
+
+  // Seam vertices of the last shard passed on, by position and normal
+  std::map<std::array<float, 6>, unsigned int> seam;
+  unsigned int numVertices = 0;
+  int nextShard = 0;
+  auto passOn = [&](int shard) {
+    MeshBrick& mesh = meshes[shard];
+    float lowX = planeX(shardStart(shard));
+    float highX = planeX(shardStart(shard + 1));
+    std::map<std::array<float, 6>, unsigned int> nextSeam;
+    std::vector<unsigned int> remap(mesh.vertices.size());
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    for (size_t v = 0; v < mesh.vertices.size(); v++) {
+      glm::vec3& position = mesh.vertices[v];
+      glm::vec3& normal = mesh.normals[v];
+      std::array<float, 6> key = {{position.x, position.y, position.z, normal.x, normal.y, normal.z}};
+      auto welded = position.x == lowX ? seam.find(key) : seam.end();
+      if (welded != seam.end()) {
+        remap[v] = welded->second;
+      } else {
+        remap[v] = numVertices + vertices.size();
+        vertices.push_back(position);
+        normals.push_back(normal);
+      }
+      if (position.x == highX) {
+        nextSeam.insert({key, remap[v]});
+      }
+    }
+    for (unsigned int& index : mesh.indices) {
+      index = remap[index];
+    }
+    if (vertices.size()) {
+      sink.addVertices(&vertices[0], &normals[0], vertices.size());
+    }
+    if (mesh.indices.size()) {
+      sink.addTriangles(&mesh.indices[0], mesh.indices.size());
+    }
+    numVertices += vertices.size();
+    seam.swap(nextSeam);
+    mesh = MeshBrick();
+  };
+
+  while (ok && (!pending.empty() || !running.empty())) {
+    while (!pending.empty() && (int)running.size() < numWorkers) {
+      int shard = pending.front();
+      pid_t pid = fork();
+      if (pid < 0) break;
+      if (pid == 0) {
+        if (loadShard) {
+          loadShard(shardStart(shard), shardStart(shard + 1));
+        }
+        MeshBrick mesh;
+        meshRegion(glm::ivec3(shardStart(shard), 0, 0), glm::ivec3(shardStart(shard + 1), p.sizeY() - 1, p.sizeZ() - 1), mesh);
+        // Skips the coordinator's exit handlers and buffered output
+        _exit(writeShard(shardObjectName(coordinator, shard, attempts[shard]), mesh) ? 0 : 1);
+      }
+      pending.pop_front();
+      running[pid] = shard;
+    }
+    if (running.empty()) {
+      fprintf(stderr, "Could not start a worker process\n");
+      ok = false;
+      break;
+    }
+
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      ok = false;
+      break;
+    }
+    auto worker = running.find(pid);
+    if (worker == running.end()) continue;
+    int shard = worker->second;
+    running.erase(worker);
+
+    std::string name = shardObjectName(coordinator, shard, attempts[shard]++);
+    bool exited = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (exited && readShard(name, meshes[shard])) {
+      finished[shard] = true;
+    } else {
+      shm_unlink(name.c_str());
+      if (WIFSIGNALED(status)) {
+        fprintf(stderr, "Worker for shard %d was killed by signal %d\n", shard, WTERMSIG(status));
+      } else {
+        fprintf(stderr, "Worker for shard %d failed\n", shard);
+      }
+      if (attempts[shard] >= MAX_SHARD_ATTEMPTS) {
+        fprintf(stderr, "Giving up on shard %d after %d attempts\n", shard, attempts[shard]);
+        ok = false;
+      } else {
+        pending.push_back(shard);
+        numRetries++;
+      }
+    }
+    while (ok && nextShard < numShards && finished[nextShard]) {
+      passOn(nextShard++);
+    }
+  }
+
+  // Workers still running after a failure are of no use
+  for (auto& worker : running) {
+    kill(worker.first, SIGKILL);
+    waitpid(worker.first, nullptr, 0);
+    shm_unlink(shardObjectName(coordinator, worker.second, attempts[worker.second]).c_str());
+  }
+
+  if (report) {
+    report->numShards = numShards;
+    report->numWorkers = numWorkers;
+    report->numRetries = numRetries;
+  }
+  return ok;
+}
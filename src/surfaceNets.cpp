@@ -0,0 +1,220 @@
+#include "pointGrid.h"
+#include <cmath>
+#include <algorithm>
+
+// Corner i of a cell sits at (+i%2, +(i%4)/2, +i/4), as in the marching cubes mesher
+static const int cellEdges[12][2] = {
+  {0, 1}, {2, 3}, {4, 5}, {6, 7},
+  {0, 2}, {1, 3}, {4, 6}, {5, 7},
+  {0, 4}, {1, 5}, {2, 6}, {3, 7}
+};
+
+// Gradient of the trilinear interpolation of the corner values at local position l
+static glm::vec3 trilinearGradient(const float* c, glm::vec3 l) {
+  float u = l.x, v = l.y, w = l.z;
+  return glm::vec3(
+    (1 - v) * (1 - w) * (c[1] - c[0]) + v * (1 - w) * (c[3] - c[2]) + (1 - v) * w * (c[5] - c[4]) + v * w * (c[7] - c[6]),
+    (1 - u) * (1 - w) * (c[2] - c[0]) + u * (1 - w) * (c[3] - c[1]) + (1 - u) * w * (c[6] - c[4]) + u * w * (c[7] - c[5]),
+    (1 - u) * (1 - v) * (c[4] - c[0]) + u * (1 - v) * (c[5] - c[1]) + (1 - u) * v * (c[6] - c[2]) + u * v * (c[7] - c[3])
+  );
+}
+
+/**
+  NOTE:
+  Dual contouring places the vertex at the point that
+  best fits the tangent planes of its edge crossings.
+  A small pull towards the mass point keeps the system
+  solvable on flat and cylindrical patches, and the
+  result is clamped to the cell so the mesh cannot fold.
+*/
+static glm::vec3 solveQef(const glm::vec3* points, const glm::vec3* normals, int count, glm::vec3 massPoint) {
+  const float bias = 0.05f;
+  float a[3][3] = {{bias, 0, 0}, {0, bias, 0}, {0, 0, bias}};
+  float b[3] = {bias * massPoint.x, bias * massPoint.y, bias * massPoint.z};
+  for (int i = 0; i < count; i++) {
+    const glm::vec3& n = normals[i];
+    float d = glm::dot(n, points[i]);
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        a[r][c] += n[r] * n[c];
+      }
+      b[r] += n[r] * d;
+    }
+  }
+
+  float det =
+    a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) -
+    a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0]) +
+    a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+  if (std::abs(det) < 1e-12f) {
+    return massPoint;
+  }
+
+  // Cramer's rule
+  glm::vec3 result;
+  for (int k = 0; k < 3; k++) {
+    float m[3][3];
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        m[r][c] = c == k ? b[r] : a[r][c];
+      }
+    }
+    result[k] = (
+      m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+      m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+      m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0])
+    ) / det;
+  }
+  return glm::clamp(result, glm::vec3(0.0f), glm::vec3(1.0f));
+}
+
+/**
+  NOTE:
+  Surface nets place one vertex in every cell the
+  surface passes through and join the four cells
+  around each crossed grid edge with a quad, so the
+  mesh has roughly half the vertices of the marching
+  cubes one and no duplicated vertices. Normals come
+  from the field gradient instead of face averages.
+
+  Like the marching cubes mesher, cells are visited a
+  slab at a time. A slab's vertices are final as soon
+  as they are placed, so they are handed to the sink
+  straight away. Each cell then emits the quads of
+  the three edges leaving its lowest corner, whose
+  cells all lie in this slab or the previous one, so
+  only two slabs of cell indices are kept.
+*/
+void PointGrid::netSlabs(MeshSink& sink, std::function<void(int)> loadSlab) {
+  int cellsY = p.sizeY() - 1;
+  int cellsZ = p.sizeZ() - 1;
+  if (p.sizeX() < 2 || cellsY < 1 || cellsZ < 1) return;
+
+  bool dualContour = p.mesher == MESHER_DUAL_CONTOURING;
+  std::vector<int> previous(cellsY * cellsZ, -1);
+  std::vector<int> current(cellsY * cellsZ, -1);
+  std::vector<glm::vec3> slabVertices;
+  std::vector<glm::vec3> slabNormals;
+  std::vector<unsigned int> slabIndices;
+  unsigned int numVertices = 0;
+
+  for (int x = 0; x < p.sizeX() - 1; x++) {
+    if (loadSlab) {
+      loadSlab(x);
+    }
+
+    // Place the vertices of this slab
+    for (int y = 0; y < cellsY; y++) {
+      for (int z = 0; z < cellsZ; z++) {
+        float corners[8];
+        int mask = 0;
+        for (int i = 0; i < 8; i++) {
+          int pX = x + i%2;
+          int pY = y + (i % 4) / 2;
+          int pZ = z + i / 4;
+          corners[i] = scalarField[coordsToIndex(pX, pY, pZ)];
+          bool active = corners[i] >= p.isoValue;
+          if (active) mask |= 1 << i;
+        }
+
+        int& cell = current[y * cellsZ + z];
+        if (mask == 0 || mask == 255) {
+          cell = -1;
+          continue;
+        }
+
+        // Edge crossings in cell local coordinates
+        glm::vec3 crossings[12];
+        glm::vec3 crossingNormals[12];
+        int numCrossings = 0;
+        glm::vec3 massPoint(0.0f);
+        for (auto& edge : cellEdges) {
+          int a = edge[0];
+          int b = edge[1];
+          if (((mask >> a) & 1) == ((mask >> b) & 1)) continue;
+
+          float t = 0.5f;
+          if (p.interpolate && std::abs(corners[b] - corners[a]) > 0.000001f) {
+            t = (p.isoValue - corners[a]) / (corners[b] - corners[a]);
+          }
+          glm::vec3 cornerA(a%2, (a % 4) / 2, a / 4);
+          glm::vec3 cornerB(b%2, (b % 4) / 2, b / 4);
+          glm::vec3 crossing = cornerA + t * (cornerB - cornerA);
+          crossings[numCrossings] = crossing;
+          if (dualContour) {
+            glm::vec3 gradient = trilinearGradient(corners, crossing);
+            float length = glm::length(gradient);
+            crossingNormals[numCrossings] = length > 0.000001f ? gradient / length : glm::vec3(0.0f);
+          }
+          massPoint += crossing;
+          numCrossings++;
+        }
+        massPoint /= numCrossings;
+
+        glm::vec3 local = dualContour ? solveQef(crossings, crossingNormals, numCrossings, massPoint) : massPoint;
+
+        // The field increases inwards, so the outward normal is against the gradient
+        glm::vec3 normal = -trilinearGradient(corners, local);
+        float length = glm::length(normal);
+        normal = length > 0.000001f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+
+        cell = numVertices + slabVertices.size();
+        slabVertices.push_back(glm::vec3(
+          (x - p.sizeX()/2 + local.x)/p.density,
+          (y + local.y)/p.density,
+          (z - p.sizeZ()/2 + local.z)/p.density
+        ));
+        slabNormals.push_back(normal);
+      }
+    }
+
+    if (slabVertices.size()) {
+      sink.addVertices(&slabVertices[0], &slabNormals[0], slabVertices.size());
+      numVertices += slabVertices.size();
+      slabVertices.clear();
+      slabNormals.clear();
+    }
+
+    // Join the cells around every crossed edge
+    auto cellAt = [&](int cX, int cY, int cZ) {
+      return (cX == x ? current : previous)[cY * cellsZ + cZ];
+    };
+    auto addQuad = [&](int c0, int c1, int c2, int c3, bool flip) {
+      if (c0 < 0 || c1 < 0 || c2 < 0 || c3 < 0) return 0;
+      // The quad is wound so that its normal points along the edge
+      if (flip) std::swap(c1, c3);
+      slabIndices.push_back(c0);
+      slabIndices.push_back(c1);
+      slabIndices.push_back(c2);
+      slabIndices.push_back(c0);
+      slabIndices.push_back(c2);
+      slabIndices.push_back(c3);
+      return 2;
+    };
+    for (int y = 0; y < cellsY; y++) {
+      for (int z = 0; z < cellsZ; z++) {
+        int trisPerCube = 0;
+        bool inside = scalarField[coordsToIndex(x, y, z)] >= p.isoValue;
+
+        // Triangles face inwards, as in the marching cubes mesher, so a
+        // crossing that leaves the surface along +axis is wound against it
+        if (y > 0 && z > 0 && inside != (scalarField[coordsToIndex(x + 1, y, z)] >= p.isoValue)) {
+          trisPerCube += addQuad(cellAt(x, y - 1, z - 1), cellAt(x, y, z - 1), cellAt(x, y, z), cellAt(x, y - 1, z), inside);
+        }
+        if (x > 0 && z > 0 && inside != (scalarField[coordsToIndex(x, y + 1, z)] >= p.isoValue)) {
+          trisPerCube += addQuad(cellAt(x - 1, y, z - 1), cellAt(x - 1, y, z), cellAt(x, y, z), cellAt(x, y, z - 1), inside);
+        }
+        if (x > 0 && y > 0 && inside != (scalarField[coordsToIndex(x, y, z + 1)] >= p.isoValue)) {
+          trisPerCube += addQuad(cellAt(x - 1, y - 1, z), cellAt(x, y - 1, z), cellAt(x, y, z), cellAt(x - 1, y, z), inside);
+        }
+        sink.addCube(trisPerCube);
+      }
+    }
+
+    if (slabIndices.size()) {
+      sink.addTriangles(&slabIndices[0], slabIndices.size());
+      slabIndices.clear();
+    }
+    std::swap(previous, current);
+  }
+}
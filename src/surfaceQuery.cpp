@@ -0,0 +1,350 @@
+#include "pointGrid.h"
+#include <cmath>
+#include <algorithm>
+#include <thread>
+
+// Steps through a block holding the surface, in grid cells
+const float QUERY_STEP = 0.5f;
+// Bisection steps refining a crossing once it is bracketed
+const int QUERY_REFINE = 8;
+
+void PointGrid::invalidateRanges() {
+  rangeLevels.clear();
+  rangeCounts.clear();
+  rangesDirty = false;
+}
+
+void PointGrid::markRangesDirty(glm::ivec3 lo, glm::ivec3 hi) {
+  if (rangeLevels.empty()) return;
+  if (!rangesDirty) {
+    rangesDirtyMin = lo;
+    rangesDirtyMax = hi;
+    rangesDirty = true;
+  } else {
+    rangesDirtyMin = glm::ivec3(std::min(rangesDirtyMin.x, lo.x), std::min(rangesDirtyMin.y, lo.y), std::min(rangesDirtyMin.z, lo.z));
+    rangesDirtyMax = glm::ivec3(std::max(rangesDirtyMax.x, hi.x), std::max(rangesDirtyMax.y, hi.y), std::max(rangesDirtyMax.z, hi.z));
+  }
+}
+
+/**
+  NOTE:
+  Level 0 holds the min and max of the field over
+  blocks of QUERY_BLOCK^3 cubes, including the points
+  on their far faces, and each level above merges
+  2x2x2 blocks of the one below. A trilinear cell
+  never leaves the range of its corners, so a block
+  whose range misses the iso value holds no surface.
+*/
+void PointGrid::updateRanges() {
+  glm::ivec3 cubes(p.sizeX() - 1, p.sizeY() - 1, p.sizeZ() - 1);
+  glm::ivec3 blockMin, blockMax;
+  if (rangeLevels.empty()) {
+    glm::ivec3 counts(
+      (cubes.x + QUERY_BLOCK - 1) / QUERY_BLOCK,
+      (cubes.y + QUERY_BLOCK - 1) / QUERY_BLOCK,
+      (cubes.z + QUERY_BLOCK - 1) / QUERY_BLOCK
+    );
+    while (true) {
+      rangeCounts.push_back(counts);
+      rangeLevels.push_back(std::vector<glm::vec2>((size_t)counts.x * counts.y * counts.z));
+      if (counts.x == 1 && counts.y == 1 && counts.z == 1) break;
+      counts = glm::ivec3((counts.x + 1) / 2, (counts.y + 1) / 2, (counts.z + 1) / 2);
+    }
+    blockMin = glm::ivec3(0);
+    blockMax = rangeCounts[0] - glm::ivec3(1);
+  } else if (rangesDirty) {
+    // A point is shared by the blocks on both sides of it
+    for (int a = 0; a < 3; a++) {
+      blockMin[a] = std::max(rangesDirtyMin[a] - 1, 0) / QUERY_BLOCK;
+      blockMax[a] = std::min(rangesDirtyMax[a], cubes[a] - 1) / QUERY_BLOCK;
+    }
+  } else {
+    return;
+  }
+  rangesDirty = false;
+
+  glm::ivec3 counts = rangeCounts[0];
+  for (int bx = blockMin.x; bx <= blockMax.x; bx++) {
+    for (int by = blockMin.y; by <= blockMax.y; by++) {
+      for (int bz = blockMin.z; bz <= blockMax.z; bz++) {
+        glm::vec2 range(INFINITY, -INFINITY);
+        int x1 = std::min((bx + 1) * QUERY_BLOCK, cubes.x);
+        int y1 = std::min((by + 1) * QUERY_BLOCK, cubes.y);
+        int z1 = std::min((bz + 1) * QUERY_BLOCK, cubes.z);
+        for (int x = bx * QUERY_BLOCK; x <= x1; x++) {
+          for (int y = by * QUERY_BLOCK; y <= y1; y++) {
+            for (int z = bz * QUERY_BLOCK; z <= z1; z++) {
+              float value = scalarField[coordsToIndex(x, y, z)];
+              range.x = std::min(range.x, value);
+              range.y = std::max(range.y, value);
+            }
+          }
+        }
+        rangeLevels[0][bz + counts.z * (by + counts.y * bx)] = range;
+      }
+    }
+  }
+
+  for (size_t level = 1; level < rangeLevels.size(); level++) {
+    glm::ivec3 childCounts = rangeCounts[level - 1];
+    counts = rangeCounts[level];
+    blockMin = glm::ivec3(blockMin.x / 2, blockMin.y / 2, blockMin.z / 2);
+    blockMax = glm::ivec3(blockMax.x / 2, blockMax.y / 2, blockMax.z / 2);
+    for (int bx = blockMin.x; bx <= blockMax.x; bx++) {
+      for (int by = blockMin.y; by <= blockMax.y; by++) {
+        for (int bz = blockMin.z; bz <= blockMax.z; bz++) {
+          glm::vec2 range(INFINITY, -INFINITY);
+          for (int x = bx * 2; x < std::min(bx * 2 + 2, childCounts.x); x++) {
+            for (int y = by * 2; y < std::min(by * 2 + 2, childCounts.y); y++) {
+              for (int z = bz * 2; z < std::min(bz * 2 + 2, childCounts.z); z++) {
+                glm::vec2 child = rangeLevels[level - 1][z + childCounts.z * (y + childCounts.y * x)];
+                range.x = std::min(range.x, child.x);
+                range.y = std::max(range.y, child.y);
+              }
+            }
+          }
+          rangeLevels[level][bz + counts.z * (by + counts.y * bx)] = range;
+        }
+      }
+    }
+  }
+}
+
+float PointGrid::sampleTrilinear(glm::vec3 g) const {
+  int sizeX = p.sizeX();
+  int sizeY = p.sizeY();
+  int sizeZ = p.sizeZ();
+  glm::vec3 c = glm::clamp(g, glm::vec3(0), glm::vec3(sizeX - 1, sizeY - 1, sizeZ - 1));
+  int x = std::min((int)c.x, sizeX - 2);
+  int y = std::min((int)c.y, sizeY - 2);
+  int z = std::min((int)c.z, sizeZ - 2);
+  float u = c.x - x, v = c.y - y, w = c.z - z;
+
+  const float* corner = scalarField + (z + sizeZ * (y + sizeY * x));
+  int dy = sizeZ;
+  int dx = sizeZ * sizeY;
+  float c00 = corner[0] + (corner[dx] - corner[0]) * u;
+  float c10 = corner[dy] + (corner[dx + dy] - corner[dy]) * u;
+  float c01 = corner[1] + (corner[dx + 1] - corner[1]) * u;
+  float c11 = corner[dy + 1] + (corner[dx + dy + 1] - corner[dy + 1]) * u;
+  float c0 = c00 + (c10 - c00) * v;
+  float c1 = c01 + (c11 - c01) * v;
+  return c0 + (c1 - c0) * w;
+}
+
+/**
+  NOTE:
+  Rays skip the largest block around them that lies
+  wholly on their starting side of the surface, and
+  only march (QUERY_STEP cells at a time) through
+  blocks that may hold it. The first bracketed
+  crossing is then refined by bisection.
+*/
+RayHit PointGrid::traceRay(glm::vec3 origin, glm::vec3 direction) const {
+  RayHit result;
+  if (glm::length(direction) <= 0.0f) return result;
+
+  int sizeX = p.sizeX();
+  int sizeY = p.sizeY();
+  int sizeZ = p.sizeZ();
+  float isoValue = p.isoValue;
+  glm::vec3 gridMax(sizeX - 1, sizeY - 1, sizeZ - 1);
+  glm::vec3 start(origin.x * p.density + sizeX / 2, origin.y * p.density, origin.z * p.density + sizeZ / 2);
+  glm::vec3 step = glm::normalize(direction);
+
+  // Clip the ray to the grid so only the part inside it is marched
+  float tNear = 0.0f;
+  float tFar = 1e30f;
+  for (int a = 0; a < 3; a++) {
+    if (std::abs(step[a]) < 1e-8f) {
+      if (start[a] < 0 || start[a] > gridMax[a]) return result;
+      continue;
+    }
+    float t0 = (0 - start[a]) / step[a];
+    float t1 = (gridMax[a] - start[a]) / step[a];
+    tNear = std::max(tNear, std::min(t0, t1));
+    tFar = std::min(tFar, std::max(t0, t1));
+  }
+  if (tNear > tFar) return result;
+
+  float t = tNear;
+  float value = sampleTrilinear(start + step * t);
+  bool startInside = value >= isoValue;
+  while (t < tFar) {
+    // Find the largest block around the ray holding nothing but its starting side
+    glm::vec3 ahead = glm::clamp(start + step * (t + 1e-4f), glm::vec3(0), gridMax - glm::vec3(1));
+    glm::ivec3 cube((int)ahead.x, (int)ahead.y, (int)ahead.z);
+    int skipLevel = -1;
+    for (size_t level = 0; level < rangeLevels.size(); level++) {
+      int blockSize = QUERY_BLOCK << level;
+      glm::ivec3 counts = rangeCounts[level];
+      glm::vec2 range = rangeLevels[level][cube.z / blockSize + counts.z * (cube.y / blockSize + counts.y * (cube.x / blockSize))];
+      bool sameSide = startInside ? range.x >= isoValue : range.y < isoValue;
+      if (!sameSide) break;
+      skipLevel = level;
+    }
+
+    float tNext;
+    if (skipLevel >= 0) {
+      int blockSize = QUERY_BLOCK << skipLevel;
+      float tExit = tFar;
+      for (int a = 0; a < 3; a++) {
+        if (std::abs(step[a]) < 1e-8f) continue;
+        float lo = (cube[a] / blockSize) * blockSize;
+        float bound = step[a] > 0 ? lo + blockSize : lo;
+        tExit = std::min(tExit, (bound - start[a]) / step[a]);
+      }
+      tNext = std::max(tExit, t + 1e-4f);
+    } else {
+      tNext = t + QUERY_STEP;
+    }
+    tNext = std::min(tNext, tFar);
+
+    float nextValue = sampleTrilinear(start + step * tNext);
+    if ((nextValue >= isoValue) != startInside) {
+      float lo = t;
+      float hi = tNext;
+      for (int i = 0; i < QUERY_REFINE; i++) {
+        float mid = (lo + hi) / 2;
+        if ((sampleTrilinear(start + step * mid) >= isoValue) != startInside) {
+          hi = mid;
+        } else {
+          lo = mid;
+        }
+      }
+      float loValue = sampleTrilinear(start + step * lo);
+      float hiValue = sampleTrilinear(start + step * hi);
+      float mu = std::abs(hiValue - loValue) < 0.000001f ? 0.0f : (isoValue - loValue) / (hiValue - loValue);
+      glm::vec3 g = start + step * (lo + mu * (hi - lo));
+
+      // The field grows inwards, so the outward normal is against its gradient
+      glm::vec3 gradient(
+        sampleTrilinear(g + glm::vec3(0.5f, 0, 0)) - sampleTrilinear(g - glm::vec3(0.5f, 0, 0)),
+        sampleTrilinear(g + glm::vec3(0, 0.5f, 0)) - sampleTrilinear(g - glm::vec3(0, 0.5f, 0)),
+        sampleTrilinear(g + glm::vec3(0, 0, 0.5f)) - sampleTrilinear(g - glm::vec3(0, 0, 0.5f))
+      );
+      result.hit = true;
+      result.position = glm::vec3((g.x - sizeX / 2) / p.density, g.y / p.density, (g.z - sizeZ / 2) / p.density);
+      result.normal = glm::length(gradient) > 0.0f ? -glm::normalize(gradient) : -step;
+      result.distance = (lo + mu * (hi - lo)) / p.density;
+      return result;
+    }
+    t = tNext;
+  }
+  return result;
+}
+
+bool PointGrid::raycast(glm::vec3 origin, glm::vec3 direction, glm::vec3& hit) {
+  if (!scalarField || fieldOriginX != 0) return false;
+  updateRanges();
+  RayHit result = traceRay(origin, direction);
+  hit = result.position;
+  return result.hit;
+}
+
+void PointGrid::raycast(const std::vector<glm::vec3>& origins, const std::vector<glm::vec3>& directions, std::vector<RayHit>& hits, int numThreads) {
+  hits.assign(std::min(origins.size(), directions.size()), RayHit());
+  if (!scalarField || fieldOriginX != 0 || hits.empty()) return;
+  updateRanges();
+
+  // Rays only read the field and its ranges, so they are split evenly across threads
+  if (numThreads <= 0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  numThreads = std::min((size_t)numThreads, (hits.size() + 255) / 256);
+  auto traceRange = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      hits[i] = traceRay(origins[i], directions[i]);
+    }
+  };
+  if (numThreads <= 1) {
+    traceRange(0, hits.size());
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  size_t perThread = (hits.size() + numThreads - 1) / numThreads;
+  for (int i = 0; i < numThreads; i++) {
+    size_t begin = i * perThread;
+    size_t end = std::min(hits.size(), begin + perThread);
+    if (begin < end) threads.push_back(std::thread(traceRange, begin, end));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+/**
+  NOTE:
+  The closest point is searched for among the edge
+  crossings the marching cubes mesher would place its
+  vertices on, descending only into blocks that hold
+  the surface and are nearer than the best so far.
+*/
+bool PointGrid::closestPoint(glm::vec3 point, float maxDistance, glm::vec3& closest) {
+  if (!scalarField || fieldOriginX != 0) return false;
+  updateRanges();
+
+  int sizeX = p.sizeX();
+  int sizeY = p.sizeY();
+  int sizeZ = p.sizeZ();
+  float isoValue = p.isoValue;
+  glm::ivec3 cubes(sizeX - 1, sizeY - 1, sizeZ - 1);
+  glm::vec3 target(point.x * p.density + sizeX / 2, point.y * p.density, point.z * p.density + sizeZ / 2);
+  float best = maxDistance * p.density;
+  float bestSquared = best * best;
+  bool found = false;
+  glm::vec3 bestPoint;
+
+  std::function<void(int, int, int, int)> visit = [&](int level, int bx, int by, int bz) {
+    glm::ivec3 counts = rangeCounts[level];
+    if (bx >= counts.x || by >= counts.y || bz >= counts.z) return;
+    glm::vec2 range = rangeLevels[level][bz + counts.z * (by + counts.y * bx)];
+    if (range.y < isoValue || range.x >= isoValue) return;
+
+    int blockSize = QUERY_BLOCK << level;
+    glm::vec3 lo = glm::vec3(bx, by, bz) * (float)blockSize;
+    glm::vec3 hi = glm::min(lo + glm::vec3(blockSize), glm::vec3(cubes));
+    glm::vec3 nearest = glm::clamp(target, lo, hi);
+    if (glm::dot(nearest - target, nearest - target) > bestSquared) return;
+
+    if (level > 0) {
+      for (int i = 0; i < 8; i++) {
+        visit(level - 1, bx * 2 + i % 2, by * 2 + (i % 4) / 2, bz * 2 + i / 4);
+      }
+      return;
+    }
+
+    // Edges along each axis from every point of the block
+    for (int x = (int)lo.x; x <= (int)hi.x; x++) {
+      for (int y = (int)lo.y; y <= (int)hi.y; y++) {
+        for (int z = (int)lo.z; z <= (int)hi.z; z++) {
+          float value = scalarField[coordsToIndex(x, y, z)];
+          glm::ivec3 corner(x, y, z);
+          for (int a = 0; a < 3; a++) {
+            glm::ivec3 other = corner;
+            other[a]++;
+            if (other[a] > (int)hi[a]) continue;
+            float otherValue = scalarField[coordsToIndex(other.x, other.y, other.z)];
+            if ((value >= isoValue) == (otherValue >= isoValue)) continue;
+
+            glm::vec3 crossing(corner);
+            crossing[a] += (isoValue - value) / (otherValue - value);
+            float distanceSquared = glm::dot(crossing - target, crossing - target);
+            if (distanceSquared <= bestSquared) {
+              bestSquared = distanceSquared;
+              bestPoint = crossing;
+              found = true;
+            }
+          }
+        }
+      }
+    }
+  };
+  visit(rangeLevels.size() - 1, 0, 0, 0);
+
+  if (found) {
+    closest = glm::vec3((bestPoint.x - sizeX / 2) / p.density, bestPoint.y / p.density, (bestPoint.z - sizeZ / 2) / p.density);
+  }
+  return found;
+}
@@ -0,0 +1,175 @@
+#include "taskGraph.h"
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+using namespace std::chrono;
+
+int TaskGraph::addStage(const std::string& name) {
+  stageNames.push_back(name);
+  return stageNames.size() - 1;
+}
+
+int TaskGraph::addTask(int stage, std::function<void()> run) {
+  Task task;
+  task.stage = stage;
+  task.run = run;
+  tasks.push_back(task);
+  return tasks.size() - 1;
+}
+
+void TaskGraph::addDependency(int before, int after) {
+  if (before < 0 || after <= before || after >= (int)tasks.size()) return;
+  tasks[before].successors.push_back(after);
+  tasks[after].numPredecessors++;
+}
+
+struct TaskQueue {
+  std::mutex mutex;
+  std::deque<int> tasks;
+};
+
+// What one thread ran, merged into the report once the graph is done
+struct ThreadTimes {
+  std::vector<int> numTasks;
+  std::vector<float> busyMs;
+  std::vector<float> firstStartMs;
+  std::vector<float> lastEndMs;
+  float totalBusyMs = 0.0f;
+};
+
+void TaskGraph::run(int numThreads, TaskReport* report) {
+  numThreads = std::max(numThreads, 1);
+  int numTasks = tasks.size();
+  int numStages = stageNames.size();
+
+  std::unique_ptr<std::atomic<int>[]> waiting(new std::atomic<int>[numTasks]);
+  std::vector<TaskQueue> queues(numThreads);
+  // Tasks ready from the start are dealt out in turn, each queue's first at its back
+  int numRoots = 0;
+  for (int i = numTasks - 1; i >= 0; i--) {
+    waiting[i] = tasks[i].numPredecessors;
+    if (!tasks[i].numPredecessors) numRoots++;
+  }
+  for (int i = 0, dealt = 0; i < numTasks; i++) {
+    if (!tasks[i].numPredecessors) {
+      queues[dealt++ % numThreads].tasks.push_front(i);
+    }
+  }
+
+  std::atomic<int> remaining(numTasks);
+  std::atomic<int> numReady(numRoots);
+  std::atomic<int> numSteals(0);
+  std::mutex idleMutex;
+  std::condition_variable idle;
+
+  std::vector<ThreadTimes> times(numThreads);
+  for (ThreadTimes& t : times) {
+    t.numTasks.assign(numStages, 0);
+    t.busyMs.assign(numStages, 0.0f);
+    t.firstStartMs.assign(numStages, 0.0f);
+    t.lastEndMs.assign(numStages, 0.0f);
+  }
+  auto start = steady_clock::now();
+  auto since = [&](steady_clock::time_point time) {
+    return duration<float, std::milli>(time - start).count();
+  };
+
+  auto take = [&](int thread, int& task) {
+    {
+      std::lock_guard<std::mutex> lock(queues[thread].mutex);
+      if (!queues[thread].tasks.empty()) {
+        task = queues[thread].tasks.back();
+        queues[thread].tasks.pop_back();
+        return true;
+      }
+    }
+    for (int k = 1; k < numThreads; k++) {
+      TaskQueue& other = queues[(thread + k) % numThreads];
+      std::lock_guard<std::mutex> lock(other.mutex);
+      if (!other.tasks.empty()) {
+        task = other.tasks.front();
+        other.tasks.pop_front();
+        numSteals++;
+        return true;
+      }
+    }
+    return false;
+  };
+
+  auto work = [&](int thread) {
+    ThreadTimes& t = times[thread];
+    while (remaining > 0) {
+      int task;
+      if (!take(thread, task)) {
+        std::unique_lock<std::mutex> lock(idleMutex);
+        idle.wait(lock, [&]() { return numReady > 0 || remaining == 0; });
+        continue;
+      }
+      numReady--;
+
+      Task& current = tasks[task];
+      auto taskStart = steady_clock::now();
+      current.run();
+      auto taskEnd = steady_clock::now();
+      int stage = current.stage;
+      float busy = duration<float, std::milli>(taskEnd - taskStart).count();
+      if (stage >= 0 && stage < numStages) {
+        if (!t.numTasks[stage]++) t.firstStartMs[stage] = since(taskStart);
+        t.busyMs[stage] += busy;
+        t.lastEndMs[stage] = since(taskEnd);
+      }
+      t.totalBusyMs += busy;
+
+      int madeReady = 0;
+      for (int successor : current.successors) {
+        if (--waiting[successor] == 0) {
+          std::lock_guard<std::mutex> lock(queues[thread].mutex);
+          queues[thread].tasks.push_back(successor);
+          madeReady++;
+        }
+      }
+      numReady += madeReady;
+      // This thread takes one of them itself, so only the rest need waking for
+      bool done = --remaining == 0;
+      if (done || madeReady > 1) {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        idle.notify_all();
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < numThreads; i++) {
+    threads.push_back(std::thread(work, i));
+  }
+  work(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  if (!report) return;
+  report->numThreads = numThreads;
+  report->wallMs = since(steady_clock::now());
+  report->numSteals = numSteals;
+  report->stages.assign(numStages, StageReport());
+  report->threadBusyMs.clear();
+  for (int s = 0; s < numStages; s++) {
+    StageReport& stage = report->stages[s];
+    stage.name = stageNames[s];
+    for (ThreadTimes& t : times) {
+      if (!t.numTasks[s]) continue;
+      stage.firstStartMs = stage.numTasks ? std::min(stage.firstStartMs, t.firstStartMs[s]) : t.firstStartMs[s];
+      stage.lastEndMs = std::max(stage.lastEndMs, t.lastEndMs[s]);
+      stage.numTasks += t.numTasks[s];
+      stage.busyMs += t.busyMs[s];
+    }
+  }
+  for (ThreadTimes& t : times) {
+    report->threadBusyMs.push_back(t.totalBusyMs);
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef TASKGRAPH
+#define TASKGRAPH
+
+#include <vector>
+#include <string>
+#include <functional>
+
+struct StageReport {
+  std::string name;
+  int numTasks = 0;
+  // Summed over the threads that ran the stage's tasks
+  float busyMs = 0.0f;
+  // When the stage's first task started and its last ended, since the graph started
+  float firstStartMs = 0.0f;
+  float lastEndMs = 0.0f;
+};
+
+struct TaskReport {
+  int numThreads = 0;
+  float wallMs = 0.0f;
+  // Tasks taken from another thread's queue
+  int numSteals = 0;
+  std::vector<StageReport> stages;
+  std::vector<float> threadBusyMs;
+
+  // Share of the time all threads had that went to a stage
+  float utilisation(const StageReport& stage) const {
+    return wallMs > 0.0f && numThreads > 0 ? stage.busyMs / (wallMs * numThreads) : 0.0f;
+  }
+};
+
+/**
+  NOTE:
+  A graph of tasks, each in a stage, that runs a task
+  once every task it depends on has run. Every thread
+  keeps a queue of its own: the tasks a finished task
+  makes ready go to the back of its thread's queue and
+  are taken from there first, so a task usually runs
+  right after the one that produced its data, while
+  that data is still in cache. A thread with nothing
+  left steals from the front of another's queue.
+
+  Tasks and dependencies are added before run, and
+  dependencies only ever point to later tasks, so a
+  graph cannot have cycles.
+*/
+class TaskGraph {
+  struct Task {
+    int stage;
+    std::function<void()> run;
+    std::vector<int> successors;
+    int numPredecessors = 0;
+  };
+  std::vector<Task> tasks;
+  std::vector<std::string> stageNames;
+
+  public:
+    int addStage(const std::string& name);
+    int addTask(int stage, std::function<void()> run);
+    // after only runs once before has
+    void addDependency(int before, int after);
+    size_t size() { return tasks.size(); }
+
+    // Runs every task on numThreads threads, the calling thread among them
+    void run(int numThreads, TaskReport* report = nullptr);
+};
+
+#endif
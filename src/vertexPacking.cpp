@@ -0,0 +1,76 @@
+#include "vertexPacking.h"
+#include <cmath>
+#include <algorithm>
+
+void getGridBounds(Params& p, glm::vec3& boundsMin, glm::vec3& boundsMax) {
+  boundsMin = glm::vec3(-(p.sizeX() / 2), 0, -(p.sizeZ() / 2)) / p.density;
+  boundsMax = glm::vec3(p.sizeX() - 1 - p.sizeX() / 2, p.sizeY() - 1, p.sizeZ() - 1 - p.sizeZ() / 2) / p.density;
+}
+
+void packPosition(glm::vec3 position, glm::vec3 boundsMin, glm::vec3 boundsMax, uint16_t* packed) {
+  for (int a = 0; a < 3; a++) {
+    float size = boundsMax[a] - boundsMin[a];
+    float t = size > 0.0f ? (position[a] - boundsMin[a]) / size : 0.0f;
+    packed[a] = (uint16_t)lroundf(std::min(std::max(t, 0.0f), 1.0f) * 65535.0f);
+  }
+}
+
+glm::vec3 unpackPosition(const uint16_t* position, glm::vec3 boundsMin, glm::vec3 boundsMax) {
+  glm::vec3 t(position[0], position[1], position[2]);
+  return boundsMin + t / 65535.0f * (boundsMax - boundsMin);
+}
+
+int8_t packSnorm(float value) {
+  return (int8_t)lroundf(std::min(std::max(value, -1.0f), 1.0f) * 127.0f);
+}
+
+/**
+  NOTE:
+  The normal is projected onto the octahedron |x| +
+  |y| + |z| = 1, and the lower half (z < 0) is folded
+  out over the corners of the upper half's square, so
+  x and y alone say where on the sphere it points.
+*/
+void packNormal(glm::vec3 normal, int8_t* packed) {
+  float length = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+  if (length == 0.0f) {
+    packed[0] = 0;
+    packed[1] = 0;
+    return;
+  }
+  normal /= length;
+  float x = normal.x;
+  float y = normal.y;
+  if (normal.z < 0.0f) {
+    x = (1.0f - fabsf(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f);
+    y = (1.0f - fabsf(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f);
+  }
+  packed[0] = packSnorm(x);
+  packed[1] = packSnorm(y);
+}
+
+// Must match octahedronDecode in VertexShader.glsl
+glm::vec3 unpackNormal(const int8_t* packed) {
+  float x = std::max(packed[0] / 127.0f, -1.0f);
+  float y = std::max(packed[1] / 127.0f, -1.0f);
+  glm::vec3 normal(x, y, 1.0f - fabsf(x) - fabsf(y));
+  if (normal.z < 0.0f) {
+    normal.x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    normal.y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+  }
+  return glm::normalize(normal);
+}
+
+void packVertices(
+  const glm::vec3* vertices,
+  const glm::vec3* normals,
+  size_t count,
+  glm::vec3 boundsMin,
+  glm::vec3 boundsMax,
+  PackedVertex* packed
+) {
+  for (size_t i = 0; i < count; i++) {
+    packPosition(vertices[i], boundsMin, boundsMax, packed[i].position);
+    packNormal(normals[i], packed[i].normal);
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef VERTEXPACKING
+#define VERTEXPACKING
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "params.h"
+
+/**
+  NOTE:
+  A vertex in 8 bytes instead of 24. The position is
+  stored in 16 bit steps across the bounds of the grid
+  it was meshed in, which are far finer than a cube,
+  and the unit normal is folded onto an octahedron and
+  stored in two signed bytes, which keeps it within
+  about a degree.
+*/
+struct PackedVertex {
+  uint16_t position[3];
+  int8_t normal[2];
+};
+
+// The space every vertex meshed from the grid lies in, in world coordinates
+void getGridBounds(Params& p, glm::vec3& boundsMin, glm::vec3& boundsMax);
+
+void packVertices(
+  const glm::vec3* vertices,
+  const glm::vec3* normals,
+  size_t count,
+  glm::vec3 boundsMin,
+  glm::vec3 boundsMax,
+  PackedVertex* packed
+);
+
+// Positions are clamped to the bounds
+void packPosition(glm::vec3 position, glm::vec3 boundsMin, glm::vec3 boundsMax, uint16_t* packed);
+glm::vec3 unpackPosition(const uint16_t* position, glm::vec3 boundsMin, glm::vec3 boundsMax);
+// Normalised signed byte, read back by GL and glTF as max(value / 127, -1)
+int8_t packSnorm(float value);
+void packNormal(glm::vec3 normal, int8_t* packed);
+glm::vec3 unpackNormal(const int8_t* packed);
+
+#endif
@@ -0,0 +1,274 @@
+#include "volumeFile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <climits>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t voxelSize(VoxelType type) {
+  switch (type) {
+    case VOXEL_UINT8: return 1;
+    case VOXEL_UINT16: return 2;
+    case VOXEL_FLOAT32: return 4;
+  }
+  return 1;
+}
+
+static bool isLittleEndian() {
+  const uint16_t one = 1;
+  return *(const unsigned char*)&one == 1;
+}
+
+static std::string trim(const std::string& s) {
+  size_t start = s.find_first_not_of(" \t\r\n");
+  size_t end = s.find_last_not_of(" \t\r\n");
+  return start == std::string::npos ? "" : s.substr(start, end - start + 1);
+}
+
+// The whole of text as a decimal integer in [minimum, maximum]
+static bool parseInteger(const std::string& text, long minimum, long maximum, long& value) {
+  const char* start = text.c_str();
+  char* end;
+  errno = 0;
+  value = strtol(start, &end, 10);
+  return end != start && *end == '\0' && errno != ERANGE && value >= minimum && value <= maximum;
+}
+
+bool parseVoxelType(const std::string& name, VoxelType& type) {
+  if (name == "uchar" || name == "unsigned char" || name == "uint8" || name == "uint8_t") {
+    type = VOXEL_UINT8;
+  } else if (name == "ushort" || name == "unsigned short" || name == "unsigned short int" || name == "uint16" || name == "uint16_t") {
+    type = VOXEL_UINT16;
+  } else if (name == "float" || name == "float32") {
+    type = VOXEL_FLOAT32;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+VolumeFile::~VolumeFile() {
+  close();
+}
+
+bool VolumeFile::map(const std::string& path) {
+  fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close();
+    return false;
+  }
+  mappingSize = st.st_size;
+
+  // Private writable mapping so planes can be handed out as float* without touching the file
+  void* addr = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    close();
+    return false;
+  }
+  mapping = (unsigned char*)addr;
+  madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+
+  size_t needed = (size_t)dims[0] * dims[1] * dims[2] * voxelSize(type);
+  if (dims[0] < 2 || dims[1] < 2 || dims[2] < 2 || dataOffset + needed > mappingSize) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void VolumeFile::close() {
+  if (mapping) {
+    munmap(mapping, mappingSize);
+    mapping = nullptr;
+  }
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+bool VolumeFile::openRaw(const std::string& path, int sizeX, int sizeY, int sizeZ, VoxelType voxelType, VolumeLayout volumeLayout, size_t headerBytes) {
+  close();
+  dims[0] = sizeX;
+  dims[1] = sizeY;
+  dims[2] = sizeZ;
+  type = voxelType;
+  layout = volumeLayout;
+  dataOffset = headerBytes;
+  swapBytes = false;
+  return map(path);
+}
+
+/**
+  NOTE:
+  Only the NRRD fields needed to locate the samples
+  are read: type, dimension, sizes, encoding, endian,
+  byte skip and data file. Spacing and orientation are
+  ignored, the mesh is always in voxel units.
+*/
+bool VolumeFile::openNrrd(const std::string& path) {
+  close();
+  std::ifstream header(path, std::ios::binary);
+  if (!header.is_open()) return false;
+
+  std::string line;
+  std::getline(header, line);
+  if (line.compare(0, 7, "NRRD000") != 0) return false;
+
+  std::string dataFile;
+  std::string encoding = "raw";
+  bool bigEndian = false;
+  long byteSkip = 0;
+  int dimension = 0;
+  type = VOXEL_UINT8;
+  layout = LAYOUT_X_FASTEST;
+
+  while (std::getline(header, line)) {
+    if (trim(line).empty()) break;
+    if (line[0] == '#') continue;
+
+    size_t colon = line.find(": ");
+    if (colon == std::string::npos) continue;
+    std::string key = trim(line.substr(0, colon));
+    std::string value = trim(line.substr(colon + 2));
+
+    if (key == "type") {
+      if (!parseVoxelType(value, type)) return false;
+    } else if (key == "dimension") {
+      long number;
+      if (!parseInteger(value, 0, INT_MAX, number)) {
+        fprintf(stderr, "Bad NRRD dimension: %s\n", value.c_str());
+        return false;
+      }
+      dimension = (int)number;
+    } else if (key == "sizes") {
+      std::istringstream sizes(value);
+      std::string size;
+      for (int axis = 0; axis < 3 && sizes >> size; axis++) {
+        long number;
+        if (!parseInteger(size, 0, INT_MAX, number)) {
+          fprintf(stderr, "Bad NRRD sizes: %s\n", value.c_str());
+          return false;
+        }
+        dims[axis] = (int)number;
+      }
+    } else if (key == "encoding") {
+      encoding = value;
+    } else if (key == "endian") {
+      bigEndian = value == "big";
+    } else if (key == "byte skip" || key == "byteskip") {
+      // -1 asks readers to find the data from the end of the file, which is not supported
+      if (!parseInteger(value, 0, LONG_MAX, byteSkip)) {
+        fprintf(stderr, "Bad NRRD byte skip: %s\n", value.c_str());
+        return false;
+      }
+    } else if (key == "data file" || key == "datafile") {
+      dataFile = value;
+    }
+  }
+
+  if (dimension != 3 || encoding != "raw" || byteSkip < 0) return false;
+  swapBytes = voxelSize(type) > 1 && bigEndian == isLittleEndian();
+
+  if (dataFile.empty()) {
+    // Attached header, the samples start right after the blank line
+    dataOffset = (size_t)header.tellg() + byteSkip;
+    return map(path);
+  }
+
+  // Detached header, the data file is relative to the header
+  size_t slash = path.find_last_of('/');
+  if (dataFile[0] != '/' && slash != std::string::npos) {
+    dataFile = path.substr(0, slash + 1) + dataFile;
+  }
+  dataOffset = byteSkip;
+  return map(dataFile);
+}
+
+int VolumeFile::gridSizeX() {
+  return layout == LAYOUT_Z_FASTEST ? dims[0] : dims[2];
+}
+
+int VolumeFile::gridSizeY() {
+  return dims[1];
+}
+
+int VolumeFile::gridSizeZ() {
+  return layout == LAYOUT_Z_FASTEST ? dims[2] : dims[0];
+}
+
+size_t VolumeFile::planeBytes() {
+  return (size_t)gridSizeY() * gridSizeZ() * voxelSize(type);
+}
+
+float* VolumeFile::mapPlanes(int x, int count) {
+  if (type != VOXEL_FLOAT32 || swapBytes || dataOffset % sizeof(float) != 0) {
+    return nullptr;
+  }
+  return (float*)(mapping + dataOffset + x * planeBytes());
+}
+
+void VolumeFile::readPlanes(int x, int count, float* out) {
+  const unsigned char* src = mapping + dataOffset + x * planeBytes();
+  size_t n = (size_t)count * gridSizeY() * gridSizeZ();
+
+  switch (type) {
+    case VOXEL_UINT8:
+      for (size_t i = 0; i < n; i++) {
+        out[i] = src[i] / 255.0f;
+      }
+      break;
+    case VOXEL_UINT16:
+      for (size_t i = 0; i < n; i++) {
+        uint16_t v;
+        memcpy(&v, src + i * 2, 2);
+        if (swapBytes) v = (v >> 8) | (v << 8);
+        out[i] = v / 65535.0f;
+      }
+      break;
+    case VOXEL_FLOAT32:
+      for (size_t i = 0; i < n; i++) {
+        uint32_t v;
+        memcpy(&v, src + i * 4, 4);
+        if (swapBytes) v = __builtin_bswap32(v);
+        memcpy(&out[i], &v, 4);
+      }
+      break;
+  }
+}
+
+static void adviseRange(unsigned char* mapping, size_t mappingSize, size_t start, size_t length, int advice) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t alignedStart = start / page * page;
+  if (alignedStart >= mappingSize) return;
+  size_t end = std::min(start + length, mappingSize);
+  madvise(mapping + alignedStart, end - alignedStart, advice);
+}
+
+void VolumeFile::prefetch(int x, int count) {
+  if (!mapping || x >= gridSizeX()) return;
+  adviseRange(mapping, mappingSize, dataOffset + x * planeBytes(), count * planeBytes(), MADV_WILLNEED);
+}
+
+void VolumeFile::release(int x, int count) {
+  if (!mapping || count <= 0) return;
+  // Keep the page holding the first plane we still need
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t start = dataOffset + x * planeBytes();
+  size_t end = (start + count * planeBytes()) / page * page;
+  if (end > start) {
+    adviseRange(mapping, mappingSize, start, end - start, MADV_DONTNEED);
+  }
+}
@@ -0,0 +1,78 @@
+#ifndef VOLUMEFILE
+#define VOLUMEFILE
+
+#include <string>
+#include <cstddef>
+
+enum VoxelType {
+  VOXEL_UINT8,
+  VOXEL_UINT16,
+  VOXEL_FLOAT32
+};
+
+enum VolumeLayout {
+  // x varies fastest, as in NRRD and most .raw dumps
+  LAYOUT_X_FASTEST,
+  // z varies fastest, the order used by PointGrid::coordsToIndex
+  LAYOUT_Z_FASTEST
+};
+
+/**
+  NOTE:
+  A volume file is memory mapped and read one plane
+  of its slowest axis at a time, which is always a
+  contiguous range of the file. The mesher sweeps
+  along x, so for z-fastest files planes are x-planes
+  and the data is used as is. For x-fastest files the
+  slowest axis is z, so the volume is presented with
+  x and z swapped and the mesh is swapped back as it
+  is written (see isTransposed). Neither layout is
+  ever transcoded.
+
+  Integer voxels are normalised to [0, 1] so that the
+  usual iso values apply. Float voxels are used as is,
+  and when their byte order matches the machine the
+  mapped planes are handed to the mesher directly.
+*/
+class VolumeFile {
+  int fd = -1;
+  unsigned char* mapping = nullptr;
+  size_t mappingSize = 0;
+  size_t dataOffset = 0;
+
+  int dims[3] = { 0, 0, 0 };
+  VoxelType type = VOXEL_UINT8;
+  VolumeLayout layout = LAYOUT_X_FASTEST;
+  bool swapBytes = false;
+
+  bool map(const std::string& path);
+  size_t planeBytes();
+
+  public:
+    ~VolumeFile();
+
+    // NRRD with raw encoding, attached or detached (.nhdr) header
+    bool openNrrd(const std::string& path);
+    // Headerless dump, or one with a fixed size header to skip
+    bool openRaw(const std::string& path, int sizeX, int sizeY, int sizeZ, VoxelType type, VolumeLayout layout, size_t headerBytes = 0);
+    void close();
+
+    // Grid dimensions as seen by the mesher, with x being the sweep axis
+    int gridSizeX();
+    int gridSizeY();
+    int gridSizeZ();
+    bool isTransposed() { return layout == LAYOUT_X_FASTEST; }
+
+    // Pointer to grid x-planes [x, x + count) if they can be used without conversion
+    float* mapPlanes(int x, int count);
+    // Converts grid x-planes [x, x + count) into out, in coordsToIndex order
+    void readPlanes(int x, int count, float* out);
+
+    // Paging hints for the planes ahead of and behind the sweep
+    void prefetch(int x, int count);
+    void release(int x, int count);
+};
+
+bool parseVoxelType(const std::string& name, VoxelType& type);
+
+#endif